@@ -0,0 +1,103 @@
+/*
+ * COMMANDLINE.C
+ *
+ * Command line patterns for the Cyberion driver.
+ *
+ * The whole command line is scanned, not just the part an event has room
+ * for, in one pass over its characters (Patterns.c). A new pattern set is
+ * compiled before anything changes and then published by swapping a
+ * pointer under a push lock, as the path rules are.
+ */
+
+#include "CommandLine.h"
+
+//
+// Globals
+//
+static EX_PUSH_LOCK g_PatternLock;
+static PCYBERION_PATTERNS g_Patterns; // Compiled patterns, protected by g_PatternLock
+
+NTSTATUS CyberionCommandLineInitialize(VOID)
+{
+    ExInitializePushLock(&g_PatternLock);
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionCommandLineShutdown(VOID)
+{
+    if (g_Patterns) {
+        CyberionFree(g_Patterns);
+        g_Patterns = NULL;
+    }
+}
+
+VOID CyberionCommandLineScan(
+    _In_opt_ PCUNICODE_STRING CommandLine,
+    _Out_ PCYBERION_PATTERN_MATCHES Matches
+)
+{
+    RtlZeroMemory(Matches, sizeof(*Matches));
+
+    if (CommandLine == NULL || CommandLine->Buffer == NULL) {
+        return;
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_PatternLock);
+
+    if (g_Patterns) {
+        CyberionPatternsScan(g_Patterns, CommandLine->Buffer, CommandLine->Length / sizeof(WCHAR), Matches);
+    }
+
+    ExReleasePushLockShared(&g_PatternLock);
+    KeLeaveCriticalRegion();
+}
+
+NTSTATUS CyberionCommandLineSetPatterns(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_ARGUMENT_PATTERN_SET patternSet = (PCYBERION_ARGUMENT_PATTERN_SET)Irp->AssociatedIrp.SystemBuffer;
+    ULONG inputLength = Stack->Parameters.DeviceIoControl.InputBufferLength;
+    PCYBERION_PATTERNS patterns = NULL;
+    PCYBERION_PATTERNS oldPatterns;
+    NTSTATUS status;
+
+    if (inputLength < FIELD_OFFSET(CYBERION_ARGUMENT_PATTERN_SET, Patterns)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (patternSet->Count > CYBERION_MAX_ARGUMENT_PATTERNS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (inputLength < FIELD_OFFSET(CYBERION_ARGUMENT_PATTERN_SET, Patterns) +
+                      (SIZE_T)patternSet->Count * sizeof(CYBERION_ARGUMENT_PATTERN)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    // No patterns removes the pattern set
+    if (patternSet->Count != 0) {
+        status = CyberionPatternsCompile(patternSet->Patterns, patternSet->Count, &patterns);
+        if (!NT_SUCCESS(status)) {
+            DbgPrint("CyberionDriver: Argument patterns rejected (0x%08X).\n", status);
+            return status;
+        }
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&g_PatternLock);
+    oldPatterns = g_Patterns;
+    g_Patterns = patterns;
+    ExReleasePushLockExclusive(&g_PatternLock);
+    KeLeaveCriticalRegion();
+
+    if (oldPatterns) {
+        CyberionFree(oldPatterns);
+    }
+
+    DbgPrint("CyberionDriver: Loaded %lu argument patterns into %lu states.\n",
+             patternSet->Count, patterns ? patterns->StateCount : 0);
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,30 @@
+/*
+ * COMMANDLINE.H
+ *
+ * Command line patterns: the compiled pattern set every command line is
+ * scanned with as its process is created, and the
+ * IOCTL_CYBERION_SET_ARGUMENT_PATTERNS path that replaces it.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+#include "Patterns.h"
+
+NTSTATUS CyberionCommandLineInitialize(VOID);
+VOID CyberionCommandLineShutdown(VOID);
+
+//
+// CyberionCommandLineScan: Finds the argument patterns in CommandLine.
+// Callable at IRQL <= APC_LEVEL.
+//
+VOID CyberionCommandLineScan(
+    _In_opt_ PCUNICODE_STRING CommandLine,
+    _Out_ PCYBERION_PATTERN_MATCHES Matches
+);
+
+//
+// CyberionCommandLineSetPatterns: Handles IOCTL_CYBERION_SET_ARGUMENT_PATTERNS.
+//
+NTSTATUS CyberionCommandLineSetPatterns(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
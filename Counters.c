@@ -0,0 +1,65 @@
+/*
+ * COUNTERS.C
+ *
+ * Per-processor statistics counters.
+ */
+
+#include "Counters.h"
+
+NTSTATUS CyberionCountersInitialize(
+    _Out_ PCYBERION_COUNTERS Counters
+)
+{
+    RtlZeroMemory(Counters, sizeof(*Counters));
+
+    // Allocations are not cache aligned; one spare set leaves room to align
+    // the rest
+    Counters->SetCount = CyberionProcessorCount();
+    Counters->Memory = CyberionAllocate(((SIZE_T)Counters->SetCount + 1) * sizeof(CYBERION_COUNTER_SET));
+    if (Counters->Memory == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Counters->Sets = (PCYBERION_COUNTER_SET)(((ULONG_PTR)Counters->Memory + sizeof(CYBERION_COUNTER_SET) - 1) &
+                                             ~(ULONG_PTR)(sizeof(CYBERION_COUNTER_SET) - 1));
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionCountersDestroy(
+    _Inout_ PCYBERION_COUNTERS Counters
+)
+{
+    if (Counters->Memory) {
+        CyberionFree(Counters->Memory);
+    }
+
+    RtlZeroMemory(Counters, sizeof(*Counters));
+}
+
+SIZE_T CyberionCountersMemory(
+    _In_ const CYBERION_COUNTERS *Counters
+)
+{
+    if (Counters->Memory == NULL) {
+        return 0;
+    }
+
+    return ((SIZE_T)Counters->SetCount + 1) * sizeof(CYBERION_COUNTER_SET);
+}
+
+ULONG64 CyberionCountersQuery(
+    _In_ const CYBERION_COUNTERS *Counters,
+    _In_ ULONG Index
+)
+{
+    ULONG64 total = 0;
+    ULONG i;
+
+    // Each value is written by one processor and read whole on x64, so the
+    // total is at worst a few updates behind
+    for (i = 0; i < Counters->SetCount; i++) {
+        total += ((const volatile CYBERION_COUNTER_SET *)&Counters->Sets[i])->Values[Index];
+    }
+
+    return total;
+}
@@ -0,0 +1,60 @@
+/*
+ * COUNTERS.H
+ *
+ * Statistics counters kept per processor. Every processor has a set of
+ * its own, in a cache line of its own, which only code pinned to that
+ * processor writes, with plain stores; a query adds the sets up. Counting
+ * on a hot path therefore needs no interlocked operation and shares no
+ * cache line with other processors.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+
+#define CYBERION_COUNTERS_PER_SET 8
+
+typedef struct DECLSPEC_CACHEALIGN _CYBERION_COUNTER_SET {
+    ULONG64 Values[CYBERION_COUNTERS_PER_SET];
+} CYBERION_COUNTER_SET, *PCYBERION_COUNTER_SET;
+
+C_ASSERT(sizeof(CYBERION_COUNTER_SET) == 64);
+
+typedef struct _CYBERION_COUNTERS {
+    PCYBERION_COUNTER_SET Sets;     // SetCount sets, by processor, in Memory
+    PVOID Memory;
+    ULONG SetCount;
+} CYBERION_COUNTERS, *PCYBERION_COUNTERS;
+
+//
+// CyberionCountersInitialize: Allocates a zeroed set for every processor.
+//
+NTSTATUS CyberionCountersInitialize(_Out_ PCYBERION_COUNTERS Counters);
+
+VOID CyberionCountersDestroy(_Inout_ PCYBERION_COUNTERS Counters);
+
+//
+// CyberionCountersMemory: Bytes allocated for the sets.
+//
+SIZE_T CyberionCountersMemory(_In_ const CYBERION_COUNTERS *Counters);
+
+//
+// CyberionCountersIncrement: Adds one to counter Index, below
+// CYBERION_COUNTERS_PER_SET, of the current processor's set.
+//
+FORCEINLINE VOID CyberionCountersIncrement(_Inout_ PCYBERION_COUNTERS Counters, _In_ ULONG Index)
+{
+    CYBERION_PIN_STATE pinState;
+    PCYBERION_COUNTER_SET set = &Counters->Sets[CyberionPinProcessor(&pinState) % Counters->SetCount];
+    volatile ULONG64 *value = &set->Values[Index];
+
+    *value = *value + 1;
+    CyberionUnpinProcessor(pinState);
+}
+
+//
+// CyberionCountersQuery: Returns counter Index added up over every
+// processor.
+//
+ULONG64 CyberionCountersQuery(_In_ const CYBERION_COUNTERS *Counters, _In_ ULONG Index);
@@ -0,0 +1,295 @@
+/*
+ * DECISION.C
+ *
+ * Pending decisions for the Cyberion driver.
+ *
+ * Records come from a fixed-size slab and are found through a lock-striped
+ * table (DecisionTable.c), so the lookup made for every process exit and
+ * every response never takes a global lock. However many are pending,
+ * their deadlines sit in one timing wheel (TimerWheel.c), so arming,
+ * resolving and expiring each cost the same. The wheel is turned by one
+ * thread, woken by one periodic timer that only runs while some decision
+ * is pending; the thread applies DefaultDecision at PASSIVE_LEVEL, where a
+ * process can be terminated, unless the policy (Policy.c) fails open.
+ *
+ * Whoever removes a record from the table owns it. Arming and inserting
+ * happen together under g_DecisionLock, and the thread only keeps an
+ * expired record if it can still remove it from the table, so a record is
+ * never resolved and expired both.
+ */
+
+#include "Decision.h"
+#include "DecisionTable.h"
+#include "Policy.h"
+#include "Slab.h"
+#include "TimerWheel.h"
+#include "Tunables.h"
+#include "Verdict.h"
+
+#define DECISION_TICK       (10 * 10000LL)      // 100ns units per wheel tick
+
+typedef struct _CYBERION_DECISION {
+    CYBERION_TIMER Timer;               // In g_DecisionWheel while pending
+    HANDLE ProcessId;
+    ULONG64 ProcessKey;
+    ULONG64 Armed;                      // Interrupt time the wait began
+} CYBERION_DECISION, *PCYBERION_DECISION;
+
+//
+// Globals
+//
+static CYBERION_SLAB g_DecisionRecords; // Backing store for CYBERION_DECISION records
+static CYBERION_DECISION_TABLE g_DecisionTable; // Pending decisions by process ID
+static KSPIN_LOCK g_DecisionLock; // Protects everything below but the thread and the counter
+static CYBERION_TIMER_WHEEL g_DecisionWheel; // Their deadlines, in ticks of interrupt time
+static KTIMER g_DecisionTick; // Periodic while g_DecisionTicking
+static BOOLEAN g_DecisionTicking;
+static BOOLEAN g_DecisionStopping;
+static PKTHREAD g_DecisionThread; // Referenced
+static volatile LONG64 g_DecisionTimeouts;
+
+KSTART_ROUTINE CyberionDecisionWorker;
+
+FORCEINLINE ULONG64 DecisionNow(VOID)
+{
+    return KeQueryInterruptTime() / DECISION_TICK;
+}
+
+//
+// CyberionDecisionWorker: Expires decisions at every tick.
+//
+VOID CyberionDecisionWorker(
+    _In_ PVOID StartContext
+)
+{
+    UNREFERENCED_PARAMETER(StartContext);
+
+    for (;;) {
+        CYBERION_TUNABLES tunables;
+        KLOCK_QUEUE_HANDLE lockHandle;
+        PCYBERION_TIMER expired;
+        PCYBERION_TIMER *link;
+
+        KeWaitForSingleObject(&g_DecisionTick, Executive, KernelMode, FALSE, NULL);
+
+        KeAcquireInStackQueuedSpinLock(&g_DecisionLock, &lockHandle);
+
+        if (g_DecisionStopping) {
+            KeReleaseInStackQueuedSpinLock(&lockHandle);
+            break;
+        }
+
+        // A record already removed by CyberionDecisionResolve is dropped;
+        // that call frees it once it gets the lock
+        expired = CyberionTimerWheelAdvance(&g_DecisionWheel, DecisionNow());
+        for (link = &expired; *link; ) {
+            PCYBERION_DECISION decision = CONTAINING_RECORD(*link, CYBERION_DECISION, Timer);
+
+            if (CyberionDecisionTableRemove(&g_DecisionTable, (ULONG64)(ULONG_PTR)decision->ProcessId, decision->ProcessKey) == decision) {
+                link = &(*link)->Next;
+            } else {
+                *link = (*link)->Next;
+            }
+        }
+
+        if (g_DecisionWheel.Count == 0 && g_DecisionTicking) {
+            KeCancelTimer(&g_DecisionTick);
+            g_DecisionTicking = FALSE;
+        }
+
+        KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+        CyberionTunablesQuery(&tunables);
+
+        while (expired) {
+            PCYBERION_DECISION decision = CONTAINING_RECORD(expired, CYBERION_DECISION, Timer);
+
+            expired = expired->Next;
+
+            DbgPrint("CyberionDriver: No decision for PID %d in time.\n", decision->ProcessId);
+            InterlockedIncrement64(&g_DecisionTimeouts);
+            CyberionPolicyRecord(KeQueryInterruptTime() - decision->Armed);
+
+            if (tunables.DefaultDecision != VerdictUnknown && CyberionPolicyMode() == PolicyModeEnforce) {
+                CyberionVerdictDecide(decision->ProcessId, decision->ProcessKey, (CYBERION_VERDICT)tunables.DefaultDecision);
+            }
+
+            CyberionSlabFree(&g_DecisionRecords, decision);
+        }
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS CyberionDecisionInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+    OBJECT_ATTRIBUTES attributes;
+    HANDLE thread;
+    NTSTATUS status;
+
+    CyberionTunablesQuery(&tunables);
+
+    KeInitializeSpinLock(&g_DecisionLock);
+    CyberionTimerWheelInitialize(&g_DecisionWheel, DecisionNow());
+    KeInitializeTimerEx(&g_DecisionTick, SynchronizationTimer);
+    g_DecisionTicking = FALSE;
+    g_DecisionStopping = FALSE;
+
+    // A decision is only pending for a live process
+    status = CyberionSlabInitialize(&g_DecisionRecords, sizeof(CYBERION_DECISION), tunables.ProcessTableSize);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = CyberionDecisionTableInitialize(&g_DecisionTable, tunables.ProcessTableSize);
+    if (!NT_SUCCESS(status)) {
+        CyberionSlabDestroy(&g_DecisionRecords);
+        return status;
+    }
+
+    InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    status = PsCreateSystemThread(&thread, THREAD_ALL_ACCESS, &attributes, NULL, NULL, CyberionDecisionWorker, NULL);
+    if (!NT_SUCCESS(status)) {
+        CyberionDecisionTableDestroy(&g_DecisionTable);
+        CyberionSlabDestroy(&g_DecisionRecords);
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(thread, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID *)&g_DecisionThread, NULL);
+    ZwClose(thread);
+
+    return status;
+}
+
+VOID CyberionDecisionShutdown(VOID)
+{
+    KLOCK_QUEUE_HANDLE lockHandle;
+    LARGE_INTEGER dueTime;
+    PVOID decision;
+
+    if (g_DecisionThread == NULL) {
+        return;
+    }
+
+    KeAcquireInStackQueuedSpinLock(&g_DecisionLock, &lockHandle);
+    g_DecisionStopping = TRUE;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    // Wake the thread at once; it exits at the next tick
+    dueTime.QuadPart = -1;
+    KeSetTimerEx(&g_DecisionTick, dueTime, 0, NULL);
+
+    KeWaitForSingleObject(g_DecisionThread, Executive, KernelMode, FALSE, NULL);
+    ObDereferenceObject(g_DecisionThread);
+    g_DecisionThread = NULL;
+
+    KeCancelTimer(&g_DecisionTick);
+
+    while ((decision = CyberionDecisionTableRemoveAny(&g_DecisionTable)) != NULL) {
+        CyberionSlabFree(&g_DecisionRecords, decision);
+    }
+
+    CyberionDecisionTableDestroy(&g_DecisionTable);
+    CyberionSlabDestroy(&g_DecisionRecords);
+}
+
+VOID CyberionDecisionExpect(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey
+)
+{
+    PCYBERION_DECISION decision;
+    PCYBERION_DECISION stale;
+    CYBERION_TUNABLES tunables;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    LARGE_INTEGER dueTime;
+    NTSTATUS status;
+
+    CyberionTunablesQuery(&tunables);
+
+    decision = (PCYBERION_DECISION)CyberionSlabAllocate(&g_DecisionRecords);
+    if (decision == NULL) {
+        return;
+    }
+
+    RtlZeroMemory(decision, sizeof(*decision));
+    decision->ProcessId = ProcessId;
+    decision->ProcessKey = ProcessKey;
+    decision->Armed = KeQueryInterruptTime();
+
+    KeAcquireInStackQueuedSpinLock(&g_DecisionLock, &lockHandle);
+
+    // An exit we never saw leaves a stale decision, which is replaced
+    status = CyberionDecisionTableInsert(&g_DecisionTable, (ULONG64)(ULONG_PTR)ProcessId, ProcessKey, decision, (PVOID *)&stale);
+    if (!NT_SUCCESS(status)) {
+        KeReleaseInStackQueuedSpinLock(&lockHandle);
+        CyberionSlabFree(&g_DecisionRecords, decision);
+        return;
+    }
+
+    if (stale) {
+        CyberionTimerWheelCancel(&g_DecisionWheel, &stale->Timer);
+    }
+
+    // An idle wheel is not turned; catch it up (nothing can expire)
+    if (g_DecisionWheel.Count == 0) {
+        CyberionTimerWheelAdvance(&g_DecisionWheel, DecisionNow());
+    }
+
+    CyberionTimerWheelArm(&g_DecisionWheel,
+                          &decision->Timer,
+                          DecisionNow() + ((ULONG64)tunables.DecisionTimeout * 10000 + DECISION_TICK - 1) / DECISION_TICK);
+
+    if (!g_DecisionTicking && !g_DecisionStopping) {
+        dueTime.QuadPart = -DECISION_TICK;
+        KeSetTimerEx(&g_DecisionTick, dueTime, (LONG)(DECISION_TICK / 10000), NULL);
+        g_DecisionTicking = TRUE;
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (stale) {
+        CyberionSlabFree(&g_DecisionRecords, stale);
+    }
+}
+
+BOOLEAN CyberionDecisionResolve(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _Out_opt_ PULONG64 Waited
+)
+{
+    PCYBERION_DECISION decision;
+    KLOCK_QUEUE_HANDLE lockHandle;
+
+    decision = (PCYBERION_DECISION)CyberionDecisionTableRemove(&g_DecisionTable, (ULONG64)(ULONG_PTR)ProcessId, ProcessKey);
+    if (decision == NULL) {
+        return FALSE;
+    }
+
+    if (Waited) {
+        *Waited = KeQueryInterruptTime() - decision->Armed;
+    }
+
+    // The thread may have taken it off the wheel already, and dropped it
+    KeAcquireInStackQueuedSpinLock(&g_DecisionLock, &lockHandle);
+    CyberionTimerWheelCancel(&g_DecisionWheel, &decision->Timer);
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    CyberionSlabFree(&g_DecisionRecords, decision);
+    return TRUE;
+}
+
+VOID CyberionDecisionQueryStatistics(
+    _Inout_ PCYBERION_VERDICT_STATISTICS Statistics
+)
+{
+    KLOCK_QUEUE_HANDLE lockHandle;
+
+    KeAcquireInStackQueuedSpinLock(&g_DecisionLock, &lockHandle);
+    Statistics->DecisionsPending = g_DecisionWheel.Count;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    Statistics->DecisionTimeouts = (ULONG64)ReadNoFence64(&g_DecisionTimeouts);
+}
@@ -0,0 +1,43 @@
+/*
+ * DECISION.H
+ *
+ * Pending decisions: processes whose event a session held, waiting for a
+ * USER_RESPONSE until DecisionTimeout, after which DefaultDecision is
+ * applied for them unless the policy fails open (Policy.h).
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+
+//
+// CyberionDecisionInitialize: Starts the thread that expires decisions.
+//
+NTSTATUS CyberionDecisionInitialize(VOID);
+VOID CyberionDecisionShutdown(VOID);
+
+//
+// CyberionDecisionExpect: Starts waiting for a decision on a process,
+// identified by its ID and start key (PsGetProcessStartKey). Callable at
+// IRQL <= DISPATCH_LEVEL.
+//
+VOID CyberionDecisionExpect(_In_ HANDLE ProcessId, _In_ ULONG64 ProcessKey);
+
+//
+// CyberionDecisionResolve: Stops waiting for a decision on a process,
+// because it arrived or the process exited. A ProcessKey of 0 matches any
+// process with the ID. Returns FALSE if none was pending, otherwise how
+// long it was waited for (100ns units) in *Waited.
+//
+BOOLEAN CyberionDecisionResolve(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _Out_opt_ PULONG64 Waited
+);
+
+//
+// CyberionDecisionQueryStatistics: Fills in the decision counters of
+// Statistics.
+//
+VOID CyberionDecisionQueryStatistics(_Inout_ PCYBERION_VERDICT_STATISTICS Statistics);
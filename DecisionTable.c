@@ -0,0 +1,232 @@
+/*
+ * DECISIONTABLE.C
+ *
+ * Lock-striped, open-addressed table of pending decisions.
+ *
+ * Process IDs are scattered by a multiplicative hash; its top bits pick
+ * the stripe and the bits below them the home slot, probing linearly from
+ * there. A stripe refuses entries beyond three quarters of its slots, so
+ * there is always a free slot to end a probe.
+ */
+
+#include "DecisionTable.h"
+
+#define DECISION_MIN_SLOTS  16              // Per stripe
+
+C_ASSERT(CYBERION_DECISION_STRIPES <= 64);
+
+FORCEINLINE ULONG64 DecisionHash(_In_ ULONG64 ProcessId)
+{
+    // Process IDs are multiples of four
+    return (ProcessId >> 2) * 0x9E3779B97F4A7C15ull;
+}
+
+FORCEINLINE PCYBERION_DECISION_STRIPE DecisionStripe(
+    _In_ PCYBERION_DECISION_TABLE Table,
+    _In_ ULONG64 Hash
+)
+{
+    return &Table->Stripes[(ULONG)(Hash >> 58) & (CYBERION_DECISION_STRIPES - 1)];
+}
+
+FORCEINLINE ULONG DecisionHome(
+    _In_ const CYBERION_DECISION_TABLE *Table,
+    _In_ ULONG64 Hash
+)
+{
+    return (ULONG)(Hash >> 26) & Table->SlotMask;
+}
+
+//
+// DecisionFind: Returns the slot holding ProcessId, or the free slot that
+// ends its probe. Caller holds the stripe lock.
+//
+static ULONG DecisionFind(
+    _In_ const CYBERION_DECISION_TABLE *Table,
+    _In_ const CYBERION_DECISION_STRIPE *Stripe,
+    _In_ ULONG64 ProcessId,
+    _In_ ULONG64 Hash
+)
+{
+    ULONG index = DecisionHome(Table, Hash);
+
+    while (Stripe->Slots[index].ProcessId != 0 && Stripe->Slots[index].ProcessId != ProcessId) {
+        index = (index + 1) & Table->SlotMask;
+    }
+
+    return index;
+}
+
+//
+// DecisionVacate: Frees a slot, moving back any later entry of the same
+// probe so that no probe crosses a free slot. Caller holds the stripe lock.
+//
+static VOID DecisionVacate(
+    _In_ const CYBERION_DECISION_TABLE *Table,
+    _Inout_ PCYBERION_DECISION_STRIPE Stripe,
+    _In_ ULONG Index
+)
+{
+    ULONG next = Index;
+
+    for (;;) {
+        ULONG home;
+
+        next = (next + 1) & Table->SlotMask;
+        if (Stripe->Slots[next].ProcessId == 0) {
+            break;
+        }
+
+        // An entry may move back unless its home lies between the free
+        // slot (exclusive) and where it is now (inclusive)
+        home = DecisionHome(Table, DecisionHash(Stripe->Slots[next].ProcessId));
+        if (((next - home) & Table->SlotMask) < ((next - Index) & Table->SlotMask)) {
+            continue;
+        }
+
+        Stripe->Slots[Index] = Stripe->Slots[next];
+        Index = next;
+    }
+
+    RtlZeroMemory(&Stripe->Slots[Index], sizeof(Stripe->Slots[Index]));
+    Stripe->Count--;
+}
+
+NTSTATUS CyberionDecisionTableInitialize(
+    _Out_ PCYBERION_DECISION_TABLE Table,
+    _In_ ULONG Capacity
+)
+{
+    ULONG slots = DECISION_MIN_SLOTS;
+    ULONG i;
+
+    RtlZeroMemory(Table, sizeof(*Table));
+
+    while (slots < Capacity / (CYBERION_DECISION_STRIPES / 2) && slots < 0x10000) {
+        slots *= 2;
+    }
+
+    Table->Slots = (PCYBERION_DECISION_SLOT)CyberionAllocate((SIZE_T)slots * CYBERION_DECISION_STRIPES * sizeof(CYBERION_DECISION_SLOT));
+    if (Table->Slots == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Table->SlotMask = slots - 1;
+    Table->StripeLimit = slots / 4 * 3;
+
+    for (i = 0; i < CYBERION_DECISION_STRIPES; i++) {
+        Table->Stripes[i].Slots = &Table->Slots[(SIZE_T)i * slots];
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionDecisionTableDestroy(
+    _Inout_ PCYBERION_DECISION_TABLE Table
+)
+{
+    if (Table->Slots) {
+        CyberionFree(Table->Slots);
+    }
+
+    RtlZeroMemory(Table, sizeof(*Table));
+}
+
+NTSTATUS CyberionDecisionTableInsert(
+    _Inout_ PCYBERION_DECISION_TABLE Table,
+    _In_ ULONG64 ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ PVOID Value,
+    _Out_ PVOID *Replaced
+)
+{
+    ULONG64 hash = DecisionHash(ProcessId);
+    PCYBERION_DECISION_STRIPE stripe = DecisionStripe(Table, hash);
+    PCYBERION_DECISION_SLOT slot;
+    CYBERION_PIN_STATE pinState;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    *Replaced = NULL;
+
+    CyberionAcquireLock(&stripe->Lock, &pinState);
+
+    slot = &stripe->Slots[DecisionFind(Table, stripe, ProcessId, hash)];
+    if (slot->ProcessId != 0) {
+        *Replaced = slot->Value;
+        slot->ProcessKey = ProcessKey;
+        slot->Value = Value;
+    } else if (stripe->Count < Table->StripeLimit) {
+        slot->ProcessId = ProcessId;
+        slot->ProcessKey = ProcessKey;
+        slot->Value = Value;
+        stripe->Count++;
+    } else {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    CyberionReleaseLock(&stripe->Lock, pinState);
+    return status;
+}
+
+PVOID CyberionDecisionTableRemove(
+    _Inout_ PCYBERION_DECISION_TABLE Table,
+    _In_ ULONG64 ProcessId,
+    _In_ ULONG64 ProcessKey
+)
+{
+    ULONG64 hash = DecisionHash(ProcessId);
+    PCYBERION_DECISION_STRIPE stripe = DecisionStripe(Table, hash);
+    CYBERION_PIN_STATE pinState;
+    PVOID value = NULL;
+    ULONG index;
+
+    if (ProcessId == 0) {
+        return NULL;
+    }
+
+    CyberionAcquireLock(&stripe->Lock, &pinState);
+
+    index = DecisionFind(Table, stripe, ProcessId, hash);
+    if (stripe->Slots[index].ProcessId != 0 &&
+        (ProcessKey == 0 || stripe->Slots[index].ProcessKey == ProcessKey)) {
+        value = stripe->Slots[index].Value;
+        DecisionVacate(Table, stripe, index);
+    }
+
+    CyberionReleaseLock(&stripe->Lock, pinState);
+    return value;
+}
+
+PVOID CyberionDecisionTableRemoveAny(
+    _Inout_ PCYBERION_DECISION_TABLE Table
+)
+{
+    ULONG i;
+
+    for (i = 0; i < CYBERION_DECISION_STRIPES; i++) {
+        PCYBERION_DECISION_STRIPE stripe = &Table->Stripes[i];
+        CYBERION_PIN_STATE pinState;
+        PVOID value = NULL;
+        ULONG index;
+
+        CyberionAcquireLock(&stripe->Lock, &pinState);
+
+        if (stripe->Count != 0) {
+            index = 0;
+            while (stripe->Slots[index].ProcessId == 0) {
+                index++;
+            }
+
+            value = stripe->Slots[index].Value;
+            DecisionVacate(Table, stripe, index);
+        }
+
+        CyberionReleaseLock(&stripe->Lock, pinState);
+
+        if (value) {
+            return value;
+        }
+    }
+
+    return NULL;
+}
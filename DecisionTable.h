@@ -0,0 +1,84 @@
+/*
+ * DECISIONTABLE.H
+ *
+ * Table of pending decisions, keyed by process ID. An entry also records
+ * the process's start key, which unlike its ID is never reused before a
+ * reboot, so a late answer for a process that has exited cannot resolve a
+ * decision for a newer process that got the same ID.
+ *
+ * The table is split into stripes, each an open-addressed array with its
+ * own lock, so lookups for different processes rarely touch the same lock
+ * or cache line. Each stripe has room for twice its share of the capacity,
+ * and removal shifts entries back instead of leaving tombstones, so probes
+ * stay short however long the table is used. Callers need no locking of
+ * their own.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+
+#define CYBERION_DECISION_STRIPES   64      // A power of two
+
+typedef struct _CYBERION_DECISION_SLOT {
+    ULONG64 ProcessId;                      // 0 when the slot is free
+    ULONG64 ProcessKey;
+    PVOID Value;
+} CYBERION_DECISION_SLOT, *PCYBERION_DECISION_SLOT;
+
+typedef struct DECLSPEC_CACHEALIGN _CYBERION_DECISION_STRIPE {
+    CYBERION_LOCK Lock;                     // Protects everything below
+    ULONG Count;
+    PCYBERION_DECISION_SLOT Slots;          // SlotMask + 1 of them
+} CYBERION_DECISION_STRIPE, *PCYBERION_DECISION_STRIPE;
+
+typedef struct _CYBERION_DECISION_TABLE {
+    ULONG SlotMask;                         // Slots per stripe - 1 (a power of two)
+    ULONG StripeLimit;                      // Most entries a stripe takes
+    PCYBERION_DECISION_SLOT Slots;          // Every stripe's slots, one after the other
+    CYBERION_DECISION_STRIPE Stripes[CYBERION_DECISION_STRIPES];
+} CYBERION_DECISION_TABLE, *PCYBERION_DECISION_TABLE;
+
+//
+// CyberionDecisionTableInitialize: Allocates a table for about Capacity
+// entries.
+//
+NTSTATUS CyberionDecisionTableInitialize(
+    _Out_ PCYBERION_DECISION_TABLE Table,
+    _In_ ULONG Capacity
+);
+
+VOID CyberionDecisionTableDestroy(_Inout_ PCYBERION_DECISION_TABLE Table);
+
+//
+// CyberionDecisionTableInsert: Adds an entry for a process. A process ID
+// has at most one entry: one left behind by an earlier process with the
+// same ID is replaced and its Value returned in *Replaced, otherwise
+// *Replaced is NULL. Returns STATUS_INSUFFICIENT_RESOURCES if the stripe
+// is full.
+//
+NTSTATUS CyberionDecisionTableInsert(
+    _Inout_ PCYBERION_DECISION_TABLE Table,
+    _In_ ULONG64 ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ PVOID Value,
+    _Out_ PVOID *Replaced
+);
+
+//
+// CyberionDecisionTableRemove: Removes the entry for a process and returns
+// its Value, or NULL if there is none or it belongs to a process with a
+// different start key. A ProcessKey of 0 matches any.
+//
+PVOID CyberionDecisionTableRemove(
+    _Inout_ PCYBERION_DECISION_TABLE Table,
+    _In_ ULONG64 ProcessId,
+    _In_ ULONG64 ProcessKey
+);
+
+//
+// CyberionDecisionTableRemoveAny: Removes some entry and returns its Value,
+// or NULL if the table is empty. Used to drain the table.
+//
+PVOID CyberionDecisionTableRemoveAny(_Inout_ PCYBERION_DECISION_TABLE Table);
@@ -0,0 +1,176 @@
+/*
+ * DETAILSTORE.C
+ *
+ * Ring of event detail records.
+ *
+ * A record is a header giving each field's size, followed by the fields in
+ * order, and never wraps: one that does not fit before the end of the ring
+ * starts again at its beginning, and the gap counts as written. A record
+ * is intact as long as it starts no more than a ring's length behind the
+ * head. Event Ids are consecutive, so the index slot for Id & IndexMask
+ * always belongs to the newest event that maps there.
+ */
+
+#include "DetailStore.h"
+
+#define DETAIL_RECORD_ALIGNMENT 8
+#define DETAIL_BYTES_PER_SLOT   128     // Ring bytes per index slot
+
+typedef struct _DETAIL_RECORD {
+    ULONG64 EventId;
+    ULONG64 Time;
+    ULONG Size;                         // Bytes, header included, aligned
+    ULONG FieldSizes[DetailFieldMax];   // Bytes of each field, following in order
+} DETAIL_RECORD, *PDETAIL_RECORD;
+
+NTSTATUS CyberionDetailStoreInitialize(
+    _Out_ PCYBERION_DETAIL_STORE Store,
+    _In_ ULONG Capacity
+)
+{
+    ULONG capacity = 4096;
+
+    RtlZeroMemory(Store, sizeof(*Store));
+
+    while (capacity < Capacity && capacity < 0x80000000u) {
+        capacity *= 2;
+    }
+
+    Store->Ring = (PUCHAR)CyberionAllocate(capacity);
+    Store->Index = (PCYBERION_DETAIL_SLOT)CyberionAllocate((SIZE_T)(capacity / DETAIL_BYTES_PER_SLOT) * sizeof(CYBERION_DETAIL_SLOT));
+
+    if (Store->Ring == NULL || Store->Index == NULL) {
+        CyberionDetailStoreDestroy(Store);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Store->Capacity = capacity;
+    Store->IndexMask = capacity / DETAIL_BYTES_PER_SLOT - 1;
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionDetailStoreDestroy(
+    _Inout_ PCYBERION_DETAIL_STORE Store
+)
+{
+    if (Store->Ring) {
+        CyberionFree(Store->Ring);
+    }
+
+    if (Store->Index) {
+        CyberionFree(Store->Index);
+    }
+
+    RtlZeroMemory(Store, sizeof(*Store));
+}
+
+ULONG64 CyberionDetailStoreAdd(
+    _Inout_ PCYBERION_DETAIL_STORE Store,
+    _In_ ULONG64 Time,
+    _In_reads_(PartCount) const CYBERION_DETAIL_PART *Parts,
+    _In_ ULONG PartCount
+)
+{
+    ULONG64 eventId = ++Store->LastEventId;
+    SIZE_T size = sizeof(DETAIL_RECORD);
+    PDETAIL_RECORD record;
+    PUCHAR cursor;
+    ULONG offset;
+    ULONG field;
+    ULONG i;
+
+    for (i = 0; i < PartCount; i++) {
+        size += Parts[i].Size;
+    }
+    size = (size + DETAIL_RECORD_ALIGNMENT - 1) & ~(SIZE_T)(DETAIL_RECORD_ALIGNMENT - 1);
+
+    if (size > Store->Capacity / 4) {
+        return eventId;
+    }
+
+    offset = (ULONG)(Store->Head & (Store->Capacity - 1));
+    if (Store->Capacity - offset < size) {
+        Store->Head += Store->Capacity - offset;
+        offset = 0;
+    }
+
+    record = (PDETAIL_RECORD)(Store->Ring + offset);
+    RtlZeroMemory(record, sizeof(*record));
+    record->EventId = eventId;
+    record->Time = Time;
+    record->Size = (ULONG)size;
+
+    cursor = (PUCHAR)(record + 1);
+    for (field = 0; field < DetailFieldMax; field++) {
+        for (i = 0; i < PartCount; i++) {
+            if ((ULONG)Parts[i].Field == field && Parts[i].Size != 0) {
+                RtlCopyMemory(cursor, Parts[i].Data, Parts[i].Size);
+                cursor += Parts[i].Size;
+                record->FieldSizes[field] += Parts[i].Size;
+            }
+        }
+    }
+
+    Store->Index[eventId & Store->IndexMask].EventId = eventId;
+    Store->Index[eventId & Store->IndexMask].Position = Store->Head;
+    Store->Head += size;
+    return eventId;
+}
+
+NTSTATUS CyberionDetailStoreGet(
+    _In_ const CYBERION_DETAIL_STORE *Store,
+    _In_ ULONG64 EventId,
+    _In_ ULONG64 OldestTime,
+    _In_ ULONG Fields,
+    _Out_writes_bytes_(Size) PCYBERION_EVENT_DETAILS Details,
+    _In_ ULONG Size,
+    _Out_ PULONG Written
+)
+{
+    const CYBERION_DETAIL_SLOT *slot = &Store->Index[EventId & Store->IndexMask];
+    const DETAIL_RECORD *record;
+    const UCHAR *data;
+    ULONG needed = sizeof(CYBERION_EVENT_DETAILS);
+    ULONG field;
+
+    *Written = 0;
+
+    if (EventId == 0 || slot->EventId != EventId || Store->Head - slot->Position > Store->Capacity) {
+        return STATUS_NOT_FOUND;
+    }
+
+    record = (const DETAIL_RECORD *)(Store->Ring + (slot->Position & (Store->Capacity - 1)));
+    if (record->Time < OldestTime) {
+        return STATUS_NOT_FOUND;
+    }
+
+    RtlZeroMemory(Details, sizeof(*Details));
+    Details->EventId = EventId;
+
+    for (field = 0; field < DetailFieldMax; field++) {
+        if ((Fields & (1u << field)) && record->FieldSizes[field] != 0) {
+            Details->Fields |= 1u << field;
+            Details->Ranges[field].Offset = needed;
+            Details->Ranges[field].Size = record->FieldSizes[field];
+            needed += record->FieldSizes[field];
+        }
+    }
+
+    Details->Size = needed;
+
+    if (Size < needed) {
+        *Written = sizeof(CYBERION_EVENT_DETAILS);
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    data = (const UCHAR *)(record + 1);
+    for (field = 0; field < DetailFieldMax; field++) {
+        if (Details->Fields & (1u << field)) {
+            RtlCopyMemory((PUCHAR)Details + Details->Ranges[field].Offset, data, record->FieldSizes[field]);
+        }
+        data += record->FieldSizes[field];
+    }
+
+    *Written = needed;
+    return STATUS_SUCCESS;
+}
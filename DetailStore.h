@@ -0,0 +1,81 @@
+/*
+ * DETAILSTORE.H
+ *
+ * Short-lived store of event details: the fields too large or too rarely
+ * wanted to copy into every event (CYBERION_DETAIL_FIELD). Records are
+ * appended to a ring of fixed size and found by event Id through a direct
+ * mapped index, so the newest events are always kept and nothing needs to
+ * be freed. Callers serialize access: Add excludes everything else, Get
+ * only excludes Add.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+typedef struct _CYBERION_DETAIL_SLOT {
+    ULONG64 EventId;
+    ULONG64 Position;               // Of its record, in bytes ever written
+} CYBERION_DETAIL_SLOT, *PCYBERION_DETAIL_SLOT;
+
+typedef struct _CYBERION_DETAIL_STORE {
+    PUCHAR Ring;
+    ULONG Capacity;                 // Bytes in Ring (a power of two)
+    ULONG IndexMask;                // Index slots - 1 (a power of two)
+    PCYBERION_DETAIL_SLOT Index;    // By event Id
+    ULONG64 Head;                   // Bytes ever written
+    ULONG64 LastEventId;
+} CYBERION_DETAIL_STORE, *PCYBERION_DETAIL_STORE;
+
+//
+// Part of a field to record. Parts of the same field are stored one after
+// the other, so a drive letter and the rest of a path become one field.
+//
+typedef struct _CYBERION_DETAIL_PART {
+    CYBERION_DETAIL_FIELD Field;
+    ULONG Size;                     // Bytes
+    const VOID *Data;
+} CYBERION_DETAIL_PART, *PCYBERION_DETAIL_PART;
+
+//
+// CyberionDetailStoreInitialize: Allocates a ring of at least Capacity
+// bytes (rounded up to a power of two).
+//
+NTSTATUS CyberionDetailStoreInitialize(
+    _Out_ PCYBERION_DETAIL_STORE Store,
+    _In_ ULONG Capacity
+);
+
+VOID CyberionDetailStoreDestroy(_Inout_ PCYBERION_DETAIL_STORE Store);
+
+//
+// CyberionDetailStoreAdd: Records the details of a new event at Time and
+// returns the event's Id, which is never 0. A record larger than a quarter
+// of the ring is not kept, but the event still gets its Id.
+//
+ULONG64 CyberionDetailStoreAdd(
+    _Inout_ PCYBERION_DETAIL_STORE Store,
+    _In_ ULONG64 Time,
+    _In_reads_(PartCount) const CYBERION_DETAIL_PART *Parts,
+    _In_ ULONG PartCount
+);
+
+//
+// CyberionDetailStoreGet: Writes the requested Fields (a mask of
+// 1 << CYBERION_DETAIL_FIELD) of event EventId into Details, which holds
+// Size bytes, and returns the bytes written in *Written. Returns
+// STATUS_NOT_FOUND if the record was overwritten or is older than
+// OldestTime, and STATUS_BUFFER_OVERFLOW if only the header fits; its
+// Size then says how much room is needed.
+//
+NTSTATUS CyberionDetailStoreGet(
+    _In_ const CYBERION_DETAIL_STORE *Store,
+    _In_ ULONG64 EventId,
+    _In_ ULONG64 OldestTime,
+    _In_ ULONG Fields,
+    _Out_writes_bytes_(Size) PCYBERION_EVENT_DETAILS Details,
+    _In_ ULONG Size,
+    _Out_ PULONG Written
+);
@@ -0,0 +1,113 @@
+/*
+ * DETAILS.C
+ *
+ * Event details for the Cyberion driver.
+ *
+ * Events carry only what most consumers look at; the whole image path and
+ * command line go into a ring (DetailStore.c) and are fetched by event Id
+ * only for the events someone wants to look at closer. Recording copies
+ * from the creation information, which may be paged, so the ring is
+ * guarded by a push lock rather than a spin lock: exclusive to record,
+ * shared to read.
+ */
+
+#include "Details.h"
+#include "DetailStore.h"
+#include "Tunables.h"
+
+//
+// Globals
+//
+static EX_PUSH_LOCK g_DetailLock;
+static CYBERION_DETAIL_STORE g_DetailStore; // Protected by g_DetailLock
+
+NTSTATUS CyberionDetailsInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+
+    CyberionTunablesQuery(&tunables);
+
+    ExInitializePushLock(&g_DetailLock);
+    return CyberionDetailStoreInitialize(&g_DetailStore, tunables.DetailStoreSize * 1024);
+}
+
+VOID CyberionDetailsShutdown(VOID)
+{
+    CyberionDetailStoreDestroy(&g_DetailStore);
+}
+
+ULONG64 CyberionDetailsRecord(
+    _In_ const CYBERION_IMAGE_PATH *ImagePath,
+    _In_opt_ PCUNICODE_STRING CommandLine
+)
+{
+    CYBERION_DETAIL_PART parts[3];
+    ULONG count = 0;
+    ULONG64 eventId;
+
+    if (ImagePath->Rest.Buffer != NULL) {
+        parts[count].Field = DetailFieldImageFileName;
+        parts[count].Size = ImagePath->VolumeLength * sizeof(WCHAR);
+        parts[count].Data = ImagePath->Volume;
+        count++;
+        parts[count].Field = DetailFieldImageFileName;
+        parts[count].Size = ImagePath->Rest.Length;
+        parts[count].Data = ImagePath->Rest.Buffer;
+        count++;
+    }
+
+    if (CommandLine != NULL && CommandLine->Buffer != NULL) {
+        parts[count].Field = DetailFieldCommandLine;
+        parts[count].Size = CommandLine->Length;
+        parts[count].Data = CommandLine->Buffer;
+        count++;
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&g_DetailLock);
+    eventId = CyberionDetailStoreAdd(&g_DetailStore, CyberionQueryTime(), parts, count);
+    ExReleasePushLockExclusive(&g_DetailLock);
+    KeLeaveCriticalRegion();
+
+    return eventId;
+}
+
+NTSTATUS CyberionDetailsGet(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    CYBERION_DETAILS_REQUEST request;
+    CYBERION_TUNABLES tunables;
+    ULONG64 retention;
+    ULONG64 now;
+    ULONG written;
+    NTSTATUS status;
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength < sizeof(CYBERION_DETAILS_REQUEST) ||
+        Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(CYBERION_EVENT_DETAILS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    // The reply overwrites the request in the system buffer
+    RtlCopyMemory(&request, Irp->AssociatedIrp.SystemBuffer, sizeof(request));
+
+    CyberionTunablesQuery(&tunables);
+    retention = (ULONG64)tunables.DetailRetention * 10000;
+    now = CyberionQueryTime();
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_DetailLock);
+    status = CyberionDetailStoreGet(&g_DetailStore,
+                                    request.EventId,
+                                    now > retention ? now - retention : 0,
+                                    request.Fields,
+                                    (PCYBERION_EVENT_DETAILS)Irp->AssociatedIrp.SystemBuffer,
+                                    Stack->Parameters.DeviceIoControl.OutputBufferLength,
+                                    &written);
+    ExReleasePushLockShared(&g_DetailLock);
+    KeLeaveCriticalRegion();
+
+    Irp->IoStatus.Information = written;
+    return status;
+}
@@ -0,0 +1,30 @@
+/*
+ * DETAILS.H
+ *
+ * Event details: the whole image path and command line of each recent
+ * process creation, kept apart from the event records, and the
+ * IOCTL_CYBERION_GET_EVENT_DETAILS path that hands them out.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+#include "Path.h"
+
+NTSTATUS CyberionDetailsInitialize(VOID);
+VOID CyberionDetailsShutdown(VOID);
+
+//
+// CyberionDetailsRecord: Keeps the details of a new process creation and
+// returns the Id its event is to carry. Called at PASSIVE_LEVEL.
+//
+ULONG64 CyberionDetailsRecord(
+    _In_ const CYBERION_IMAGE_PATH *ImagePath,
+    _In_opt_ PCUNICODE_STRING CommandLine
+);
+
+//
+// CyberionDetailsGet: Handles IOCTL_CYBERION_GET_EVENT_DETAILS.
+//
+NTSTATUS CyberionDetailsGet(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
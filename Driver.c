@@ -6,16 +6,33 @@
  * and communicating with a user-mode service for analysis and decision-making.
  */
 
-#include <ntddk.h>
+#include <ntifs.h>
 #include <wdm.h>
+#include <wdmsec.h>
 #include "Public.h"
+#include "CommandLine.h"
+#include "Decision.h"
+#include "Details.h"
+#include "Filter.h"
+#include "HashQueue.h"
+#include "Image.h"
+#include "Path.h"
+#include "Policy.h"
+#include "Process.h"
+#include "Session.h"
+#include "Token.h"
+#include "Tunables.h"
+#include "Verdict.h"
 
 //
 // Globals
 //
 PDEVICE_OBJECT g_DeviceObject = NULL; // Global pointer to our device object
-PIRP g_PendingIrp = NULL; // Stores the IRP from user-mode waiting for a notification
-KSPIN_LOCK g_IrpQueueLock; // Spinlock to protect access to the pending IRP
+
+// {7B0D6F25-3C1A-4E5B-9F3E-1D2C8A6B4E71}
+// Device class; its registry key can override the device's security
+static const GUID g_CyberionDeviceClass =
+    { 0x7b0d6f25, 0x3c1a, 0x4e5b, { 0x9f, 0x3e, 0x1d, 0x2c, 0x8a, 0x6b, 0x4e, 0x71 } };
 
 //
 // Forward Declarations
@@ -26,6 +43,25 @@ DRIVER_DISPATCH CyberionCreateClose;
 DRIVER_DISPATCH CyberionDeviceControl;
 VOID ProcessNotifyCallback(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO CreateInfo);
 
+//
+// CyberionReleaseComponents: Tears down everything DriverEntry initialized,
+// in reverse order. Each component's shutdown tolerates never having been
+// initialized, so this also unwinds a partial load.
+//
+static VOID CyberionReleaseComponents(VOID)
+{
+    CyberionDecisionShutdown();
+    CyberionSessionShutdown();
+    CyberionHashQueueShutdown();
+    CyberionImageShutdown();
+    CyberionProcessShutdown();
+    CyberionDetailsShutdown();
+    CyberionTokenShutdown();
+    CyberionCommandLineShutdown();
+    CyberionPathShutdown();
+    CyberionVerdictShutdown();
+}
+
 //
 // DriverEntry: The entry point for the driver.
 //
@@ -38,22 +74,113 @@ NTSTATUS DriverEntry(
     UNICODE_STRING devName = RTL_CONSTANT_STRING(CYBERION_DEVICE_NAME);
     UNICODE_STRING dosDeviceName = RTL_CONSTANT_STRING(CYBERION_DOS_DEVICE_NAME);
 
-    UNREFERENCED_PARAMETER(RegistryPath);
-
     DbgPrint("CyberionDriver: DriverEntry - Loading.\n");
 
-    // Create the device object
-    status = IoCreateDevice(
+    status = CyberionTunablesInitialize(RegistryPath);
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to load tunables (0x%08X).\n", status);
+        return status;
+    }
+
+    status = CyberionVerdictInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to allocate verdict table (0x%08X).\n", status);
+        return status;
+    }
+
+    status = CyberionPathInitialize(DriverObject);
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to initialize path rules (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    status = CyberionCommandLineInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to initialize argument patterns (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    status = CyberionTokenInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to allocate SID table (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    status = CyberionDetailsInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to allocate event detail store (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    status = CyberionProcessInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to allocate process table (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    status = CyberionImageInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to allocate identity cache (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    status = CyberionHashQueueInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to start hash workers (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    status = CyberionSessionInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to allocate event pool (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    // Expired decisions can report policy changes to sessions
+    CyberionPolicyInitialize();
+
+    status = CyberionDecisionInitialize();
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Failed to start decision timer (0x%08X).\n", status);
+        CyberionReleaseComponents();
+        return status;
+    }
+
+    // Create the device object. Responses terminate processes and settings
+    // apply to every user, so only SYSTEM and administrators may open it.
+    status = IoCreateDeviceSecure(
         DriverObject,
         0,
         &devName,
         FILE_DEVICE_UNKNOWN,
-        0,
+        FILE_DEVICE_SECURE_OPEN,
         FALSE,
+        &SDDL_DEVOBJ_SYS_ALL_ADM_ALL,
+        &g_CyberionDeviceClass,
         &g_DeviceObject);
 
     if (!NT_SUCCESS(status)) {
         DbgPrint("CyberionDriver: Failed to create device object (0x%08X).\n", status);
+        CyberionReleaseComponents();
         return status;
     }
 
@@ -63,12 +190,14 @@ NTSTATUS DriverEntry(
     if (!NT_SUCCESS(status)) {
         DbgPrint("CyberionDriver: Failed to create symbolic link (0x%08X).\n", status);
         IoDeleteDevice(g_DeviceObject);
+        CyberionReleaseComponents();
         return status;
     }
 
     // Set up driver dispatch routines
     DriverObject->DriverUnload = CyberionUnload;
     DriverObject->MajorFunction[IRP_MJ_CREATE] = CyberionCreateClose;
+    DriverObject->MajorFunction[IRP_MJ_CLEANUP] = CyberionCreateClose;
     DriverObject->MajorFunction[IRP_MJ_CLOSE] = CyberionCreateClose;
     DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = CyberionDeviceControl;
 
@@ -79,11 +208,10 @@ NTSTATUS DriverEntry(
         DbgPrint("CyberionDriver: Failed to register process notify routine (0x%08X).\n", status);
         IoDeleteSymbolicLink(&dosDeviceName);
         IoDeleteDevice(g_DeviceObject);
+        CyberionReleaseComponents();
         return status;
     }
 
-    KeInitializeSpinLock(&g_IrpQueueLock);
-
     DbgPrint("CyberionDriver: Driver loaded successfully.\n");
 
     return STATUS_SUCCESS;
@@ -103,19 +231,18 @@ VOID CyberionUnload(
     // Unregister the callback routine
     PsSetCreateProcessNotifyRoutineEx(ProcessNotifyCallback, TRUE);
 
-    // If an IRP is pending, cancel it
-    if (g_PendingIrp) {
-        IoCancelIrp(g_PendingIrp);
-        g_PendingIrp = NULL;
-    }
+    // Pending reads belong to sessions; the I/O manager only unloads the
+    // driver after every handle, and therefore every session, is closed.
 
     // Clean up resources
     IoDeleteSymbolicLink(&dosDeviceName);
     IoDeleteDevice(DriverObject->DeviceObject);
+    CyberionReleaseComponents();
 }
 
 //
-// CyberionCreateClose: Handles IRP_MJ_CREATE and IRP_MJ_CLOSE requests.
+// CyberionCreateClose: Handles IRP_MJ_CREATE, IRP_MJ_CLEANUP and IRP_MJ_CLOSE
+// requests by creating and tearing down the handle's session.
 //
 NTSTATUS CyberionCreateClose(
     _In_ PDEVICE_OBJECT DeviceObject,
@@ -123,10 +250,28 @@ NTSTATUS CyberionCreateClose(
 )
 {
     UNREFERENCED_PARAMETER(DeviceObject);
-    Irp->IoStatus.Status = STATUS_SUCCESS;
+
+    PIO_STACK_LOCATION stack = IoGetCurrentIrpStackLocation(Irp);
+    NTSTATUS status = STATUS_SUCCESS;
+
+    switch (stack->MajorFunction) {
+        case IRP_MJ_CREATE:
+            status = CyberionSessionCreate(stack->FileObject);
+            break;
+
+        case IRP_MJ_CLEANUP:
+            CyberionSessionCleanup(stack->FileObject);
+            break;
+
+        case IRP_MJ_CLOSE:
+            CyberionSessionClose(stack->FileObject);
+            break;
+    }
+
+    Irp->IoStatus.Status = status;
     Irp->IoStatus.Information = 0;
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
-    return STATUS_SUCCESS;
+    return status;
 }
 
 //
@@ -138,33 +283,90 @@ VOID ProcessNotifyCallback(
     _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo
 )
 {
-    UNREFERENCED_PARAMETER(Process);
-    
     if (CreateInfo) { // Process is being created
         DbgPrint("CyberionDriver: Process creation detected: PID %d, Name: %wZ\n", ProcessId, CreateInfo->ImageFileName);
 
-        KLOCK_QUEUE_HANDLE lockHandle;
-        KeAcquireInStackQueuedSpinLock(&g_IrpQueueLock, &lockHandle);
-
-        if (g_PendingIrp) {
-            PPROCESS_CREATION_INFO pInfo = (PPROCESS_CREATION_INFO)g_PendingIrp->AssociatedIrp.SystemBuffer;
-            
-            pInfo->ProcessId = ProcessId;
-            pInfo->ParentProcessId = CreateInfo->ParentProcessId;
-            
-            // Safely copy the image file name
-            if (CreateInfo->ImageFileName != NULL) {
-                RtlCopyMemory(pInfo->ImageFileName, CreateInfo->ImageFileName->Buffer, min(CreateInfo->ImageFileName->Length, MAX_PATH_SIZE * sizeof(WCHAR)));
-            }
-
-            g_PendingIrp->IoStatus.Status = STATUS_SUCCESS;
-            g_PendingIrp->IoStatus.Information = sizeof(PROCESS_CREATION_INFO);
-            IoCompleteRequest(g_PendingIrp, IO_NO_INCREMENT);
-            g_PendingIrp = NULL;
+        CYBERION_FILTER_CONTEXT filterContext;
+        CYBERION_IMAGE_INFO image;
+        CYBERION_TOKEN_INFO token;
+        CYBERION_TOKEN_INFO parentToken;
+        CYBERION_IMAGE_PATH imagePath;
+        CYBERION_PATTERN_MATCHES argumentMatches;
+        CYBERION_VERDICT pathVerdict;
+        ULONG64 pathTags;
+        ULONG64 eventId;
+        ULONG64 processKey = PsGetProcessStartKey(Process);
+
+        CyberionTokenCapture(Process, &token);
+        CyberionProcessQueryToken(CreateInfo->ParentProcessId, &parentToken);
+        CyberionImageIdentify(ProcessId, processKey, CreateInfo, &token, &image);
+        CyberionPathNormalize(CreateInfo->ImageFileName, &imagePath);
+        pathVerdict = CyberionPathMatch(&imagePath, &pathTags);
+        CyberionCommandLineScan(CreateInfo->CommandLine, &argumentMatches);
+        eventId = CyberionDetailsRecord(&imagePath, CreateInfo->CommandLine);
+
+        // A known-bad image is refused before it ever runs
+        if (image.Verdict == VerdictBlock) {
+            DbgPrint("CyberionDriver: Blocking PID %d (cached verdict).\n", ProcessId);
+            CreateInfo->CreationStatus = STATUS_ACCESS_DENIED;
+        } else if (pathVerdict == VerdictBlock) {
+            DbgPrint("CyberionDriver: Blocking PID %d (path rule).\n", ProcessId);
+            CreateInfo->CreationStatus = STATUS_ACCESS_DENIED;
         }
 
-        KeReleaseInStackQueuedSpinLock(&lockHandle);
+        filterContext.ProcessId = (ULONG64)(ULONG_PTR)ProcessId;
+        filterContext.ParentProcessId = (ULONG64)(ULONG_PTR)CreateInfo->ParentProcessId;
+        filterContext.CreatingProcessId = (ULONG64)(ULONG_PTR)CreateInfo->CreatingThreadId.UniqueProcess;
+        filterContext.CreatingThreadId = (ULONG64)(ULONG_PTR)CreateInfo->CreatingThreadId.UniqueThread;
+        filterContext.ImageNameLength = CreateInfo->ImageFileName ? CreateInfo->ImageFileName->Length : 0;
+        filterContext.FileOpenNameAvailable = (BOOLEAN)CreateInfo->FileOpenNameAvailable;
+        filterContext.IsSubsystemProcess = (BOOLEAN)CreateInfo->IsSubsystemProcess;
+        filterContext.ImageVerdict = image.Verdict;
+        filterContext.PathVerdict = pathVerdict;
+        filterContext.PathTags = pathTags;
+        filterContext.CommandLineLength = CreateInfo->CommandLine ? (USHORT)(CreateInfo->CommandLine->Length / sizeof(WCHAR)) : 0;
+        filterContext.ArgumentMatchCount = argumentMatches.Count;
+        filterContext.ArgumentTags = argumentMatches.Tags;
+        filterContext.UserId = token.UserId;
+        filterContext.IntegrityLevel = token.IntegrityLevel;
+        filterContext.ParentUserId = parentToken.UserId;
+        filterContext.ParentIntegrityLevel = parentToken.IntegrityLevel;
+
+        CyberionSessionPublish(&filterContext, eventId, processKey, &imagePath, &argumentMatches, &image);
+    } else { // Process is exiting
+        CyberionDecisionResolve(ProcessId, PsGetProcessStartKey(Process), NULL);
+        CyberionProcessRemove(ProcessId);
+    }
+}
+
+//
+// CyberionRequestorPrivileged: Decides whether the sender of a device
+// control request may change driver-wide state. Kernel-mode senders,
+// holders of SeTcbPrivilege and elevated administrators may. Called in
+// the sender's context.
+//
+static BOOLEAN CyberionRequestorPrivileged(
+    _In_ PIRP Irp
+)
+{
+    SECURITY_SUBJECT_CONTEXT subject;
+    BOOLEAN privileged;
+
+    if (Irp->RequestorMode == KernelMode) {
+        return TRUE;
     }
+
+    if (SeSinglePrivilegeCheck(RtlConvertLongToLuid(SE_TCB_PRIVILEGE), UserMode)) {
+        return TRUE;
+    }
+
+    SeCaptureSubjectContext(&subject);
+    SeLockSubjectContext(&subject);
+    privileged = SeTokenIsAdmin(SeQuerySubjectContextToken(&subject));
+    SeUnlockSubjectContext(&subject);
+    SeReleaseSubjectContext(&subject);
+
+    return privileged;
 }
 
 //
@@ -180,56 +382,166 @@ NTSTATUS CyberionDeviceControl(
     PIO_STACK_LOCATION stack = IoGetCurrentIrpStackLocation(Irp);
     NTSTATUS status = STATUS_SUCCESS;
 
+    Irp->IoStatus.Information = 0;
+
     switch (stack->Parameters.DeviceIoControl.IoControlCode) {
         case IOCTL_CYBERION_GET_PROCESS_INFO:
         {
             DbgPrint("CyberionDriver: IOCTL_CYBERION_GET_PROCESS_INFO received.\n");
-            
-            KLOCK_QUEUE_HANDLE lockHandle;
-            KeAcquireInStackQueuedSpinLock(&g_IrpQueueLock, &lockHandle);
-
-            if (g_PendingIrp) {
-                // Another request is already pending
-                status = STATUS_DEVICE_BUSY;
-            } else {
-                // Mark the IRP as pending and store it
-                g_PendingIrp = Irp;
-                status = STATUS_PENDING;
-                IoMarkIrpPending(Irp);
-            }
 
-            KeReleaseInStackQueuedSpinLock(&lockHandle);
+            // Returns STATUS_PENDING if the IRP was queued on the session
+            status = CyberionSessionRead(Irp, stack);
+            break;
+        }
 
-            // If not pending, complete the request now
-            if (status != STATUS_PENDING) {
-                Irp->IoStatus.Status = status;
-                Irp->IoStatus.Information = 0;
-                IoCompleteRequest(Irp, IO_NO_INCREMENT);
-            }
+        case IOCTL_CYBERION_GET_EVENTS:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_GET_EVENTS received.\n");
+            status = CyberionSessionRead(Irp, stack);
             break;
         }
 
         case IOCTL_CYBERION_SEND_RESPONSE:
         {
-            // In a full implementation, you would handle the response here.
-            // For example, terminate a process if the user chose to block it.
-            // This part is left for future expansion.
             DbgPrint("CyberionDriver: IOCTL_CYBERION_SEND_RESPONSE received.\n");
-            
-            // For now, just complete the request successfully.
-            Irp->IoStatus.Status = STATUS_SUCCESS;
-            Irp->IoStatus.Information = 0;
-            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+            if (!CyberionRequestorPrivileged(Irp)) {
+                status = STATUS_ACCESS_DENIED;
+                break;
+            }
+
+            status = CyberionVerdictRespond(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_SET_FILTER:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_SET_FILTER received.\n");
+            status = CyberionSessionSetFilter(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_GET_SESSION_STATS:
+        {
+            status = CyberionSessionQueryStatistics(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_SET_DELIVERY:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_SET_DELIVERY received.\n");
+            status = CyberionSessionSetDelivery(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_GET_TUNABLES:
+        {
+            status = CyberionTunablesGet(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_SET_TUNABLES:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_SET_TUNABLES received.\n");
+
+            if (!CyberionRequestorPrivileged(Irp)) {
+                status = STATUS_ACCESS_DENIED;
+                break;
+            }
+
+            status = CyberionTunablesSet(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_SET_RULE:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_SET_RULE received.\n");
+
+            if (!CyberionRequestorPrivileged(Irp)) {
+                status = STATUS_ACCESS_DENIED;
+                break;
+            }
+
+            status = CyberionVerdictSetRule(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_GET_VERDICT_STATS:
+        {
+            status = CyberionVerdictQueryStatistics(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_PRELOAD_VERDICTS:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_PRELOAD_VERDICTS received.\n");
+
+            if (!CyberionRequestorPrivileged(Irp)) {
+                status = STATUS_ACCESS_DENIED;
+                break;
+            }
+
+            status = CyberionVerdictPreload(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_EXPORT_VERDICTS:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_EXPORT_VERDICTS received.\n");
+            status = CyberionVerdictExport(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_SET_PATH_RULES:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_SET_PATH_RULES received.\n");
+
+            if (!CyberionRequestorPrivileged(Irp)) {
+                status = STATUS_ACCESS_DENIED;
+                break;
+            }
+
+            status = CyberionPathSetRules(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_SET_ARGUMENT_PATTERNS:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_SET_ARGUMENT_PATTERNS received.\n");
+
+            if (!CyberionRequestorPrivileged(Irp)) {
+                status = STATUS_ACCESS_DENIED;
+                break;
+            }
+
+            status = CyberionCommandLineSetPatterns(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_GET_EVENT_DETAILS:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_GET_EVENT_DETAILS received.\n");
+            status = CyberionDetailsGet(Irp, stack);
+            break;
+        }
+
+        case IOCTL_CYBERION_GET_SID:
+        {
+            DbgPrint("CyberionDriver: IOCTL_CYBERION_GET_SID received.\n");
+            status = CyberionTokenGetSid(Irp, stack);
             break;
         }
 
         default:
             status = STATUS_INVALID_DEVICE_REQUEST;
-            Irp->IoStatus.Status = status;
-            Irp->IoStatus.Information = 0;
-            IoCompleteRequest(Irp, IO_NO_INCREMENT);
             break;
     }
 
+    // If not pending, complete the request now
+    if (status != STATUS_PENDING) {
+        Irp->IoStatus.Status = status;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    }
+
     return status;
-} 
\ No newline at end of file
+}
@@ -0,0 +1,249 @@
+/*
+ * FILTER.C
+ *
+ * Verifier and interpreter for event filter programs.
+ *
+ * Programs are only ever run after CyberionFilterVerify has accepted them,
+ * so the interpreter does no bounds or type checking of its own. Because
+ * every jump is forward, a program executes at most InstructionCount
+ * instructions.
+ */
+
+#include "Filter.h"
+
+//
+// Location and width of each CYBERION_FILTER_FIELD within the context.
+//
+typedef struct _FILTER_FIELD_DESCRIPTOR {
+    USHORT Offset;
+    USHORT Size;
+} FILTER_FIELD_DESCRIPTOR;
+
+#define FILTER_FIELD(Name) \
+    { (USHORT)FIELD_OFFSET(CYBERION_FILTER_CONTEXT, Name), (USHORT)RTL_FIELD_SIZE(CYBERION_FILTER_CONTEXT, Name) }
+
+static const FILTER_FIELD_DESCRIPTOR g_FilterFields[] = {
+    FILTER_FIELD(ProcessId),                // FilterFieldProcessId
+    FILTER_FIELD(ParentProcessId),          // FilterFieldParentProcessId
+    FILTER_FIELD(CreatingProcessId),        // FilterFieldCreatingProcessId
+    FILTER_FIELD(CreatingThreadId),         // FilterFieldCreatingThreadId
+    FILTER_FIELD(ImageNameLength),          // FilterFieldImageNameLength
+    FILTER_FIELD(FileOpenNameAvailable),    // FilterFieldFileOpenNameAvailable
+    FILTER_FIELD(IsSubsystemProcess),       // FilterFieldIsSubsystemProcess
+    FILTER_FIELD(ImageVerdict),             // FilterFieldImageVerdict
+    FILTER_FIELD(PathVerdict),              // FilterFieldPathVerdict
+    FILTER_FIELD(PathTags),                 // FilterFieldPathTags
+    FILTER_FIELD(CommandLineLength),        // FilterFieldCommandLineLength
+    FILTER_FIELD(ArgumentMatchCount),       // FilterFieldArgumentMatchCount
+    FILTER_FIELD(ArgumentTags),             // FilterFieldArgumentTags
+    FILTER_FIELD(UserId),                   // FilterFieldUserId
+    FILTER_FIELD(IntegrityLevel),           // FilterFieldIntegrityLevel
+    FILTER_FIELD(ParentUserId),             // FilterFieldParentUserId
+    FILTER_FIELD(ParentIntegrityLevel),     // FilterFieldParentIntegrityLevel
+};
+
+C_ASSERT(RTL_NUMBER_OF(g_FilterFields) == FilterFieldMax);
+C_ASSERT(CYBERION_FILTER_REGISTERS <= 8); // Register sets are tracked in a UCHAR
+
+#define REGISTER_BIT(r) ((UCHAR)(1u << (r)))
+
+FORCEINLINE BOOLEAN FilterIsJump(UCHAR Opcode)
+{
+    return Opcode >= FilterOpJump && Opcode <= FilterOpJumpSet;
+}
+
+FORCEINLINE BOOLEAN FilterIsAlu(UCHAR Opcode)
+{
+    return Opcode >= FilterOpAdd && Opcode <= FilterOpRsh;
+}
+
+//
+// CyberionFilterVerify: Walks the program once in order. Since control only
+// flows forward, every predecessor of an instruction has been visited by the
+// time it is reached, which lets us track the set of registers initialized
+// on all paths without iterating to a fixed point.
+//
+NTSTATUS CyberionFilterVerify(
+    _In_reads_(InstructionCount) const CYBERION_FILTER_INSN *Instructions,
+    _In_ ULONG InstructionCount
+)
+{
+    UCHAR initialized[CYBERION_FILTER_MAX_INSNS];
+    BOOLEAN reached[CYBERION_FILTER_MAX_INSNS];
+    ULONG pc;
+
+    if (Instructions == NULL || InstructionCount == 0 || InstructionCount > CYBERION_FILTER_MAX_INSNS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Every path must end in a return, so the last instruction has to be one.
+    if (Instructions[InstructionCount - 1].Opcode != FilterOpReturn) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory(initialized, sizeof(initialized));
+    RtlZeroMemory(reached, sizeof(reached));
+    reached[0] = TRUE;
+
+    for (pc = 0; pc < InstructionCount; pc++) {
+        const CYBERION_FILTER_INSN *insn = &Instructions[pc];
+        BOOLEAN immediate = (insn->Flags & FILTER_INSN_IMMEDIATE) != 0;
+        UCHAR uses = 0;
+        UCHAR state;
+
+        if (insn->Opcode >= FilterOpMax ||
+            (insn->Flags & ~FILTER_INSN_IMMEDIATE) != 0 ||
+            insn->Dst >= CYBERION_FILTER_REGISTERS ||
+            (!immediate && insn->Src >= CYBERION_FILTER_REGISTERS)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if (!reached[pc]) {
+            // Dead code is harmless; it only has to be well formed.
+            continue;
+        }
+
+        state = initialized[pc];
+
+        if (!immediate && insn->Opcode != FilterOpLoadField && insn->Opcode != FilterOpJump) {
+            uses |= REGISTER_BIT(insn->Src);
+        }
+
+        if (FilterIsAlu(insn->Opcode) || (FilterIsJump(insn->Opcode) && insn->Opcode != FilterOpJump)) {
+            uses |= REGISTER_BIT(insn->Dst);
+        }
+
+        if ((uses & state) != uses) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        switch (insn->Opcode) {
+            case FilterOpLoadField:
+                if (!immediate || insn->Immediate >= FilterFieldMax) {
+                    return STATUS_INVALID_PARAMETER;
+                }
+                break;
+
+            case FilterOpLsh:
+            case FilterOpRsh:
+                if (immediate && insn->Immediate >= 64) {
+                    return STATUS_INVALID_PARAMETER;
+                }
+                break;
+
+            case FilterOpReturn:
+                if (immediate && insn->Immediate >= FilterVerdictMax) {
+                    return STATUS_INVALID_PARAMETER;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        if (insn->Opcode == FilterOpMove || insn->Opcode == FilterOpLoadField) {
+            state |= REGISTER_BIT(insn->Dst);
+        }
+
+        if (FilterIsJump(insn->Opcode)) {
+            ULONG target;
+
+            if (insn->Offset >= InstructionCount - pc - 1) {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            target = pc + 1 + insn->Offset;
+            initialized[target] = reached[target] ? (UCHAR)(initialized[target] & state) : state;
+            reached[target] = TRUE;
+
+            if (insn->Opcode == FilterOpJump) {
+                continue;
+            }
+        }
+
+        if (insn->Opcode != FilterOpReturn) {
+            // Fall through. The last instruction is a return, so pc + 1 is
+            // in range.
+            initialized[pc + 1] = reached[pc + 1] ? (UCHAR)(initialized[pc + 1] & state) : state;
+            reached[pc + 1] = TRUE;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// FilterLoadField: Reads one context field, zero-extended to 64 bits.
+//
+static ULONG64 FilterLoadField(
+    _In_ const CYBERION_FILTER_CONTEXT *Context,
+    _In_ ULONG64 Field
+)
+{
+    const FILTER_FIELD_DESCRIPTOR *desc = &g_FilterFields[Field];
+    const UCHAR *p = (const UCHAR *)Context + desc->Offset;
+
+    switch (desc->Size) {
+        case sizeof(UCHAR):   return *(const UCHAR *)p;
+        case sizeof(USHORT):  return *(const USHORT *)p;
+        case sizeof(ULONG):   return *(const ULONG *)p;
+        default:              return *(const ULONG64 *)p;
+    }
+}
+
+//
+// CyberionFilterRun: Interprets a verified program.
+//
+CYBERION_FILTER_VERDICT CyberionFilterRun(
+    _In_reads_(InstructionCount) const CYBERION_FILTER_INSN *Instructions,
+    _In_ ULONG InstructionCount,
+    _In_ const CYBERION_FILTER_CONTEXT *Context
+)
+{
+    ULONG64 regs[CYBERION_FILTER_REGISTERS];
+    ULONG pc = 0;
+
+    RtlZeroMemory(regs, sizeof(regs));
+
+    while (pc < InstructionCount) {
+        const CYBERION_FILTER_INSN *insn = &Instructions[pc++];
+        ULONG64 src = (insn->Flags & FILTER_INSN_IMMEDIATE) ? insn->Immediate : regs[insn->Src];
+        ULONG64 *dst = &regs[insn->Dst];
+        BOOLEAN taken;
+
+        switch (insn->Opcode) {
+            case FilterOpMove:      *dst = src; continue;
+            case FilterOpLoadField: *dst = FilterLoadField(Context, insn->Immediate); continue;
+            case FilterOpAdd:       *dst += src; continue;
+            case FilterOpSub:       *dst -= src; continue;
+            case FilterOpAnd:       *dst &= src; continue;
+            case FilterOpOr:        *dst |= src; continue;
+            case FilterOpXor:       *dst ^= src; continue;
+            case FilterOpLsh:       *dst <<= (src & 63); continue;
+            case FilterOpRsh:       *dst >>= (src & 63); continue;
+
+            case FilterOpJump:      taken = TRUE; break;
+            case FilterOpJumpEq:    taken = (*dst == src); break;
+            case FilterOpJumpNe:    taken = (*dst != src); break;
+            case FilterOpJumpGt:    taken = (*dst > src); break;
+            case FilterOpJumpGe:    taken = (*dst >= src); break;
+            case FilterOpJumpLt:    taken = (*dst < src); break;
+            case FilterOpJumpLe:    taken = (*dst <= src); break;
+            case FilterOpJumpSet:   taken = ((*dst & src) != 0); break;
+
+            case FilterOpReturn:
+                // Register verdicts are only known at run time; anything out
+                // of range fails open.
+                return (src < FilterVerdictMax) ? (CYBERION_FILTER_VERDICT)src : FilterVerdictDeliver;
+
+            default:
+                return FilterVerdictDeliver;
+        }
+
+        if (taken) {
+            pc += insn->Offset;
+        }
+    }
+
+    return FilterVerdictDeliver;
+}
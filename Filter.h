@@ -0,0 +1,55 @@
+/*
+ * FILTER.H
+ *
+ * Verifier and interpreter for event filter programs (see Public.h).
+ * This component is portable C: it has no dependency on the WDK beyond
+ * the types supplied by Platform.h.
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+//
+// Values visible to a filter program for one process creation event.
+//
+typedef struct _CYBERION_FILTER_CONTEXT {
+    ULONG64 ProcessId;
+    ULONG64 ParentProcessId;
+    ULONG64 CreatingProcessId;
+    ULONG64 CreatingThreadId;
+    ULONG ImageNameLength;
+    BOOLEAN FileOpenNameAvailable;
+    BOOLEAN IsSubsystemProcess;
+    CYBERION_VERDICT ImageVerdict;
+    CYBERION_VERDICT PathVerdict;
+    ULONG64 PathTags;
+    USHORT CommandLineLength;
+    ULONG ArgumentMatchCount;
+    ULONG64 ArgumentTags;
+    ULONG UserId;
+    ULONG IntegrityLevel;
+    ULONG ParentUserId;
+    ULONG ParentIntegrityLevel;
+} CYBERION_FILTER_CONTEXT, *PCYBERION_FILTER_CONTEXT;
+
+//
+// CyberionFilterVerify: Checks that a program is well formed and terminates.
+// Returns STATUS_INVALID_PARAMETER for any program that could read an
+// unknown field or an uninitialized register, jump backwards or out of
+// bounds, or run off its end.
+//
+NTSTATUS CyberionFilterVerify(
+    _In_reads_(InstructionCount) const CYBERION_FILTER_INSN *Instructions,
+    _In_ ULONG InstructionCount
+);
+
+//
+// CyberionFilterRun: Evaluates a verified program against an event.
+//
+CYBERION_FILTER_VERDICT CyberionFilterRun(
+    _In_reads_(InstructionCount) const CYBERION_FILTER_INSN *Instructions,
+    _In_ ULONG InstructionCount,
+    _In_ const CYBERION_FILTER_CONTEXT *Context
+);
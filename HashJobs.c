@@ -0,0 +1,141 @@
+/*
+ * HASHJOBS.C
+ *
+ * Pending and in-flight hashing jobs.
+ *
+ * Jobs come from a fixed-size slab, so the queue depth is a hard bound and
+ * submitting never allocates. Every job is linked both on the FIFO of
+ * pending work and on a small hash of in-flight identities; it stays on the
+ * latter until it is completed, which is what lets a submission for a file
+ * already being hashed be dropped. The in-flight hash is searched before a
+ * job is allocated, so a full queue still coalesces.
+ */
+
+#include "HashJobs.h"
+
+FORCEINLINE PCYBERION_HASH_JOB *HashJobsBucket(
+    _In_ PCYBERION_HASH_JOBS Jobs,
+    _In_ const CYBERION_FILE_IDENTITY *Identity
+)
+{
+    ULONG64 h = (Identity->FileId ^ Identity->VolumeId) * 0x9E3779B97F4A7C15ULL;
+    return &Jobs->InFlight[(h >> 32) & (CYBERION_HASH_JOB_BUCKETS - 1)];
+}
+
+NTSTATUS CyberionHashJobsInitialize(
+    _Out_ PCYBERION_HASH_JOBS Jobs,
+    _In_ ULONG Depth
+)
+{
+    RtlZeroMemory(Jobs, sizeof(*Jobs));
+    return CyberionSlabInitialize(&Jobs->Jobs, sizeof(CYBERION_HASH_JOB), Depth);
+}
+
+VOID CyberionHashJobsDestroy(
+    _Inout_ PCYBERION_HASH_JOBS Jobs
+)
+{
+    CyberionSlabDestroy(&Jobs->Jobs);
+}
+
+CYBERION_HASH_SUBMIT CyberionHashJobsSubmit(
+    _Inout_ PCYBERION_HASH_JOBS Jobs,
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_ PVOID Context
+)
+{
+    PCYBERION_HASH_JOB *bucket = HashJobsBucket(Jobs, Identity);
+    CYBERION_HASH_SUBMIT result = HashSubmitRejected;
+    CYBERION_PIN_STATE pin;
+    PCYBERION_HASH_JOB job;
+
+    CyberionAcquireLock(&Jobs->Lock, &pin);
+
+    for (job = *bucket; job != NULL; job = job->InFlightNext) {
+        if (RtlEqualMemory(&job->Identity, Identity, sizeof(*Identity))) {
+            result = HashSubmitCoalesced;
+            break;
+        }
+    }
+
+    if (job == NULL && !Jobs->Stopping) {
+        job = (PCYBERION_HASH_JOB)CyberionSlabAllocate(&Jobs->Jobs);
+        if (job != NULL) {
+            job->QueueNext = NULL;
+            job->InFlightNext = *bucket;
+            job->Context = Context;
+            job->Identity = *Identity;
+            *bucket = job;
+
+            if (Jobs->PendingTail != NULL) {
+                Jobs->PendingTail->QueueNext = job;
+            } else {
+                Jobs->PendingHead = job;
+            }
+            Jobs->PendingTail = job;
+            result = HashSubmitQueued;
+        }
+    }
+
+    CyberionReleaseLock(&Jobs->Lock, pin);
+    return result;
+}
+
+PCYBERION_HASH_JOB CyberionHashJobsTake(
+    _Inout_ PCYBERION_HASH_JOBS Jobs
+)
+{
+    PCYBERION_HASH_JOB job = NULL;
+    CYBERION_PIN_STATE pin;
+
+    CyberionAcquireLock(&Jobs->Lock, &pin);
+
+    if (!Jobs->Stopping && Jobs->PendingHead != NULL) {
+        job = Jobs->PendingHead;
+        Jobs->PendingHead = job->QueueNext;
+        if (Jobs->PendingHead == NULL) {
+            Jobs->PendingTail = NULL;
+        }
+    }
+
+    CyberionReleaseLock(&Jobs->Lock, pin);
+    return job;
+}
+
+VOID CyberionHashJobsComplete(
+    _Inout_ PCYBERION_HASH_JOBS Jobs,
+    _In_ PCYBERION_HASH_JOB Job
+)
+{
+    PCYBERION_HASH_JOB *link = HashJobsBucket(Jobs, &Job->Identity);
+    CYBERION_PIN_STATE pin;
+
+    CyberionAcquireLock(&Jobs->Lock, &pin);
+
+    while (*link != Job) {
+        link = &(*link)->InFlightNext;
+    }
+    *link = Job->InFlightNext;
+
+    CyberionReleaseLock(&Jobs->Lock, pin);
+
+    CyberionSlabFree(&Jobs->Jobs, Job);
+}
+
+PCYBERION_HASH_JOB CyberionHashJobsStop(
+    _Inout_ PCYBERION_HASH_JOBS Jobs
+)
+{
+    PCYBERION_HASH_JOB pending;
+    CYBERION_PIN_STATE pin;
+
+    CyberionAcquireLock(&Jobs->Lock, &pin);
+
+    Jobs->Stopping = TRUE;
+    pending = Jobs->PendingHead;
+    Jobs->PendingHead = NULL;
+    Jobs->PendingTail = NULL;
+
+    CyberionReleaseLock(&Jobs->Lock, pin);
+    return pending;
+}
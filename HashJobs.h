@@ -0,0 +1,90 @@
+/*
+ * HASHJOBS.H
+ *
+ * Bookkeeping for the image hashing queue: a bounded FIFO of pending jobs
+ * and a hash of the file identities that are queued or being hashed. A
+ * submission for an identity already there is folded into that job, so a
+ * burst of launches of one new binary hashes it once. The threads and the
+ * file references belong to the caller (system threads in HashQueue.c,
+ * pthreads in the harness).
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "IdentityCache.h"
+#include "Slab.h"
+
+#define CYBERION_HASH_JOB_BUCKETS 64 // In-flight identity hash, a power of two
+
+typedef struct _CYBERION_HASH_JOB {
+    struct _CYBERION_HASH_JOB *QueueNext;       // Next pending job, oldest first
+    struct _CYBERION_HASH_JOB *InFlightNext;    // Next job in the same identity bucket
+    PVOID Context;                              // Caller's reference to the file
+    CYBERION_FILE_IDENTITY Identity;            // Identity when the job was submitted
+} CYBERION_HASH_JOB, *PCYBERION_HASH_JOB;
+
+typedef enum _CYBERION_HASH_SUBMIT {
+    HashSubmitQueued,       // A new job holds Context until it is completed
+    HashSubmitCoalesced,    // A job for the identity is already queued or running
+    HashSubmitRejected      // The queue is full or stopping
+} CYBERION_HASH_SUBMIT;
+
+typedef struct _CYBERION_HASH_JOBS {
+    CYBERION_SLAB Jobs;                 // Backing store; its size is the queue depth
+    CYBERION_LOCK Lock;                 // Protects the fields below
+    PCYBERION_HASH_JOB PendingHead;
+    PCYBERION_HASH_JOB PendingTail;
+    PCYBERION_HASH_JOB InFlight[CYBERION_HASH_JOB_BUCKETS]; // Queued and running jobs
+    BOOLEAN Stopping;
+} CYBERION_HASH_JOBS, *PCYBERION_HASH_JOBS;
+
+//
+// CyberionHashJobsInitialize: Reserves room for Depth jobs.
+//
+NTSTATUS CyberionHashJobsInitialize(
+    _Out_ PCYBERION_HASH_JOBS Jobs,
+    _In_ ULONG Depth
+);
+
+//
+// CyberionHashJobsDestroy: Releases the job memory. Every job must have
+// been completed.
+//
+VOID CyberionHashJobsDestroy(_Inout_ PCYBERION_HASH_JOBS Jobs);
+
+//
+// CyberionHashJobsSubmit: Queues a job for Identity unless one is already
+// queued or running. Never blocks. Context is only kept when the result is
+// HashSubmitQueued.
+//
+CYBERION_HASH_SUBMIT CyberionHashJobsSubmit(
+    _Inout_ PCYBERION_HASH_JOBS Jobs,
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_ PVOID Context
+);
+
+//
+// CyberionHashJobsTake: Removes the oldest pending job, or returns NULL if
+// there is none or the jobs are stopping. The job stays in flight until it
+// is completed.
+//
+PCYBERION_HASH_JOB CyberionHashJobsTake(_Inout_ PCYBERION_HASH_JOBS Jobs);
+
+//
+// CyberionHashJobsComplete: Ends a job returned by CyberionHashJobsTake or
+// CyberionHashJobsStop and frees it. Later submissions for its identity
+// queue a new job.
+//
+VOID CyberionHashJobsComplete(
+    _Inout_ PCYBERION_HASH_JOBS Jobs,
+    _In_ PCYBERION_HASH_JOB Job
+);
+
+//
+// CyberionHashJobsStop: Refuses further submissions and takes, and returns
+// the jobs still pending, linked through QueueNext. The caller completes
+// each of them.
+//
+PCYBERION_HASH_JOB CyberionHashJobsStop(_Inout_ PCYBERION_HASH_JOBS Jobs);
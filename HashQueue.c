@@ -0,0 +1,218 @@
+/*
+ * HASHQUEUE.C
+ *
+ * Worker pool for image hashing.
+ *
+ * The pending FIFO and the in-flight identities are kept by HashJobs.c;
+ * this file owns the threads and the file object references. A queued job
+ * holds a reference on its file object until its worker completes it. A
+ * worker re-reads the file's identity after hashing and discards the
+ * result if the file changed underneath it.
+ */
+
+#include "HashQueue.h"
+#include "HashJobs.h"
+#include "Image.h"
+#include "Tunables.h"
+
+//
+// Globals
+//
+static CYBERION_HASH_JOBS g_HashJobs; // Pending and in-flight jobs
+static KSEMAPHORE g_HashWork; // One count per pending job
+static PKTHREAD *g_HashWorkers; // Referenced worker threads
+static ULONG g_HashWorkerCount;
+static CYBERION_HASH_QUEUE_STATISTICS g_HashStats;
+
+KSTART_ROUTINE CyberionHashWorker;
+
+//
+// HashQueueProcess: Hashes one file and records the result.
+//
+static VOID HashQueueProcess(
+    _In_ PCYBERION_HASH_JOB Job
+)
+{
+    CYBERION_FILE_IDENTITY after;
+    UCHAR hash[CYBERION_HASH_SIZE];
+    NTSTATUS status;
+
+    status = CyberionImageComputeHash((PFILE_OBJECT)Job->Context, Job->Identity.FileSize, hash);
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Hashing failed (0x%08X).\n", status);
+        InterlockedIncrement64(&g_HashStats.Failed);
+        return;
+    }
+
+    // A hash only describes the identity it was computed for
+    status = CyberionImageQueryIdentity((PFILE_OBJECT)Job->Context, &after);
+    if (!NT_SUCCESS(status) || !RtlEqualMemory(&after, &Job->Identity, sizeof(after))) {
+        InterlockedIncrement64(&g_HashStats.Stale);
+        return;
+    }
+
+    CyberionImageRecordHash(&Job->Identity, hash);
+    InterlockedIncrement64(&g_HashStats.Completed);
+}
+
+static VOID HashQueueCompleteJob(
+    _In_ PCYBERION_HASH_JOB Job
+)
+{
+    PFILE_OBJECT fileObject = (PFILE_OBJECT)Job->Context;
+
+    CyberionHashJobsComplete(&g_HashJobs, Job);
+    ObDereferenceObject(fileObject);
+}
+
+//
+// CyberionHashWorker: Body of each worker thread.
+//
+VOID CyberionHashWorker(
+    _In_ PVOID StartContext
+)
+{
+    UNREFERENCED_PARAMETER(StartContext);
+
+    for (;;) {
+        PCYBERION_HASH_JOB job;
+
+        KeWaitForSingleObject(&g_HashWork, Executive, KernelMode, FALSE, NULL);
+
+        job = CyberionHashJobsTake(&g_HashJobs);
+        if (job == NULL) {
+            if (g_HashJobs.Stopping) {
+                break;
+            }
+            continue;
+        }
+
+        HashQueueProcess(job);
+        HashQueueCompleteJob(job);
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS CyberionHashQueueInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+    NTSTATUS status;
+    ULONG i;
+
+    CyberionTunablesQuery(&tunables);
+
+    KeInitializeSemaphore(&g_HashWork, 0, MAXLONG);
+    g_HashWorkerCount = 0;
+    RtlZeroMemory(&g_HashStats, sizeof(g_HashStats));
+
+    status = CyberionHashJobsInitialize(&g_HashJobs, tunables.HashQueueDepth);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    g_HashWorkers = (PKTHREAD *)ExAllocatePool2(POOL_FLAG_NON_PAGED, tunables.HashWorkers * sizeof(PKTHREAD), CYBERION_POOL_TAG);
+    if (g_HashWorkers == NULL) {
+        CyberionHashJobsDestroy(&g_HashJobs);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < tunables.HashWorkers; i++) {
+        OBJECT_ATTRIBUTES attributes;
+        HANDLE thread;
+
+        InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+        status = PsCreateSystemThread(&thread, THREAD_ALL_ACCESS, &attributes, NULL, NULL, CyberionHashWorker, NULL);
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+
+        status = ObReferenceObjectByHandle(thread, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID *)&g_HashWorkers[i], NULL);
+        ZwClose(thread);
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+
+        g_HashWorkerCount++;
+    }
+
+    if (!NT_SUCCESS(status)) {
+        CyberionHashQueueShutdown();
+    }
+
+    return status;
+}
+
+VOID CyberionHashQueueShutdown(VOID)
+{
+    PCYBERION_HASH_JOB pending;
+    ULONG i;
+
+    if (g_HashWorkers == NULL) {
+        return;
+    }
+
+    pending = CyberionHashJobsStop(&g_HashJobs);
+
+    // Wake every worker; each one exits at its next wait
+    if (g_HashWorkerCount) {
+        KeReleaseSemaphore(&g_HashWork, IO_NO_INCREMENT, (LONG)g_HashWorkerCount, FALSE);
+    }
+
+    for (i = 0; i < g_HashWorkerCount; i++) {
+        KeWaitForSingleObject(g_HashWorkers[i], Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(g_HashWorkers[i]);
+    }
+
+    while (pending != NULL) {
+        PCYBERION_HASH_JOB next = pending->QueueNext;
+
+        HashQueueCompleteJob(pending);
+        pending = next;
+    }
+
+    ExFreePoolWithTag(g_HashWorkers, CYBERION_POOL_TAG);
+    g_HashWorkers = NULL;
+    g_HashWorkerCount = 0;
+
+    CyberionHashJobsDestroy(&g_HashJobs);
+}
+
+BOOLEAN CyberionHashQueueSubmit(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ const CYBERION_FILE_IDENTITY *Identity
+)
+{
+    // Taken up front: once queued, a worker may finish the job before
+    // CyberionHashJobsSubmit returns.
+    ObReferenceObject(FileObject);
+
+    switch (CyberionHashJobsSubmit(&g_HashJobs, Identity, FileObject)) {
+        case HashSubmitQueued:
+            KeReleaseSemaphore(&g_HashWork, IO_NO_INCREMENT, 1, FALSE);
+            InterlockedIncrement64(&g_HashStats.Submitted);
+            return TRUE;
+
+        case HashSubmitCoalesced:
+            ObDereferenceObject(FileObject);
+            InterlockedIncrement64(&g_HashStats.Coalesced);
+            return TRUE;
+
+        default:
+            ObDereferenceObject(FileObject);
+            InterlockedIncrement64(&g_HashStats.Rejected);
+            return FALSE;
+    }
+}
+
+VOID CyberionHashQueueQueryStatistics(
+    _Inout_ PCYBERION_VERDICT_STATISTICS Statistics
+)
+{
+    Statistics->HashSubmitted = (ULONG64)ReadNoFence64(&g_HashStats.Submitted);
+    Statistics->HashCoalesced = (ULONG64)ReadNoFence64(&g_HashStats.Coalesced);
+    Statistics->HashRejected = (ULONG64)ReadNoFence64(&g_HashStats.Rejected);
+    Statistics->HashCompleted = (ULONG64)ReadNoFence64(&g_HashStats.Completed);
+    Statistics->HashFailed = (ULONG64)ReadNoFence64(&g_HashStats.Failed);
+    Statistics->HashStale = (ULONG64)ReadNoFence64(&g_HashStats.Stale);
+}
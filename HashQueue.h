@@ -0,0 +1,51 @@
+/*
+ * HASHQUEUE.H
+ *
+ * Asynchronous image hashing. The process notify routine submits images
+ * whose hash is not cached; a small pool of system threads hashes them and
+ * records the results in the identity cache. Only one job per file identity
+ * is ever queued or running, so a burst of launches of the same new binary
+ * hashes it once.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "IdentityCache.h"
+
+typedef struct _CYBERION_HASH_QUEUE_STATISTICS {
+    volatile LONG64 Submitted;      // Jobs accepted
+    volatile LONG64 Coalesced;      // Submissions folded into a job already in flight
+    volatile LONG64 Rejected;       // Submissions refused because the queue was full
+    volatile LONG64 Completed;      // Hashes recorded in the identity cache
+    volatile LONG64 Failed;         // Files that could not be hashed
+    volatile LONG64 Stale;          // Files modified while being hashed
+} CYBERION_HASH_QUEUE_STATISTICS, *PCYBERION_HASH_QUEUE_STATISTICS;
+
+//
+// CyberionHashQueueInitialize: Starts the worker threads. Called once from
+// DriverEntry after the identity cache exists.
+//
+NTSTATUS CyberionHashQueueInitialize(VOID);
+
+//
+// CyberionHashQueueShutdown: Stops the workers and discards queued jobs.
+// No submissions may be in progress.
+//
+VOID CyberionHashQueueShutdown(VOID);
+
+//
+// CyberionHashQueueSubmit: Queues a file for hashing unless a job for the
+// same identity is already queued or running. Takes its own reference on
+// FileObject. Never blocks; returns FALSE if the job was refused.
+//
+BOOLEAN CyberionHashQueueSubmit(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ const CYBERION_FILE_IDENTITY *Identity
+);
+
+//
+// CyberionHashQueueQueryStatistics: Fills in the hashing counters of
+// Statistics.
+//
+VOID CyberionHashQueueQueryStatistics(_Inout_ PCYBERION_VERDICT_STATISTICS Statistics);
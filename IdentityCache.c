@@ -0,0 +1,186 @@
+/*
+ * IDENTITYCACHE.C
+ *
+ * File-identity keyed cache of image hashes.
+ *
+ * The cache is a fixed array of small set-associative buckets, each guarded
+ * by its own spin lock, so lookups for different files rarely touch the
+ * same cache line and no operation ever allocates. A bucket holds
+ * CYBERION_IDENTITY_CACHE_WAYS entries and replaces the least recently used
+ * one when it is full. Counters are kept per processor (Counters.h), so
+ * counting shares no cache line either.
+ */
+
+#include "IdentityCache.h"
+
+//
+// IdentityHash: Mixes all four identity fields into a bucket selector.
+//
+FORCEINLINE ULONG64 IdentityHash(_In_ const CYBERION_FILE_IDENTITY *Identity)
+{
+    ULONG64 h = Identity->FileId;
+
+    h ^= (Identity->VolumeId << 17) | (Identity->VolumeId >> 47);
+    h ^= ((ULONG64)Identity->LastWriteTime << 31) | ((ULONG64)Identity->LastWriteTime >> 33);
+    h ^= (Identity->FileSize << 47) | (Identity->FileSize >> 17);
+
+    // 64-bit finalizer from MurmurHash3
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+FORCEINLINE PCYBERION_IDENTITY_BUCKET IdentityBucket(
+    _In_ PCYBERION_IDENTITY_CACHE Cache,
+    _In_ const CYBERION_FILE_IDENTITY *Identity
+)
+{
+    return &Cache->Buckets[IdentityHash(Identity) & Cache->BucketMask];
+}
+
+//
+// IdentityFind: Returns the way holding Identity, or -1. Caller holds the
+// bucket lock.
+//
+static LONG IdentityFind(
+    _In_ PCYBERION_IDENTITY_BUCKET Bucket,
+    _In_ const CYBERION_FILE_IDENTITY *Identity
+)
+{
+    LONG way;
+
+    for (way = 0; way < CYBERION_IDENTITY_CACHE_WAYS; way++) {
+        if ((Bucket->ValidMask & (1u << way)) &&
+            RtlEqualMemory(&Bucket->Entries[way].Identity, Identity, sizeof(CYBERION_FILE_IDENTITY))) {
+            return way;
+        }
+    }
+
+    return -1;
+}
+
+NTSTATUS CyberionIdentityCacheInitialize(
+    _Out_ PCYBERION_IDENTITY_CACHE Cache,
+    _In_ ULONG Capacity
+)
+{
+    ULONG buckets = 1;
+
+    RtlZeroMemory(Cache, sizeof(*Cache));
+
+    if (Capacity < CYBERION_IDENTITY_CACHE_WAYS || Capacity > (1u << 30)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    while (buckets * CYBERION_IDENTITY_CACHE_WAYS < Capacity) {
+        buckets <<= 1;
+    }
+
+    Cache->Buckets = (PCYBERION_IDENTITY_BUCKET)CyberionAllocate(buckets * sizeof(CYBERION_IDENTITY_BUCKET));
+    if (Cache->Buckets == NULL || !NT_SUCCESS(CyberionCountersInitialize(&Cache->Counters))) {
+        CyberionIdentityCacheDestroy(Cache);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // CyberionAllocate returns zeroed memory, so every bucket starts
+    // unlocked and empty
+    Cache->BucketMask = buckets - 1;
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionIdentityCacheDestroy(
+    _Inout_ PCYBERION_IDENTITY_CACHE Cache
+)
+{
+    if (Cache->Buckets) {
+        CyberionFree(Cache->Buckets);
+    }
+
+    CyberionCountersDestroy(&Cache->Counters);
+    RtlZeroMemory(Cache, sizeof(*Cache));
+}
+
+BOOLEAN CyberionIdentityCacheLookup(
+    _Inout_ PCYBERION_IDENTITY_CACHE Cache,
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash
+)
+{
+    PCYBERION_IDENTITY_BUCKET bucket = IdentityBucket(Cache, Identity);
+    CYBERION_PIN_STATE pinState;
+    LONG way;
+
+    CyberionAcquireLock(&bucket->Lock, &pinState);
+
+    way = IdentityFind(bucket, Identity);
+    if (way >= 0) {
+        PCYBERION_IDENTITY_ENTRY entry = &bucket->Entries[way];
+
+        RtlCopyMemory(Hash, entry->Hash, CYBERION_HASH_SIZE);
+        entry->LastUse = (ULONG)ReadNoFence(&Cache->Clock);
+    }
+
+    CyberionReleaseLock(&bucket->Lock, pinState);
+
+    if (way < 0) {
+        CyberionCountersIncrement(&Cache->Counters, IdentityCounterMisses);
+        return FALSE;
+    }
+
+    CyberionCountersIncrement(&Cache->Counters, IdentityCounterHits);
+    return TRUE;
+}
+
+VOID CyberionIdentityCacheInsert(
+    _Inout_ PCYBERION_IDENTITY_CACHE Cache,
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    PCYBERION_IDENTITY_BUCKET bucket = IdentityBucket(Cache, Identity);
+    ULONG now = (ULONG)InterlockedIncrement(&Cache->Clock);
+    CYBERION_PIN_STATE pinState;
+    BOOLEAN evicted = FALSE;
+    LONG way;
+
+    CyberionAcquireLock(&bucket->Lock, &pinState);
+
+    way = IdentityFind(bucket, Identity);
+    if (way < 0) {
+        ULONG oldestAge = 0;
+        LONG candidate;
+
+        // Take a free way if there is one, otherwise the least recently used
+        for (candidate = 0; candidate < CYBERION_IDENTITY_CACHE_WAYS; candidate++) {
+            ULONG age;
+
+            if ((bucket->ValidMask & (1u << candidate)) == 0) {
+                way = candidate;
+                break;
+            }
+
+            age = now - bucket->Entries[candidate].LastUse;
+            if (way < 0 || age > oldestAge) {
+                way = candidate;
+                oldestAge = age;
+            }
+        }
+
+        evicted = (bucket->ValidMask & (1u << way)) != 0;
+        bucket->Entries[way].Identity = *Identity;
+        bucket->ValidMask |= 1u << way;
+    }
+
+    RtlCopyMemory(bucket->Entries[way].Hash, Hash, CYBERION_HASH_SIZE);
+    bucket->Entries[way].LastUse = now;
+
+    CyberionReleaseLock(&bucket->Lock, pinState);
+
+    CyberionCountersIncrement(&Cache->Counters, IdentityCounterInsertions);
+    if (evicted) {
+        CyberionCountersIncrement(&Cache->Counters, IdentityCounterEvictions);
+    }
+}
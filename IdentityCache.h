@@ -0,0 +1,87 @@
+/*
+ * IDENTITYCACHE.H
+ *
+ * Cache of image hashes keyed by file identity.
+ *
+ * A file's identity is its volume, file ID, last-write time and size. While
+ * all four are unchanged the contents are taken to be unchanged as well, so
+ * the hash of an image is reused instead of reading the file again.
+ * Verdicts are not cached here; they are looked up by hash in the verdict
+ * table, which is the one place they change. The driver takes the
+ * identity from the image's file object; the Linux harness uses st_dev,
+ * st_ino, st_mtim and st_size.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+#include "Counters.h"
+
+#define CYBERION_IDENTITY_CACHE_WAYS 4  // Entries per bucket
+
+typedef struct _CYBERION_FILE_IDENTITY {
+    ULONG64 VolumeId;       // Volume serial number (st_dev)
+    ULONG64 FileId;         // File ID on the volume (st_ino)
+    LONG64 LastWriteTime;   // 100ns units (st_mtim)
+    ULONG64 FileSize;       // End of file (st_size)
+} CYBERION_FILE_IDENTITY, *PCYBERION_FILE_IDENTITY;
+
+typedef struct _CYBERION_IDENTITY_ENTRY {
+    CYBERION_FILE_IDENTITY Identity;
+    UCHAR Hash[CYBERION_HASH_SIZE];
+    ULONG LastUse;          // Cache clock at the last insert or hit
+} CYBERION_IDENTITY_ENTRY, *PCYBERION_IDENTITY_ENTRY;
+
+typedef struct _CYBERION_IDENTITY_BUCKET {
+    CYBERION_LOCK Lock;
+    ULONG ValidMask;        // Bit n set when Entries[n] is in use
+    CYBERION_IDENTITY_ENTRY Entries[CYBERION_IDENTITY_CACHE_WAYS];
+} CYBERION_IDENTITY_BUCKET, *PCYBERION_IDENTITY_BUCKET;
+
+typedef enum _CYBERION_IDENTITY_COUNTER {
+    IdentityCounterHits,
+    IdentityCounterMisses,
+    IdentityCounterInsertions,
+    IdentityCounterEvictions        // Valid entries replaced by an insert
+} CYBERION_IDENTITY_COUNTER;
+
+typedef struct _CYBERION_IDENTITY_CACHE {
+    PCYBERION_IDENTITY_BUCKET Buckets;
+    ULONG BucketMask;               // Bucket count - 1 (a power of two)
+    volatile LONG Clock;            // Advanced on every insert, for LRU replacement
+    CYBERION_COUNTERS Counters;     // Indexed by CYBERION_IDENTITY_COUNTER
+} CYBERION_IDENTITY_CACHE, *PCYBERION_IDENTITY_CACHE;
+
+//
+// CyberionIdentityCacheInitialize: Reserves room for at least Capacity
+// entries. The cache never grows; when a bucket is full the least recently
+// used entry in it is replaced.
+//
+NTSTATUS CyberionIdentityCacheInitialize(
+    _Out_ PCYBERION_IDENTITY_CACHE Cache,
+    _In_ ULONG Capacity
+);
+
+VOID CyberionIdentityCacheDestroy(_Inout_ PCYBERION_IDENTITY_CACHE Cache);
+
+//
+// CyberionIdentityCacheLookup: Returns TRUE and the cached hash when the
+// identity is known.
+//
+BOOLEAN CyberionIdentityCacheLookup(
+    _Inout_ PCYBERION_IDENTITY_CACHE Cache,
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash
+);
+
+//
+// CyberionIdentityCacheInsert: Records the hash of a file, replacing any
+// entry for the same identity.
+//
+VOID CyberionIdentityCacheInsert(
+    _Inout_ PCYBERION_IDENTITY_CACHE Cache,
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
@@ -0,0 +1,196 @@
+/*
+ * IMAGE.C
+ *
+ * Image identification for the Cyberion driver.
+ *
+ * Each creation's image is identified by (volume serial, file ID, last-write
+ * time, size), which costs three small queries to the file system. That key
+ * is looked up in the identity cache, so an unchanged executable is only
+ * hashed once however often it is launched.
+ *
+ * Hashing maps the whole file read-only into system space and computes its
+ * Authenticode digest in place. Reads through the view can fault with an
+ * in-page error if the file's storage fails, so the digest runs under an
+ * exception handler.
+ */
+
+#include "Image.h"
+#include "HashQueue.h"
+#include "Pe.h"
+#include "Process.h"
+#include "Sha256.h"
+#include "Tunables.h"
+#include "Verdict.h"
+
+//
+// Globals
+//
+static CYBERION_IDENTITY_CACHE g_IdentityCache; // Image hashes by file identity
+
+NTSTATUS CyberionImageInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+
+    CyberionTunablesQuery(&tunables);
+
+    DbgPrint("CyberionDriver: SHA-256 engines 0x%X.\n", CyberionSha256Initialize(CYBERION_SHA256_ALL));
+
+    return CyberionIdentityCacheInitialize(&g_IdentityCache, tunables.IdentityCacheSize);
+}
+
+VOID CyberionImageShutdown(VOID)
+{
+    CyberionIdentityCacheDestroy(&g_IdentityCache);
+}
+
+NTSTATUS CyberionImageQueryIdentity(
+    _In_ PFILE_OBJECT FileObject,
+    _Out_ PCYBERION_FILE_IDENTITY Identity
+)
+{
+    FILE_NETWORK_OPEN_INFORMATION openInfo;
+    FILE_INTERNAL_INFORMATION internalInfo;
+    union {
+        FILE_FS_VOLUME_INFORMATION Info;
+        UCHAR Buffer[sizeof(FILE_FS_VOLUME_INFORMATION) + 32 * sizeof(WCHAR)];
+    } volume;
+    ULONG returned;
+    NTSTATUS status;
+
+    RtlZeroMemory(Identity, sizeof(*Identity));
+
+    status = IoQueryFileInformation(FileObject, FileNetworkOpenInformation, sizeof(openInfo), &openInfo, &returned);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = IoQueryFileInformation(FileObject, FileInternalInformation, sizeof(internalInfo), &internalInfo, &returned);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Only the fixed part is needed; a long volume label overflows harmlessly
+    status = IoQueryVolumeInformation(FileObject, FileFsVolumeInformation, sizeof(volume), &volume, &returned);
+    if (!NT_SUCCESS(status) && status != STATUS_BUFFER_OVERFLOW) {
+        return status;
+    }
+
+    Identity->VolumeId = volume.Info.VolumeSerialNumber;
+    Identity->FileId = (ULONG64)internalInfo.IndexNumber.QuadPart;
+    Identity->LastWriteTime = openInfo.LastWriteTime.QuadPart;
+    Identity->FileSize = (ULONG64)openInfo.EndOfFile.QuadPart;
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionImageIdentify(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ PPS_CREATE_NOTIFY_INFO CreateInfo,
+    _In_ const CYBERION_TOKEN_INFO *Token,
+    _Out_ PCYBERION_IMAGE_INFO Image
+)
+{
+    NTSTATUS status;
+
+    RtlZeroMemory(Image, sizeof(*Image));
+    Image->Verdict = VerdictUnknown;
+
+    if (CreateInfo->FileObject) {
+        status = CyberionImageQueryIdentity(CreateInfo->FileObject, &Image->Identity);
+        if (NT_SUCCESS(status)) {
+            Image->IdentityValid = TRUE;
+            Image->HashValid = CyberionIdentityCacheLookup(&g_IdentityCache, &Image->Identity, Image->Hash);
+        } else {
+            DbgPrint("CyberionDriver: Could not identify image %wZ (0x%08X).\n", CreateInfo->ImageFileName, status);
+        }
+    }
+
+    if (Image->HashValid) {
+        Image->Verdict = CyberionVerdictLookup(Image->Hash);
+    }
+
+    // Recorded before the hash is queued, so a decision for this process
+    // can always find the hash once it is computed
+    CyberionProcessInsert(ProcessId, ProcessKey, CreateInfo->ParentProcessId, Image, Token);
+
+    // Hash it in the background so the next launch finds it cached
+    if (Image->IdentityValid && !Image->HashValid) {
+        CyberionHashQueueSubmit(CreateInfo->FileObject, &Image->Identity);
+    }
+}
+
+NTSTATUS CyberionImageComputeHash(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ ULONG64 FileSize,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash
+)
+{
+    OBJECT_ATTRIBUTES attributes;
+    HANDLE fileHandle = NULL;
+    HANDLE sectionHandle = NULL;
+    PVOID section = NULL;
+    PVOID view = NULL;
+    SIZE_T viewSize = 0;
+    NTSTATUS status;
+
+    // An empty file cannot be mapped; its hash is that of no data
+    if (FileSize == 0) {
+        CyberionPeComputeImageHash((PCUCHAR)"", 0, Hash);
+        return STATUS_SUCCESS;
+    }
+
+    if (FileSize > MAXULONG) {
+        return STATUS_FILE_TOO_LARGE;
+    }
+
+    status = ObOpenObjectByPointer(FileObject, OBJ_KERNEL_HANDLE, NULL, GENERIC_READ, *IoFileObjectType, KernelMode, &fileHandle);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    status = ZwCreateSection(&sectionHandle, SECTION_MAP_READ, &attributes, NULL, PAGE_READONLY, SEC_COMMIT, fileHandle);
+    ZwClose(fileHandle);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(sectionHandle, SECTION_MAP_READ, NULL, KernelMode, &section, NULL);
+    ZwClose(sectionHandle);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = MmMapViewInSystemSpace(section, &view, &viewSize);
+    if (NT_SUCCESS(status)) {
+        __try {
+            CyberionPeComputeImageHash((PCUCHAR)view, (SIZE_T)min(FileSize, viewSize), Hash);
+        } __except (EXCEPTION_EXECUTE_HANDLER) {
+            status = GetExceptionCode();
+        }
+
+        MmUnmapViewInSystemSpace(view);
+    }
+
+    ObDereferenceObject(section);
+    return status;
+}
+
+VOID CyberionImageRecordHash(
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    CyberionIdentityCacheInsert(&g_IdentityCache, Identity, Hash);
+    CyberionVerdictImageHashed(Identity, Hash);
+}
+
+VOID CyberionImageQueryStatistics(
+    _Inout_ PCYBERION_VERDICT_STATISTICS Statistics
+)
+{
+    Statistics->IdentityCacheHits = CyberionCountersQuery(&g_IdentityCache.Counters, IdentityCounterHits);
+    Statistics->IdentityCacheMisses = CyberionCountersQuery(&g_IdentityCache.Counters, IdentityCounterMisses);
+    Statistics->IdentityCacheInsertions = CyberionCountersQuery(&g_IdentityCache.Counters, IdentityCounterInsertions);
+    Statistics->IdentityCacheEvictions = CyberionCountersQuery(&g_IdentityCache.Counters, IdentityCounterEvictions);
+}
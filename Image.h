@@ -0,0 +1,79 @@
+/*
+ * IMAGE.H
+ *
+ * Identification of the executable image behind a process creation: its
+ * file identity, hash and verdict, as far as they are known when the
+ * process notify routine runs.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+#include "IdentityCache.h"
+#include "Token.h"
+
+typedef struct _CYBERION_IMAGE_INFO {
+    CYBERION_FILE_IDENTITY Identity;
+    BOOLEAN IdentityValid;      // The file system answered the identity queries
+    BOOLEAN HashValid;          // Hash came from the identity cache
+    CYBERION_VERDICT Verdict;
+    UCHAR Hash[CYBERION_HASH_SIZE];
+} CYBERION_IMAGE_INFO, *PCYBERION_IMAGE_INFO;
+
+//
+// CyberionImageInitialize: Allocates the identity cache. Called once from
+// DriverEntry after the tunables are loaded.
+//
+NTSTATUS CyberionImageInitialize(VOID);
+VOID CyberionImageShutdown(VOID);
+
+//
+// CyberionImageIdentify: Fills Image for a process being created and
+// records the process, with its start key and Token, in the process
+// table. Called from the process notify routine at PASSIVE_LEVEL; never
+// reads the file. Images whose hash is not cached are queued for
+// background hashing.
+//
+VOID CyberionImageIdentify(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ PPS_CREATE_NOTIFY_INFO CreateInfo,
+    _In_ const CYBERION_TOKEN_INFO *Token,
+    _Out_ PCYBERION_IMAGE_INFO Image
+);
+
+//
+// CyberionImageQueryIdentity: Reads the identity of an open file.
+//
+NTSTATUS CyberionImageQueryIdentity(
+    _In_ PFILE_OBJECT FileObject,
+    _Out_ PCYBERION_FILE_IDENTITY Identity
+);
+
+//
+// CyberionImageComputeHash: Computes the image hash of an open file: its
+// Authenticode digest for PE files, otherwise the SHA-256 of its contents.
+// Must be called at PASSIVE_LEVEL; reads the whole file.
+//
+NTSTATUS CyberionImageComputeHash(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ ULONG64 FileSize,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash
+);
+
+//
+// CyberionImageRecordHash: Remembers the hash computed for a file identity
+// so later launches of the unchanged file skip hashing, and applies any
+// decision that was waiting for it.
+//
+VOID CyberionImageRecordHash(
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
+
+//
+// CyberionImageQueryStatistics: Fills in the identity cache counters of
+// Statistics.
+//
+VOID CyberionImageQueryStatistics(_Inout_ PCYBERION_VERDICT_STATISTICS Statistics);
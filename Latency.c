@@ -0,0 +1,140 @@
+/*
+ * LATENCY.C
+ *
+ * Sliding-window latency percentiles.
+ *
+ * Values below 8 have a bucket each. Above that, a value with its top bit
+ * at position e falls in one of eight buckets of width 2^(e-3), picked by
+ * the three bits below the top one.
+ */
+
+#include "Latency.h"
+
+C_ASSERT((CYBERION_LATENCY_SPANS & (CYBERION_LATENCY_SPANS - 1)) == 0);
+
+static ULONG LatencyBucket(
+    _In_ ULONG Latency
+)
+{
+    ULONG top = 0;
+    ULONG bucket;
+
+    if (Latency < 8) {
+        return Latency;
+    }
+
+    while ((Latency >> top) > 1) {
+        top++;
+    }
+
+    bucket = (top - 2) * 8 + ((Latency >> (top - 3)) & 7);
+    return (bucket < CYBERION_LATENCY_BUCKETS) ? bucket : CYBERION_LATENCY_BUCKETS - 1;
+}
+
+//
+// LatencyBucketEnd: Returns the largest value counted in a bucket.
+//
+static ULONG LatencyBucketEnd(
+    _In_ ULONG Bucket
+)
+{
+    ULONG top = Bucket / 8 + 2;
+
+    if (Bucket < 8) {
+        return Bucket;
+    }
+
+    return ((8 + Bucket % 8) << (top - 3)) + (1u << (top - 3)) - 1;
+}
+
+//
+// LatencyAdvance: Empties the spans that ended before Now.
+//
+static VOID LatencyAdvance(
+    _Inout_ PCYBERION_LATENCY_WINDOW Window,
+    _In_ ULONG64 Now
+)
+{
+    ULONG64 elapsed;
+    ULONG i;
+
+    if (Now < Window->SpanStart || Now - Window->SpanStart < Window->SpanLength) {
+        return;
+    }
+
+    elapsed = (Now - Window->SpanStart) / Window->SpanLength;
+    Window->SpanStart += elapsed * Window->SpanLength;
+
+    if (elapsed > CYBERION_LATENCY_SPANS) {
+        elapsed = CYBERION_LATENCY_SPANS;
+    }
+
+    for (i = 0; i < elapsed; i++) {
+        Window->Current = (Window->Current + 1) & (CYBERION_LATENCY_SPANS - 1);
+        Window->Samples -= Window->SpanSamples[Window->Current];
+        Window->SpanSamples[Window->Current] = 0;
+        RtlZeroMemory(Window->Counts[Window->Current], sizeof(Window->Counts[Window->Current]));
+    }
+}
+
+VOID CyberionLatencyInitialize(
+    _Out_ PCYBERION_LATENCY_WINDOW Window,
+    _In_ ULONG64 Length,
+    _In_ ULONG64 Now
+)
+{
+    RtlZeroMemory(Window, sizeof(*Window));
+    Window->SpanLength = max(Length / CYBERION_LATENCY_SPANS, 1);
+    Window->SpanStart = Now;
+}
+
+VOID CyberionLatencyRecord(
+    _Inout_ PCYBERION_LATENCY_WINDOW Window,
+    _In_ ULONG64 Now,
+    _In_ ULONG Latency
+)
+{
+    LatencyAdvance(Window, Now);
+
+    Window->Counts[Window->Current][LatencyBucket(Latency)]++;
+    Window->SpanSamples[Window->Current]++;
+    Window->Samples++;
+}
+
+ULONG CyberionLatencyPercentile(
+    _Inout_ PCYBERION_LATENCY_WINDOW Window,
+    _In_ ULONG64 Now,
+    _In_ ULONG Percent,
+    _Out_ PULONG Samples
+)
+{
+    ULONG64 rank;
+    ULONG64 seen = 0;
+    ULONG bucket;
+    ULONG span;
+
+    LatencyAdvance(Window, Now);
+
+    *Samples = Window->Samples;
+    if (Window->Samples == 0) {
+        return 0;
+    }
+
+    // The sample at this rank (counting from 1) is the percentile
+    rank = ((ULONG64)Window->Samples * min(Percent, 100) + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (bucket = 0; bucket < CYBERION_LATENCY_BUCKETS; bucket++) {
+        for (span = 0; span < CYBERION_LATENCY_SPANS; span++) {
+            seen += Window->Counts[span][bucket];
+        }
+
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    return LatencyBucketEnd(bucket);
+}
@@ -0,0 +1,60 @@
+/*
+ * LATENCY.H
+ *
+ * Sliding-window latency percentiles. Samples are counted in log-linear
+ * buckets, eight to each power of two, so a percentile is known to within
+ * an eighth of its value whatever the spread, and recording one is a
+ * handful of instructions. The window is made of a few spans; the oldest
+ * is emptied and reused as time moves on, so samples older than the
+ * window fall out of it. Callers serialize access.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+
+#define CYBERION_LATENCY_BUCKETS    152     // Covers values below 2^21
+#define CYBERION_LATENCY_SPANS      4       // Spans in a window
+
+typedef struct _CYBERION_LATENCY_WINDOW {
+    ULONG64 SpanLength;                     // In the caller's time unit
+    ULONG64 SpanStart;                      // Time the current span began
+    ULONG Current;                          // Index of the current span
+    ULONG Samples;                          // In all spans
+    ULONG Counts[CYBERION_LATENCY_SPANS][CYBERION_LATENCY_BUCKETS];
+    ULONG SpanSamples[CYBERION_LATENCY_SPANS];
+} CYBERION_LATENCY_WINDOW, *PCYBERION_LATENCY_WINDOW;
+
+//
+// CyberionLatencyInitialize: Empties a window that covers Length units of
+// time from Now.
+//
+VOID CyberionLatencyInitialize(
+    _Out_ PCYBERION_LATENCY_WINDOW Window,
+    _In_ ULONG64 Length,
+    _In_ ULONG64 Now
+);
+
+//
+// CyberionLatencyRecord: Adds a sample taken at Now. Latencies are in any
+// unit; values beyond the last bucket count in it.
+//
+VOID CyberionLatencyRecord(
+    _Inout_ PCYBERION_LATENCY_WINDOW Window,
+    _In_ ULONG64 Now,
+    _In_ ULONG Latency
+);
+
+//
+// CyberionLatencyPercentile: Returns the latency that Percent of the
+// samples in the window up to Now do not exceed, rounded up to the end of
+// its bucket, and the number of samples in *Samples. Returns 0 for an
+// empty window.
+//
+ULONG CyberionLatencyPercentile(
+    _Inout_ PCYBERION_LATENCY_WINDOW Window,
+    _In_ ULONG64 Now,
+    _In_ ULONG Percent,
+    _Out_ PULONG Samples
+);
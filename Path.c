@@ -0,0 +1,332 @@
+/*
+ * PATH.C
+ *
+ * Image paths for the Cyberion driver.
+ *
+ * Image names arrive as \Device\HarddiskVolume3\..., which neither
+ * people nor rules know a volume by. The drive letters are read from the
+ * global \GLOBAL??\A: to Z: links into a table of at most 26 entries,
+ * which is rebuilt when a volume arrives or goes away, or when a name on
+ * an unknown device turns up (at most every PATH_VOLUME_RETRY). The
+ * letter is then put in place of the device name without copying the
+ * rest of the path.
+ *
+ * The service sends the whole rule set at once. It is compiled into
+ * automata (PathRules.c) before anything changes, so a rule set that does
+ * not compile leaves the previous one in force, and is then published by
+ * swapping a pointer under a push lock, as the preloaded verdict list is.
+ * Matching reads each character of the image path once, whatever the
+ * number of rules.
+ */
+
+#include <initguid.h>
+#include <ntddstor.h>
+#include "Path.h"
+#include "PathRules.h"
+
+#define PATH_MAX_DEVICE     96                  // Characters in a volume device name
+#define PATH_VOLUME_RETRY   (5 * 10000000LL)    // 100ns units between rebuilds on a miss
+
+typedef struct _PATH_VOLUME {
+    WCHAR Letter;
+    USHORT DeviceLength;            // Characters
+    WCHAR Device[PATH_MAX_DEVICE];  // \Device\HarddiskVolume3
+} PATH_VOLUME, *PPATH_VOLUME;
+
+typedef struct _PATH_VOLUME_TABLE {
+    ULONG Count;
+    PATH_VOLUME Volumes[26];
+} PATH_VOLUME_TABLE, *PPATH_VOLUME_TABLE;
+
+//
+// Globals
+//
+static EX_PUSH_LOCK g_PathLock;
+static PCYBERION_PATH_RULES g_PathRules; // Compiled rules, protected by g_PathLock
+static PPATH_VOLUME_TABLE g_Volumes; // Drive letters, protected by g_PathLock
+static volatile LONG g_VolumesStale = TRUE; // A volume arrived or went away
+static volatile LONG64 g_VolumesBuilt; // Interrupt time of the last rebuild
+static PVOID g_VolumeNotification; // IoRegisterPlugPlayNotification entry
+
+DRIVER_NOTIFICATION_CALLBACK_ROUTINE PathVolumeChanged;
+
+//
+// PathVolumeChanged: Volume interface arrival or removal. The table is
+// rebuilt by the next creation that needs it.
+//
+NTSTATUS PathVolumeChanged(
+    _In_ PVOID NotificationStructure,
+    _Inout_opt_ PVOID Context
+)
+{
+    UNREFERENCED_PARAMETER(NotificationStructure);
+    UNREFERENCED_PARAMETER(Context);
+
+    InterlockedExchange(&g_VolumesStale, TRUE);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS CyberionPathInitialize(
+    _In_ PDRIVER_OBJECT DriverObject
+)
+{
+    ExInitializePushLock(&g_PathLock);
+
+    return IoRegisterPlugPlayNotification(EventCategoryDeviceInterfaceChange,
+                                          0,
+                                          (PVOID)&GUID_DEVINTERFACE_VOLUME,
+                                          DriverObject,
+                                          PathVolumeChanged,
+                                          NULL,
+                                          &g_VolumeNotification);
+}
+
+VOID CyberionPathShutdown(VOID)
+{
+    if (g_VolumeNotification) {
+        IoUnregisterPlugPlayNotificationEx(g_VolumeNotification);
+        g_VolumeNotification = NULL;
+    }
+
+    if (g_Volumes) {
+        CyberionFree(g_Volumes);
+        g_Volumes = NULL;
+    }
+
+    if (g_PathRules) {
+        CyberionFree(g_PathRules);
+        g_PathRules = NULL;
+    }
+}
+
+//
+// PathBuildVolumes: Reads the device each drive letter links to and
+// publishes the new table.
+//
+static VOID PathBuildVolumes(VOID)
+{
+    WCHAR linkName[] = L"\\GLOBAL??\\A:";
+    PPATH_VOLUME_TABLE table;
+    PPATH_VOLUME_TABLE oldTable;
+    WCHAR letter;
+
+    // Cleared first, so a change seen while reading the links is not lost
+    InterlockedExchange(&g_VolumesStale, FALSE);
+    InterlockedExchange64(&g_VolumesBuilt, (LONG64)KeQueryInterruptTime());
+
+    table = (PPATH_VOLUME_TABLE)CyberionAllocate(sizeof(PATH_VOLUME_TABLE));
+    if (table == NULL) {
+        return;
+    }
+
+    for (letter = L'A'; letter <= L'Z'; letter++) {
+        PPATH_VOLUME volume = &table->Volumes[table->Count];
+        UNICODE_STRING name;
+        UNICODE_STRING target;
+        OBJECT_ATTRIBUTES attributes;
+        HANDLE link;
+        NTSTATUS status;
+
+        linkName[RTL_NUMBER_OF(linkName) - 3] = letter;
+        RtlInitUnicodeString(&name, linkName);
+        InitializeObjectAttributes(&attributes, &name, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+        if (!NT_SUCCESS(ZwOpenSymbolicLinkObject(&link, SYMBOLIC_LINK_QUERY, &attributes))) {
+            continue;
+        }
+
+        target.Buffer = volume->Device;
+        target.Length = 0;
+        target.MaximumLength = sizeof(volume->Device);
+        status = ZwQuerySymbolicLinkObject(link, &target, NULL);
+        ZwClose(link);
+
+        // A device name too long for the table fails the query, and that
+        // volume keeps its name
+        if (NT_SUCCESS(status) && target.Length != 0) {
+            volume->Letter = letter;
+            volume->DeviceLength = target.Length / sizeof(WCHAR);
+            table->Count++;
+        }
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&g_PathLock);
+    oldTable = g_Volumes;
+    g_Volumes = table;
+    ExReleasePushLockExclusive(&g_PathLock);
+    KeLeaveCriticalRegion();
+
+    if (oldTable) {
+        CyberionFree(oldTable);
+    }
+
+    DbgPrint("CyberionDriver: Mapped %lu volumes to drive letters.\n", table->Count);
+}
+
+//
+// PathFindVolume: Returns the drive letter of the volume ImageFileName is
+// on and the length of its device name, or 0.
+//
+static WCHAR PathFindVolume(
+    _In_ PCUNICODE_STRING ImageFileName,
+    _Out_ PUSHORT DeviceLength
+)
+{
+    USHORT length = ImageFileName->Length / sizeof(WCHAR);
+    WCHAR letter = 0;
+    ULONG i;
+
+    *DeviceLength = 0;
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_PathLock);
+
+    for (i = 0; g_Volumes && i < g_Volumes->Count; i++) {
+        const PATH_VOLUME *volume = &g_Volumes->Volumes[i];
+
+        // HarddiskVolume1 must not match HarddiskVolume10
+        if (volume->DeviceLength <= length &&
+            (volume->DeviceLength == length || ImageFileName->Buffer[volume->DeviceLength] == L'\\') &&
+            RtlEqualMemory(volume->Device, ImageFileName->Buffer, volume->DeviceLength * sizeof(WCHAR))) {
+            letter = volume->Letter;
+            *DeviceLength = volume->DeviceLength;
+            break;
+        }
+    }
+
+    ExReleasePushLockShared(&g_PathLock);
+    KeLeaveCriticalRegion();
+
+    return letter;
+}
+
+VOID CyberionPathNormalize(
+    _In_opt_ PCUNICODE_STRING ImageFileName,
+    _Out_ PCYBERION_IMAGE_PATH ImagePath
+)
+{
+    static const WCHAR dosPrefix[] = L"\\??\\";
+    static const WCHAR devicePrefix[] = L"\\Device\\";
+    USHORT deviceLength = 0;
+    WCHAR letter;
+
+    RtlZeroMemory(ImagePath, sizeof(*ImagePath));
+
+    if (ImageFileName == NULL || ImageFileName->Buffer == NULL) {
+        return;
+    }
+
+    ImagePath->Rest = *ImageFileName;
+
+    // \??\C:\... already names its drive
+    if (ImageFileName->Length >= sizeof(dosPrefix) + sizeof(WCHAR) &&
+        RtlEqualMemory(ImageFileName->Buffer, dosPrefix, sizeof(dosPrefix) - sizeof(WCHAR)) &&
+        ImageFileName->Buffer[RTL_NUMBER_OF(dosPrefix)] == L':') {
+        letter = ImageFileName->Buffer[RTL_NUMBER_OF(dosPrefix) - 1];
+        deviceLength = RTL_NUMBER_OF(dosPrefix) + 1;
+    } else {
+        if (g_VolumesStale) {
+            PathBuildVolumes();
+        }
+
+        letter = PathFindVolume(ImageFileName, &deviceLength);
+
+        // A letter assigned since the last rebuild sends no notification
+        if (letter == 0 &&
+            ImageFileName->Length >= sizeof(devicePrefix) &&
+            RtlEqualMemory(ImageFileName->Buffer, devicePrefix, sizeof(devicePrefix) - sizeof(WCHAR)) &&
+            (LONG64)KeQueryInterruptTime() - g_VolumesBuilt > PATH_VOLUME_RETRY) {
+            PathBuildVolumes();
+            letter = PathFindVolume(ImageFileName, &deviceLength);
+        }
+    }
+
+    if (letter != 0) {
+        ImagePath->Volume[0] = RtlUpcaseUnicodeChar(letter);
+        ImagePath->Volume[1] = L':';
+        ImagePath->VolumeLength = 2;
+        ImagePath->Rest.Buffer += deviceLength;
+        ImagePath->Rest.Length -= deviceLength * sizeof(WCHAR);
+        ImagePath->Rest.MaximumLength -= deviceLength * sizeof(WCHAR);
+    }
+}
+
+CYBERION_VERDICT CyberionPathMatch(
+    _In_ const CYBERION_IMAGE_PATH *ImagePath,
+    _Out_ PULONG64 Tags
+)
+{
+    CYBERION_VERDICT verdict = VerdictUnknown;
+
+    *Tags = 0;
+
+    if (ImagePath->Rest.Buffer == NULL) {
+        return VerdictUnknown;
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_PathLock);
+
+    if (g_PathRules) {
+        verdict = CyberionPathRulesMatch(g_PathRules,
+                                         ImagePath->Volume,
+                                         ImagePath->VolumeLength,
+                                         ImagePath->Rest.Buffer,
+                                         ImagePath->Rest.Length / sizeof(WCHAR),
+                                         Tags);
+    }
+
+    ExReleasePushLockShared(&g_PathLock);
+    KeLeaveCriticalRegion();
+
+    return verdict;
+}
+
+NTSTATUS CyberionPathSetRules(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_PATH_RULE_SET ruleSet = (PCYBERION_PATH_RULE_SET)Irp->AssociatedIrp.SystemBuffer;
+    ULONG inputLength = Stack->Parameters.DeviceIoControl.InputBufferLength;
+    PCYBERION_PATH_RULES rules = NULL;
+    PCYBERION_PATH_RULES oldRules;
+    NTSTATUS status;
+
+    if (inputLength < FIELD_OFFSET(CYBERION_PATH_RULE_SET, Rules)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (ruleSet->Count > CYBERION_MAX_PATH_RULES) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (inputLength < FIELD_OFFSET(CYBERION_PATH_RULE_SET, Rules) + (SIZE_T)ruleSet->Count * sizeof(CYBERION_PATH_RULE)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    // No rules removes the rule set
+    if (ruleSet->Count != 0) {
+        status = CyberionPathRulesCompile(ruleSet->Rules, ruleSet->Count, &rules);
+        if (!NT_SUCCESS(status)) {
+            DbgPrint("CyberionDriver: Path rules rejected (0x%08X).\n", status);
+            return status;
+        }
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&g_PathLock);
+    oldRules = g_PathRules;
+    g_PathRules = rules;
+    ExReleasePushLockExclusive(&g_PathLock);
+    KeLeaveCriticalRegion();
+
+    if (oldRules) {
+        CyberionFree(oldRules);
+    }
+
+    DbgPrint("CyberionDriver: Loaded %lu path rules into %lu automata of %lu states.\n",
+             ruleSet->Count, rules ? rules->AutomatonCount : 0, rules ? rules->StateCount : 0);
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,55 @@
+/*
+ * PATH.H
+ *
+ * Image paths: the device name a path arrives with, replaced by the drive
+ * letter mounted on its volume, and the compiled path rules consulted on
+ * every process creation, with the IOCTL_CYBERION_SET_PATH_RULES path that
+ * replaces them.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+
+//
+// An image path as Volume ("C:") followed by Rest. Rest points into the
+// name it was made from, which must outlive it.
+//
+typedef struct _CYBERION_IMAGE_PATH {
+    WCHAR Volume[2];
+    USHORT VolumeLength;        // Characters in Volume: 2, or 0 if no drive letter is known
+    UNICODE_STRING Rest;        // From the '\' after the volume, or the whole name
+} CYBERION_IMAGE_PATH, *PCYBERION_IMAGE_PATH;
+
+//
+// CyberionPathInitialize: Registers for volume arrivals and removals, which
+// invalidate the drive letter table.
+//
+NTSTATUS CyberionPathInitialize(_In_ PDRIVER_OBJECT DriverObject);
+VOID CyberionPathShutdown(VOID);
+
+//
+// CyberionPathNormalize: Splits ImageFileName into its volume's drive
+// letter and the rest, rebuilding the drive letter table first if it is
+// stale. \??\C:\... names are split as they are. Called at PASSIVE_LEVEL.
+//
+VOID CyberionPathNormalize(
+    _In_opt_ PCUNICODE_STRING ImageFileName,
+    _Out_ PCYBERION_IMAGE_PATH ImagePath
+);
+
+//
+// CyberionPathMatch: Returns the strongest verdict of the path rules that
+// match ImagePath (VerdictUnknown if none do) and their tags. Callable at
+// IRQL <= APC_LEVEL.
+//
+CYBERION_VERDICT CyberionPathMatch(
+    _In_ const CYBERION_IMAGE_PATH *ImagePath,
+    _Out_ PULONG64 Tags
+);
+
+//
+// CyberionPathSetRules: Handles IOCTL_CYBERION_SET_PATH_RULES.
+//
+NTSTATUS CyberionPathSetRules(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
@@ -0,0 +1,1152 @@
+/*
+ * PATHRULES.C
+ *
+ * Glob compiler and matcher for image path rules.
+ *
+ * Each pattern is parsed into tokens (a character class, ?, * or **), and
+ * the token strings of all rules are merged into a trie, so rules sharing
+ * a prefix such as **\Program Files\ share its nodes. A node stands for
+ * "the tokens on the way to it have matched"; a set of nodes is a state of
+ * the nondeterministic automaton, and the subset construction turns each
+ * reachable set into one state of the compiled one.
+ *
+ * Rules that end alike share their ends too: once the trie is built, nodes
+ * with the same token, the same accepted rules and the same children are
+ * merged, bottom up, so it becomes a graph. Otherwise "\App1\*.exe" and
+ * "\App2\*.exe" would stay two * nodes, and every set holding one of them
+ * would be distinct from the same set holding the other.
+ *
+ * A pattern that starts with ** can begin a match at any character, so its
+ * ** node belongs to every reachable set. Such nodes are left out of the
+ * stored sets, and the nodes they lead to are added back for each
+ * character class. Without that, every set would carry them, and every
+ * step of the construction would visit them again.
+ *
+ * A ** that ends a pattern matches whatever follows, so once reached it
+ * only adds its rules' tags and verdict to every later state. Such nodes
+ * are not stored in the sets either; a state carries what they accepted
+ * instead, so "under \Temp\ of user A" and "of user B" stay one state.
+ *
+ * Some rule sets still have no small automaton: a * inside a component
+ * multiplies with every rule that could be matching the same characters,
+ * and subtree rules with many different tags can nest in any combination,
+ * each of which is a state. Such rule sets are split across automata, and
+ * compiling fails with STATUS_QUOTA_EXCEEDED once those run out.
+ */
+
+#include "PathRules.h"
+
+typedef enum _PATH_TOKEN {
+    PathTokenRoot,          // The empty prefix
+    PathTokenChar,          // One character of class Class
+    PathTokenOne,           // ?
+    PathTokenStar,          // *
+    PathTokenGlobstar       // **
+} PATH_TOKEN;
+
+#define PATH_CLASS_OTHER        0       // Characters no pattern names
+#define PATH_CLASS_SEPARATOR    1       // '\'
+#define PATH_MAX_TRANSITIONS    (1u << 21)  // States * classes in one automaton
+#define PATH_TOKENS_PER_RULE    MAX_PATH_SIZE // Every character, and a trailing **
+
+//
+// One trie node: the token leading to it from its parent, and the rules
+// whose patterns end there. The sibling links build the trie; once nodes
+// are merged, a node may have several parents and its children are listed
+// in PATH_BUILD.Edges instead.
+//
+typedef struct _PATH_NODE {
+    UCHAR Kind;                 // PATH_TOKEN
+    UCHAR Verdict;              // Strongest verdict of the rules ending here
+    BOOLEAN Persistent;         // In every reachable set
+    UCHAR Reserved;
+    ULONG Class;                // PathTokenChar
+    ULONG FirstChild;           // 0 if none; the root is never a child
+    ULONG NextSibling;
+    ULONG Edges;                // Children, in PATH_BUILD.Edges
+    ULONG EdgeCount;
+    ULONG64 Tags;               // Tags of the rules ending here
+} PATH_NODE, *PPATH_NODE;
+
+typedef struct _PATH_STATE {
+    ULONG SetStart;             // Nodes, in PATH_BUILD.Sets
+    ULONG SetLength;
+    ULONG Hash;
+    UCHAR Verdict;
+    UCHAR StickyVerdict;        // Accepted by a final ** on the way here
+    ULONG64 StickyTags;
+    ULONG64 Tags;
+} PATH_STATE, *PPATH_STATE;
+
+//
+// An automaton built for the rules First to First + Count - 1.
+//
+typedef struct _PATH_PIECE {
+    ULONG First;
+    ULONG Count;
+    ULONG StateCount;
+    USHORT Start;
+    USHORT Dead;
+    PUSHORT Next;
+    PULONG64 Tags;
+    PUCHAR Verdicts;
+} PATH_PIECE, *PPATH_PIECE;
+
+typedef struct _PATH_BUILD {
+    const CYBERION_PATH_RULE *Rules;
+    CYBERION_PATH_RULES Shape;      // Classes; Wide and WideClasses point into scratch
+
+    // Everything below is for the automaton being built
+    PPATH_NODE Nodes;
+    ULONG NodeCount;
+    PULONG Edges;
+
+    // Marks nodes already in the set being built
+    PULONG Stamp;
+    ULONG Generation;
+    PULONG Successors;              // The set being built
+    ULONG SuccessorCount;
+    UCHAR StickyVerdict;            // And what its final ** nodes accept
+    ULONG64 StickyTags;
+
+    // Nodes reached from the persistent ones, by class
+    PULONG PersistentNext;
+    PULONG PersistentNextStart;     // ClassCount + 1 offsets
+    ULONG PersistentNextCapacity;
+    BOOLEAN HasPersistent;
+    UCHAR PersistentVerdict;
+    ULONG64 PersistentTags;
+
+    // Nodes the current state leads to, grouped by the classes they accept
+    PULONG Grouped;
+    PULONG GroupStart;              // ClassCount + 1 offsets
+    PULONG Wild;                    // ? children and * nodes, then ** nodes
+
+    // Deterministic states
+    PPATH_STATE States;
+    ULONG StateCount;
+    ULONG StateCapacity;
+    PULONG Sets;
+    ULONG SetsUsed;
+    ULONG SetsCapacity;
+    PUSHORT Next;
+    ULONG NextCapacity;
+    PULONG Table;                   // State index + 1, open addressed by set hash
+    ULONG TableMask;
+    ULONG Start;
+} PATH_BUILD, *PPATH_BUILD;
+
+FORCEINLINE ULONG PathMix(_In_ ULONG Value)
+{
+    Value ^= Value >> 16;
+    Value *= 0x7FEB352Du;
+    Value ^= Value >> 15;
+    Value *= 0x846CA68Bu;
+    Value ^= Value >> 16;
+    return Value;
+}
+
+//
+// PathClassOf: Character class of C. ASCII is case folded by the table
+// itself; anything else is upcased and looked up among the wide characters
+// the patterns name.
+//
+FORCEINLINE ULONG PathClassOf(_In_ const CYBERION_PATH_RULES *Rules, _In_ WCHAR C)
+{
+    ULONG low = 0;
+    ULONG high = Rules->WideCount;
+
+    if (C < 128) {
+        return Rules->AsciiClasses[C];
+    }
+
+    C = RtlUpcaseUnicodeChar(C);
+    if (C < 128) {
+        return Rules->AsciiClasses[C];
+    }
+
+    while (low < high) {
+        ULONG middle = (low + high) / 2;
+
+        if (Rules->Wide[middle] < C) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return (low < Rules->WideCount && Rules->Wide[low] == C) ? Rules->WideClasses[low] : PATH_CLASS_OTHER;
+}
+
+//
+// PathReserve: Grows *Array, of *Capacity elements, to hold at least Needed.
+//
+static BOOLEAN PathReserve(
+    _Inout_ PVOID *Array,
+    _Inout_ PULONG Capacity,
+    _In_ ULONG Needed,
+    _In_ SIZE_T ElementSize
+)
+{
+    ULONG capacity = max(*Capacity, 64);
+    PVOID array;
+
+    if (Needed <= *Capacity) {
+        return TRUE;
+    }
+
+    while (capacity < Needed) {
+        capacity *= 2;
+    }
+
+    array = CyberionAllocate((SIZE_T)capacity * ElementSize);
+    if (array == NULL) {
+        return FALSE;
+    }
+
+    if (*Array) {
+        RtlCopyMemory(array, *Array, (SIZE_T)*Capacity * ElementSize);
+        CyberionFree(*Array);
+    }
+
+    *Array = array;
+    *Capacity = capacity;
+    return TRUE;
+}
+
+//
+// PathPatternLength: Characters in a rule's pattern, or 0 if the rule is
+// invalid.
+//
+static ULONG PathPatternLength(
+    _In_ const CYBERION_PATH_RULE *Rule
+)
+{
+    ULONG length = 0;
+
+    while (length < MAX_PATH_SIZE && Rule->Pattern[length] != L'\0') {
+        length++;
+    }
+
+    if (length == MAX_PATH_SIZE || (ULONG)Rule->Verdict > VerdictBlock) {
+        return 0;
+    }
+
+    return length;
+}
+
+//
+// PathNextToken: Reads the token at *Index in Pattern and moves past it.
+// Character tokens return the upcased character in *Char. Any run of two
+// or more stars is one **, so a star is never followed by another.
+//
+static PATH_TOKEN PathNextToken(
+    _In_reads_(Length) PCWCH Pattern,
+    _In_ ULONG Length,
+    _Inout_ PULONG Index,
+    _Out_ PWCHAR Char
+)
+{
+    WCHAR c = Pattern[(*Index)++];
+
+    *Char = 0;
+
+    if (c == L'?') {
+        return PathTokenOne;
+    }
+
+    if (c != L'*') {
+        *Char = RtlUpcaseUnicodeChar(c);
+        return PathTokenChar;
+    }
+
+    if (*Index == Length || Pattern[*Index] != L'*') {
+        return PathTokenStar;
+    }
+
+    while (*Index < Length && Pattern[*Index] == L'*') {
+        (*Index)++;
+    }
+    return PathTokenGlobstar;
+}
+
+//
+// PathAssignClasses: Gives every character the patterns name a class of
+// its own.
+//
+static NTSTATUS PathAssignClasses(
+    _Inout_ PPATH_BUILD Build,
+    _In_ ULONG Count
+)
+{
+    PCYBERION_PATH_RULES shape = &Build->Shape;
+    PULONG used;
+    PWCHAR wide;
+    PUSHORT wideClasses;
+    ULONG wideCount = 0;
+    ULONG classes = PATH_CLASS_SEPARATOR + 1;
+    ULONG c;
+    ULONG i;
+
+    used = (PULONG)CyberionAllocate(65536 / 8);
+    if (used == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < Count; i++) {
+        const CYBERION_PATH_RULE *rule = &Build->Rules[i];
+        ULONG length = PathPatternLength(rule);
+        ULONG index = 0;
+        WCHAR ch;
+
+        if (length == 0) {
+            CyberionFree(used);
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        while (index < length) {
+            if (PathNextToken(rule->Pattern, length, &index, &ch) == PathTokenChar) {
+                used[ch / 32] |= 1u << (ch % 32);
+            }
+        }
+    }
+
+    for (c = 128; c < 65536; c++) {
+        if (used[c / 32] & (1u << (c % 32))) {
+            wideCount++;
+        }
+    }
+
+    wide = (PWCHAR)CyberionAllocate(((SIZE_T)wideCount + 1) * (sizeof(WCHAR) + sizeof(USHORT)));
+    if (wide == NULL) {
+        CyberionFree(used);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    wideClasses = (PUSHORT)(wide + wideCount + 1);
+
+    shape->Wide = wide;
+    shape->WideClasses = wideClasses;
+    shape->WideCount = 0;
+    RtlZeroMemory(shape->AsciiClasses, sizeof(shape->AsciiClasses));
+
+    for (c = 0; c < 65536; c++) {
+        if (c == L'\\' || !(used[c / 32] & (1u << (c % 32)))) {
+            continue;
+        }
+
+        if (c < 128) {
+            shape->AsciiClasses[c] = (USHORT)classes;
+        } else {
+            wide[shape->WideCount] = (WCHAR)c;
+            wideClasses[shape->WideCount] = (USHORT)classes;
+            shape->WideCount++;
+        }
+        classes++;
+    }
+
+    shape->AsciiClasses[L'\\'] = PATH_CLASS_SEPARATOR;
+
+    // Lower case ASCII shares the class of its upper case
+    for (c = 0; c < 128; c++) {
+        WCHAR upper = RtlUpcaseUnicodeChar((WCHAR)c);
+
+        if (upper != c && upper < 128) {
+            shape->AsciiClasses[c] = shape->AsciiClasses[upper];
+        }
+    }
+
+    shape->ClassCount = classes;
+    CyberionFree(used);
+    return STATUS_SUCCESS;
+}
+
+//
+// PathInsert: Adds the tokens of a rule to the trie.
+//
+static VOID PathInsert(
+    _Inout_ PPATH_BUILD Build,
+    _In_ const CYBERION_PATH_RULE *Rule
+)
+{
+    ULONG length = PathPatternLength(Rule);
+    ULONG index = 0;
+    ULONG node = 0;
+    BOOLEAN subtree = (Rule->Pattern[length - 1] == L'\\');
+
+    while (index < length || subtree) {
+        PPATH_NODE parent = &Build->Nodes[node];
+        PATH_TOKEN kind;
+        ULONG charClass = 0;
+        WCHAR c;
+
+        if (index < length) {
+            kind = PathNextToken(Rule->Pattern, length, &index, &c);
+            if (kind == PathTokenChar) {
+                charClass = PathClassOf(&Build->Shape, c);
+            }
+        } else {
+            // A trailing separator takes in the whole subtree
+            kind = PathTokenGlobstar;
+            subtree = FALSE;
+        }
+
+        for (node = parent->FirstChild; node != 0; node = Build->Nodes[node].NextSibling) {
+            if (Build->Nodes[node].Kind == kind && Build->Nodes[node].Class == charClass) {
+                break;
+            }
+        }
+
+        if (node == 0) {
+            PPATH_NODE child = &Build->Nodes[Build->NodeCount];
+
+            child->Kind = (UCHAR)kind;
+            child->Class = charClass;
+            child->NextSibling = parent->FirstChild;
+            parent->FirstChild = Build->NodeCount;
+            node = Build->NodeCount++;
+        }
+    }
+
+    Build->Nodes[node].Tags |= Rule->Tags;
+    Build->Nodes[node].Verdict = (UCHAR)max(Build->Nodes[node].Verdict, (UCHAR)Rule->Verdict);
+}
+
+//
+// PathSameNode: Whether two nodes match the same token and accept the same
+// rules, and lead on to the same (already merged) children.
+//
+static BOOLEAN PathSameNode(
+    _In_ const PATH_BUILD *Build,
+    _In_ const PATH_NODE *Left,
+    _In_ const PATH_NODE *Right
+)
+{
+    return Left->Kind == Right->Kind && Left->Class == Right->Class &&
+           Left->Tags == Right->Tags && Left->Verdict == Right->Verdict &&
+           Left->EdgeCount == Right->EdgeCount &&
+           RtlEqualMemory(Build->Edges + Left->Edges, Build->Edges + Right->Edges,
+                          (SIZE_T)Left->EdgeCount * sizeof(ULONG));
+}
+
+//
+// PathMerge: Merges nodes that match alike from there on, and lists the
+// children of those that remain in Edges. Children are created after their
+// parents, so going backwards meets every child first.
+//
+static NTSTATUS PathMerge(
+    _Inout_ PPATH_BUILD Build
+)
+{
+    PULONG canonical;
+    PULONG table;
+    ULONG mask = 1023;
+    ULONG edgeCount = 0;
+    ULONG n;
+
+    while (mask < Build->NodeCount * 2) {
+        mask = mask * 2 + 1;
+    }
+
+    canonical = (PULONG)CyberionAllocate(((SIZE_T)Build->NodeCount + mask + 1) * sizeof(ULONG));
+    if (canonical == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    table = canonical + Build->NodeCount;
+
+    for (n = Build->NodeCount; n-- > 0;) {
+        PPATH_NODE node = &Build->Nodes[n];
+        ULONG hash;
+        ULONG slot;
+        ULONG child;
+        ULONG i;
+
+        node->Edges = edgeCount;
+        for (child = node->FirstChild; child != 0; child = Build->Nodes[child].NextSibling) {
+            ULONG value = canonical[child];
+
+            // Sorted, so equal child sets compare equal
+            for (i = edgeCount; i > node->Edges && Build->Edges[i - 1] > value; i--) {
+                Build->Edges[i] = Build->Edges[i - 1];
+            }
+            Build->Edges[i] = value;
+            edgeCount++;
+        }
+        node->EdgeCount = edgeCount - node->Edges;
+
+        hash = PathMix(node->Kind | node->Class << 8) ^ PathMix((ULONG)node->Tags ^ node->Verdict) ^
+               PathMix((ULONG)(node->Tags >> 32));
+        for (i = node->Edges; i < edgeCount; i++) {
+            hash = PathMix(hash + Build->Edges[i]);
+        }
+
+        for (slot = hash & mask; table[slot] != 0; slot = (slot + 1) & mask) {
+            if (PathSameNode(Build, &Build->Nodes[table[slot] - 1], node)) {
+                break;
+            }
+        }
+
+        if (table[slot] != 0) {
+            canonical[n] = table[slot] - 1;
+            edgeCount = node->Edges;
+            node->EdgeCount = 0;
+        } else {
+            canonical[n] = n;
+            table[slot] = n + 1;
+        }
+    }
+
+    CyberionFree(canonical);
+    return STATUS_SUCCESS;
+}
+
+FORCEINLINE BOOLEAN PathIsStar(_In_ const PATH_NODE *Node)
+{
+    return Node->Kind == PathTokenStar || Node->Kind == PathTokenGlobstar;
+}
+
+//
+// PathAddOne: Adds one node to the set being built. Persistent nodes are
+// implied by every set, and a final ** only contributes what it accepts.
+//
+FORCEINLINE VOID PathAddOne(_Inout_ PPATH_BUILD Build, _In_ ULONG Node)
+{
+    const PATH_NODE *node = &Build->Nodes[Node];
+
+    if (node->Persistent || Build->Stamp[Node] == Build->Generation) {
+        return;
+    }
+
+    Build->Stamp[Node] = Build->Generation;
+
+    if (node->Kind == PathTokenGlobstar && node->EdgeCount == 0) {
+        Build->StickyTags |= node->Tags;
+        Build->StickyVerdict = (UCHAR)max(Build->StickyVerdict, node->Verdict);
+    } else {
+        Build->Successors[Build->SuccessorCount++] = Node;
+    }
+}
+
+//
+// PathAdd: Adds Node and the * and ** children it can skip to. Stars never
+// follow each other, so one level is enough.
+//
+FORCEINLINE VOID PathAdd(_Inout_ PPATH_BUILD Build, _In_ ULONG Node)
+{
+    const PATH_NODE *node = &Build->Nodes[Node];
+    ULONG e;
+
+    if (Build->Stamp[Node] == Build->Generation) {
+        return;
+    }
+
+    PathAddOne(Build, Node);
+
+    for (e = node->Edges; e < node->Edges + node->EdgeCount; e++) {
+        if (PathIsStar(&Build->Nodes[Build->Edges[e]])) {
+            PathAddOne(Build, Build->Edges[e]);
+        }
+    }
+}
+
+//
+// PathBeginSet: Starts a new set, carrying over what the final ** nodes of
+// the previous state accepted.
+//
+FORCEINLINE VOID PathBeginSet(
+    _Inout_ PPATH_BUILD Build,
+    _In_ UCHAR StickyVerdict,
+    _In_ ULONG64 StickyTags
+)
+{
+    Build->Generation++;
+    Build->SuccessorCount = 0;
+    Build->StickyVerdict = StickyVerdict;
+    Build->StickyTags = StickyTags;
+}
+
+//
+// PathStep: Adds the nodes Node leads to on a character of Class.
+//
+static VOID PathStep(_Inout_ PPATH_BUILD Build, _In_ ULONG Node, _In_ ULONG Class)
+{
+    const PATH_NODE *node = &Build->Nodes[Node];
+    ULONG e;
+
+    if (node->Kind == PathTokenGlobstar || (node->Kind == PathTokenStar && Class != PATH_CLASS_SEPARATOR)) {
+        PathAdd(Build, Node);
+    }
+
+    for (e = node->Edges; e < node->Edges + node->EdgeCount; e++) {
+        const PATH_NODE *next = &Build->Nodes[Build->Edges[e]];
+
+        if ((next->Kind == PathTokenChar && next->Class == Class) ||
+            (next->Kind == PathTokenOne && Class != PATH_CLASS_SEPARATOR)) {
+            PathAdd(Build, Build->Edges[e]);
+        }
+    }
+}
+
+//
+// PathFindPersistent: Marks the ** nodes at the root, which every reachable
+// set contains, and records what they accept and which nodes they lead to
+// for each class.
+//
+static NTSTATUS PathFindPersistent(
+    _Inout_ PPATH_BUILD Build
+)
+{
+    const PATH_NODE *root = &Build->Nodes[0];
+    ULONG classCount = Build->Shape.ClassCount;
+    ULONG node;
+    ULONG e;
+    ULONG k;
+
+    for (e = root->Edges; e < root->Edges + root->EdgeCount; e++) {
+        node = Build->Edges[e];
+        if (Build->Nodes[node].Kind == PathTokenGlobstar) {
+            Build->Nodes[node].Persistent = TRUE;
+            Build->HasPersistent = TRUE;
+            Build->PersistentTags |= Build->Nodes[node].Tags;
+            Build->PersistentVerdict = (UCHAR)max(Build->PersistentVerdict, Build->Nodes[node].Verdict);
+        }
+    }
+
+    Build->PersistentNextStart = (PULONG)CyberionAllocate(((SIZE_T)classCount + 1) * sizeof(ULONG));
+    if (Build->PersistentNextStart == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (k = 0; k < classCount; k++) {
+        PathBeginSet(Build, 0, 0);
+
+        for (e = root->Edges; e < root->Edges + root->EdgeCount; e++) {
+            if (Build->Nodes[Build->Edges[e]].Persistent) {
+                PathStep(Build, Build->Edges[e], k);
+            }
+        }
+
+        if (!PathReserve((PVOID *)&Build->PersistentNext, &Build->PersistentNextCapacity,
+                         Build->PersistentNextStart[k] + Build->SuccessorCount, sizeof(ULONG))) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlCopyMemory(Build->PersistentNext + Build->PersistentNextStart[k], Build->Successors,
+                      (SIZE_T)Build->SuccessorCount * sizeof(ULONG));
+        Build->PersistentNextStart[k + 1] = Build->PersistentNextStart[k] + Build->SuccessorCount;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// PathIntern: Returns the state for the set just built, creating it if it
+// is new. Sets are unordered; two are equal if they have the same length
+// and every node of the stored one is marked in the new one.
+//
+static NTSTATUS PathIntern(
+    _Inout_ PPATH_BUILD Build,
+    _Out_ PULONG State
+)
+{
+    ULONG hash = PathMix((ULONG)Build->StickyTags ^ (ULONG)(Build->StickyTags >> 32) ^ Build->StickyVerdict) +
+                 Build->SuccessorCount * 0x9E3779B9u;
+    PPATH_STATE state;
+    ULONG slot;
+    ULONG i;
+
+    for (i = 0; i < Build->SuccessorCount; i++) {
+        hash += PathMix(Build->Successors[i]);
+    }
+
+    for (slot = hash & Build->TableMask; Build->Table[slot] != 0; slot = (slot + 1) & Build->TableMask) {
+        state = &Build->States[Build->Table[slot] - 1];
+
+        if (state->Hash == hash && state->SetLength == Build->SuccessorCount &&
+            state->StickyTags == Build->StickyTags && state->StickyVerdict == Build->StickyVerdict) {
+            for (i = 0; i < state->SetLength; i++) {
+                if (Build->Stamp[Build->Sets[state->SetStart + i]] != Build->Generation) {
+                    break;
+                }
+            }
+
+            if (i == state->SetLength) {
+                *State = Build->Table[slot] - 1;
+                return STATUS_SUCCESS;
+            }
+        }
+    }
+
+    if (Build->StateCount == CYBERION_PATH_MAX_STATES ||
+        ((ULONG64)Build->StateCount + 1) * Build->Shape.ClassCount > PATH_MAX_TRANSITIONS) {
+        return STATUS_QUOTA_EXCEEDED;
+    }
+
+    if (!PathReserve((PVOID *)&Build->States, &Build->StateCapacity, Build->StateCount + 1, sizeof(PATH_STATE)) ||
+        !PathReserve((PVOID *)&Build->Sets, &Build->SetsCapacity, Build->SetsUsed + Build->SuccessorCount, sizeof(ULONG))) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    state = &Build->States[Build->StateCount];
+    state->SetStart = Build->SetsUsed;
+    state->SetLength = Build->SuccessorCount;
+    state->Hash = hash;
+    state->StickyVerdict = Build->StickyVerdict;
+    state->StickyTags = Build->StickyTags;
+    state->Verdict = (UCHAR)max(Build->PersistentVerdict, Build->StickyVerdict);
+    state->Tags = Build->PersistentTags | Build->StickyTags;
+
+    for (i = 0; i < Build->SuccessorCount; i++) {
+        const PATH_NODE *node = &Build->Nodes[Build->Successors[i]];
+
+        state->Tags |= node->Tags;
+        state->Verdict = (UCHAR)max(state->Verdict, node->Verdict);
+    }
+
+    RtlCopyMemory(Build->Sets + Build->SetsUsed, Build->Successors, (SIZE_T)Build->SuccessorCount * sizeof(ULONG));
+    Build->SetsUsed += Build->SuccessorCount;
+    Build->Table[slot] = ++Build->StateCount;
+    *State = Build->StateCount - 1;
+
+    // Keep the table at most half full
+    if (Build->StateCount * 2 > Build->TableMask) {
+        ULONG mask = Build->TableMask * 2 + 1;
+        PULONG table = (PULONG)CyberionAllocate(((SIZE_T)mask + 1) * sizeof(ULONG));
+
+        if (table == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        for (i = 0; i < Build->StateCount; i++) {
+            for (slot = Build->States[i].Hash & mask; table[slot] != 0; slot = (slot + 1) & mask) {
+            }
+            table[slot] = i + 1;
+        }
+
+        CyberionFree(Build->Table);
+        Build->Table = table;
+        Build->TableMask = mask;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// PathExpand: Computes every transition of State.
+//
+static NTSTATUS PathExpand(
+    _Inout_ PPATH_BUILD Build,
+    _In_ ULONG State
+)
+{
+    ULONG classCount = Build->Shape.ClassCount;
+    ULONG setStart = Build->States[State].SetStart;
+    ULONG setLength = Build->States[State].SetLength;
+    ULONG wildCount = 0;
+    ULONG anyCount = 0;
+    ULONG next;
+    NTSTATUS status;
+    ULONG child;
+    ULONG e;
+    ULONG k;
+    ULONG i;
+
+    if (!PathReserve((PVOID *)&Build->Next, &Build->NextCapacity, (State + 1) * classCount, sizeof(USHORT))) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // Group the character children by class (counting sort). ? children
+    // and * nodes go to the front of Wild, ** nodes to the back.
+    RtlZeroMemory(Build->GroupStart, ((SIZE_T)classCount + 1) * sizeof(ULONG));
+
+    for (i = 0; i < setLength; i++) {
+        const PATH_NODE *node = &Build->Nodes[Build->Sets[setStart + i]];
+
+        if (node->Kind == PathTokenStar) {
+            Build->Wild[wildCount++] = Build->Sets[setStart + i];
+        } else if (node->Kind == PathTokenGlobstar) {
+            Build->Wild[Build->NodeCount - ++anyCount] = Build->Sets[setStart + i];
+        }
+
+        for (e = node->Edges; e < node->Edges + node->EdgeCount; e++) {
+            child = Build->Edges[e];
+            if (Build->Nodes[child].Kind == PathTokenChar) {
+                Build->GroupStart[Build->Nodes[child].Class + 1]++;
+            } else if (Build->Nodes[child].Kind == PathTokenOne) {
+                Build->Wild[wildCount++] = child;
+            }
+        }
+    }
+
+    for (k = 0; k < classCount; k++) {
+        Build->GroupStart[k + 1] += Build->GroupStart[k];
+    }
+
+    for (i = 0; i < setLength; i++) {
+        const PATH_NODE *node = &Build->Nodes[Build->Sets[setStart + i]];
+
+        for (e = node->Edges; e < node->Edges + node->EdgeCount; e++) {
+            child = Build->Edges[e];
+            if (Build->Nodes[child].Kind == PathTokenChar) {
+                Build->Grouped[Build->GroupStart[Build->Nodes[child].Class]++] = child;
+            }
+        }
+    }
+
+    // Filling moved each start to the next class's; shift them back
+    for (k = classCount; k > 0; k--) {
+        Build->GroupStart[k] = Build->GroupStart[k - 1];
+    }
+    Build->GroupStart[0] = 0;
+
+    for (k = 0; k < classCount; k++) {
+        PathBeginSet(Build, Build->States[State].StickyVerdict, Build->States[State].StickyTags);
+
+        for (i = Build->PersistentNextStart[k]; i < Build->PersistentNextStart[k + 1]; i++) {
+            PathAdd(Build, Build->PersistentNext[i]);
+        }
+
+        for (i = Build->GroupStart[k]; i < Build->GroupStart[k + 1]; i++) {
+            PathAdd(Build, Build->Grouped[i]);
+        }
+
+        if (k != PATH_CLASS_SEPARATOR) {
+            for (i = 0; i < wildCount; i++) {
+                PathAdd(Build, Build->Wild[i]);
+            }
+        }
+
+        for (i = 0; i < anyCount; i++) {
+            PathAdd(Build, Build->Wild[Build->NodeCount - 1 - i]);
+        }
+
+        status = PathIntern(Build, &next);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        Build->Next[(SIZE_T)State * classCount + k] = (USHORT)next;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// PathConstruct: Builds the trie of Count rules from First and runs the
+// subset construction from its root. State 0 is the empty set.
+//
+static NTSTATUS PathConstruct(
+    _Inout_ PPATH_BUILD Build,
+    _In_ ULONG First,
+    _In_ ULONG Count
+)
+{
+    ULONG nodes = Count * PATH_TOKENS_PER_RULE + 1;
+    ULONG state;
+    ULONG i;
+    NTSTATUS status;
+
+    // Nodes, then stamps, the set being built, grouped and wild nodes, edges
+    Build->Nodes = (PPATH_NODE)CyberionAllocate((SIZE_T)nodes * (sizeof(PATH_NODE) + 5 * sizeof(ULONG)));
+    Build->GroupStart = (PULONG)CyberionAllocate(((SIZE_T)Build->Shape.ClassCount + 1) * sizeof(ULONG));
+    Build->Table = (PULONG)CyberionAllocate(1024 * sizeof(ULONG));
+    Build->TableMask = 1023;
+
+    if (Build->Nodes == NULL || Build->GroupStart == NULL || Build->Table == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Build->Stamp = (PULONG)(Build->Nodes + nodes);
+    Build->Successors = Build->Stamp + nodes;
+    Build->Grouped = Build->Successors + nodes;
+    Build->Wild = Build->Grouped + nodes;
+    Build->Edges = Build->Wild + nodes;
+
+    Build->Nodes[0].Kind = PathTokenRoot;
+    Build->NodeCount = 1;
+
+    for (i = First; i < First + Count; i++) {
+        PathInsert(Build, &Build->Rules[i]);
+    }
+
+    status = PathMerge(Build);
+
+    if (NT_SUCCESS(status)) {
+        status = PathFindPersistent(Build);
+    }
+
+    if (NT_SUCCESS(status)) {
+        PathBeginSet(Build, 0, 0);
+        status = PathIntern(Build, &state);
+    }
+
+    if (NT_SUCCESS(status)) {
+        PathBeginSet(Build, 0, 0);
+        PathAdd(Build, 0);
+        status = PathIntern(Build, &Build->Start);
+    }
+
+    // States are appended as they are found; expanding in order reaches all
+    for (state = 0; state < Build->StateCount && NT_SUCCESS(status); state++) {
+        status = PathExpand(Build, state);
+    }
+
+    return status;
+}
+
+//
+// PathKeep: Moves the automaton just built into Piece.
+//
+static NTSTATUS PathKeep(
+    _Inout_ PPATH_BUILD Build,
+    _Inout_ PPATH_PIECE Piece
+)
+{
+    ULONG i;
+
+    Piece->Tags = (PULONG64)CyberionAllocate((SIZE_T)Build->StateCount * (sizeof(ULONG64) + sizeof(UCHAR)));
+    if (Piece->Tags == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Piece->Verdicts = (PUCHAR)(Piece->Tags + Build->StateCount);
+    for (i = 0; i < Build->StateCount; i++) {
+        Piece->Tags[i] = Build->States[i].Tags;
+        Piece->Verdicts[i] = Build->States[i].Verdict;
+    }
+
+    Piece->StateCount = Build->StateCount;
+    Piece->Start = (USHORT)Build->Start;
+
+    // A match can only fail for good if no rule starts with **
+    Piece->Dead = Build->HasPersistent ? CYBERION_PATH_NO_STATE : 0;
+
+    Piece->Next = Build->Next;
+    Build->Next = NULL;
+    return STATUS_SUCCESS;
+}
+
+//
+// PathReset: Frees everything built for one automaton.
+//
+static VOID PathReset(
+    _Inout_ PPATH_BUILD Build
+)
+{
+    PVOID arrays[] = {
+        Build->Nodes, Build->PersistentNext, Build->PersistentNextStart, Build->GroupStart,
+        Build->States, Build->Sets, Build->Next, Build->Table,
+    };
+    ULONG i;
+
+    for (i = 0; i < RTL_NUMBER_OF(arrays); i++) {
+        if (arrays[i]) {
+            CyberionFree(arrays[i]);
+        }
+    }
+
+    RtlZeroMemory(&Build->Nodes, sizeof(*Build) - FIELD_OFFSET(PATH_BUILD, Nodes));
+}
+
+//
+// PathPack: Copies the classes and automata into one allocation.
+//
+static PCYBERION_PATH_RULES PathPack(
+    _In_ const PATH_BUILD *Build,
+    _In_reads_(PieceCount) const PATH_PIECE *Pieces,
+    _In_ ULONG PieceCount
+)
+{
+    PCYBERION_PATH_RULES rules;
+    SIZE_T wideCount = Build->Shape.WideCount;
+    SIZE_T states = 0;
+    SIZE_T transitions;
+    PUCHAR cursor;
+    ULONG i;
+
+    for (i = 0; i < PieceCount; i++) {
+        states += Pieces[i].StateCount;
+    }
+    transitions = states * Build->Shape.ClassCount;
+
+    rules = (PCYBERION_PATH_RULES)CyberionAllocate(sizeof(CYBERION_PATH_RULES) +
+                                                   states * (sizeof(ULONG64) + sizeof(UCHAR)) +
+                                                   transitions * sizeof(USHORT) +
+                                                   wideCount * (sizeof(WCHAR) + sizeof(USHORT)));
+    if (rules == NULL) {
+        return NULL;
+    }
+
+    RtlCopyMemory(rules, &Build->Shape, sizeof(*rules));
+    rules->AutomatonCount = PieceCount;
+    rules->StateCount = (ULONG)states;
+
+    // Widest elements first, so each array is aligned
+    cursor = (PUCHAR)(rules + 1);
+    for (i = 0; i < PieceCount; i++) {
+        rules->Automata[i].Tags = (const ULONG64 *)cursor;
+        RtlCopyMemory(cursor, Pieces[i].Tags, (SIZE_T)Pieces[i].StateCount * sizeof(ULONG64));
+        cursor += (SIZE_T)Pieces[i].StateCount * sizeof(ULONG64);
+    }
+
+    for (i = 0; i < PieceCount; i++) {
+        SIZE_T size = (SIZE_T)Pieces[i].StateCount * Build->Shape.ClassCount * sizeof(USHORT);
+
+        rules->Automata[i].Next = (const USHORT *)cursor;
+        RtlCopyMemory(cursor, Pieces[i].Next, size);
+        cursor += size;
+    }
+
+    rules->Wide = (const WCHAR *)cursor;
+    RtlCopyMemory(cursor, Build->Shape.Wide, wideCount * sizeof(WCHAR));
+    cursor += wideCount * sizeof(WCHAR);
+
+    rules->WideClasses = (const USHORT *)cursor;
+    RtlCopyMemory(cursor, Build->Shape.WideClasses, wideCount * sizeof(USHORT));
+    cursor += wideCount * sizeof(USHORT);
+
+    for (i = 0; i < PieceCount; i++) {
+        rules->Automata[i].Verdicts = cursor;
+        RtlCopyMemory(cursor, Pieces[i].Verdicts, Pieces[i].StateCount);
+        cursor += Pieces[i].StateCount;
+
+        rules->Automata[i].StateCount = Pieces[i].StateCount;
+        rules->Automata[i].Start = Pieces[i].Start;
+        rules->Automata[i].Dead = Pieces[i].Dead;
+    }
+
+    return rules;
+}
+
+NTSTATUS CyberionPathRulesCompile(
+    _In_reads_(Count) const CYBERION_PATH_RULE *Rules,
+    _In_ ULONG Count,
+    _Out_ PCYBERION_PATH_RULES *Compiled
+)
+{
+    PATH_BUILD build;
+    PATH_PIECE pieces[CYBERION_PATH_MAX_AUTOMATA];
+    ULONG pieceCount = 1;
+    NTSTATUS status;
+    ULONG i;
+
+    *Compiled = NULL;
+
+    if (Count == 0 || Count > CYBERION_MAX_PATH_RULES) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory(&build, sizeof(build));
+    RtlZeroMemory(pieces, sizeof(pieces));
+    build.Rules = Rules;
+    pieces[0].Count = Count;
+
+    status = PathAssignClasses(&build, Count);
+
+    // Rules that interact badly are usually few; halve the share of any
+    // automaton that grows too large until the pieces run out
+    i = 0;
+    while (i < pieceCount && NT_SUCCESS(status)) {
+        status = PathConstruct(&build, pieces[i].First, pieces[i].Count);
+
+        if (status == STATUS_QUOTA_EXCEEDED && pieces[i].Count > 1 && pieceCount < CYBERION_PATH_MAX_AUTOMATA) {
+            // Retry with the first half; the second becomes a new piece
+            pieces[pieceCount].First = pieces[i].First + pieces[i].Count / 2;
+            pieces[pieceCount].Count = pieces[i].Count - pieces[i].Count / 2;
+            pieces[i].Count /= 2;
+            pieceCount++;
+            status = STATUS_SUCCESS;
+        } else if (NT_SUCCESS(status)) {
+            status = PathKeep(&build, &pieces[i]);
+            i++;
+        }
+
+        PathReset(&build);
+    }
+
+    if (NT_SUCCESS(status)) {
+        *Compiled = PathPack(&build, pieces, pieceCount);
+        if (*Compiled == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    for (i = 0; i < pieceCount; i++) {
+        if (pieces[i].Next) {
+            CyberionFree(pieces[i].Next);
+        }
+        if (pieces[i].Tags) {
+            CyberionFree(pieces[i].Tags);
+        }
+    }
+
+    if (build.Shape.Wide) {
+        CyberionFree((PVOID)build.Shape.Wide);
+    }
+
+    return status;
+}
+
+//
+// PathRun: Steps every automaton still live over Length characters of Path.
+// Returns the number still live.
+//
+FORCEINLINE ULONG PathRun(
+    _In_ const CYBERION_PATH_RULES *Rules,
+    _Inout_updates_(CYBERION_PATH_MAX_AUTOMATA) PULONG States,
+    _In_ ULONG Live,
+    _In_reads_(Length) PCWCH Path,
+    _In_ SIZE_T Length
+)
+{
+    ULONG classCount = Rules->ClassCount;
+    SIZE_T i;
+    ULONG a;
+
+    for (i = 0; i < Length && Live != 0; i++) {
+        ULONG charClass = PathClassOf(Rules, Path[i]);
+
+        for (a = 0; a < Rules->AutomatonCount; a++) {
+            const CYBERION_PATH_AUTOMATON *automaton = &Rules->Automata[a];
+
+            if (States[a] != automaton->Dead) {
+                States[a] = automaton->Next[(SIZE_T)States[a] * classCount + charClass];
+                Live -= (States[a] == automaton->Dead);
+            }
+        }
+    }
+
+    return Live;
+}
+
+CYBERION_VERDICT CyberionPathRulesMatch(
+    _In_ const CYBERION_PATH_RULES *Rules,
+    _In_reads_opt_(VolumeLength) PCWCH Volume,
+    _In_ SIZE_T VolumeLength,
+    _In_reads_(Length) PCWCH Path,
+    _In_ SIZE_T Length,
+    _Out_ PULONG64 Tags
+)
+{
+    ULONG states[CYBERION_PATH_MAX_AUTOMATA];
+    ULONG live = 0;
+    UCHAR verdict = VerdictUnknown;
+    ULONG a;
+
+    for (a = 0; a < Rules->AutomatonCount; a++) {
+        states[a] = Rules->Automata[a].Start;
+        live++;
+    }
+
+    if (VolumeLength != 0) {
+        live = PathRun(Rules, states, live, Volume, VolumeLength);
+    }
+    PathRun(Rules, states, live, Path, Length);
+
+    *Tags = 0;
+    for (a = 0; a < Rules->AutomatonCount; a++) {
+        *Tags |= Rules->Automata[a].Tags[states[a]];
+        verdict = (UCHAR)max(verdict, Rules->Automata[a].Verdicts[states[a]]);
+    }
+
+    return (CYBERION_VERDICT)verdict;
+}
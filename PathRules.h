@@ -0,0 +1,79 @@
+/*
+ * PATHRULES.H
+ *
+ * Image path rules (CYBERION_PATH_RULE) compiled into a deterministic
+ * automaton over UTF-16. Matching a path costs one table step per
+ * character however many rules there are, and gives the verdict and tags
+ * of every rule the whole path matches. Case is folded into the character
+ * classes, so ASCII characters need no upcasing while matching. Rules whose
+ * single automaton would grow too large are split across a few, which
+ * still run side by side in the same pass.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+#define CYBERION_PATH_MAX_STATES    65535   // States in one automaton
+#define CYBERION_PATH_MAX_AUTOMATA  8       // Automata one rule set may be split across
+#define CYBERION_PATH_NO_STATE      0xFFFF
+
+//
+// One automaton over a share of the rules. State 0 is where a match goes
+// once none of its rules can match any more; Dead is 0 then, or
+// CYBERION_PATH_NO_STATE if one of them starts with ** and so never fails.
+//
+typedef struct _CYBERION_PATH_AUTOMATON {
+    ULONG StateCount;
+    USHORT Start;
+    USHORT Dead;
+    const USHORT *Next;             // StateCount * ClassCount transitions
+    const ULONG64 *Tags;            // Per state: tags of the rules it accepts
+    const UCHAR *Verdicts;          // Per state: strongest verdict of those rules
+} CYBERION_PATH_AUTOMATON, *PCYBERION_PATH_AUTOMATON;
+
+//
+// A compiled rule set, in one allocation. The character classes are shared
+// by its automata, so each character of a path is classified once.
+//
+typedef struct _CYBERION_PATH_RULES {
+    ULONG ClassCount;               // Class 0 is every character no rule names
+    ULONG WideCount;
+    ULONG AutomatonCount;
+    ULONG StateCount;               // In all automata
+    USHORT AsciiClasses[128];       // Class of each ASCII character, case folded
+    const WCHAR *Wide;              // WideCount upcased non-ASCII characters, ascending
+    const USHORT *WideClasses;      // Their classes
+    CYBERION_PATH_AUTOMATON Automata[CYBERION_PATH_MAX_AUTOMATA];
+} CYBERION_PATH_RULES, *PCYBERION_PATH_RULES;
+
+//
+// CyberionPathRulesCompile: Compiles Count rules into a rule set allocated
+// with CyberionAllocate; the caller frees it with CyberionFree. Returns
+// STATUS_INVALID_PARAMETER for an empty or unterminated pattern or an
+// invalid verdict, and STATUS_QUOTA_EXCEEDED if the rules do not fit in
+// CYBERION_PATH_MAX_AUTOMATA automata of CYBERION_PATH_MAX_STATES states.
+//
+NTSTATUS CyberionPathRulesCompile(
+    _In_reads_(Count) const CYBERION_PATH_RULE *Rules,
+    _In_ ULONG Count,
+    _Out_ PCYBERION_PATH_RULES *Compiled
+);
+
+//
+// CyberionPathRulesMatch: Matches a path against every rule: VolumeLength
+// characters of Volume (none if 0), followed by Length characters of Path,
+// so a drive letter can stand in for a device name without copying the
+// path. Returns the strongest verdict of the matching rules (VerdictUnknown
+// if none match) and their tags, ORed together.
+//
+CYBERION_VERDICT CyberionPathRulesMatch(
+    _In_ const CYBERION_PATH_RULES *Rules,
+    _In_reads_opt_(VolumeLength) PCWCH Volume,
+    _In_ SIZE_T VolumeLength,
+    _In_reads_(Length) PCWCH Path,
+    _In_ SIZE_T Length,
+    _Out_ PULONG64 Tags
+);
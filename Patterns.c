@@ -0,0 +1,400 @@
+/*
+ * PATTERNS.C
+ *
+ * Aho-Corasick compiler and scanner for command line patterns.
+ *
+ * The patterns are merged into a trie whose nodes are the states: "the
+ * longest pattern prefix the text read so far ends with". Each state's
+ * failure state, its longest proper suffix that is also a state, is less
+ * deep, so going breadth first it is complete before the states that fail
+ * to it, and their missing transitions are copied from its row. The table
+ * that results never needs a failure step while scanning.
+ *
+ * A pattern ending at a state also ends at every state whose failure chain
+ * leads there. Each state keeps the nearest such state (Output), so a scan
+ * walks the chain only where something actually matched.
+ */
+
+#include "Patterns.h"
+
+#define PATTERN_CLASS_OTHER     0           // Characters no pattern names
+#define PATTERN_MAX_TRANSITIONS (1u << 22)  // States * classes
+
+C_ASSERT((ULONG)CYBERION_MAX_ARGUMENT_PATTERNS * (CYBERION_MAX_ARGUMENT_PATTERN - 1) < 0xFFFF);
+
+//
+// One trie node.
+//
+typedef struct _PATTERN_NODE {
+    USHORT Class;               // Of the character leading to it
+    USHORT FirstChild;          // 0 if none; the root is never a child
+    USHORT NextSibling;
+    USHORT First;               // First pattern ending here, + 1, or 0
+} PATTERN_NODE, *PPATTERN_NODE;
+
+//
+// PatternClassOf: Character class of C. ASCII is case folded by the table
+// itself; anything else is upcased and looked up among the wide characters
+// the patterns name.
+//
+FORCEINLINE ULONG PatternClassOf(_In_ const CYBERION_PATTERNS *Patterns, _In_ WCHAR C)
+{
+    ULONG low = 0;
+    ULONG high = Patterns->WideCount;
+
+    if (C < 128) {
+        return Patterns->AsciiClasses[C];
+    }
+
+    C = RtlUpcaseUnicodeChar(C);
+    if (C < 128) {
+        return Patterns->AsciiClasses[C];
+    }
+
+    while (low < high) {
+        ULONG middle = (low + high) / 2;
+
+        if (Patterns->Wide[middle] < C) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return (low < Patterns->WideCount && Patterns->Wide[low] == C) ? Patterns->WideClasses[low] : PATTERN_CLASS_OTHER;
+}
+
+//
+// PatternLength: Characters in a pattern, or 0 if it is empty or not
+// terminated.
+//
+static ULONG PatternLength(
+    _In_ const CYBERION_ARGUMENT_PATTERN *Pattern
+)
+{
+    ULONG length = 0;
+
+    while (length < CYBERION_MAX_ARGUMENT_PATTERN && Pattern->Text[length] != L'\0') {
+        length++;
+    }
+
+    return length == CYBERION_MAX_ARGUMENT_PATTERN ? 0 : length;
+}
+
+//
+// PatternAssignClasses: Gives every character the patterns name a class of
+// its own, and returns their total length. Shape->Wide and WideClasses
+// are allocated together; the caller frees Wide.
+//
+static NTSTATUS PatternAssignClasses(
+    _In_reads_(Count) const CYBERION_ARGUMENT_PATTERN *Patterns,
+    _In_ ULONG Count,
+    _Inout_ PCYBERION_PATTERNS Shape,
+    _Out_ PULONG TotalLength
+)
+{
+    PULONG used;
+    PWCHAR wide;
+    PUSHORT wideClasses;
+    ULONG wideCount = 0;
+    ULONG classes = PATTERN_CLASS_OTHER + 1;
+    ULONG c;
+    ULONG i;
+
+    *TotalLength = 0;
+
+    used = (PULONG)CyberionAllocate(65536 / 8);
+    if (used == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < Count; i++) {
+        ULONG length = PatternLength(&Patterns[i]);
+        ULONG k;
+
+        if (length == 0) {
+            CyberionFree(used);
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        for (k = 0; k < length; k++) {
+            WCHAR ch = RtlUpcaseUnicodeChar(Patterns[i].Text[k]);
+
+            used[ch / 32] |= 1u << (ch % 32);
+        }
+
+        *TotalLength += length;
+    }
+
+    for (c = 128; c < 65536; c++) {
+        if (used[c / 32] & (1u << (c % 32))) {
+            wideCount++;
+        }
+    }
+
+    wide = (PWCHAR)CyberionAllocate(((SIZE_T)wideCount + 1) * (sizeof(WCHAR) + sizeof(USHORT)));
+    if (wide == NULL) {
+        CyberionFree(used);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    wideClasses = (PUSHORT)(wide + wideCount + 1);
+
+    Shape->Wide = wide;
+    Shape->WideClasses = wideClasses;
+    Shape->WideCount = 0;
+    RtlZeroMemory(Shape->AsciiClasses, sizeof(Shape->AsciiClasses));
+
+    for (c = 0; c < 65536; c++) {
+        if (!(used[c / 32] & (1u << (c % 32)))) {
+            continue;
+        }
+
+        if (c < 128) {
+            Shape->AsciiClasses[c] = (USHORT)classes;
+        } else {
+            wide[Shape->WideCount] = (WCHAR)c;
+            wideClasses[Shape->WideCount] = (USHORT)classes;
+            Shape->WideCount++;
+        }
+        classes++;
+    }
+
+    // Lower case ASCII shares the class of its upper case
+    for (c = 0; c < 128; c++) {
+        WCHAR upper = RtlUpcaseUnicodeChar((WCHAR)c);
+
+        if (upper != c && upper < 128) {
+            Shape->AsciiClasses[c] = Shape->AsciiClasses[upper];
+        }
+    }
+
+    Shape->ClassCount = classes;
+    CyberionFree(used);
+    return STATUS_SUCCESS;
+}
+
+//
+// PatternInsert: Adds pattern Index to the trie of *NodeCount nodes.
+//
+static VOID PatternInsert(
+    _Inout_ PPATTERN_NODE Nodes,
+    _Inout_ PULONG NodeCount,
+    _In_ const CYBERION_PATTERNS *Shape,
+    _In_ const CYBERION_ARGUMENT_PATTERN *Pattern,
+    _In_ ULONG Index,
+    _Inout_ PUSHORT NextPattern
+)
+{
+    ULONG length = PatternLength(Pattern);
+    ULONG node = 0;
+    ULONG i;
+
+    for (i = 0; i < length; i++) {
+        ULONG charClass = PatternClassOf(Shape, Pattern->Text[i]);
+        ULONG child;
+
+        for (child = Nodes[node].FirstChild; child != 0; child = Nodes[child].NextSibling) {
+            if (Nodes[child].Class == charClass) {
+                break;
+            }
+        }
+
+        if (child == 0) {
+            child = (*NodeCount)++;
+            Nodes[child].Class = (USHORT)charClass;
+            Nodes[child].NextSibling = Nodes[node].FirstChild;
+            Nodes[node].FirstChild = (USHORT)child;
+        }
+
+        node = child;
+    }
+
+    // Patterns with the same text share the state
+    NextPattern[Index] = Nodes[node].First;
+    Nodes[node].First = (USHORT)(Index + 1);
+}
+
+//
+// PatternBuildTable: Fills the transitions, failure states and outputs of
+// the compiled set from the trie, breadth first. Queue holds StateCount
+// entries.
+//
+static VOID PatternBuildTable(
+    _In_ const PATTERN_NODE *Nodes,
+    _Inout_ PCYBERION_PATTERNS Compiled,
+    _Out_writes_(Compiled->StateCount) PUSHORT Queue
+)
+{
+    PUSHORT next = (PUSHORT)Compiled->Next;
+    PUSHORT output = (PUSHORT)Compiled->Output;
+    PUSHORT fail = (PUSHORT)Compiled->Fail;
+    PUSHORT first = (PUSHORT)Compiled->First;
+    ULONG classCount = Compiled->ClassCount;
+    ULONG head = 0;
+    ULONG tail = 1;
+
+    // The root fails to itself, and its row stays all root
+    Queue[0] = 0;
+
+    while (head < tail) {
+        ULONG state = Queue[head++];
+        PUSHORT row = next + (SIZE_T)state * classCount;
+        ULONG child;
+
+        if (state != 0) {
+            RtlCopyMemory(row, next + (SIZE_T)fail[state] * classCount, classCount * sizeof(USHORT));
+        }
+
+        // Siblings have distinct classes, so each still reads the failure
+        // state's transition here
+        for (child = Nodes[state].FirstChild; child != 0; child = Nodes[child].NextSibling) {
+            fail[child] = (state == 0) ? 0 : row[Nodes[child].Class];
+            row[Nodes[child].Class] = (USHORT)child;
+            first[child] = Nodes[child].First;
+            output[child] = Nodes[child].First ? (USHORT)child : output[fail[child]];
+            Queue[tail++] = (USHORT)child;
+        }
+    }
+}
+
+NTSTATUS CyberionPatternsCompile(
+    _In_reads_(Count) const CYBERION_ARGUMENT_PATTERN *Patterns,
+    _In_ ULONG Count,
+    _Out_ PCYBERION_PATTERNS *Compiled
+)
+{
+    CYBERION_PATTERNS shape;
+    PCYBERION_PATTERNS compiled = NULL;
+    PPATTERN_NODE nodes = NULL;
+    PUSHORT queue;
+    PUCHAR cursor;
+    SIZE_T transitions;
+    ULONG totalLength;
+    ULONG nodeCount = 1;
+    NTSTATUS status;
+    ULONG i;
+
+    *Compiled = NULL;
+
+    if (Count == 0 || Count > CYBERION_MAX_ARGUMENT_PATTERNS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory(&shape, sizeof(shape));
+
+    status = PatternAssignClasses(Patterns, Count, &shape, &totalLength);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Nodes, then the next pattern of each pattern, then the queue
+    nodes = (PPATTERN_NODE)CyberionAllocate(((SIZE_T)totalLength + 1) * (sizeof(PATTERN_NODE) + sizeof(USHORT)) +
+                                            (SIZE_T)Count * sizeof(USHORT));
+    if (nodes == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    } else {
+        PUSHORT nextPattern = (PUSHORT)(nodes + totalLength + 1);
+
+        for (i = 0; i < Count; i++) {
+            PatternInsert(nodes, &nodeCount, &shape, &Patterns[i], i, nextPattern);
+        }
+
+        transitions = (SIZE_T)nodeCount * shape.ClassCount;
+        if (transitions > PATTERN_MAX_TRANSITIONS) {
+            status = STATUS_QUOTA_EXCEEDED;
+        } else {
+            compiled = (PCYBERION_PATTERNS)CyberionAllocate(sizeof(CYBERION_PATTERNS) +
+                                                            (SIZE_T)Count * (sizeof(ULONG64) + sizeof(ULONG) + sizeof(USHORT)) +
+                                                            (transitions + 3 * (SIZE_T)nodeCount) * sizeof(USHORT) +
+                                                            (SIZE_T)shape.WideCount * (sizeof(WCHAR) + sizeof(USHORT)));
+            if (compiled == NULL) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+
+        if (NT_SUCCESS(status)) {
+            RtlCopyMemory(compiled, &shape, sizeof(*compiled));
+            compiled->StateCount = nodeCount;
+            compiled->PatternCount = Count;
+
+            // Widest elements first, so each array is aligned
+            cursor = (PUCHAR)(compiled + 1);
+            compiled->Tags = (const ULONG64 *)cursor;
+            cursor += (SIZE_T)Count * sizeof(ULONG64);
+            compiled->Ids = (const ULONG *)cursor;
+            cursor += (SIZE_T)Count * sizeof(ULONG);
+            compiled->Next = (const USHORT *)cursor;
+            cursor += transitions * sizeof(USHORT);
+            compiled->Output = (const USHORT *)cursor;
+            cursor += (SIZE_T)nodeCount * sizeof(USHORT);
+            compiled->Fail = (const USHORT *)cursor;
+            cursor += (SIZE_T)nodeCount * sizeof(USHORT);
+            compiled->First = (const USHORT *)cursor;
+            cursor += (SIZE_T)nodeCount * sizeof(USHORT);
+            compiled->NextPattern = (const USHORT *)cursor;
+            cursor += (SIZE_T)Count * sizeof(USHORT);
+            compiled->Wide = (const WCHAR *)cursor;
+            cursor += (SIZE_T)shape.WideCount * sizeof(WCHAR);
+            compiled->WideClasses = (const USHORT *)cursor;
+
+            for (i = 0; i < Count; i++) {
+                ((PULONG64)compiled->Tags)[i] = Patterns[i].Tags;
+                ((PULONG)compiled->Ids)[i] = Patterns[i].Id;
+            }
+
+            RtlCopyMemory((PVOID)compiled->NextPattern, nextPattern, (SIZE_T)Count * sizeof(USHORT));
+            RtlCopyMemory((PVOID)compiled->Wide, shape.Wide, (SIZE_T)shape.WideCount * sizeof(WCHAR));
+            RtlCopyMemory((PVOID)compiled->WideClasses, shape.WideClasses, (SIZE_T)shape.WideCount * sizeof(USHORT));
+
+            queue = nextPattern + Count;
+            PatternBuildTable(nodes, compiled, queue);
+            *Compiled = compiled;
+        }
+
+        CyberionFree(nodes);
+    }
+
+    CyberionFree((PVOID)shape.Wide);
+    return status;
+}
+
+VOID CyberionPatternsScan(
+    _In_ const CYBERION_PATTERNS *Patterns,
+    _In_reads_(Length) PCWCH Text,
+    _In_ SIZE_T Length,
+    _Out_ PCYBERION_PATTERN_MATCHES Matches
+)
+{
+    ULONG seen[CYBERION_MAX_ARGUMENT_PATTERNS / 32];
+    ULONG classCount = Patterns->ClassCount;
+    ULONG state = 0;
+    SIZE_T i;
+
+    RtlZeroMemory(Matches, sizeof(*Matches));
+    RtlZeroMemory(seen, sizeof(seen));
+
+    for (i = 0; i < Length; i++) {
+        ULONG output;
+
+        state = Patterns->Next[(SIZE_T)state * classCount + PatternClassOf(Patterns, Text[i])];
+
+        for (output = Patterns->Output[state]; output != 0; output = Patterns->Output[Patterns->Fail[output]]) {
+            ULONG pattern;
+
+            for (pattern = Patterns->First[output]; pattern != 0; pattern = Patterns->NextPattern[pattern - 1]) {
+                ULONG index = pattern - 1;
+
+                if (seen[index / 32] & (1u << (index % 32))) {
+                    continue;
+                }
+                seen[index / 32] |= 1u << (index % 32);
+
+                if (Matches->Count < CYBERION_MAX_ARGUMENT_MATCHES) {
+                    Matches->Ids[Matches->Count] = Patterns->Ids[index];
+                }
+                Matches->Count++;
+                Matches->Tags |= Patterns->Tags[index];
+            }
+        }
+    }
+}
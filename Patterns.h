@@ -0,0 +1,66 @@
+/*
+ * PATTERNS.H
+ *
+ * Command line patterns (CYBERION_ARGUMENT_PATTERN) compiled into an
+ * Aho-Corasick automaton over UTF-16. Scanning a command line takes one
+ * table step per character, however many patterns there are, and finds
+ * every occurrence of every pattern, ignoring case.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+//
+// A compiled pattern set, in one allocation. State 0 is the root.
+//
+typedef struct _CYBERION_PATTERNS {
+    ULONG ClassCount;               // Class 0 is every character no pattern names
+    ULONG WideCount;
+    ULONG StateCount;
+    ULONG PatternCount;
+    USHORT AsciiClasses[128];       // Class of each ASCII character, case folded
+    const WCHAR *Wide;              // WideCount upcased non-ASCII characters, ascending
+    const USHORT *WideClasses;      // Their classes
+    const USHORT *Next;             // StateCount * ClassCount transitions, failures resolved
+    const USHORT *Output;           // Per state: nearest state on its failure chain where a pattern ends, 0 if none
+    const USHORT *Fail;             // Per state: longest proper suffix that is also a state
+    const USHORT *First;            // Per state: first pattern ending there, + 1, or 0
+    const USHORT *NextPattern;      // Per pattern: next pattern with the same text, + 1, or 0
+    const ULONG *Ids;               // Per pattern
+    const ULONG64 *Tags;            // Per pattern
+} CYBERION_PATTERNS, *PCYBERION_PATTERNS;
+
+//
+// What a scan found.
+//
+typedef struct _CYBERION_PATTERN_MATCHES {
+    ULONG Count;                    // Distinct patterns found
+    ULONG Ids[CYBERION_MAX_ARGUMENT_MATCHES]; // Ids of the first of them, in the order their first occurrences end
+    ULONG64 Tags;                   // Tags of all of them, ORed together
+} CYBERION_PATTERN_MATCHES, *PCYBERION_PATTERN_MATCHES;
+
+//
+// CyberionPatternsCompile: Compiles Count patterns into a pattern set
+// allocated with CyberionAllocate; the caller frees it with CyberionFree.
+// Returns STATUS_INVALID_PARAMETER for an empty or unterminated pattern, and
+// STATUS_QUOTA_EXCEEDED if the automaton would be too large.
+//
+NTSTATUS CyberionPatternsCompile(
+    _In_reads_(Count) const CYBERION_ARGUMENT_PATTERN *Patterns,
+    _In_ ULONG Count,
+    _Out_ PCYBERION_PATTERNS *Compiled
+);
+
+//
+// CyberionPatternsScan: Finds the patterns occurring in Length characters
+// of Text.
+//
+VOID CyberionPatternsScan(
+    _In_ const CYBERION_PATTERNS *Patterns,
+    _In_reads_(Length) PCWCH Text,
+    _In_ SIZE_T Length,
+    _Out_ PCYBERION_PATTERN_MATCHES Matches
+);
@@ -0,0 +1,210 @@
+/*
+ * PE.C
+ *
+ * PE header validation and the Authenticode digest.
+ *
+ * Offsets follow the PE/COFF specification. Fields are read byte by byte in
+ * little-endian order, so the buffer may be unaligned and the code runs the
+ * same on any host. Every range is checked against the buffer before the
+ * digest touches it.
+ */
+
+#include "Pe.h"
+#include "Sha256.h"
+
+#define PE_DOS_SIGNATURE        0x5A4D      // "MZ"
+#define PE_NT_SIGNATURE         0x00004550  // "PE\0\0"
+#define PE_MAGIC_PE32           0x010B
+#define PE_MAGIC_PE32_PLUS      0x020B
+
+#define PE_DOS_LFANEW           0x3C        // e_lfanew in the DOS header
+#define PE_FILE_HEADER_SIZE     20
+#define PE_SECTION_HEADER_SIZE  40
+#define PE_SECURITY_DIRECTORY   4           // IMAGE_DIRECTORY_ENTRY_SECURITY
+
+//
+// Offsets within the optional header. PE32 and PE32+ differ only after the
+// fields below SizeOfHeaders and CheckSum.
+//
+#define PE_OPT_SIZE_OF_HEADERS  60
+#define PE_OPT_CHECKSUM         64
+#define PE_OPT_RVA_COUNT_PE32   92
+#define PE_OPT_RVA_COUNT_PE32P  108
+#define PE_OPT_DIRECTORY_PE32   96
+#define PE_OPT_DIRECTORY_PE32P  112
+
+FORCEINLINE USHORT PeRead16(_In_ PCUCHAR p)
+{
+    return (USHORT)(p[0] | (p[1] << 8));
+}
+
+FORCEINLINE ULONG PeRead32(_In_ PCUCHAR p)
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+//
+// PeRangeValid: TRUE when [Offset, Offset + Length) lies inside the file.
+//
+FORCEINLINE BOOLEAN PeRangeValid(_In_ SIZE_T Size, _In_ ULONG64 Offset, _In_ ULONG64 Length)
+{
+    return Offset <= Size && Length <= Size - Offset;
+}
+
+NTSTATUS CyberionPeParse(
+    _In_reads_bytes_(Size) PCUCHAR Base,
+    _In_ SIZE_T Size,
+    _Out_ PCYBERION_PE_FILE File
+)
+{
+    ULONG ntHeaders;
+    ULONG optionalHeader;
+    ULONG optionalSize;
+    ULONG rvaCountOffset;
+    ULONG directoryOffset;
+    ULONG i;
+
+    RtlZeroMemory(File, sizeof(*File));
+
+    if (Size < PE_DOS_LFANEW + 4 || PeRead16(Base) != PE_DOS_SIGNATURE) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    ntHeaders = PeRead32(Base + PE_DOS_LFANEW);
+    if (!PeRangeValid(Size, ntHeaders, 4 + PE_FILE_HEADER_SIZE) || PeRead32(Base + ntHeaders) != PE_NT_SIGNATURE) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    File->SectionCount = PeRead16(Base + ntHeaders + 4 + 2);
+    optionalSize = PeRead16(Base + ntHeaders + 4 + 16);
+    optionalHeader = ntHeaders + 4 + PE_FILE_HEADER_SIZE;
+
+    if (File->SectionCount > CYBERION_PE_MAX_SECTIONS || !PeRangeValid(Size, optionalHeader, optionalSize) || optionalSize < 2) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    switch (PeRead16(Base + optionalHeader)) {
+        case PE_MAGIC_PE32:
+            rvaCountOffset = PE_OPT_RVA_COUNT_PE32;
+            directoryOffset = PE_OPT_DIRECTORY_PE32;
+            break;
+
+        case PE_MAGIC_PE32_PLUS:
+            rvaCountOffset = PE_OPT_RVA_COUNT_PE32P;
+            directoryOffset = PE_OPT_DIRECTORY_PE32P;
+            break;
+
+        default:
+            return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    if (optionalSize < rvaCountOffset + 4) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    File->Base = Base;
+    File->Size = Size;
+    File->ChecksumOffset = optionalHeader + PE_OPT_CHECKSUM;
+    File->SizeOfHeaders = PeRead32(Base + optionalHeader + PE_OPT_SIZE_OF_HEADERS);
+    File->SectionTableOffset = optionalHeader + optionalSize;
+
+    // The certificate table entry only exists if the directory reaches it
+    if (PeRead32(Base + optionalHeader + rvaCountOffset) > PE_SECURITY_DIRECTORY &&
+        optionalSize >= directoryOffset + (PE_SECURITY_DIRECTORY + 1) * 8) {
+        File->SecurityEntryOffset = optionalHeader + directoryOffset + PE_SECURITY_DIRECTORY * 8;
+        File->CertificateOffset = PeRead32(Base + File->SecurityEntryOffset);
+        File->CertificateSize = PeRead32(Base + File->SecurityEntryOffset + 4);
+    }
+
+    // The hashed header region must cover every field the digest skips
+    if (!PeRangeValid(Size, 0, File->SizeOfHeaders) ||
+        File->SizeOfHeaders < File->ChecksumOffset + 4 ||
+        File->SizeOfHeaders < File->SecurityEntryOffset + 8 ||
+        !PeRangeValid(Size, File->SectionTableOffset, (ULONG64)File->SectionCount * PE_SECTION_HEADER_SIZE) ||
+        !PeRangeValid(Size, File->CertificateOffset, File->CertificateSize)) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    for (i = 0; i < File->SectionCount; i++) {
+        PCUCHAR section = Base + File->SectionTableOffset + i * PE_SECTION_HEADER_SIZE;
+
+        if (!PeRangeValid(Size, PeRead32(section + 20), PeRead32(section + 16))) {
+            return STATUS_INVALID_IMAGE_FORMAT;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionPeAuthenticodeHash(
+    _In_ const CYBERION_PE_FILE *File,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Digest
+)
+{
+    PCUCHAR sections[CYBERION_PE_MAX_SECTIONS];
+    CYBERION_SHA256 sha;
+    ULONG64 hashed;
+    ULONG count = 0;
+    ULONG i, j;
+
+    CyberionSha256Init(&sha);
+
+    // Headers, minus CheckSum and the certificate table entry
+    CyberionSha256Update(&sha, File->Base, File->ChecksumOffset);
+    if (File->SecurityEntryOffset) {
+        CyberionSha256Update(&sha, File->Base + File->ChecksumOffset + 4, File->SecurityEntryOffset - (File->ChecksumOffset + 4));
+        CyberionSha256Update(&sha, File->Base + File->SecurityEntryOffset + 8, File->SizeOfHeaders - (File->SecurityEntryOffset + 8));
+    } else {
+        CyberionSha256Update(&sha, File->Base + File->ChecksumOffset + 4, File->SizeOfHeaders - (File->ChecksumOffset + 4));
+    }
+
+    // Sections with raw data, in file order (insertion sort on at most 96)
+    for (i = 0; i < File->SectionCount; i++) {
+        PCUCHAR section = File->Base + File->SectionTableOffset + i * PE_SECTION_HEADER_SIZE;
+
+        if (PeRead32(section + 16) == 0) {
+            continue;
+        }
+
+        for (j = count; j > 0 && PeRead32(sections[j - 1] + 20) > PeRead32(section + 20); j--) {
+            sections[j] = sections[j - 1];
+        }
+        sections[j] = section;
+        count++;
+    }
+
+    hashed = File->SizeOfHeaders;
+    for (i = 0; i < count; i++) {
+        ULONG rawSize = PeRead32(sections[i] + 16);
+
+        CyberionSha256Update(&sha, File->Base + PeRead32(sections[i] + 20), rawSize);
+        hashed += rawSize;
+    }
+
+    // Trailing data (overlays), excluding the certificate table
+    if (File->Size > hashed + File->CertificateSize) {
+        CyberionSha256Update(&sha, File->Base + hashed, (SIZE_T)(File->Size - hashed - File->CertificateSize));
+    }
+
+    CyberionSha256Final(&sha, Digest);
+}
+
+BOOLEAN CyberionPeComputeImageHash(
+    _In_reads_bytes_(Size) PCUCHAR Base,
+    _In_ SIZE_T Size,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Digest
+)
+{
+    CYBERION_PE_FILE file;
+    CYBERION_SHA256 sha;
+
+    if (NT_SUCCESS(CyberionPeParse(Base, Size, &file))) {
+        CyberionPeAuthenticodeHash(&file, Digest);
+        return TRUE;
+    }
+
+    CyberionSha256Init(&sha);
+    CyberionSha256Update(&sha, Base, Size);
+    CyberionSha256Final(&sha, Digest);
+    return FALSE;
+}
@@ -0,0 +1,63 @@
+/*
+ * PE.H
+ *
+ * Zero-copy PE parsing and Authenticode digests.
+ *
+ * The parser validates a PE file laid out as on disk (a mapped view of the
+ * file, not a loaded image) and records the offsets the Authenticode digest
+ * needs, reading every field in place. Allowlists are expressed as
+ * Authenticode SHA-256 hashes, which exclude the CheckSum field, the
+ * certificate table directory entry and the certificate table itself, so
+ * signing or re-signing a file does not change its hash.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+#define CYBERION_PE_MAX_SECTIONS 96 // Loader limit on the section count
+
+typedef struct _CYBERION_PE_FILE {
+    PCUCHAR Base;
+    SIZE_T Size;
+    ULONG ChecksumOffset;           // File offset of OptionalHeader.CheckSum
+    ULONG SecurityEntryOffset;      // File offset of the certificate table entry, 0 if absent
+    ULONG SizeOfHeaders;
+    ULONG CertificateOffset;        // Certificate table (a file offset, not an RVA)
+    ULONG CertificateSize;
+    ULONG SectionTableOffset;
+    USHORT SectionCount;
+} CYBERION_PE_FILE, *PCYBERION_PE_FILE;
+
+//
+// CyberionPeParse: Checks that Base..Base+Size holds a PE file whose headers,
+// sections and certificate table all lie inside it. Returns
+// STATUS_INVALID_IMAGE_FORMAT otherwise.
+//
+NTSTATUS CyberionPeParse(
+    _In_reads_bytes_(Size) PCUCHAR Base,
+    _In_ SIZE_T Size,
+    _Out_ PCYBERION_PE_FILE File
+);
+
+//
+// CyberionPeAuthenticodeHash: Computes the Authenticode SHA-256 digest of a
+// parsed file.
+//
+VOID CyberionPeAuthenticodeHash(
+    _In_ const CYBERION_PE_FILE *File,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Digest
+);
+
+//
+// CyberionPeComputeImageHash: Authenticode digest for PE files, plain
+// SHA-256 of the whole buffer for anything else (scripts, malformed
+// images). Returns TRUE when the Authenticode digest was used.
+//
+BOOLEAN CyberionPeComputeImageHash(
+    _In_reads_bytes_(Size) PCUCHAR Base,
+    _In_ SIZE_T Size,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Digest
+);
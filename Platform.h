@@ -0,0 +1,370 @@
+/*
+ * PLATFORM.H
+ *
+ * Minimal platform layer for the portable parts of the Cyberion driver.
+ * Components that must also build in the Linux test harness (the event
+ * filter VM, caches, allocators) include this header instead of the WDK
+ * headers. In kernel mode it simply pulls in the WDK; in user mode it
+ * supplies the handful of NT types and helpers those components rely on.
+ */
+
+#pragma once
+
+#ifdef _KERNEL_MODE
+
+#include <ntifs.h>
+
+#else // !_KERNEL_MODE
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+// Basic NT types
+//
+typedef void VOID, *PVOID;
+typedef const void *PCVOID;
+typedef void *HANDLE;
+typedef uint8_t UCHAR, *PUCHAR, BOOLEAN, *PBOOLEAN;
+typedef const uint8_t *PCUCHAR;
+typedef char CHAR, *PCHAR;
+typedef uint16_t USHORT, *PUSHORT;
+typedef uint16_t WCHAR, *PWCHAR, *PWCH;
+typedef const uint16_t *PCWCH;
+typedef int32_t LONG, *PLONG;
+typedef uint32_t ULONG, *PULONG;
+typedef int64_t LONG64, LONGLONG, *PLONG64;
+typedef uint64_t ULONG64, ULONGLONG, *PULONG64;
+typedef size_t SIZE_T, *PSIZE_T;
+typedef uintptr_t ULONG_PTR;
+typedef int32_t NTSTATUS;
+
+typedef struct _GUID {
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    extern const GUID name
+
+#define TRUE 1
+#define FALSE 0
+#define ANYSIZE_ARRAY 1
+#define MAXULONG 0xFFFFFFFFUL
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _Inout_updates_(n)
+#define _In_reads_(n)
+#define _In_reads_opt_(n)
+#define _In_reads_bytes_(n)
+#define _Out_writes_(n)
+#define _Out_writes_bytes_(n)
+#define _Outptr_result_bytebuffer_(n)
+#define _Must_inspect_result_
+
+#define FORCEINLINE static inline
+#define DECLSPEC_CACHEALIGN __attribute__((aligned(64)))
+#define UNREFERENCED_PARAMETER(p) ((void)(p))
+#define C_ASSERT(e) _Static_assert((e), #e)
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define RTL_FIELD_SIZE(type, field) (sizeof(((type *)0)->field))
+#define RTL_NUMBER_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define RtlZeroMemory(d, l) memset((d), 0, (l))
+#define RtlCopyMemory(d, s, l) memcpy((d), (s), (l))
+#define RtlMoveMemory(d, s, l) memmove((d), (s), (l))
+#define RtlEqualMemory(a, b, l) (memcmp((a), (b), (l)) == 0)
+#define RtlUlonglongByteSwap(x) __builtin_bswap64(x)
+
+// Folds ASCII only; the kernel uses the full Unicode upcase table
+#define RtlUpcaseUnicodeChar(c) ((WCHAR)(((c) >= 'a' && (c) <= 'z') ? (c) - ('a' - 'A') : (c)))
+
+//
+// Status codes used by the portable components
+//
+#define NT_SUCCESS(s) (((NTSTATUS)(s)) >= 0)
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_NOT_FOUND                ((NTSTATUS)0xC0000225L)
+#define STATUS_INVALID_IMAGE_FORMAT     ((NTSTATUS)0xC000007BL)
+#define STATUS_OBJECT_NAME_COLLISION    ((NTSTATUS)0xC0000035L)
+#define STATUS_QUOTA_EXCEEDED           ((NTSTATUS)0xC0000044L)
+
+#define DbgPrint(...) ((void)0)
+
+//
+// Interlocked operations
+//
+#define InterlockedIncrement(p)                 __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)                 __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(p)               __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(p)               __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v)            __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(p, v)          __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)               __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, x, c)     __sync_val_compare_and_swap((p), (c), (x))
+#define InterlockedCompareExchange64(p, x, c)   __sync_val_compare_and_swap((p), (c), (x))
+#define ReadNoFence(p)                          __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ReadNoFence64(p)                        __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ReadAcquire(p)                          __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WriteRelease(p, v)                      __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define WriteNoFence(p, v)                      __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define WriteNoFence64(p, v)                    __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define YieldProcessor()                        sched_yield()
+
+#endif // _KERNEL_MODE
+
+//
+// Pool tag for all Cyberion allocations ('Cybn' in pool dumps)
+//
+#define CYBERION_POOL_TAG 'nbyC'
+
+//
+// Memory, processor and scheduling helpers shared by the portable components.
+// Kernel-mode callers must be at IRQL <= DISPATCH_LEVEL.
+//
+#ifdef _KERNEL_MODE
+
+typedef KIRQL CYBERION_PIN_STATE;
+
+FORCEINLINE PVOID CyberionAllocate(_In_ SIZE_T Size)
+{
+    return ExAllocatePool2(POOL_FLAG_NON_PAGED, Size, CYBERION_POOL_TAG);
+}
+
+FORCEINLINE VOID CyberionFree(_In_ PVOID Pointer)
+{
+    ExFreePoolWithTag(Pointer, CYBERION_POOL_TAG);
+}
+
+FORCEINLINE ULONG CyberionProcessorCount(VOID)
+{
+    return KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+}
+
+//
+// CyberionPinProcessor: Keeps the caller on the current processor (by raising
+// to DISPATCH_LEVEL) and returns that processor's index.
+//
+FORCEINLINE ULONG CyberionPinProcessor(_Out_ CYBERION_PIN_STATE *State)
+{
+    *State = KeGetCurrentIrql();
+    if (*State < DISPATCH_LEVEL) {
+        KeRaiseIrql(DISPATCH_LEVEL, State);
+    }
+    return KeGetCurrentProcessorNumberEx(NULL);
+}
+
+FORCEINLINE VOID CyberionUnpinProcessor(_In_ CYBERION_PIN_STATE State)
+{
+    if (State < DISPATCH_LEVEL) {
+        KeLowerIrql(State);
+    }
+}
+
+//
+// CyberionCurrentProcessor: Index of the processor the caller was running on
+// a moment ago. Only a hint for spreading contention; the caller may migrate.
+//
+FORCEINLINE ULONG CyberionCurrentProcessor(VOID)
+{
+    return KeGetCurrentProcessorNumberEx(NULL);
+}
+
+//
+// CyberionQueryTime: Monotonic time in 100-nanosecond units.
+//
+FORCEINLINE ULONG64 CyberionQueryTime(VOID)
+{
+    return KeQueryInterruptTime();
+}
+
+#else // !_KERNEL_MODE
+
+typedef int CYBERION_PIN_STATE;
+
+FORCEINLINE PVOID CyberionAllocate(_In_ SIZE_T Size)
+{
+    return calloc(1, Size);
+}
+
+FORCEINLINE VOID CyberionFree(_In_ PVOID Pointer)
+{
+    free(Pointer);
+}
+
+FORCEINLINE ULONG CyberionProcessorCount(VOID)
+{
+    long count = sysconf(_SC_NPROCESSORS_CONF);
+    return (count > 0) ? (ULONG)count : 1;
+}
+
+//
+// User mode cannot pin a thread cheaply; callers must tolerate migrating
+// after the processor index has been read.
+//
+FORCEINLINE ULONG CyberionPinProcessor(_Out_ CYBERION_PIN_STATE *State)
+{
+    int cpu = sched_getcpu();
+    *State = 0;
+    return (cpu >= 0) ? (ULONG)cpu : 0;
+}
+
+FORCEINLINE VOID CyberionUnpinProcessor(_In_ CYBERION_PIN_STATE State)
+{
+    UNREFERENCED_PARAMETER(State);
+}
+
+FORCEINLINE ULONG CyberionCurrentProcessor(VOID)
+{
+    int cpu = sched_getcpu();
+    return (cpu >= 0) ? (ULONG)cpu : 0;
+}
+
+FORCEINLINE ULONG64 CyberionQueryTime(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONG64)now.tv_sec * 10000000 + (ULONG64)now.tv_nsec / 100;
+}
+
+#endif // _KERNEL_MODE
+
+//
+// CYBERION_TARGET: Lets GCC and Clang compile one function for an instruction
+// set extension that the rest of the file may not assume. MSVC needs no
+// annotation to use intrinsics.
+//
+#if defined(__GNUC__)
+#define CYBERION_TARGET(Isa) __attribute__((target(Isa)))
+#else
+#define CYBERION_TARGET(Isa)
+#endif
+
+//
+// CPU features that select optional vector code paths. Callers must check
+// them before calling a CYBERION_TARGET function.
+//
+#define CYBERION_CPU_SSE41  0x00000001
+#define CYBERION_CPU_SHA    0x00000002  // SHA-NI
+
+#ifdef _KERNEL_MODE
+
+FORCEINLINE ULONG CyberionCpuFeatures(VOID)
+{
+    ULONG features = 0;
+#if defined(_M_AMD64) || defined(_M_IX86)
+    int regs[4];
+    int maxLeaf;
+
+    __cpuid(regs, 0);
+    maxLeaf = regs[0];
+
+    __cpuid(regs, 1);
+    if (regs[2] & (1 << 19)) {
+        features |= CYBERION_CPU_SSE41;
+    }
+
+    if (maxLeaf >= 7) {
+        __cpuidex(regs, 7, 0);
+        if (regs[1] & (1 << 29)) {
+            features |= CYBERION_CPU_SHA;
+        }
+    }
+#endif
+    return features;
+}
+
+#else // !_KERNEL_MODE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+FORCEINLINE ULONG CyberionCpuFeatures(VOID)
+{
+    ULONG features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        if (ecx & bit_SSE4_1) {
+            features |= CYBERION_CPU_SSE41;
+        }
+
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29))) {
+            features |= CYBERION_CPU_SHA;
+        }
+    }
+#endif
+    return features;
+}
+
+#endif // _KERNEL_MODE
+
+//
+// Fences for sequence-lock readers and writers. x86 never reorders loads
+// with loads or stores with stores, so there they only restrain the
+// compiler.
+//
+#ifdef _KERNEL_MODE
+#if defined(_M_AMD64) || defined(_M_IX86)
+#define CyberionLoadFence()     KeMemoryBarrierWithoutFence()
+#define CyberionStoreFence()    KeMemoryBarrierWithoutFence()
+#else
+#define CyberionLoadFence()     MemoryBarrier()
+#define CyberionStoreFence()    MemoryBarrier()
+#endif
+#else // !_KERNEL_MODE
+#define CyberionLoadFence()     __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define CyberionStoreFence()    __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif // _KERNEL_MODE
+
+//
+// CYBERION_LOCK: Small spin lock for portable components. Holders run
+// pinned (at DISPATCH_LEVEL in kernel mode) and must not block.
+//
+typedef volatile LONG CYBERION_LOCK;
+
+FORCEINLINE VOID CyberionAcquireLock(_Inout_ CYBERION_LOCK *Lock, _Out_ CYBERION_PIN_STATE *State)
+{
+    CyberionPinProcessor(State);
+    while (InterlockedExchange(Lock, 1) != 0) {
+        while (ReadNoFence(Lock) != 0) {
+            YieldProcessor();
+        }
+    }
+}
+
+FORCEINLINE VOID CyberionReleaseLock(_Inout_ CYBERION_LOCK *Lock, _In_ CYBERION_PIN_STATE State)
+{
+    WriteRelease(Lock, 0);
+    CyberionUnpinProcessor(State);
+}
@@ -0,0 +1,151 @@
+/*
+ * POLICY.C
+ *
+ * Adaptive decision policy for the Cyberion driver.
+ *
+ * Every answered or expired held event adds its wait to a sliding window
+ * of response latencies (Latency.c). After each one, the FailOpenPercentile
+ * latency is compared with the budgets: reaching FailOpenBudget fails
+ * open, dropping below FailOpenRecovery enforces again. The gap between
+ * the two, and the window the slow answers must age out of, keep the mode
+ * from flapping. Changes are reported to every session as events, in the
+ * order they happened.
+ */
+
+#include "Policy.h"
+#include "Latency.h"
+#include "Session.h"
+#include "Tunables.h"
+
+#define POLICY_MIN_SAMPLES  10          // Waits seen before the mode may change
+#define POLICY_UNIT         10000       // 100ns units per millisecond
+
+//
+// Globals
+//
+static KSPIN_LOCK g_PolicyLock; // Protects everything below but the report state
+static CYBERION_LATENCY_WINDOW g_PolicyLatency; // Response latencies, in milliseconds of interrupt time
+static ULONG g_PolicyWindow; // LatencyWindow g_PolicyLatency was set up with
+static volatile LONG g_PolicyMode; // CYBERION_POLICY_MODE
+static ULONG g_PolicyChangeLatency; // Latency that caused the last change
+static ULONG64 g_PolicyChanges;
+static FAST_MUTEX g_PolicyReportLock; // Serializes reports, and protects g_PolicyReported
+static CYBERION_POLICY_MODE g_PolicyReported; // Mode sessions were last told about
+
+FORCEINLINE ULONG64 PolicyNow(VOID)
+{
+    return KeQueryInterruptTime() / POLICY_UNIT;
+}
+
+//
+// PolicyReport: Tells every session about the mode now in effect, unless
+// it already knows.
+//
+static VOID PolicyReport(VOID)
+{
+    CYBERION_POLICY_MODE mode;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    ULONG latency;
+
+    ExAcquireFastMutex(&g_PolicyReportLock);
+
+    KeAcquireInStackQueuedSpinLock(&g_PolicyLock, &lockHandle);
+    mode = (CYBERION_POLICY_MODE)g_PolicyMode;
+    latency = g_PolicyChangeLatency;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (mode != g_PolicyReported) {
+        DbgPrint("CyberionDriver: Decision policy now %s (response latency %u ms).\n",
+                 (mode == PolicyModeFailOpen) ? "fail-open" : "enforce", latency);
+        CyberionSessionPublishPolicy(mode, latency);
+        g_PolicyReported = mode;
+    }
+
+    ExReleaseFastMutex(&g_PolicyReportLock);
+}
+
+VOID CyberionPolicyInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+
+    CyberionTunablesQuery(&tunables);
+
+    KeInitializeSpinLock(&g_PolicyLock);
+    ExInitializeFastMutex(&g_PolicyReportLock);
+    CyberionLatencyInitialize(&g_PolicyLatency, tunables.LatencyWindow, PolicyNow());
+    g_PolicyWindow = tunables.LatencyWindow;
+    g_PolicyMode = PolicyModeEnforce;
+    g_PolicyReported = PolicyModeEnforce;
+    g_PolicyChangeLatency = 0;
+    g_PolicyChanges = 0;
+}
+
+VOID CyberionPolicyRecord(
+    _In_ ULONG64 Waited
+)
+{
+    CYBERION_TUNABLES tunables;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    CYBERION_POLICY_MODE mode;
+    BOOLEAN changed = FALSE;
+    ULONG64 now = PolicyNow();
+    ULONG latency;
+    ULONG samples;
+
+    CyberionTunablesQuery(&tunables);
+
+    KeAcquireInStackQueuedSpinLock(&g_PolicyLock, &lockHandle);
+
+    if (g_PolicyWindow != tunables.LatencyWindow) {
+        CyberionLatencyInitialize(&g_PolicyLatency, tunables.LatencyWindow, now);
+        g_PolicyWindow = tunables.LatencyWindow;
+    }
+
+    CyberionLatencyRecord(&g_PolicyLatency, now, (ULONG)min(Waited / POLICY_UNIT, MAXULONG));
+    latency = CyberionLatencyPercentile(&g_PolicyLatency, now, tunables.FailOpenPercentile, &samples);
+
+    mode = (CYBERION_POLICY_MODE)g_PolicyMode;
+    if (mode == PolicyModeEnforce) {
+        if (tunables.FailOpenBudget != 0 && samples >= POLICY_MIN_SAMPLES && latency >= tunables.FailOpenBudget) {
+            mode = PolicyModeFailOpen;
+        }
+    } else if (tunables.FailOpenBudget == 0 || latency < tunables.FailOpenRecovery) {
+        mode = PolicyModeEnforce;
+    }
+
+    if (mode != (CYBERION_POLICY_MODE)g_PolicyMode) {
+        InterlockedExchange(&g_PolicyMode, (LONG)mode);
+        g_PolicyChangeLatency = latency;
+        g_PolicyChanges++;
+        changed = TRUE;
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (changed) {
+        PolicyReport();
+    }
+}
+
+CYBERION_POLICY_MODE CyberionPolicyMode(VOID)
+{
+    return (CYBERION_POLICY_MODE)ReadNoFence(&g_PolicyMode);
+}
+
+VOID CyberionPolicyQueryStatistics(
+    _Inout_ PCYBERION_VERDICT_STATISTICS Statistics
+)
+{
+    CYBERION_TUNABLES tunables;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    ULONG samples;
+
+    CyberionTunablesQuery(&tunables);
+
+    KeAcquireInStackQueuedSpinLock(&g_PolicyLock, &lockHandle);
+    Statistics->PolicyMode = (ULONG64)g_PolicyMode;
+    Statistics->PolicyChanges = g_PolicyChanges;
+    Statistics->ResponseLatency = CyberionLatencyPercentile(&g_PolicyLatency, PolicyNow(), tunables.FailOpenPercentile, &samples);
+    Statistics->ResponseSamples = samples;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+}
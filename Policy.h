@@ -0,0 +1,33 @@
+/*
+ * POLICY.H
+ *
+ * Adaptive decision policy. The latency of USER_RESPONSEs to held events
+ * decides whether unanswered events get DefaultDecision (enforce) or
+ * nothing (fail open), so a stalled service cannot make the driver act on
+ * every process it was too slow to judge.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+
+VOID CyberionPolicyInitialize(VOID);
+
+//
+// CyberionPolicyRecord: Adds the time a held event waited for its answer,
+// in 100ns units, and switches the policy if the budgets say so. A timeout
+// counts as an answer after that long. Called at PASSIVE_LEVEL.
+//
+VOID CyberionPolicyRecord(_In_ ULONG64 Waited);
+
+//
+// CyberionPolicyMode: Returns the policy in effect.
+//
+CYBERION_POLICY_MODE CyberionPolicyMode(VOID);
+
+//
+// CyberionPolicyQueryStatistics: Fills in the policy counters of
+// Statistics.
+//
+VOID CyberionPolicyQueryStatistics(_Inout_ PCYBERION_VERDICT_STATISTICS Statistics);
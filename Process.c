@@ -0,0 +1,369 @@
+/*
+ * PROCESS.C
+ *
+ * Live process table for the Cyberion driver.
+ *
+ * Records come from a fixed-size slab and are chained in a small hash of
+ * process IDs under one spin lock; every operation is a short walk of one
+ * chain, except CyberionProcessHashKnown, which runs once per hashed file
+ * and walks them all.
+ *
+ * Each record also links to the record of its parent, found by ID when it
+ * is made, and lists the records of its children, so descendants are
+ * found without searching. A process that exits while some of its
+ * children are recorded keeps its record, marked exited and ignored by
+ * lookups by ID, until the last of them goes; a grandchild is then still
+ * reached after its parent has exited. A process ID is reused once its
+ * process has exited, so records also carry the process's start key,
+ * which is not.
+ */
+
+#include "Process.h"
+#include "Slab.h"
+#include "Tunables.h"
+
+#define PROCESS_TABLE_BUCKETS 256 // A power of two
+
+typedef struct _CYBERION_PROCESS {
+    LIST_ENTRY Link;                    // Entry in g_ProcessTable
+    LIST_ENTRY Children;                // Records of the processes it started
+    LIST_ENTRY Sibling;                 // Entry in Parent->Children
+    struct _CYBERION_PROCESS *Parent;   // NULL if the parent was not recorded
+    HANDLE ProcessId;
+    ULONG64 ProcessKey;                 // PsGetProcessStartKey
+    BOOLEAN Exited;                     // Kept only while Children is not empty
+    CYBERION_FILE_IDENTITY Identity;
+    BOOLEAN IdentityValid;
+    BOOLEAN HashValid;
+    UCHAR PendingVerdict;               // Decision waiting for the hash
+    UCHAR Hash[CYBERION_HASH_SIZE];
+    CYBERION_TOKEN_INFO Token;
+} CYBERION_PROCESS, *PCYBERION_PROCESS;
+
+//
+// Globals
+//
+static CYBERION_SLAB g_ProcessRecords; // Backing store for CYBERION_PROCESS records
+static KSPIN_LOCK g_ProcessTableLock;
+static LIST_ENTRY g_ProcessTable[PROCESS_TABLE_BUCKETS]; // Processes by ID
+
+FORCEINLINE PLIST_ENTRY ProcessBucket(_In_ HANDLE ProcessId)
+{
+    // Process IDs are multiples of four
+    return &g_ProcessTable[((ULONG_PTR)ProcessId >> 2) & (PROCESS_TABLE_BUCKETS - 1)];
+}
+
+//
+// ProcessFindKey: Finds the record of the live process with this ID or, if
+// ProcessKey is not 0, of the process with this ID and start key, exited
+// or not. Caller holds g_ProcessTableLock.
+//
+static PCYBERION_PROCESS ProcessFindKey(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey
+)
+{
+    PLIST_ENTRY bucket = ProcessBucket(ProcessId);
+    PLIST_ENTRY entry;
+
+    for (entry = bucket->Flink; entry != bucket; entry = entry->Flink) {
+        PCYBERION_PROCESS process = CONTAINING_RECORD(entry, CYBERION_PROCESS, Link);
+
+        if (process->ProcessId == ProcessId &&
+            ((ProcessKey == 0) ? !process->Exited : process->ProcessKey == ProcessKey)) {
+            return process;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// ProcessFind: Finds the record of the live process with this ID. Caller
+// holds g_ProcessTableLock.
+//
+FORCEINLINE PCYBERION_PROCESS ProcessFind(_In_ HANDLE ProcessId)
+{
+    return ProcessFindKey(ProcessId, 0);
+}
+
+//
+// ProcessExit: Marks a record exited and moves every record no longer
+// needed, it and then its exited ancestors, to Released. Caller holds
+// g_ProcessTableLock.
+//
+static VOID ProcessExit(
+    _Inout_ PCYBERION_PROCESS Process,
+    _Inout_ PLIST_ENTRY Released
+)
+{
+    Process->Exited = TRUE;
+
+    while (Process && Process->Exited && IsListEmpty(&Process->Children)) {
+        PCYBERION_PROCESS parent = Process->Parent;
+
+        RemoveEntryList(&Process->Link);
+        if (parent) {
+            RemoveEntryList(&Process->Sibling);
+        }
+
+        InsertTailList(Released, &Process->Link);
+        Process = parent;
+    }
+}
+
+//
+// ProcessFreeReleased: Frees the records ProcessExit released.
+//
+static VOID ProcessFreeReleased(
+    _Inout_ PLIST_ENTRY Released
+)
+{
+    while (!IsListEmpty(Released)) {
+        CyberionSlabFree(&g_ProcessRecords, CONTAINING_RECORD(RemoveHeadList(Released), CYBERION_PROCESS, Link));
+    }
+}
+
+NTSTATUS CyberionProcessInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+    ULONG i;
+
+    CyberionTunablesQuery(&tunables);
+
+    KeInitializeSpinLock(&g_ProcessTableLock);
+    for (i = 0; i < PROCESS_TABLE_BUCKETS; i++) {
+        InitializeListHead(&g_ProcessTable[i]);
+    }
+
+    return CyberionSlabInitialize(&g_ProcessRecords, sizeof(CYBERION_PROCESS), tunables.ProcessTableSize);
+}
+
+VOID CyberionProcessShutdown(VOID)
+{
+    CyberionSlabDestroy(&g_ProcessRecords);
+}
+
+VOID CyberionProcessInsert(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ HANDLE ParentProcessId,
+    _In_ const CYBERION_IMAGE_INFO *Image,
+    _In_ const CYBERION_TOKEN_INFO *Token
+)
+{
+    PCYBERION_PROCESS process;
+    PCYBERION_PROCESS stale;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    LIST_ENTRY released;
+
+    process = (PCYBERION_PROCESS)CyberionSlabAllocate(&g_ProcessRecords);
+    if (process == NULL) {
+        // Never leave an earlier process's record under a reused ID
+        CyberionProcessRemove(ProcessId);
+        return;
+    }
+
+    RtlZeroMemory(process, sizeof(*process));
+    InitializeListHead(&process->Children);
+    process->ProcessId = ProcessId;
+    process->ProcessKey = ProcessKey;
+    process->Identity = Image->Identity;
+    process->IdentityValid = Image->IdentityValid;
+    process->HashValid = Image->HashValid;
+    process->PendingVerdict = VerdictUnknown;
+    RtlCopyMemory(process->Hash, Image->Hash, CYBERION_HASH_SIZE);
+    process->Token = *Token;
+
+    InitializeListHead(&released);
+
+    KeAcquireInStackQueuedSpinLock(&g_ProcessTableLock, &lockHandle);
+
+    // An exit we never saw (the table was full) leaves a stale record
+    stale = ProcessFind(ProcessId);
+    if (stale) {
+        ProcessExit(stale, &released);
+    }
+
+    // The parent is alive while its child is being created, so the live
+    // record under its ID is its own
+    process->Parent = ProcessFind(ParentProcessId);
+    if (process->Parent) {
+        InsertTailList(&process->Parent->Children, &process->Sibling);
+    }
+
+    InsertHeadList(ProcessBucket(ProcessId), &process->Link);
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    ProcessFreeReleased(&released);
+}
+
+VOID CyberionProcessRemove(
+    _In_ HANDLE ProcessId
+)
+{
+    PCYBERION_PROCESS process;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    LIST_ENTRY released;
+
+    InitializeListHead(&released);
+
+    KeAcquireInStackQueuedSpinLock(&g_ProcessTableLock, &lockHandle);
+
+    process = ProcessFind(ProcessId);
+    if (process) {
+        ProcessExit(process, &released);
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    ProcessFreeReleased(&released);
+}
+
+VOID CyberionProcessQueryToken(
+    _In_ HANDLE ProcessId,
+    _Out_ PCYBERION_TOKEN_INFO Token
+)
+{
+    PCYBERION_PROCESS process;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    PEPROCESS object;
+    BOOLEAN found = FALSE;
+
+    KeAcquireInStackQueuedSpinLock(&g_ProcessTableLock, &lockHandle);
+
+    process = ProcessFind(ProcessId);
+    if (process) {
+        *Token = process->Token;
+        found = TRUE;
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (found) {
+        return;
+    }
+
+    if (NT_SUCCESS(PsLookupProcessByProcessId(ProcessId, &object))) {
+        CyberionTokenCapture(object, Token);
+        ObDereferenceObject(object);
+    } else {
+        RtlZeroMemory(Token, sizeof(*Token));
+    }
+}
+
+ULONG CyberionProcessCollectDescendants(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _Out_writes_(Capacity) PCYBERION_PROCESS_KEY Descendants,
+    _In_ ULONG Capacity
+)
+{
+    PCYBERION_PROCESS *found;
+    PCYBERION_PROCESS root;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    ULONG foundCount = 0;
+    ULONG count = 0;
+    ULONG next;
+
+    // Exited records are walked through but not returned, so there may be
+    // more of them than room for results
+    found = (PCYBERION_PROCESS *)CyberionAllocate((SIZE_T)Capacity * 2 * sizeof(PCYBERION_PROCESS));
+    if (found == NULL) {
+        return 0;
+    }
+
+    KeAcquireInStackQueuedSpinLock(&g_ProcessTableLock, &lockHandle);
+
+    root = ProcessFindKey(ProcessId, ProcessKey);
+
+    // Breadth first along the child lists; found doubles as the queue
+    for (next = 0; root && next <= foundCount && count < Capacity && foundCount < Capacity * 2; next++) {
+        PCYBERION_PROCESS parent = (next == 0) ? root : found[next - 1];
+        PLIST_ENTRY entry;
+
+        for (entry = parent->Children.Flink;
+             entry != &parent->Children && count < Capacity && foundCount < Capacity * 2;
+             entry = entry->Flink) {
+            PCYBERION_PROCESS process = CONTAINING_RECORD(entry, CYBERION_PROCESS, Sibling);
+
+            found[foundCount++] = process;
+
+            if (!process->Exited) {
+                Descendants[count].ProcessId = process->ProcessId;
+                Descendants[count].ProcessKey = process->ProcessKey;
+                count++;
+            }
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    CyberionFree(found);
+    return count;
+}
+
+NTSTATUS CyberionProcessResolveHash(
+    _In_ HANDLE ProcessId,
+    _In_ CYBERION_VERDICT Verdict,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash
+)
+{
+    PCYBERION_PROCESS process;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    NTSTATUS status = STATUS_NOT_FOUND;
+
+    KeAcquireInStackQueuedSpinLock(&g_ProcessTableLock, &lockHandle);
+
+    process = ProcessFind(ProcessId);
+    if (process && process->HashValid) {
+        RtlCopyMemory(Hash, process->Hash, CYBERION_HASH_SIZE);
+        status = STATUS_SUCCESS;
+    } else if (process && process->IdentityValid) {
+        process->PendingVerdict = (UCHAR)Verdict;
+        status = STATUS_PENDING;
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    return status;
+}
+
+CYBERION_VERDICT CyberionProcessHashKnown(
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    CYBERION_VERDICT verdict = VerdictUnknown;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    ULONG i;
+
+    KeAcquireInStackQueuedSpinLock(&g_ProcessTableLock, &lockHandle);
+
+    for (i = 0; i < PROCESS_TABLE_BUCKETS; i++) {
+        PLIST_ENTRY entry;
+
+        for (entry = g_ProcessTable[i].Flink; entry != &g_ProcessTable[i]; entry = entry->Flink) {
+            PCYBERION_PROCESS process = CONTAINING_RECORD(entry, CYBERION_PROCESS, Link);
+
+            if (process->Exited || process->HashValid || !process->IdentityValid ||
+                !RtlEqualMemory(&process->Identity, Identity, sizeof(*Identity))) {
+                continue;
+            }
+
+            RtlCopyMemory(process->Hash, Hash, CYBERION_HASH_SIZE);
+            process->HashValid = TRUE;
+
+            if (process->PendingVerdict == VerdictBlock ||
+                (process->PendingVerdict == VerdictAllow && verdict == VerdictUnknown)) {
+                verdict = (CYBERION_VERDICT)process->PendingVerdict;
+            }
+            process->PendingVerdict = VerdictUnknown;
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    return verdict;
+}
@@ -0,0 +1,94 @@
+/*
+ * PROCESS.H
+ *
+ * Table of live processes created while the driver is loaded, keyed by
+ * process ID. It remembers which image each process runs so a decision
+ * that names only a process (USER_RESPONSE) can be applied to the image's
+ * hash, including when the hash is still being computed, and which
+ * process started which, so a blocked process's descendants can be found.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+#include "Image.h"
+#include "Token.h"
+
+//
+// A process named by its ID and start key (PsGetProcessStartKey), which
+// together stay unique after the ID is reused.
+//
+typedef struct _CYBERION_PROCESS_KEY {
+    HANDLE ProcessId;
+    ULONG64 ProcessKey;
+} CYBERION_PROCESS_KEY, *PCYBERION_PROCESS_KEY;
+
+NTSTATUS CyberionProcessInitialize(VOID);
+VOID CyberionProcessShutdown(VOID);
+
+//
+// CyberionProcessInsert: Records a process being created. Silently does
+// nothing if the table is full.
+//
+VOID CyberionProcessInsert(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ HANDLE ParentProcessId,
+    _In_ const CYBERION_IMAGE_INFO *Image,
+    _In_ const CYBERION_TOKEN_INFO *Token
+);
+
+//
+// CyberionProcessRemove: Forgets a process that exited.
+//
+VOID CyberionProcessRemove(_In_ HANDLE ProcessId);
+
+//
+// CyberionProcessQueryToken: Returns the token information recorded for a
+// process, or reads it from the process's token if it was never recorded
+// (it started before the driver, or the table was full). Called at
+// PASSIVE_LEVEL.
+//
+VOID CyberionProcessQueryToken(
+    _In_ HANDLE ProcessId,
+    _Out_ PCYBERION_TOKEN_INFO Token
+);
+
+//
+// CyberionProcessCollectDescendants: Writes at most Capacity live recorded
+// processes descended from a process into Descendants, parents before
+// their children, and returns how many there are. Descent runs through
+// processes that have exited since. The process is the live one with
+// ProcessId if ProcessKey is 0, otherwise the one with that start key,
+// which may have exited. Called at PASSIVE_LEVEL.
+//
+ULONG CyberionProcessCollectDescendants(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _Out_writes_(Capacity) PCYBERION_PROCESS_KEY Descendants,
+    _In_ ULONG Capacity
+);
+
+//
+// CyberionProcessResolveHash: Finds the image hash of a process for a
+// decision. Returns STATUS_SUCCESS with the hash when it is known. If the
+// hash is still being computed, Verdict is parked on the process and
+// STATUS_PENDING is returned; CyberionProcessHashKnown hands it back once
+// the hash arrives. Returns STATUS_NOT_FOUND for unknown processes.
+//
+NTSTATUS CyberionProcessResolveHash(
+    _In_ HANDLE ProcessId,
+    _In_ CYBERION_VERDICT Verdict,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash
+);
+
+//
+// CyberionProcessHashKnown: Attaches a newly computed hash to every process
+// running the file and returns the strongest verdict parked on any of them
+// (Block over Allow), or VerdictUnknown.
+//
+CYBERION_VERDICT CyberionProcessHashKnown(
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
@@ -22,34 +22,202 @@ DEFINE_GUID(GUID_DEVINTERFACE_CYBERION,
 //
 // Custom IOCTL Codes
 //
+// Each handle opened on the device is an independent subscriber session
+// with its own event queue and filter. Only SYSTEM and administrators can
+// open the device. Requests that change driver-wide state also fail with
+// STATUS_ACCESS_DENIED unless the caller is an elevated administrator or
+// holds SeTcbPrivilege.
+//
 // IOCTL_CYBERION_GET_PROCESS_INFO:
 //   User-mode service calls this to wait for a new process notification.
-//   This is a blocking (pending) IOCTL.
+//   This is a blocking (pending) IOCTL. The output buffer receives as many
+//   records as fit (at most CYBERION_MAX_BATCH), each the first
+//   PROCESS_CREATION_INFO_BASE_SIZE bytes of a PROCESS_CREATION_INFO, the
+//   layout this request has always returned. IoStatus.Information is the
+//   number of bytes returned.
+//
+// IOCTL_CYBERION_GET_EVENTS:
+//   The same, except that each record is a whole PROCESS_CREATION_INFO.
+//   Its Size gives its length: later versions of the driver only append
+//   fields, so readers step through a batch by Size. Besides process
+//   creations, every handle that reads this way receives an
+//   EventTypePolicyChange record when the decision policy changes,
+//   whatever its filter; GET_PROCESS_INFO never returns one.
 //
 // IOCTL_CYBERION_SEND_RESPONSE:
 //   User-mode service calls this to send the user's decision (allow/block)
-//   for a specific process.
+//   for a specific process. The decision is remembered for the process's
+//   image hash and applied to every later launch. Creations are not held
+//   for a decision, so an unknown image runs until its Block arrives; Block
+//   then terminates the process, and with TerminateDescendants set, every
+//   process descended from it that started since the driver loaded, even
+//   through processes that have since exited. For an event a filter held
+//   (FilterVerdictHold), a response is expected within DecisionTimeout;
+//   if none arrives, DefaultDecision is applied as if it had. A response
+//   giving the event's ProcessKey is refused with STATUS_NOT_FOUND once the
+//   process has exited, even if its PID was reused; older callers may send
+//   the structure without ProcessKey.
+//   The driver tracks the FailOpenPercentile latency of these responses,
+//   counting a timeout as a response after DecisionTimeout. Once it
+//   reaches FailOpenBudget the driver fails open: held events expire
+//   without DefaultDecision being applied, until that latency drops below
+//   FailOpenRecovery again. Unless FailOpenBudget is 0, which never fails
+//   open, FailOpenRecovery must be below it and DecisionTimeout at least
+//   as long.
+//
+// IOCTL_CYBERION_SET_FILTER:
+//   Installs an event filter program (CYBERION_FILTER_PROGRAM) for the
+//   calling handle. The driver verifies the program before accepting it.
+//   An empty program removes the current filter.
+//
+// IOCTL_CYBERION_GET_SESSION_STATS:
+//   Returns delivery counters (CYBERION_SESSION_STATISTICS) for the calling
+//   handle.
+//
+// IOCTL_CYBERION_SET_DELIVERY:
+//   Sets how the calling handle's reads are coalesced
+//   (CYBERION_DELIVERY_SETTINGS). A pending read completes once BatchSize
+//   events are queued, or BatchTimeout microseconds after the first one was.
+//
+// IOCTL_CYBERION_GET_TUNABLES / IOCTL_CYBERION_SET_TUNABLES:
+//   Read or change the driver-wide settings (CYBERION_TUNABLES). Defaults
+//   come from DWORD values of the same names under the service key. A
+//   change with any value out of range or inconsistent with the others
+//   fails with STATUS_INVALID_PARAMETER and changes nothing.
+//
+// IOCTL_CYBERION_SET_RULE:
+//   Pins an administrator verdict for an image hash (CYBERION_VERDICT_RULE).
+//   Rules are never evicted or expired, and USER_RESPONSE decisions do not
+//   override them. VerdictUnknown removes the hash's entry.
+//
+// IOCTL_CYBERION_GET_VERDICT_STATS:
+//   Returns the verdict store's size and counters, and those of the image
+//   hash cache in front of it and of background hashing
+//   (CYBERION_VERDICT_STATISTICS).
+//
+// IOCTL_CYBERION_PRELOAD_VERDICTS:
+//   Replaces the preloaded verdict list in one step. The input buffer is a
+//   CYBERION_PRELOAD_HEADER; the output buffer, which the driver only reads,
+//   holds the list in the given Format. A Count of zero removes the list.
+//   Recorded responses and rules take precedence over the list.
+//
+// IOCTL_CYBERION_EXPORT_VERDICTS:
+//   Writes the recorded verdicts as a verdict store image (see
+//   CYBERION_STORE_HEADER) into the output buffer, for the service to save
+//   and preload after the next restart. Allow decisions with a lifetime are
+//   not exported. Fails with STATUS_BUFFER_TOO_SMALL if the image does not
+//   fit; an image for the table's Capacity always does.
+//
+// IOCTL_CYBERION_SET_PATH_RULES:
+//   Replaces the image path rules in one step (CYBERION_PATH_RULE_SET). The
+//   driver compiles every rule into one automaton, so a creation is checked
+//   against all of them in a single pass over its image path. A Count of
+//   zero removes the rules.
+//
+// IOCTL_CYBERION_SET_ARGUMENT_PATTERNS:
+//   Replaces the command line patterns in one step
+//   (CYBERION_ARGUMENT_PATTERN_SET). Every command line is scanned for all
+//   of them in one pass as the process is created. A Count of zero removes
+//   the patterns.
+//
+// IOCTL_CYBERION_GET_EVENT_DETAILS:
+//   Returns fields of an event too large to copy into every record, such
+//   as its whole command line (CYBERION_DETAILS_REQUEST in,
+//   CYBERION_EVENT_DETAILS out). The driver keeps them for DetailRetention
+//   milliseconds, or less if DetailStoreSize fills first; after that the
+//   request fails with STATUS_NOT_FOUND. If the output buffer only holds
+//   the header, the request returns STATUS_BUFFER_OVERFLOW and the header's
+//   Size.
+//
+// IOCTL_CYBERION_GET_SID:
+//   Resolves a user Id from an event (PROCESS_CREATION_INFO.UserId) to the
+//   SID it stands for. The input buffer is the ULONG Id; the output buffer
+//   receives the SID, at most CYBERION_MAX_SID_SIZE bytes. An Id always
+//   stands for the same SID while the driver is loaded.
 //
 #define IOCTL_CYBERION_GET_PROCESS_INFO CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_READ_DATA)
 #define IOCTL_CYBERION_SEND_RESPONSE    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_SET_FILTER       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_GET_SESSION_STATS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_CYBERION_SET_DELIVERY     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_GET_TUNABLES     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_CYBERION_SET_TUNABLES     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_BUFFERED, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_SET_RULE         CTL_CODE(FILE_DEVICE_UNKNOWN, 0x808, METHOD_BUFFERED, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_GET_VERDICT_STATS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x809, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_CYBERION_PRELOAD_VERDICTS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80A, METHOD_IN_DIRECT, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_EXPORT_VERDICTS  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80B, METHOD_OUT_DIRECT, FILE_READ_DATA)
+#define IOCTL_CYBERION_SET_PATH_RULES   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80C, METHOD_BUFFERED, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_SET_ARGUMENT_PATTERNS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80D, METHOD_BUFFERED, FILE_WRITE_DATA)
+#define IOCTL_CYBERION_GET_EVENT_DETAILS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80E, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_CYBERION_GET_SID          CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80F, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_CYBERION_GET_EVENTS       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x810, METHOD_BUFFERED, FILE_READ_DATA)
 
 
 //
 // Shared Data Structures
 //
 
+//
+// Image hashes are SHA-256 digests. A verdict is what the driver currently
+// knows about an image hash.
+//
+#define CYBERION_HASH_SIZE 32
+
+typedef enum _CYBERION_VERDICT {
+    VerdictUnknown,     // No decision has been recorded for the image
+    VerdictAllow,       // The image is allowlisted
+    VerdictBlock        // The image is blocklisted; its creation is denied
+} CYBERION_VERDICT;
+
+typedef enum _CYBERION_EVENT_TYPE {
+    EventTypeProcessCreation,   // A process was created
+    EventTypePolicyChange       // The decision policy changed; only the policy fields are set
+} CYBERION_EVENT_TYPE;
+
+//
+// How the driver treats held events nobody answers in time.
+//
+typedef enum _CYBERION_POLICY_MODE {
+    PolicyModeEnforce,  // DefaultDecision is applied
+    PolicyModeFailOpen  // Nothing is applied; responses are too slow to wait for
+} CYBERION_POLICY_MODE;
+
 //
 // Structure for passing process creation data from kernel to user mode.
-// We use fixed-size arrays to simplify marshalling.
+// We use fixed-size arrays to simplify marshalling. New fields are only
+// ever added at the end.
 //
 #define MAX_PATH_SIZE 260
+#define CYBERION_MAX_ARGUMENT_MATCHES   8   // Pattern Ids reported per event
+#define CYBERION_MAX_SID_SIZE           68  // SECURITY_MAX_SID_SIZE
 
 typedef struct _PROCESS_CREATION_INFO {
     HANDLE ProcessId;       // PID of the new process
     HANDLE ParentProcessId; // PID of the parent process
-    WCHAR ImageFileName[MAX_PATH_SIZE]; // Full path of the executable
+    WCHAR ImageFileName[MAX_PATH_SIZE]; // Full path of the executable, from its drive letter if it has one
+    ULONG Size;             // Bytes in the record (IOCTL_CYBERION_GET_EVENTS)
+    CYBERION_VERDICT Verdict; // Verdict known for the image at creation time
+    UCHAR ImageHash[CYBERION_HASH_SIZE]; // Image hash if already known, otherwise zero
+    USHORT VolumeLength;    // Characters of ImageFileName naming the volume ("C:"), 0 if it has no drive letter
+    USHORT CommandLineLength; // Characters in the command line (DetailFieldCommandLine)
+    ULONG ArgumentMatchCount; // Argument patterns found anywhere in the command line
+    ULONG ArgumentMatches[CYBERION_MAX_ARGUMENT_MATCHES]; // Ids of the first of them
+    ULONG64 EventId;        // Names the event to IOCTL_CYBERION_GET_EVENT_DETAILS
+    ULONG UserId;           // User SID of the process's token (IOCTL_CYBERION_GET_SID), 0 if unknown
+    ULONG IntegrityLevel;   // Mandatory label RID of its token (SECURITY_MANDATORY_*_RID)
+    ULONG ParentUserId;     // The same for the parent process
+    ULONG ParentIntegrityLevel;
+    ULONG64 ProcessKey;     // Start key of the new process, unique until reboot; echoed in USER_RESPONSE
+    CYBERION_EVENT_TYPE Type; // EventTypePolicyChange only through IOCTL_CYBERION_GET_EVENTS
+    CYBERION_POLICY_MODE PolicyMode; // Policy from now on (EventTypePolicyChange)
+    ULONG ResponseLatency;  // FailOpenPercentile response latency behind the change, milliseconds
 } PROCESS_CREATION_INFO, *PPROCESS_CREATION_INFO;
 
+//
+// Records returned by IOCTL_CYBERION_GET_PROCESS_INFO end before Size.
+//
+#define PROCESS_CREATION_INFO_BASE_SIZE FIELD_OFFSET(PROCESS_CREATION_INFO, Size)
+
 
 //
 // Structure for passing the user's response from user mode to kernel.
@@ -62,4 +230,348 @@ typedef enum _USER_RESPONSE_TYPE {
 typedef struct _USER_RESPONSE {
     HANDLE ProcessId;
     USER_RESPONSE_TYPE Response;
-} USER_RESPONSE, *PUSER_RESPONSE; 
\ No newline at end of file
+    ULONG64 ProcessKey;     // From the event, so a reused PID is not answered; 0 (or omitted) for any
+} USER_RESPONSE, *PUSER_RESPONSE;
+
+//
+// Administrator rule for IOCTL_CYBERION_SET_RULE.
+//
+typedef struct _CYBERION_VERDICT_RULE {
+    UCHAR Hash[CYBERION_HASH_SIZE];
+    CYBERION_VERDICT Verdict;   // VerdictUnknown removes the entry
+} CYBERION_VERDICT_RULE, *PCYBERION_VERDICT_RULE;
+
+//
+// Image path rules for IOCTL_CYBERION_SET_PATH_RULES. A pattern must match
+// the whole image path as events report it: C:\Windows\..., or
+// \Device\HarddiskVolume5\... on a volume with no drive letter. Case is
+// ignored:
+//   ?   any one character except '\'
+//   *   any run of characters without a '\'
+//   **  any run of characters
+// and a trailing '\' matches everything below that directory. For example
+// **\Users\*\AppData\Local\Temp\ matches any image under a user's
+// temporary directory, on any volume. A creation is denied if a matching
+// rule has VerdictBlock. The Tags of all matching rules, and the strongest
+// of their verdicts, are visible to filter programs.
+//
+#define CYBERION_MAX_PATH_RULES 1024
+
+typedef struct _CYBERION_PATH_RULE {
+    WCHAR Pattern[MAX_PATH_SIZE];   // NUL-terminated
+    CYBERION_VERDICT Verdict;       // VerdictBlock denies the creation
+    ULONG Reserved;
+    ULONG64 Tags;                   // Reported in FilterFieldPathTags on a match
+} CYBERION_PATH_RULE, *PCYBERION_PATH_RULE;
+
+typedef struct _CYBERION_PATH_RULE_SET {
+    ULONG Count;                    // At most CYBERION_MAX_PATH_RULES
+    ULONG Reserved;
+    CYBERION_PATH_RULE Rules[ANYSIZE_ARRAY];
+} CYBERION_PATH_RULE_SET, *PCYBERION_PATH_RULE_SET;
+
+//
+// Command line patterns for IOCTL_CYBERION_SET_ARGUMENT_PATTERNS. Each is
+// a literal string, found anywhere in the whole command line, ignoring
+// case (for example "-EncodedCommand" or "urlcache -split"). An event
+// reports the Ids of the patterns found, and filter programs see their
+// Tags.
+//
+#define CYBERION_MAX_ARGUMENT_PATTERNS  1024
+#define CYBERION_MAX_ARGUMENT_PATTERN   64  // Characters in a pattern, with the terminator
+
+typedef struct _CYBERION_ARGUMENT_PATTERN {
+    WCHAR Text[CYBERION_MAX_ARGUMENT_PATTERN]; // NUL-terminated
+    ULONG Id;                       // Reported in PROCESS_CREATION_INFO.ArgumentMatches
+    ULONG Reserved;
+    ULONG64 Tags;                   // Reported in FilterFieldArgumentTags
+} CYBERION_ARGUMENT_PATTERN, *PCYBERION_ARGUMENT_PATTERN;
+
+typedef struct _CYBERION_ARGUMENT_PATTERN_SET {
+    ULONG Count;                    // At most CYBERION_MAX_ARGUMENT_PATTERNS
+    ULONG Reserved;
+    CYBERION_ARGUMENT_PATTERN Patterns[ANYSIZE_ARRAY];
+} CYBERION_ARGUMENT_PATTERN_SET, *PCYBERION_ARGUMENT_PATTERN_SET;
+
+//
+// IOCTL_CYBERION_GET_EVENT_DETAILS. Text fields are UTF-16 and not
+// NUL-terminated.
+//
+typedef enum _CYBERION_DETAIL_FIELD {
+    DetailFieldImageFileName,   // Whole image path, as ImageFileName gives its start
+    DetailFieldCommandLine,     // Whole command line
+    DetailFieldMax
+} CYBERION_DETAIL_FIELD;
+
+typedef struct _CYBERION_DETAILS_REQUEST {
+    ULONG64 EventId;
+    ULONG Fields;               // 1 << CYBERION_DETAIL_FIELD for each field wanted
+    ULONG Reserved;
+} CYBERION_DETAILS_REQUEST, *PCYBERION_DETAILS_REQUEST;
+
+typedef struct _CYBERION_DETAIL_RANGE {
+    ULONG Offset;               // Bytes from the start of CYBERION_EVENT_DETAILS
+    ULONG Size;                 // Bytes
+} CYBERION_DETAIL_RANGE, *PCYBERION_DETAIL_RANGE;
+
+typedef struct _CYBERION_EVENT_DETAILS {
+    ULONG64 EventId;
+    ULONG Size;                 // Bytes of the whole reply, this header included
+    ULONG Fields;               // Requested fields the event has; the others are empty
+    CYBERION_DETAIL_RANGE Ranges[DetailFieldMax];
+} CYBERION_EVENT_DETAILS, *PCYBERION_EVENT_DETAILS;
+
+//
+// Header for IOCTL_CYBERION_PRELOAD_VERDICTS. The formats trade memory for
+// lookup time: per hash, a sorted list takes 41 bytes in the driver and
+// about 100-400 ns to search (64K-4M hashes), a perfect hash 34 bytes and
+// 40-140 ns, and a store about 80 bytes and 30-120 ns.
+//
+#define CYBERION_MAX_PRELOAD 16777216 // Hashes in one preloaded list
+
+typedef enum _CYBERION_PRELOAD_FORMAT {
+    PreloadFormatSortedList,    // Count ascending hashes, then Count verdict bytes
+    PreloadFormatStore,         // A verdict store image holding Count hashes
+    PreloadFormatPerfect,       // A perfect hash image holding Count hashes
+    PreloadFormatMax
+} CYBERION_PRELOAD_FORMAT;
+
+typedef struct _CYBERION_PRELOAD_HEADER {
+    ULONG Count;                // Hashes in the list, at most CYBERION_MAX_PRELOAD
+    ULONG Format;               // CYBERION_PRELOAD_FORMAT
+} CYBERION_PRELOAD_HEADER, *PCYBERION_PRELOAD_HEADER;
+
+//
+// Verdict store image: the on-disk form of a verdict list, designed to be
+// mapped and used in place. A fixed header is followed by SlotCount
+// entries forming an open-addressed hash table: an entry's home slot is
+// its hash's first eight bytes (little endian) modulo SlotCount, and it
+// lies at most MaxProbe slots further on. Empty slots have verdict
+// VerdictUnknown. Checksum is the SHA-256 of the header up to Checksum
+// followed by all slots.
+//
+#define CYBERION_STORE_MAGIC    0x53565943  // 'CYVS'
+#define CYBERION_STORE_VERSION  1
+
+typedef struct _CYBERION_STORE_HEADER {
+    ULONG Magic;                // CYBERION_STORE_MAGIC
+    ULONG Version;              // CYBERION_STORE_VERSION
+    ULONG HeaderSize;           // sizeof(CYBERION_STORE_HEADER)
+    ULONG EntrySize;            // sizeof(CYBERION_STORE_ENTRY)
+    ULONG SlotCount;            // A power of two
+    ULONG Count;                // Occupied slots
+    ULONG MaxProbe;             // Longest distance from an entry's home slot
+    ULONG Reserved;
+    UCHAR Checksum[CYBERION_HASH_SIZE];
+} CYBERION_STORE_HEADER, *PCYBERION_STORE_HEADER;
+
+typedef struct _CYBERION_STORE_ENTRY {
+    UCHAR Hash[CYBERION_HASH_SIZE];
+    UCHAR Verdict;              // CYBERION_VERDICT; VerdictUnknown if empty
+    UCHAR Reserved[7];
+} CYBERION_STORE_ENTRY, *PCYBERION_STORE_ENTRY;
+
+//
+// Perfect hash image: a static verdict list compiled offline so that every
+// listed hash has a slot of its own. A fixed header is followed by
+// BucketCount displacement values (ULONG), then Count hashes in slot order,
+// then their Count verdict bytes. For a hash, with Mix the splitmix64
+// finalizer and Wn its n-th eight bytes (little endian):
+//   bucket = Mix(W0 ^ Seed) % BucketCount
+//   d1 = Displacements[bucket] / Count, d2 = Displacements[bucket] % Count
+//   slot = (Mix(W1 ^ Seed) + d1 * (Mix(W2 ^ Seed) % Count) + d2) % Count
+// and the hash is listed if and only if the hash in that slot equals it.
+// Checksum is the SHA-256 of the header up to Checksum followed by the rest
+// of the image.
+//
+#define CYBERION_PERFECT_MAGIC      0x48505943  // 'CYPH'
+#define CYBERION_PERFECT_VERSION    1
+
+typedef struct _CYBERION_PERFECT_HEADER {
+    ULONG Magic;                // CYBERION_PERFECT_MAGIC
+    ULONG Version;              // CYBERION_PERFECT_VERSION
+    ULONG HeaderSize;           // sizeof(CYBERION_PERFECT_HEADER)
+    ULONG Count;                // Hashes, and slots
+    ULONG BucketCount;
+    ULONG Reserved;
+    ULONG64 Seed;
+    UCHAR Checksum[CYBERION_HASH_SIZE];
+} CYBERION_PERFECT_HEADER, *PCYBERION_PERFECT_HEADER;
+
+//
+// Verdict store counters returned by IOCTL_CYBERION_GET_VERDICT_STATS.
+//
+typedef struct _CYBERION_VERDICT_STATISTICS {
+    ULONG Capacity;             // Most image hashes the store holds
+    ULONG Count;                // Image hashes currently recorded
+    ULONG Pinned;               // Of which administrator rules
+    ULONG Preloaded;            // Hashes in the preloaded list
+    ULONG64 MemoryBytes;        // Non-paged memory used by the store
+    ULONG64 Hits;               // Lookups that found a recorded verdict
+    ULONG64 Misses;             // Lookups that did not (the list is searched next)
+    ULONG64 Expired;            // Misses on an allow decision past its TTL
+    ULONG64 Insertions;         // Verdicts recorded or replaced
+    ULONG64 Evictions;          // Verdicts dropped to stay within Capacity
+    ULONG64 IdentityCacheHits;  // Launches whose image hash was already known
+    ULONG64 IdentityCacheMisses; // Launches whose image had to be hashed
+    ULONG64 IdentityCacheInsertions; // Image hashes recorded
+    ULONG64 IdentityCacheEvictions; // Image hashes dropped to make room
+    ULONG64 HashSubmitted;      // Images queued for background hashing
+    ULONG64 HashCoalesced;      // Images not queued because they already were, or were being hashed
+    ULONG64 HashRejected;       // Images not queued because HashQueueDepth was reached
+    ULONG64 HashCompleted;      // Image hashes computed and recorded
+    ULONG64 HashFailed;         // Images that could not be hashed
+    ULONG64 HashStale;          // Hashes discarded because the file changed meanwhile
+    ULONG64 FilterRejected;     // Misses decided without probing the store
+    ULONG64 FilterFalsePositives; // Misses the filter could not rule out
+    ULONG64 Terminated;         // Processes terminated by Block responses
+    ULONG64 DecisionsPending;   // Held events still waiting for a USER_RESPONSE
+    ULONG64 DecisionTimeouts;   // Held events that got none within DecisionTimeout
+    ULONG64 PolicyMode;         // CYBERION_POLICY_MODE in effect
+    ULONG64 PolicyChanges;      // Times it changed
+    ULONG64 ResponseLatency;    // FailOpenPercentile response latency, milliseconds
+    ULONG64 ResponseSamples;    // Responses and timeouts it was taken from
+} CYBERION_VERDICT_STATISTICS, *PCYBERION_VERDICT_STATISTICS;
+
+
+//
+// Per-handle delivery counters returned by IOCTL_CYBERION_GET_SESSION_STATS.
+//
+typedef struct _CYBERION_SESSION_STATISTICS {
+    ULONG64 EventsDelivered;    // Events handed to a reader
+    ULONG64 EventsFiltered;     // Events dropped by the session's filter
+    ULONG64 EventsDropped;      // Events lost because the queue was full
+    ULONG QueuedEvents;         // Events currently waiting in the queue
+    ULONG QueueCapacity;        // Maximum number of queued events
+    ULONG64 ReadsCompleted;     // Reader IRPs completed with events
+} CYBERION_SESSION_STATISTICS, *PCYBERION_SESSION_STATISTICS;
+
+
+//
+// Read coalescing settings for IOCTL_CYBERION_SET_DELIVERY. The defaults
+// (BatchSize 1, BatchTimeout 0) complete a read for every event. A zero
+// BatchTimeout never delays a read, whatever the BatchSize.
+//
+#define CYBERION_MAX_BATCH          64          // Records returned by one read
+#define CYBERION_MAX_BATCH_TIMEOUT  1000000     // One second, in microseconds
+
+typedef struct _CYBERION_DELIVERY_SETTINGS {
+    ULONG BatchSize;        // 1..CYBERION_MAX_BATCH events per completion
+    ULONG BatchTimeout;     // Microseconds to wait after the first queued event
+} CYBERION_DELIVERY_SETTINGS, *PCYBERION_DELIVERY_SETTINGS;
+
+
+//
+// Event filter programs
+//
+// A filter is a short program for a small register machine that the driver
+// runs on every process creation to decide whether the event is delivered,
+// dropped or held. Programs are loop-free: jumps only go forward, so a
+// program never executes more instructions than it contains.
+//
+// Every instruction operates on 64-bit registers. Arithmetic and jumps
+// compare Dst with Src, or with Immediate when FILTER_INSN_IMMEDIATE is set.
+// Comparisons are unsigned. A conditional jump continues at
+// (next instruction + Offset) when its condition holds.
+//
+#define CYBERION_FILTER_MAX_INSNS   256
+#define CYBERION_FILTER_REGISTERS   8
+
+typedef enum _CYBERION_FILTER_OPCODE {
+    FilterOpMove,           // Dst = Src
+    FilterOpLoadField,      // Dst = event field selected by Immediate
+    FilterOpAdd,            // Dst += Src
+    FilterOpSub,            // Dst -= Src
+    FilterOpAnd,            // Dst &= Src
+    FilterOpOr,             // Dst |= Src
+    FilterOpXor,            // Dst ^= Src
+    FilterOpLsh,            // Dst <<= Src (modulo 64)
+    FilterOpRsh,            // Dst >>= Src (modulo 64)
+    FilterOpJump,           // Unconditional jump
+    FilterOpJumpEq,         // Jump if Dst == Src
+    FilterOpJumpNe,         // Jump if Dst != Src
+    FilterOpJumpGt,         // Jump if Dst > Src
+    FilterOpJumpGe,         // Jump if Dst >= Src
+    FilterOpJumpLt,         // Jump if Dst < Src
+    FilterOpJumpLe,         // Jump if Dst <= Src
+    FilterOpJumpSet,        // Jump if (Dst & Src) != 0
+    FilterOpReturn,         // Finish with verdict Src
+    FilterOpMax
+} CYBERION_FILTER_OPCODE;
+
+#define FILTER_INSN_IMMEDIATE 0x01 // Use Immediate instead of register Src
+
+typedef struct _CYBERION_FILTER_INSN {
+    UCHAR Opcode;       // CYBERION_FILTER_OPCODE
+    UCHAR Dst;          // Destination / left operand register
+    UCHAR Src;          // Source / right operand register
+    UCHAR Flags;        // FILTER_INSN_* flags
+    ULONG Offset;       // Jumps: forward distance from the next instruction
+    ULONG64 Immediate;  // Constant operand, field selector or verdict
+} CYBERION_FILTER_INSN, *PCYBERION_FILTER_INSN;
+
+//
+// Event fields readable with FilterOpLoadField. Values are zero-extended
+// into the destination register.
+//
+typedef enum _CYBERION_FILTER_FIELD {
+    FilterFieldProcessId,               // PID of the new process
+    FilterFieldParentProcessId,         // PID of the parent process
+    FilterFieldCreatingProcessId,       // PID of the process that called CreateProcess
+    FilterFieldCreatingThreadId,        // TID of the thread that called CreateProcess
+    FilterFieldImageNameLength,         // Length of the image path in bytes
+    FilterFieldFileOpenNameAvailable,   // 1 if the image path is the name used to open the file
+    FilterFieldIsSubsystemProcess,      // 1 for WSL/pico processes
+    FilterFieldImageVerdict,            // CYBERION_VERDICT already known for the image
+    FilterFieldPathVerdict,             // Strongest CYBERION_VERDICT of the matching path rules
+    FilterFieldPathTags,                // Tags of the matching path rules, ORed together
+    FilterFieldCommandLineLength,       // Length of the command line in characters
+    FilterFieldArgumentMatchCount,      // Argument patterns found in the command line
+    FilterFieldArgumentTags,            // Tags of those patterns, ORed together
+    FilterFieldUserId,                  // Id of the user SID of the process's token, 0 if unknown
+    FilterFieldIntegrityLevel,          // Mandatory label RID of the process's token
+    FilterFieldParentUserId,            // Id of the user SID of the parent's token, 0 if unknown
+    FilterFieldParentIntegrityLevel,    // Mandatory label RID of the parent's token
+    FilterFieldMax
+} CYBERION_FILTER_FIELD;
+
+typedef enum _CYBERION_FILTER_VERDICT {
+    FilterVerdictDeliver,   // Queue the event for user mode
+    FilterVerdictDrop,      // Discard the event
+    FilterVerdictHold,      // Deliver and expect a USER_RESPONSE within DecisionTimeout
+    FilterVerdictMax
+} CYBERION_FILTER_VERDICT;
+
+typedef struct _CYBERION_FILTER_PROGRAM {
+    ULONG InstructionCount;
+    ULONG Reserved;
+    CYBERION_FILTER_INSN Instructions[ANYSIZE_ARRAY];
+} CYBERION_FILTER_PROGRAM, *PCYBERION_FILTER_PROGRAM;
+
+
+//
+// Driver-wide settings for IOCTL_CYBERION_GET/SET_TUNABLES. Fields marked
+// load-time can only be changed in the registry and take effect on the next
+// driver load; IOCTL_CYBERION_SET_TUNABLES rejects a different value.
+//
+typedef struct _CYBERION_TUNABLES {
+    ULONG QueueCapacity;    // Events buffered per session (resized live)
+    ULONG EventPoolSize;    // Event records shared by all sessions (load-time)
+    ULONG BatchSize;        // Default BatchSize for new sessions
+    ULONG BatchTimeout;     // Default BatchTimeout for new sessions, microseconds
+    ULONG IdentityCacheSize; // Image hashes remembered by file identity (load-time)
+    ULONG HashWorkers;      // Threads hashing images in the background (load-time)
+    ULONG HashQueueDepth;   // Images waiting to be hashed (load-time)
+    ULONG ProcessTableSize; // Live processes tracked for decisions (load-time)
+    ULONG VerdictTableSize; // Most image hashes with a recorded decision (load-time)
+    ULONG VerdictAllowTtl;  // Seconds an allow decision is trusted, 0 for ever
+    ULONG DetailStoreSize;  // Kilobytes kept for IOCTL_CYBERION_GET_EVENT_DETAILS (load-time)
+    ULONG DetailRetention;  // Milliseconds event details are kept at most
+    ULONG TerminateDescendants; // 1 to terminate what a blocked process started, too
+    ULONG DecisionTimeout;  // Milliseconds a held event waits for a USER_RESPONSE
+    ULONG DefaultDecision;  // CYBERION_VERDICT applied when none arrives in time
+    ULONG FailOpenPercentile; // Percentile of response latency compared with the budgets
+    ULONG FailOpenBudget;   // Milliseconds of it that switch to PolicyModeFailOpen, 0 never
+    ULONG FailOpenRecovery; // Milliseconds it must drop below to switch back
+    ULONG LatencyWindow;    // Milliseconds of responses it is taken over
+} CYBERION_TUNABLES, *PCYBERION_TUNABLES;
@@ -0,0 +1,893 @@
+/*
+ * SESSION.C
+ *
+ * Per-handle subscriber sessions for the Cyberion driver.
+ *
+ * The process notify routine walks the session list under a shared push lock
+ * and offers each creation to every session. Accepted events are queued on
+ * the session; a waiting reader IRP is completed with a whole batch once the
+ * session's batch size is reached, or from the session's timer DPC once the
+ * oldest queued event has waited for the batch timeout. Event records are
+ * allocated at most once per creation, from a fixed-size slab, and shared
+ * between sessions by reference count.
+ */
+
+#include "Session.h"
+#include "Decision.h"
+
+//
+// Globals
+//
+static LIST_ENTRY g_SessionList; // All open sessions
+static EX_PUSH_LOCK g_SessionListLock; // Shared by publishers, exclusive for open/cleanup
+static CYBERION_SLAB g_EventSlab; // Backing store for CYBERION_EVENT records
+static volatile LONG g_SessionQueueCapacity; // Queue capacity for sessions, changed under exclusive g_SessionListLock
+
+DRIVER_CANCEL CyberionSessionCancelRead;
+KDEFERRED_ROUTINE CyberionSessionBatchDpc;
+
+//
+// CyberionSessionInitialize: Sets up the global session list and event pool.
+// Called once from DriverEntry before the process notify routine is
+// registered.
+//
+NTSTATUS CyberionSessionInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+
+    CyberionTunablesQuery(&tunables);
+
+    InitializeListHead(&g_SessionList);
+    ExInitializePushLock(&g_SessionListLock);
+    g_SessionQueueCapacity = (LONG)tunables.QueueCapacity;
+
+    return CyberionSlabInitialize(&g_EventSlab, sizeof(CYBERION_EVENT), tunables.EventPoolSize);
+}
+
+//
+// CyberionSessionShutdown: Releases the event pool. Every session must have
+// been closed.
+//
+VOID CyberionSessionShutdown(VOID)
+{
+    CyberionSlabDestroy(&g_EventSlab);
+}
+
+//
+// CyberionCreateEvent: Allocates an event record for a process creation. The
+// caller owns the initial reference.
+//
+static PCYBERION_EVENT CyberionCreateEvent(
+    _In_ const CYBERION_FILTER_CONTEXT *FilterContext,
+    _In_ ULONG64 EventId,
+    _In_ ULONG64 ProcessKey,
+    _In_ const CYBERION_IMAGE_PATH *ImagePath,
+    _In_ const CYBERION_PATTERN_MATCHES *Matches,
+    _In_ const CYBERION_IMAGE_INFO *Image
+)
+{
+    PCYBERION_EVENT event = (PCYBERION_EVENT)CyberionSlabAllocate(&g_EventSlab);
+    SIZE_T room = (MAX_PATH_SIZE - 1) * sizeof(WCHAR);
+
+    if (event == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(event, sizeof(CYBERION_EVENT));
+    event->RefCount = 1;
+    event->ArrivalTime = KeQueryInterruptTime();
+    event->Info.ProcessId = (HANDLE)(ULONG_PTR)FilterContext->ProcessId;
+    event->Info.ParentProcessId = (HANDLE)(ULONG_PTR)FilterContext->ParentProcessId;
+    event->Info.Size = sizeof(PROCESS_CREATION_INFO);
+    event->Info.Type = EventTypeProcessCreation;
+    event->Info.EventId = EventId;
+    event->Info.ProcessKey = ProcessKey;
+    event->Info.Verdict = Image->Verdict;
+
+    if (Image->HashValid) {
+        RtlCopyMemory(event->Info.ImageHash, Image->Hash, CYBERION_HASH_SIZE);
+    }
+
+    // Safely copy the image file name, always leaving room for the terminator
+    if (ImagePath->Rest.Buffer != NULL) {
+        RtlCopyMemory(event->Info.ImageFileName, ImagePath->Volume, ImagePath->VolumeLength * sizeof(WCHAR));
+        RtlCopyMemory(event->Info.ImageFileName + ImagePath->VolumeLength, ImagePath->Rest.Buffer,
+                      min(ImagePath->Rest.Length, room - ImagePath->VolumeLength * sizeof(WCHAR)));
+        event->Info.VolumeLength = ImagePath->VolumeLength;
+    }
+
+    event->Info.CommandLineLength = FilterContext->CommandLineLength;
+    event->Info.ArgumentMatchCount = Matches->Count;
+    RtlCopyMemory(event->Info.ArgumentMatches, Matches->Ids, sizeof(event->Info.ArgumentMatches));
+    event->Info.UserId = FilterContext->UserId;
+    event->Info.IntegrityLevel = FilterContext->IntegrityLevel;
+    event->Info.ParentUserId = FilterContext->ParentUserId;
+    event->Info.ParentIntegrityLevel = FilterContext->ParentIntegrityLevel;
+
+    return event;
+}
+
+FORCEINLINE VOID CyberionReferenceEvent(_In_ PCYBERION_EVENT Event)
+{
+    InterlockedIncrement(&Event->RefCount);
+}
+
+FORCEINLINE VOID CyberionReleaseEvent(_In_ PCYBERION_EVENT Event)
+{
+    if (InterlockedDecrement(&Event->RefCount) == 0) {
+        CyberionSlabFree(&g_EventSlab, Event);
+    }
+}
+
+//
+// SessionRecordSize: Bytes in each record a reader IRP receives.
+// IOCTL_CYBERION_GET_PROCESS_INFO keeps the original layout.
+//
+FORCEINLINE ULONG SessionRecordSize(_In_ PIRP Irp)
+{
+    if (IoGetCurrentIrpStackLocation(Irp)->Parameters.DeviceIoControl.IoControlCode == IOCTL_CYBERION_GET_EVENTS) {
+        return sizeof(PROCESS_CREATION_INFO);
+    }
+
+    return PROCESS_CREATION_INFO_BASE_SIZE;
+}
+
+//
+// SessionReadCapacity: Number of records a reader IRP can receive.
+//
+FORCEINLINE ULONG SessionReadCapacity(_In_ PIRP Irp)
+{
+    ULONG records = IoGetCurrentIrpStackLocation(Irp)->Parameters.DeviceIoControl.OutputBufferLength / SessionRecordSize(Irp);
+    return min(records, CYBERION_MAX_BATCH);
+}
+
+//
+// SessionBatchReady: Decides whether a reader that can take Capacity records
+// should be completed now. Caller holds the session lock.
+//
+static BOOLEAN SessionBatchReady(
+    _In_ PCYBERION_SESSION Session,
+    _In_ ULONG Capacity,
+    _In_ ULONG64 Now
+)
+{
+    if (Session->QueueCount == 0) {
+        return FALSE;
+    }
+
+    if (Session->QueueCount >= min(Session->BatchSize, Capacity)) {
+        return TRUE;
+    }
+
+    return Now - Session->Queue[Session->QueueHead]->ArrivalTime >= Session->BatchTimeout;
+}
+
+//
+// SessionArmBatchTimer: Schedules the batch DPC for when the oldest queued
+// event reaches the batch timeout. Caller holds the session lock.
+//
+static VOID SessionArmBatchTimer(
+    _In_ PCYBERION_SESSION Session,
+    _In_ ULONG64 Now
+)
+{
+    ULONG64 deadline = Session->Queue[Session->QueueHead]->ArrivalTime + Session->BatchTimeout;
+    LARGE_INTEGER dueTime;
+
+    // Relative due time, at least one tick
+    dueTime.QuadPart = -(LONGLONG)max(deadline > Now ? deadline - Now : 0, 1);
+    KeSetTimer(&Session->BatchTimer, dueTime, &Session->BatchDpc);
+}
+
+//
+// SessionDequeue: Removes up to MaxEvents events from the head of the queue.
+// Caller holds the session lock.
+//
+static ULONG SessionDequeue(
+    _Inout_ PCYBERION_SESSION Session,
+    _Out_writes_(MaxEvents) PCYBERION_EVENT *Events,
+    _In_ ULONG MaxEvents
+)
+{
+    ULONG count = min(MaxEvents, Session->QueueCount);
+    ULONG i;
+
+    for (i = 0; i < count; i++) {
+        Events[i] = Session->Queue[Session->QueueHead];
+        Session->QueueHead = (Session->QueueHead + 1) % Session->QueueCapacity;
+    }
+
+    Session->QueueCount -= count;
+    Session->Stats.EventsDelivered += count;
+    Session->Stats.ReadsCompleted++;
+    return count;
+}
+
+//
+// SessionTakePendingIrp: Detaches the waiting reader, unless its cancel
+// routine already owns it. Caller holds the session lock.
+//
+static PIRP SessionTakePendingIrp(
+    _Inout_ PCYBERION_SESSION Session
+)
+{
+    PIRP irp = Session->PendingIrp;
+
+    if (irp == NULL || IoSetCancelRoutine(irp, NULL) == NULL) {
+        // The cancel routine clears PendingIrp and completes the IRP
+        return NULL;
+    }
+
+    Session->PendingIrp = NULL;
+    return irp;
+}
+
+//
+// SessionCopyEvents: Copies dequeued events into a reader's buffer, drops
+// their references and returns the number of bytes written.
+//
+static ULONG SessionCopyEvents(
+    _In_ PIRP Irp,
+    _In_reads_(Count) PCYBERION_EVENT *Events,
+    _In_ ULONG Count
+)
+{
+    PUCHAR output = (PUCHAR)Irp->AssociatedIrp.SystemBuffer;
+    ULONG size = SessionRecordSize(Irp);
+    ULONG written = 0;
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        // The original layout cannot tell a policy change from a creation
+        if (size == sizeof(PROCESS_CREATION_INFO) || Events[i]->Info.Type == EventTypeProcessCreation) {
+            RtlCopyMemory(output + written, &Events[i]->Info, size);
+            written += size;
+        }
+
+        CyberionReleaseEvent(Events[i]);
+    }
+
+    return written;
+}
+
+//
+// SessionCompleteRead: Completes a detached reader IRP with a batch.
+//
+static VOID SessionCompleteRead(
+    _In_ PIRP Irp,
+    _In_reads_(Count) PCYBERION_EVENT *Events,
+    _In_ ULONG Count
+)
+{
+    Irp->IoStatus.Information = SessionCopyEvents(Irp, Events, Count);
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+//
+// CyberionSessionCreate: Handles IRP_MJ_CREATE by attaching a new session to
+// the file object.
+//
+NTSTATUS CyberionSessionCreate(
+    _In_ PFILE_OBJECT FileObject
+)
+{
+    PCYBERION_SESSION session;
+    CYBERION_TUNABLES tunables;
+    ULONG capacity;
+
+    CyberionTunablesQuery(&tunables);
+
+    session = (PCYBERION_SESSION)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(CYBERION_SESSION), CYBERION_POOL_TAG);
+    if (session == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeInitializeSpinLock(&session->Lock);
+    KeInitializeTimer(&session->BatchTimer);
+    KeInitializeDpc(&session->BatchDpc, CyberionSessionBatchDpc, session);
+    session->BatchSize = tunables.BatchSize;
+    session->BatchTimeout = (ULONG64)tunables.BatchTimeout * 10;
+
+    KeEnterCriticalRegion();
+
+    // The queue is sized outside the list lock; if a resize slipped in
+    // meanwhile, size it again.
+    for (;;) {
+        capacity = (ULONG)ReadNoFence(&g_SessionQueueCapacity);
+
+        session->Queue = (PCYBERION_EVENT *)ExAllocatePool2(POOL_FLAG_NON_PAGED, capacity * sizeof(PCYBERION_EVENT), CYBERION_POOL_TAG);
+        if (session->Queue == NULL) {
+            KeLeaveCriticalRegion();
+            ExFreePoolWithTag(session, CYBERION_POOL_TAG);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        ExAcquirePushLockExclusive(&g_SessionListLock);
+        if (capacity == (ULONG)g_SessionQueueCapacity) {
+            break;
+        }
+        ExReleasePushLockExclusive(&g_SessionListLock);
+
+        ExFreePoolWithTag(session->Queue, CYBERION_POOL_TAG);
+    }
+
+    session->QueueCapacity = capacity;
+    session->Stats.QueueCapacity = capacity;
+    FileObject->FsContext = session;
+
+    InsertTailList(&g_SessionList, &session->Link);
+    ExReleasePushLockExclusive(&g_SessionListLock);
+    KeLeaveCriticalRegion();
+
+    return STATUS_SUCCESS;
+}
+
+//
+// CyberionSessionCleanup: Handles IRP_MJ_CLEANUP. Stops delivery to the
+// session and cancels its waiting reader.
+//
+VOID CyberionSessionCleanup(
+    _In_ PFILE_OBJECT FileObject
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)FileObject->FsContext;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    PIRP irp;
+
+    if (session == NULL) {
+        return;
+    }
+
+    // Once the exclusive acquire returns no publisher can still see the session
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&g_SessionListLock);
+    RemoveEntryList(&session->Link);
+    InitializeListHead(&session->Link);
+    ExReleasePushLockExclusive(&g_SessionListLock);
+    KeLeaveCriticalRegion();
+
+    KeCancelTimer(&session->BatchTimer);
+
+    KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+    irp = SessionTakePendingIrp(session);
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (irp) {
+        irp->IoStatus.Status = STATUS_CANCELLED;
+        irp->IoStatus.Information = 0;
+        IoCompleteRequest(irp, IO_NO_INCREMENT);
+    }
+}
+
+//
+// CyberionSessionClose: Handles IRP_MJ_CLOSE by releasing the session and any
+// events still queued to it.
+//
+VOID CyberionSessionClose(
+    _In_ PFILE_OBJECT FileObject
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)FileObject->FsContext;
+
+    if (session == NULL) {
+        return;
+    }
+
+    // The batch DPC may still be running on another processor
+    KeCancelTimer(&session->BatchTimer);
+    KeFlushQueuedDpcs();
+
+    while (session->QueueCount) {
+        CyberionReleaseEvent(session->Queue[session->QueueHead]);
+        session->QueueHead = (session->QueueHead + 1) % session->QueueCapacity;
+        session->QueueCount--;
+    }
+
+    if (session->Filter) {
+        ExFreePoolWithTag(session->Filter, CYBERION_POOL_TAG);
+    }
+
+    ExFreePoolWithTag(session->Queue, CYBERION_POOL_TAG);
+    ExFreePoolWithTag(session, CYBERION_POOL_TAG);
+    FileObject->FsContext = NULL;
+}
+
+//
+// CyberionSessionResizeQueues: Reallocates every session's ring. Runs with the
+// session list held exclusively, so publishers wait for the (short) copy.
+//
+NTSTATUS CyberionSessionResizeQueues(
+    _In_ ULONG Capacity
+)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PLIST_ENTRY entry;
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&g_SessionListLock);
+
+    g_SessionQueueCapacity = (LONG)Capacity;
+
+    for (entry = g_SessionList.Flink; entry != &g_SessionList; entry = entry->Flink) {
+        PCYBERION_SESSION session = CONTAINING_RECORD(entry, CYBERION_SESSION, Link);
+        PCYBERION_EVENT *queue;
+        PCYBERION_EVENT *oldQueue;
+        KLOCK_QUEUE_HANDLE lockHandle;
+        ULONG i;
+
+        queue = (PCYBERION_EVENT *)ExAllocatePool2(POOL_FLAG_NON_PAGED, Capacity * sizeof(PCYBERION_EVENT), CYBERION_POOL_TAG);
+        if (queue == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            continue;
+        }
+
+        KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+
+        // Keep the newest events that fit
+        while (session->QueueCount > Capacity) {
+            CyberionReleaseEvent(session->Queue[session->QueueHead]);
+            session->QueueHead = (session->QueueHead + 1) % session->QueueCapacity;
+            session->QueueCount--;
+            session->Stats.EventsDropped++;
+        }
+
+        for (i = 0; i < session->QueueCount; i++) {
+            queue[i] = session->Queue[(session->QueueHead + i) % session->QueueCapacity];
+        }
+
+        oldQueue = session->Queue;
+        session->Queue = queue;
+        session->QueueHead = 0;
+        session->QueueCapacity = Capacity;
+        session->Stats.QueueCapacity = Capacity;
+
+        KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+        ExFreePoolWithTag(oldQueue, CYBERION_POOL_TAG);
+    }
+
+    ExReleasePushLockExclusive(&g_SessionListLock);
+    KeLeaveCriticalRegion();
+
+    return status;
+}
+
+//
+// SessionOffer: Queues an event to a session and, if that completes a
+// batch, takes the waiting reader and dequeues the batch for it. Caller
+// holds the session lock.
+//
+static PIRP SessionOffer(
+    _Inout_ PCYBERION_SESSION Session,
+    _In_ PCYBERION_EVENT Event,
+    _Out_writes_(CYBERION_MAX_BATCH) PCYBERION_EVENT *Batch,
+    _Out_ PULONG Count
+)
+{
+    PIRP irp = NULL;
+
+    *Count = 0;
+
+    if (Session->QueueCount < Session->QueueCapacity) {
+        ULONG tail = (Session->QueueHead + Session->QueueCount) % Session->QueueCapacity;
+        CyberionReferenceEvent(Event);
+        Session->Queue[tail] = Event;
+        Session->QueueCount++;
+    } else {
+        Session->Stats.EventsDropped++;
+    }
+
+    if (Session->PendingIrp) {
+        if (SessionBatchReady(Session, SessionReadCapacity(Session->PendingIrp), Event->ArrivalTime)) {
+            irp = SessionTakePendingIrp(Session);
+            if (irp) {
+                *Count = SessionDequeue(Session, Batch, SessionReadCapacity(irp));
+            }
+        } else if (Session->QueueCount == 1) {
+            // First event of a new batch starts the deadline
+            SessionArmBatchTimer(Session, Event->ArrivalTime);
+        }
+    }
+
+    return irp;
+}
+
+//
+// CyberionSessionPublish: Fans a process creation out to every session whose
+// filter accepts it.
+//
+VOID CyberionSessionPublish(
+    _In_ const CYBERION_FILTER_CONTEXT *FilterContext,
+    _In_ ULONG64 EventId,
+    _In_ ULONG64 ProcessKey,
+    _In_ const CYBERION_IMAGE_PATH *ImagePath,
+    _In_ const CYBERION_PATTERN_MATCHES *Matches,
+    _In_ const CYBERION_IMAGE_INFO *Image
+)
+{
+    PCYBERION_EVENT batch[CYBERION_MAX_BATCH];
+    PCYBERION_EVENT event = NULL;
+    BOOLEAN expected = FALSE;
+    PLIST_ENTRY entry;
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_SessionListLock);
+
+    for (entry = g_SessionList.Flink; entry != &g_SessionList; entry = entry->Flink) {
+        PCYBERION_SESSION session = CONTAINING_RECORD(entry, CYBERION_SESSION, Link);
+        CYBERION_FILTER_VERDICT verdict = FilterVerdictDeliver;
+        KLOCK_QUEUE_HANDLE lockHandle;
+        PIRP irp = NULL;
+        ULONG count = 0;
+
+        KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+
+        if (session->Filter) {
+            verdict = CyberionFilterRun(session->Filter->Instructions, session->Filter->InstructionCount, FilterContext);
+        }
+
+        if (verdict == FilterVerdictDrop) {
+            session->Stats.EventsFiltered++;
+            KeReleaseInStackQueuedSpinLock(&lockHandle);
+            continue;
+        }
+
+        // Armed before any session can see the event, so a response
+        // always finds it
+        if (verdict == FilterVerdictHold && !expected) {
+            CyberionDecisionExpect((HANDLE)(ULONG_PTR)FilterContext->ProcessId, ProcessKey);
+            expected = TRUE;
+        }
+
+        // The record is only built once some session actually wants it
+        if (event == NULL) {
+            event = CyberionCreateEvent(FilterContext, EventId, ProcessKey, ImagePath, Matches, Image);
+            if (event == NULL) {
+                session->Stats.EventsDropped++;
+                KeReleaseInStackQueuedSpinLock(&lockHandle);
+                continue;
+            }
+        }
+
+        irp = SessionOffer(session, event, batch, &count);
+
+        KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+        if (irp) {
+            SessionCompleteRead(irp, batch, count);
+        }
+    }
+
+    ExReleasePushLockShared(&g_SessionListLock);
+    KeLeaveCriticalRegion();
+
+    if (event) {
+        CyberionReleaseEvent(event);
+    }
+
+}
+
+//
+// CyberionSessionPublishPolicy: Reports a policy change to every session
+// reading whole records; filters only apply to process creations.
+//
+VOID CyberionSessionPublishPolicy(
+    _In_ CYBERION_POLICY_MODE Mode,
+    _In_ ULONG ResponseLatency
+)
+{
+    PCYBERION_EVENT batch[CYBERION_MAX_BATCH];
+    PCYBERION_EVENT event = (PCYBERION_EVENT)CyberionSlabAllocate(&g_EventSlab);
+    PLIST_ENTRY entry;
+
+    if (event) {
+        RtlZeroMemory(event, sizeof(CYBERION_EVENT));
+        event->RefCount = 1;
+        event->ArrivalTime = KeQueryInterruptTime();
+        event->Info.Size = sizeof(PROCESS_CREATION_INFO);
+        event->Info.Type = EventTypePolicyChange;
+        event->Info.PolicyMode = Mode;
+        event->Info.ResponseLatency = ResponseLatency;
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_SessionListLock);
+
+    for (entry = g_SessionList.Flink; entry != &g_SessionList; entry = entry->Flink) {
+        PCYBERION_SESSION session = CONTAINING_RECORD(entry, CYBERION_SESSION, Link);
+        KLOCK_QUEUE_HANDLE lockHandle;
+        PIRP irp = NULL;
+        ULONG count = 0;
+
+        KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+
+        // Readers of the original layout could not tell it from a creation
+        if (session->PolicyEvents) {
+            if (event) {
+                irp = SessionOffer(session, event, batch, &count);
+            } else {
+                session->Stats.EventsDropped++;
+            }
+        }
+
+        KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+        if (irp) {
+            SessionCompleteRead(irp, batch, count);
+        }
+    }
+
+    ExReleasePushLockShared(&g_SessionListLock);
+    KeLeaveCriticalRegion();
+
+    if (event) {
+        CyberionReleaseEvent(event);
+    }
+}
+
+//
+// CyberionSessionBatchDpc: Completes the waiting reader when the oldest
+// queued event reaches the session's batch timeout.
+//
+VOID CyberionSessionBatchDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)DeferredContext;
+    PCYBERION_EVENT batch[CYBERION_MAX_BATCH];
+    KLOCK_QUEUE_HANDLE lockHandle;
+    PIRP irp = NULL;
+    ULONG count = 0;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    KeAcquireInStackQueuedSpinLockAtDpcLevel(&session->Lock, &lockHandle);
+
+    if (session->PendingIrp && session->QueueCount) {
+        ULONG64 now = KeQueryInterruptTime();
+
+        if (SessionBatchReady(session, SessionReadCapacity(session->PendingIrp), now)) {
+            irp = SessionTakePendingIrp(session);
+            if (irp) {
+                count = SessionDequeue(session, batch, SessionReadCapacity(irp));
+            }
+        } else {
+            SessionArmBatchTimer(session, now);
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLockFromDpcLevel(&lockHandle);
+
+    if (irp) {
+        SessionCompleteRead(irp, batch, count);
+    }
+}
+
+//
+// CyberionSessionCancelRead: Cancel routine for a pended reader IRP.
+//
+VOID CyberionSessionCancelRead(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)IoGetCurrentIrpStackLocation(Irp)->FileObject->FsContext;
+    KLOCK_QUEUE_HANDLE lockHandle;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+    KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+    if (session->PendingIrp == Irp) {
+        session->PendingIrp = NULL;
+    }
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    Irp->IoStatus.Status = STATUS_CANCELLED;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+//
+// CyberionSessionRead: Handles IOCTL_CYBERION_GET_PROCESS_INFO and
+// IOCTL_CYBERION_GET_EVENTS. Returns a batch immediately if one is ready,
+// otherwise pends the IRP until the batch fills or times out.
+//
+NTSTATUS CyberionSessionRead(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)Stack->FileObject->FsContext;
+    PCYBERION_EVENT batch[CYBERION_MAX_BATCH];
+    KLOCK_QUEUE_HANDLE lockHandle;
+    ULONG capacity = SessionReadCapacity(Irp);
+    ULONG count = 0;
+    ULONG64 now;
+    NTSTATUS status;
+
+    if (capacity == 0) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+
+    if (Stack->Parameters.DeviceIoControl.IoControlCode == IOCTL_CYBERION_GET_EVENTS) {
+        session->PolicyEvents = TRUE;
+    }
+
+    now = KeQueryInterruptTime();
+
+    if (SessionBatchReady(session, capacity, now)) {
+        count = SessionDequeue(session, batch, capacity);
+        status = STATUS_SUCCESS;
+    } else if (session->PendingIrp) {
+        // Another request is already pending
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        IoSetCancelRoutine(Irp, CyberionSessionCancelRead);
+        if (Irp->Cancel && IoSetCancelRoutine(Irp, NULL) != NULL) {
+            status = STATUS_CANCELLED;
+        } else {
+            // Mark the IRP as pending and store it
+            IoMarkIrpPending(Irp);
+            session->PendingIrp = Irp;
+            status = STATUS_PENDING;
+
+            // A partial batch is already waiting; make sure its deadline fires
+            if (session->QueueCount) {
+                SessionArmBatchTimer(session, now);
+            }
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (count) {
+        Irp->IoStatus.Information = SessionCopyEvents(Irp, batch, count);
+    }
+
+    return status;
+}
+
+//
+// CyberionSessionSetFilter: Handles IOCTL_CYBERION_SET_FILTER. Verifies the
+// program and makes it the session's filter. An empty program removes it.
+//
+NTSTATUS CyberionSessionSetFilter(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)Stack->FileObject->FsContext;
+    PCYBERION_FILTER_PROGRAM input = (PCYBERION_FILTER_PROGRAM)Irp->AssociatedIrp.SystemBuffer;
+    ULONG inputLength = Stack->Parameters.DeviceIoControl.InputBufferLength;
+    PCYBERION_FILTER_PROGRAM program = NULL;
+    PCYBERION_FILTER_PROGRAM oldProgram;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    ULONG programSize;
+    NTSTATUS status;
+
+    if (input == NULL || inputLength < FIELD_OFFSET(CYBERION_FILTER_PROGRAM, Instructions)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (input->InstructionCount != 0) {
+        if (input->InstructionCount > CYBERION_FILTER_MAX_INSNS) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        programSize = FIELD_OFFSET(CYBERION_FILTER_PROGRAM, Instructions) + input->InstructionCount * sizeof(CYBERION_FILTER_INSN);
+        if (inputLength < programSize) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        status = CyberionFilterVerify(input->Instructions, input->InstructionCount);
+        if (!NT_SUCCESS(status)) {
+            DbgPrint("CyberionDriver: Rejected filter program (0x%08X).\n", status);
+            return status;
+        }
+
+        program = (PCYBERION_FILTER_PROGRAM)ExAllocatePool2(POOL_FLAG_NON_PAGED, programSize, CYBERION_POOL_TAG);
+        if (program == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlCopyMemory(program, input, programSize);
+    }
+
+    KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+    oldProgram = session->Filter;
+    session->Filter = program;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (oldProgram) {
+        ExFreePoolWithTag(oldProgram, CYBERION_POOL_TAG);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// CyberionSessionQueryStatistics: Handles IOCTL_CYBERION_GET_SESSION_STATS.
+//
+NTSTATUS CyberionSessionQueryStatistics(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)Stack->FileObject->FsContext;
+    PCYBERION_SESSION_STATISTICS stats = (PCYBERION_SESSION_STATISTICS)Irp->AssociatedIrp.SystemBuffer;
+    KLOCK_QUEUE_HANDLE lockHandle;
+
+    if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(CYBERION_SESSION_STATISTICS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+    *stats = session->Stats;
+    stats->QueuedEvents = session->QueueCount;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    Irp->IoStatus.Information = sizeof(CYBERION_SESSION_STATISTICS);
+    return STATUS_SUCCESS;
+}
+
+//
+// CyberionSessionSetDelivery: Handles IOCTL_CYBERION_SET_DELIVERY. New
+// settings apply to the reader already waiting, if any.
+//
+NTSTATUS CyberionSessionSetDelivery(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_SESSION session = (PCYBERION_SESSION)Stack->FileObject->FsContext;
+    PCYBERION_DELIVERY_SETTINGS settings = (PCYBERION_DELIVERY_SETTINGS)Irp->AssociatedIrp.SystemBuffer;
+    PCYBERION_EVENT batch[CYBERION_MAX_BATCH];
+    KLOCK_QUEUE_HANDLE lockHandle;
+    PIRP reader = NULL;
+    ULONG count = 0;
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength < sizeof(CYBERION_DELIVERY_SETTINGS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (settings->BatchSize == 0 || settings->BatchSize > CYBERION_MAX_BATCH ||
+        settings->BatchTimeout > CYBERION_MAX_BATCH_TIMEOUT) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KeAcquireInStackQueuedSpinLock(&session->Lock, &lockHandle);
+
+    session->BatchSize = settings->BatchSize;
+    session->BatchTimeout = (ULONG64)settings->BatchTimeout * 10;
+
+    if (session->PendingIrp && session->QueueCount) {
+        ULONG64 now = KeQueryInterruptTime();
+
+        if (SessionBatchReady(session, SessionReadCapacity(session->PendingIrp), now)) {
+            reader = SessionTakePendingIrp(session);
+            if (reader) {
+                count = SessionDequeue(session, batch, SessionReadCapacity(reader));
+            }
+        } else {
+            SessionArmBatchTimer(session, now);
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    if (reader) {
+        SessionCompleteRead(reader, batch, count);
+    }
+
+    return STATUS_SUCCESS;
+}
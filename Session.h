@@ -0,0 +1,98 @@
+/*
+ * SESSION.H
+ *
+ * Per-handle subscriber sessions. Every handle opened on the Cyberion device
+ * gets its own session with a private event queue, filter program and
+ * delivery counters. Events are reference counted so a creation delivered
+ * to several sessions is stored only once.
+ *
+ * Reads are coalesced: a waiting reader is completed once the session's
+ * batch size is reached or its batch timeout expires, whichever is first.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+#include "CommandLine.h"
+#include "Filter.h"
+#include "Image.h"
+#include "Path.h"
+#include "Slab.h"
+#include "Tunables.h"
+
+//
+// A process creation event shared by every session it was queued to.
+//
+typedef struct _CYBERION_EVENT {
+    volatile LONG RefCount;
+    ULONG64 ArrivalTime;                // Interrupt time the creation was seen
+    PROCESS_CREATION_INFO Info;
+} CYBERION_EVENT, *PCYBERION_EVENT;
+
+//
+// Per-handle session state, stored in FileObject->FsContext.
+//
+typedef struct _CYBERION_SESSION {
+    LIST_ENTRY Link;                    // Entry in g_SessionList
+    KSPIN_LOCK Lock;                    // Protects everything below
+    PIRP PendingIrp;                    // Reader waiting for an event
+    PCYBERION_FILTER_PROGRAM Filter;    // Optional event filter
+    PCYBERION_EVENT *Queue;             // Ring of queued events
+    ULONG QueueCapacity;
+    ULONG QueueHead;                    // Index of the oldest queued event
+    ULONG QueueCount;
+    ULONG BatchSize;                    // Events that complete a read immediately
+    ULONG64 BatchTimeout;               // 100ns units; 0 completes on the first event
+    BOOLEAN PolicyEvents;               // Has read with IOCTL_CYBERION_GET_EVENTS, so is sent policy changes
+    KTIMER BatchTimer;                  // Fires BatchTimeout after the oldest event arrived
+    KDPC BatchDpc;
+    CYBERION_SESSION_STATISTICS Stats;
+} CYBERION_SESSION, *PCYBERION_SESSION;
+
+NTSTATUS CyberionSessionInitialize(VOID);
+VOID CyberionSessionShutdown(VOID);
+
+//
+// CyberionSessionResizeQueues: Changes the queue capacity of every session,
+// and of sessions created from now on. When shrinking, the oldest events
+// are dropped.
+//
+NTSTATUS CyberionSessionResizeQueues(_In_ ULONG Capacity);
+
+NTSTATUS CyberionSessionCreate(_In_ PFILE_OBJECT FileObject);
+VOID CyberionSessionCleanup(_In_ PFILE_OBJECT FileObject);
+VOID CyberionSessionClose(_In_ PFILE_OBJECT FileObject);
+
+//
+// CyberionSessionPublish: Offers a process creation to every session. Called
+// from the process notify routine at PASSIVE_LEVEL. If a session's filter
+// holds the event, a USER_RESPONSE is expected for the process.
+//
+VOID CyberionSessionPublish(
+    _In_ const CYBERION_FILTER_CONTEXT *FilterContext,
+    _In_ ULONG64 EventId,
+    _In_ ULONG64 ProcessKey,
+    _In_ const CYBERION_IMAGE_PATH *ImagePath,
+    _In_ const CYBERION_PATTERN_MATCHES *Matches,
+    _In_ const CYBERION_IMAGE_INFO *Image
+);
+
+//
+// CyberionSessionPublishPolicy: Offers an EventTypePolicyChange event to
+// every session that reads with IOCTL_CYBERION_GET_EVENTS. Called at
+// IRQL <= APC_LEVEL.
+//
+VOID CyberionSessionPublishPolicy(
+    _In_ CYBERION_POLICY_MODE Mode,
+    _In_ ULONG ResponseLatency
+);
+
+//
+// IOCTL handlers. These return STATUS_PENDING when the IRP was queued,
+// otherwise the caller completes the IRP with the returned status.
+//
+NTSTATUS CyberionSessionRead(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+NTSTATUS CyberionSessionSetFilter(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+NTSTATUS CyberionSessionQueryStatistics(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+NTSTATUS CyberionSessionSetDelivery(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
@@ -0,0 +1,258 @@
+/*
+ * SHA256.C
+ *
+ * SHA-256 (FIPS 180-4) with portable and SHA-NI block functions.
+ *
+ * The message buffering is shared; only the compression of whole blocks is
+ * specialized.
+ */
+
+#include "Sha256.h"
+
+#if defined(_M_AMD64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86 1
+#include <immintrin.h>
+#endif
+
+typedef VOID SHA256_BLOCKS(_Inout_ ULONG *State, _In_ const UCHAR *Data, _In_ SIZE_T Blocks);
+
+static const ULONG g_Sha256K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static const ULONG g_Sha256Initial[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+FORCEINLINE ULONG Sha256LoadBigEndian(_In_ const UCHAR *p)
+{
+    return ((ULONG)p[0] << 24) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 8) | (ULONG)p[3];
+}
+
+FORCEINLINE VOID Sha256StoreBigEndian(_Out_ UCHAR *p, _In_ ULONG v)
+{
+    p[0] = (UCHAR)(v >> 24);
+    p[1] = (UCHAR)(v >> 16);
+    p[2] = (UCHAR)(v >> 8);
+    p[3] = (UCHAR)v;
+}
+
+//
+// Sha256BlocksPortable: Reference compression function.
+//
+static VOID Sha256BlocksPortable(
+    _Inout_ ULONG *State,
+    _In_ const UCHAR *Data,
+    _In_ SIZE_T Blocks
+)
+{
+    ULONG w[64];
+    ULONG a, b, c, d, e, f, g, h;
+    ULONG i;
+
+    while (Blocks--) {
+        for (i = 0; i < 16; i++) {
+            w[i] = Sha256LoadBigEndian(Data + i * 4);
+        }
+
+        for (i = 16; i < 64; i++) {
+            ULONG s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            ULONG s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        a = State[0]; b = State[1]; c = State[2]; d = State[3];
+        e = State[4]; f = State[5]; g = State[6]; h = State[7];
+
+        for (i = 0; i < 64; i++) {
+            ULONG t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + g_Sha256K[i] + w[i];
+            ULONG t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        State[0] += a; State[1] += b; State[2] += c; State[3] += d;
+        State[4] += e; State[5] += f; State[6] += g; State[7] += h;
+
+        Data += CYBERION_SHA256_BLOCK_SIZE;
+    }
+}
+
+#ifdef SHA256_X86
+
+//
+// Sha256BlocksShaNi: Compression with the SHA extensions. The state is kept
+// as the ABEF/CDGH register pair that SHA256RNDS2 expects; each loop
+// iteration runs four rounds and extends the message schedule four words
+// ahead.
+//
+CYBERION_TARGET("sha,sse4.1")
+static VOID Sha256BlocksShaNi(
+    _Inout_ ULONG *State,
+    _In_ const UCHAR *Data,
+    _In_ SIZE_T Blocks
+)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+    __m128i state0, state1, tmp;
+
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&State[0]), 0xB1);    // CDAB
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&State[4]), 0x1B); // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);                                       // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                    // CDGH
+
+    while (Blocks--) {
+        __m128i saved0 = state0;
+        __m128i saved1 = state1;
+        __m128i msg[4];
+        __m128i k;
+        ULONG group;
+
+        for (group = 0; group < 16; group++) {
+            if (group < 4) {
+                msg[group] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(Data + group * 16)), byteSwap);
+            }
+
+            k = _mm_add_epi32(msg[group % 4], _mm_loadu_si128((const __m128i *)&g_Sha256K[group * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+
+            if (group >= 3 && group <= 14) {
+                tmp = _mm_alignr_epi8(msg[group % 4], msg[(group + 3) % 4], 4);
+                msg[(group + 1) % 4] = _mm_add_epi32(msg[(group + 1) % 4], tmp);
+                msg[(group + 1) % 4] = _mm_sha256msg2_epu32(msg[(group + 1) % 4], msg[group % 4]);
+            }
+
+            k = _mm_shuffle_epi32(k, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, k);
+
+            if (group >= 1 && group <= 12) {
+                msg[(group + 3) % 4] = _mm_sha256msg1_epu32(msg[(group + 3) % 4], msg[group % 4]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+        Data += CYBERION_SHA256_BLOCK_SIZE;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);          // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);       // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);    // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);       // HGFE
+
+    _mm_storeu_si128((__m128i *)&State[0], state0);
+    _mm_storeu_si128((__m128i *)&State[4], state1);
+}
+
+#endif // SHA256_X86
+
+//
+// Globals
+//
+static SHA256_BLOCKS *g_Sha256Blocks = Sha256BlocksPortable; // Block function in use
+
+ULONG CyberionSha256Initialize(
+    _In_ ULONG Allowed
+)
+{
+    ULONG engines = 0;
+#ifdef SHA256_X86
+    ULONG cpu = CyberionCpuFeatures();
+
+    if ((Allowed & CYBERION_SHA256_SHANI) && (cpu & CYBERION_CPU_SHA) && (cpu & CYBERION_CPU_SSE41)) {
+        engines |= CYBERION_SHA256_SHANI;
+    }
+
+    g_Sha256Blocks = (engines & CYBERION_SHA256_SHANI) ? Sha256BlocksShaNi : Sha256BlocksPortable;
+#else
+    UNREFERENCED_PARAMETER(Allowed);
+#endif
+    return engines;
+}
+
+VOID CyberionSha256Init(
+    _Out_ PCYBERION_SHA256 Context
+)
+{
+    RtlCopyMemory(Context->State, g_Sha256Initial, sizeof(Context->State));
+    Context->Length = 0;
+    Context->BufferLength = 0;
+}
+
+VOID CyberionSha256Update(
+    _Inout_ PCYBERION_SHA256 Context,
+    _In_reads_bytes_(Length) const VOID *Data,
+    _In_ SIZE_T Length
+)
+{
+    const UCHAR *p = (const UCHAR *)Data;
+    SIZE_T blocks;
+
+    Context->Length += Length;
+
+    if (Context->BufferLength) {
+        SIZE_T take = min(Length, (SIZE_T)(CYBERION_SHA256_BLOCK_SIZE - Context->BufferLength));
+
+        RtlCopyMemory(Context->Buffer + Context->BufferLength, p, take);
+        Context->BufferLength += (ULONG)take;
+        p += take;
+        Length -= take;
+
+        if (Context->BufferLength < CYBERION_SHA256_BLOCK_SIZE) {
+            return;
+        }
+
+        g_Sha256Blocks(Context->State, Context->Buffer, 1);
+        Context->BufferLength = 0;
+    }
+
+    blocks = Length / CYBERION_SHA256_BLOCK_SIZE;
+    if (blocks) {
+        g_Sha256Blocks(Context->State, p, blocks);
+        p += blocks * CYBERION_SHA256_BLOCK_SIZE;
+        Length -= blocks * CYBERION_SHA256_BLOCK_SIZE;
+    }
+
+    if (Length) {
+        RtlCopyMemory(Context->Buffer, p, Length);
+        Context->BufferLength = (ULONG)Length;
+    }
+}
+
+VOID CyberionSha256Final(
+    _Inout_ PCYBERION_SHA256 Context,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Digest
+)
+{
+    ULONG64 bits = Context->Length * 8;
+    ULONG i;
+
+    Context->Buffer[Context->BufferLength++] = 0x80;
+
+    if (Context->BufferLength > CYBERION_SHA256_BLOCK_SIZE - 8) {
+        RtlZeroMemory(Context->Buffer + Context->BufferLength, CYBERION_SHA256_BLOCK_SIZE - Context->BufferLength);
+        g_Sha256Blocks(Context->State, Context->Buffer, 1);
+        Context->BufferLength = 0;
+    }
+
+    RtlZeroMemory(Context->Buffer + Context->BufferLength, CYBERION_SHA256_BLOCK_SIZE - 8 - Context->BufferLength);
+    Sha256StoreBigEndian(Context->Buffer + CYBERION_SHA256_BLOCK_SIZE - 8, (ULONG)(bits >> 32));
+    Sha256StoreBigEndian(Context->Buffer + CYBERION_SHA256_BLOCK_SIZE - 4, (ULONG)bits);
+    g_Sha256Blocks(Context->State, Context->Buffer, 1);
+
+    for (i = 0; i < 8; i++) {
+        Sha256StoreBigEndian(Digest + i * 4, Context->State[i]);
+    }
+
+    RtlZeroMemory(Context, sizeof(*Context));
+}
@@ -0,0 +1,50 @@
+/*
+ * SHA256.H
+ *
+ * SHA-256 for image hashing.
+ *
+ * Two block functions are provided, portable C and SHA-NI; the faster one
+ * the processor supports is chosen at run time from CPUID.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+#define CYBERION_SHA256_BLOCK_SIZE  64
+
+//
+// Engines that CyberionSha256Initialize may select.
+//
+#define CYBERION_SHA256_SHANI       0x00000001  // SHA-NI blocks
+#define CYBERION_SHA256_ALL         0xFFFFFFFF
+
+typedef struct _CYBERION_SHA256 {
+    ULONG State[8];
+    ULONG64 Length;                             // Bytes hashed so far
+    ULONG BufferLength;
+    UCHAR Buffer[CYBERION_SHA256_BLOCK_SIZE];   // Partial block
+} CYBERION_SHA256, *PCYBERION_SHA256;
+
+//
+// CyberionSha256Initialize: Selects the fastest engines that the processor
+// supports, limited to Allowed (CYBERION_SHA256_* flags; 0 forces portable
+// C). Returns the engines in use. Call once before hashing; the default
+// before any call is portable C.
+//
+ULONG CyberionSha256Initialize(_In_ ULONG Allowed);
+
+VOID CyberionSha256Init(_Out_ PCYBERION_SHA256 Context);
+
+VOID CyberionSha256Update(
+    _Inout_ PCYBERION_SHA256 Context,
+    _In_reads_bytes_(Length) const VOID *Data,
+    _In_ SIZE_T Length
+);
+
+VOID CyberionSha256Final(
+    _Inout_ PCYBERION_SHA256 Context,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Digest
+);
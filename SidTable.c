@@ -0,0 +1,119 @@
+/*
+ * SIDTABLE.C
+ *
+ * SID interning.
+ *
+ * An open-addressed hash of Ids, linearly probed and at most half full,
+ * over an array of entries in Id order. Nothing is ever deleted, so a
+ * probe ends at the first empty slot.
+ */
+
+#include "SidTable.h"
+
+//
+// SidHash: FNV-1a over the SID's bytes.
+//
+static ULONG SidHash(
+    _In_reads_bytes_(Length) const UCHAR *Sid,
+    _In_ ULONG Length
+)
+{
+    ULONG hash = 2166136261u;
+    ULONG i;
+
+    for (i = 0; i < Length; i++) {
+        hash = (hash ^ Sid[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+NTSTATUS CyberionSidTableInitialize(
+    _Out_ PCYBERION_SID_TABLE Table,
+    _In_ ULONG Capacity
+)
+{
+    ULONG slots = 2;
+
+    RtlZeroMemory(Table, sizeof(*Table));
+
+    while (slots < Capacity * 2) {
+        slots *= 2;
+    }
+
+    Table->Slots = (PULONG)CyberionAllocate((SIZE_T)slots * sizeof(ULONG));
+    Table->Entries = (PCYBERION_SID_ENTRY)CyberionAllocate((SIZE_T)Capacity * sizeof(CYBERION_SID_ENTRY));
+
+    if (Table->Slots == NULL || Table->Entries == NULL) {
+        CyberionSidTableDestroy(Table);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Table->Capacity = Capacity;
+    Table->SlotMask = slots - 1;
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionSidTableDestroy(
+    _Inout_ PCYBERION_SID_TABLE Table
+)
+{
+    if (Table->Slots) {
+        CyberionFree(Table->Slots);
+    }
+
+    if (Table->Entries) {
+        CyberionFree(Table->Entries);
+    }
+
+    RtlZeroMemory(Table, sizeof(*Table));
+}
+
+ULONG CyberionSidTableIntern(
+    _Inout_ PCYBERION_SID_TABLE Table,
+    _In_reads_bytes_(Length) const VOID *Sid,
+    _In_ ULONG Length
+)
+{
+    PCYBERION_SID_ENTRY entry;
+    ULONG hash;
+    ULONG slot;
+
+    if (Length == 0 || Length > CYBERION_MAX_SID_SIZE) {
+        return 0;
+    }
+
+    hash = SidHash((const UCHAR *)Sid, Length);
+
+    for (slot = hash & Table->SlotMask; Table->Slots[slot] != 0; slot = (slot + 1) & Table->SlotMask) {
+        entry = &Table->Entries[Table->Slots[slot] - 1];
+
+        if (entry->Hash == hash && entry->Length == Length && RtlEqualMemory(entry->Sid, Sid, Length)) {
+            return Table->Slots[slot];
+        }
+    }
+
+    if (Table->Count == Table->Capacity) {
+        return 0;
+    }
+
+    entry = &Table->Entries[Table->Count];
+    entry->Hash = hash;
+    entry->Length = Length;
+    RtlCopyMemory(entry->Sid, Sid, Length);
+
+    Table->Slots[slot] = ++Table->Count;
+    return Table->Count;
+}
+
+const CYBERION_SID_ENTRY *CyberionSidTableLookup(
+    _In_ const CYBERION_SID_TABLE *Table,
+    _In_ ULONG Id
+)
+{
+    if (Id == 0 || Id > Table->Count) {
+        return NULL;
+    }
+
+    return &Table->Entries[Id - 1];
+}
@@ -0,0 +1,55 @@
+/*
+ * SIDTABLE.H
+ *
+ * Interned security identifiers. Each distinct SID is given a small Id
+ * the first time it is seen, which events carry instead of the SID itself;
+ * Ids are never reused or removed, so user mode only resolves each one
+ * once. A machine has few distinct user SIDs, so the table is small and
+ * fixed in size. Callers serialize access.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+typedef struct _CYBERION_SID_ENTRY {
+    ULONG Hash;
+    ULONG Length;                   // Bytes of Sid
+    UCHAR Sid[CYBERION_MAX_SID_SIZE];
+} CYBERION_SID_ENTRY, *PCYBERION_SID_ENTRY;
+
+typedef struct _CYBERION_SID_TABLE {
+    ULONG Count;                    // Ids given out, 1 to Count
+    ULONG Capacity;
+    ULONG SlotMask;
+    PULONG Slots;                   // Id in each hash slot, 0 if empty
+    PCYBERION_SID_ENTRY Entries;    // By Id - 1
+} CYBERION_SID_TABLE, *PCYBERION_SID_TABLE;
+
+NTSTATUS CyberionSidTableInitialize(
+    _Out_ PCYBERION_SID_TABLE Table,
+    _In_ ULONG Capacity
+);
+
+VOID CyberionSidTableDestroy(_Inout_ PCYBERION_SID_TABLE Table);
+
+//
+// CyberionSidTableIntern: Returns the Id of the Length-byte SID, giving it
+// the next one if it is new. Returns 0 once the table is full or if the
+// SID is too long.
+//
+ULONG CyberionSidTableIntern(
+    _Inout_ PCYBERION_SID_TABLE Table,
+    _In_reads_bytes_(Length) const VOID *Sid,
+    _In_ ULONG Length
+);
+
+//
+// CyberionSidTableLookup: Returns the SID with the given Id, or NULL.
+//
+const CYBERION_SID_ENTRY *CyberionSidTableLookup(
+    _In_ const CYBERION_SID_TABLE *Table,
+    _In_ ULONG Id
+);
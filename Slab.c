@@ -0,0 +1,224 @@
+/*
+ * SLAB.C
+ *
+ * Fixed-size object allocator with per-processor magazines.
+ *
+ * Objects are identified by their index in one contiguous block. The global
+ * free list is a Treiber stack of indices whose head carries a 32-bit tag to
+ * defeat ABA, so it needs nothing stronger than a 64-bit compare-exchange.
+ * Links live in a side array, which keeps free objects cold and lets a
+ * racing pop read a stale link harmlessly.
+ */
+
+#include "Slab.h"
+
+//
+// SlabPopGlobal: Takes one object index off the global free list.
+//
+static BOOLEAN SlabPopGlobal(
+    _Inout_ PCYBERION_SLAB Slab,
+    _Out_ ULONG *Index
+)
+{
+    LONG64 oldHead;
+    LONG64 newHead;
+    ULONG top;
+
+    do {
+        oldHead = ReadNoFence64(&Slab->FreeHead);
+        top = (ULONG)oldHead;
+        if (top == 0) {
+            return FALSE;
+        }
+
+        newHead = (LONG64)(((((ULONG64)oldHead >> 32) + 1) << 32) | ((volatile ULONG *)Slab->NextFree)[top - 1]);
+    } while (InterlockedCompareExchange64(&Slab->FreeHead, newHead, oldHead) != oldHead);
+
+    *Index = top - 1;
+    return TRUE;
+}
+
+//
+// SlabPushGlobal: Returns one object index to the global free list.
+//
+static VOID SlabPushGlobal(
+    _Inout_ PCYBERION_SLAB Slab,
+    _In_ ULONG Index
+)
+{
+    LONG64 oldHead;
+    LONG64 newHead;
+
+    do {
+        oldHead = ReadNoFence64(&Slab->FreeHead);
+        ((volatile ULONG *)Slab->NextFree)[Index] = (ULONG)oldHead;
+        newHead = (LONG64)(((((ULONG64)oldHead >> 32) + 1) << 32) | (Index + 1));
+    } while (InterlockedCompareExchange64(&Slab->FreeHead, newHead, oldHead) != oldHead);
+}
+
+//
+// SlabReclaim: Flushes every magazine the caller can take to the global
+// list, so objects freed on processors that no longer allocate are not
+// stranded there, then takes one object off it.
+//
+static BOOLEAN SlabReclaim(
+    _Inout_ PCYBERION_SLAB Slab,
+    _Out_ ULONG *Index
+)
+{
+    ULONG i;
+
+    for (i = 0; i < Slab->MagazineCount; i++) {
+        PCYBERION_SLAB_MAGAZINE magazine = &Slab->Magazines[i];
+
+        if (ReadNoFence((volatile LONG *)&magazine->Count) == 0 || InterlockedExchange(&magazine->Busy, 1) != 0) {
+            continue;
+        }
+
+        while (magazine->Count) {
+            SlabPushGlobal(Slab, magazine->Objects[--magazine->Count]);
+        }
+
+        WriteRelease(&magazine->Busy, 0);
+    }
+
+    return SlabPopGlobal(Slab, Index);
+}
+
+NTSTATUS CyberionSlabInitialize(
+    _Out_ PCYBERION_SLAB Slab,
+    _In_ SIZE_T ObjectSize,
+    _In_ ULONG ObjectCount
+)
+{
+    SIZE_T objectSize;
+    ULONG i;
+
+    RtlZeroMemory(Slab, sizeof(*Slab));
+
+    if (ObjectSize == 0 || ObjectCount == 0 || ObjectCount >= MAXULONG) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    objectSize = (ObjectSize + CYBERION_SLAB_ALIGNMENT - 1) & ~(SIZE_T)(CYBERION_SLAB_ALIGNMENT - 1);
+    if (objectSize > ((SIZE_T)-1) / ObjectCount) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Slab->ObjectSize = objectSize;
+    Slab->ObjectCount = ObjectCount;
+    Slab->MagazineCount = CyberionProcessorCount();
+
+    // Small slabs get small magazines, or none
+    Slab->MagazineLimit = min(CYBERION_SLAB_MAGAZINE_SIZE, ObjectCount / 4 / Slab->MagazineCount);
+    Slab->TransferSize = max(Slab->MagazineLimit / 2, 1);
+
+    Slab->Memory = (PUCHAR)CyberionAllocate(objectSize * ObjectCount);
+    Slab->NextFree = (ULONG *)CyberionAllocate(ObjectCount * sizeof(ULONG));
+    Slab->Magazines = (PCYBERION_SLAB_MAGAZINE)CyberionAllocate(Slab->MagazineCount * sizeof(CYBERION_SLAB_MAGAZINE));
+
+    if (Slab->Memory == NULL || Slab->NextFree == NULL || Slab->Magazines == NULL) {
+        CyberionSlabDestroy(Slab);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // Thread every object onto the global list in address order
+    for (i = 0; i < ObjectCount; i++) {
+        Slab->NextFree[i] = (i + 1 < ObjectCount) ? i + 2 : 0;
+    }
+    Slab->FreeHead = 1;
+
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionSlabDestroy(
+    _Inout_ PCYBERION_SLAB Slab
+)
+{
+    if (Slab->Magazines) {
+        CyberionFree(Slab->Magazines);
+    }
+
+    if (Slab->NextFree) {
+        CyberionFree(Slab->NextFree);
+    }
+
+    if (Slab->Memory) {
+        CyberionFree(Slab->Memory);
+    }
+
+    RtlZeroMemory(Slab, sizeof(*Slab));
+}
+
+PVOID CyberionSlabAllocate(
+    _Inout_ PCYBERION_SLAB Slab
+)
+{
+    PCYBERION_SLAB_MAGAZINE magazine;
+    CYBERION_PIN_STATE pinState;
+    BOOLEAN found = FALSE;
+    ULONG index = 0;
+
+    magazine = &Slab->Magazines[CyberionPinProcessor(&pinState) % Slab->MagazineCount];
+
+    if (Slab->MagazineLimit == 0) {
+        found = SlabPopGlobal(Slab, &index);
+    } else if (InterlockedExchange(&magazine->Busy, 1) == 0) {
+        if (magazine->Count == 0) {
+            while (magazine->Count < Slab->TransferSize && SlabPopGlobal(Slab, &index)) {
+                magazine->Objects[magazine->Count++] = index;
+            }
+        }
+
+        if (magazine->Count) {
+            index = magazine->Objects[--magazine->Count];
+            found = TRUE;
+        }
+
+        WriteRelease(&magazine->Busy, 0);
+    } else {
+        found = SlabPopGlobal(Slab, &index);
+    }
+
+    if (!found) {
+        found = SlabReclaim(Slab, &index);
+    }
+
+    CyberionUnpinProcessor(pinState);
+
+    if (!found) {
+        InterlockedIncrement(&Slab->Failures);
+        return NULL;
+    }
+
+    return Slab->Memory + (SIZE_T)index * Slab->ObjectSize;
+}
+
+VOID CyberionSlabFree(
+    _Inout_ PCYBERION_SLAB Slab,
+    _In_ PVOID Object
+)
+{
+    PCYBERION_SLAB_MAGAZINE magazine;
+    CYBERION_PIN_STATE pinState;
+    ULONG index = (ULONG)(((PUCHAR)Object - Slab->Memory) / Slab->ObjectSize);
+
+    magazine = &Slab->Magazines[CyberionPinProcessor(&pinState) % Slab->MagazineCount];
+
+    if (Slab->MagazineLimit == 0) {
+        SlabPushGlobal(Slab, index);
+    } else if (InterlockedExchange(&magazine->Busy, 1) == 0) {
+        if (magazine->Count == Slab->MagazineLimit) {
+            while (magazine->Count > Slab->MagazineLimit - Slab->TransferSize) {
+                SlabPushGlobal(Slab, magazine->Objects[--magazine->Count]);
+            }
+        }
+
+        magazine->Objects[magazine->Count++] = index;
+        WriteRelease(&magazine->Busy, 0);
+    } else {
+        SlabPushGlobal(Slab, index);
+    }
+
+    CyberionUnpinProcessor(pinState);
+}
@@ -0,0 +1,67 @@
+/*
+ * SLAB.H
+ *
+ * Fixed-size object allocator for hot-path records such as events.
+ *
+ * All memory is reserved up front, so total usage is hard-capped and an
+ * allocation never reaches the system allocator. Each processor keeps a
+ * small magazine of free objects, giving lookaside-list behaviour without
+ * any shared writes in the common case; magazines refill from and spill to
+ * a lock-free global free list. Magazines never hold more than a quarter
+ * of the objects between them, and an allocation that finds both its
+ * magazine and the global list empty flushes the other magazines before
+ * it fails. This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+
+#define CYBERION_SLAB_MAGAZINE_SIZE 32      // Most objects cached per processor
+#define CYBERION_SLAB_ALIGNMENT     16      // Object alignment in bytes
+
+typedef struct DECLSPEC_CACHEALIGN _CYBERION_SLAB_MAGAZINE {
+    volatile LONG Busy;                         // Owner flag; contention falls back to the global list
+    ULONG Count;
+    ULONG Objects[CYBERION_SLAB_MAGAZINE_SIZE]; // Object indices
+} CYBERION_SLAB_MAGAZINE, *PCYBERION_SLAB_MAGAZINE;
+
+typedef struct _CYBERION_SLAB {
+    PUCHAR Memory;                      // ObjectCount * ObjectSize bytes
+    SIZE_T ObjectSize;
+    ULONG ObjectCount;
+    ULONG MagazineCount;
+    ULONG MagazineLimit;                // Objects a magazine holds, 0 to bypass them
+    ULONG TransferSize;                 // Objects moved per refill/spill
+    PCYBERION_SLAB_MAGAZINE Magazines;  // One per processor
+    ULONG *NextFree;                    // Free list links, kept out of the objects
+    volatile LONG64 FreeHead;           // (ABA tag << 32) | (index + 1), 0 when empty
+    volatile LONG Failures;             // Allocations refused because the slab was empty
+} CYBERION_SLAB, *PCYBERION_SLAB;
+
+//
+// CyberionSlabInitialize: Reserves memory for ObjectCount objects of
+// ObjectSize bytes each.
+//
+NTSTATUS CyberionSlabInitialize(
+    _Out_ PCYBERION_SLAB Slab,
+    _In_ SIZE_T ObjectSize,
+    _In_ ULONG ObjectCount
+);
+
+//
+// CyberionSlabDestroy: Releases the slab's memory. Every object must have
+// been freed.
+//
+VOID CyberionSlabDestroy(_Inout_ PCYBERION_SLAB Slab);
+
+//
+// CyberionSlabAllocate: Returns an object, or NULL when the cap is reached.
+// The object contents are undefined.
+//
+PVOID CyberionSlabAllocate(_Inout_ PCYBERION_SLAB Slab);
+
+//
+// CyberionSlabFree: Returns an object obtained from CyberionSlabAllocate.
+//
+VOID CyberionSlabFree(_Inout_ PCYBERION_SLAB Slab, _In_ PVOID Object);
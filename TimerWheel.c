@@ -0,0 +1,139 @@
+/*
+ * TIMERWHEEL.C
+ *
+ * Hierarchical timing wheel.
+ *
+ * A timer goes in the lowest level whose slots, counted from the current
+ * one, reach its tick; at level L its slot is Expires >> (6 * L). That slot
+ * comes up when the current tick's low 6 * L bits wrap to zero on the way
+ * to Expires, and its timers are then placed again, in lower levels, so
+ * every timer reaches level 0 exactly at the tick it expires. Ticks with
+ * nothing armed are skipped outright.
+ */
+
+#include "TimerWheel.h"
+
+#define WHEEL_SHIFT(Level)  ((Level) * CYBERION_WHEEL_BITS)
+#define WHEEL_REACH         ((1ull << WHEEL_SHIFT(CYBERION_WHEEL_LEVELS - 1)) * (CYBERION_WHEEL_SLOTS - 1))
+
+//
+// WheelPlace: Links Timer into the slot for its tick, seen from Now.
+//
+static VOID WheelPlace(
+    _Inout_ PCYBERION_TIMER_WHEEL Wheel,
+    _Inout_ PCYBERION_TIMER Timer
+)
+{
+    PCYBERION_TIMER *slot;
+    ULONG level = 0;
+
+    while (level < CYBERION_WHEEL_LEVELS - 1 &&
+           (Timer->Expires >> WHEEL_SHIFT(level)) - (Wheel->Now >> WHEEL_SHIFT(level)) >= CYBERION_WHEEL_SLOTS) {
+        level++;
+    }
+
+    slot = &Wheel->Slots[level][(Timer->Expires >> WHEEL_SHIFT(level)) & (CYBERION_WHEEL_SLOTS - 1)];
+
+    Timer->Next = *slot;
+    if (Timer->Next) {
+        Timer->Next->Link = &Timer->Next;
+    }
+    Timer->Link = slot;
+    *slot = Timer;
+}
+
+VOID CyberionTimerWheelInitialize(
+    _Out_ PCYBERION_TIMER_WHEEL Wheel,
+    _In_ ULONG64 Now
+)
+{
+    RtlZeroMemory(Wheel, sizeof(*Wheel));
+    Wheel->Now = Now;
+}
+
+VOID CyberionTimerWheelArm(
+    _Inout_ PCYBERION_TIMER_WHEEL Wheel,
+    _Inout_ PCYBERION_TIMER Timer,
+    _In_ ULONG64 Expires
+)
+{
+    Timer->Expires = min(max(Expires, Wheel->Now + 1), Wheel->Now + WHEEL_REACH);
+    WheelPlace(Wheel, Timer);
+    Wheel->Count++;
+}
+
+VOID CyberionTimerWheelCancel(
+    _Inout_ PCYBERION_TIMER_WHEEL Wheel,
+    _Inout_ PCYBERION_TIMER Timer
+)
+{
+    if (Timer->Link == NULL) {
+        return;
+    }
+
+    *Timer->Link = Timer->Next;
+    if (Timer->Next) {
+        Timer->Next->Link = Timer->Link;
+    }
+
+    Timer->Next = NULL;
+    Timer->Link = NULL;
+    Wheel->Count--;
+}
+
+PCYBERION_TIMER CyberionTimerWheelAdvance(
+    _Inout_ PCYBERION_TIMER_WHEEL Wheel,
+    _In_ ULONG64 Now
+)
+{
+    PCYBERION_TIMER expired = NULL;
+    PCYBERION_TIMER *tail = &expired;
+
+    while (Wheel->Now < Now) {
+        PCYBERION_TIMER timer;
+        ULONG level;
+
+        if (Wheel->Count == 0) {
+            Wheel->Now = Now;
+            break;
+        }
+
+        Wheel->Now++;
+
+        // Bring down the higher slots that come up at this tick, highest first
+        for (level = CYBERION_WHEEL_LEVELS - 1; level > 0; level--) {
+            PCYBERION_TIMER *slot;
+
+            if ((Wheel->Now & ((1ull << WHEEL_SHIFT(level)) - 1)) != 0) {
+                continue;
+            }
+
+            slot = &Wheel->Slots[level][(Wheel->Now >> WHEEL_SHIFT(level)) & (CYBERION_WHEEL_SLOTS - 1)];
+            timer = *slot;
+            *slot = NULL;
+
+            while (timer) {
+                PCYBERION_TIMER next = timer->Next;
+
+                WheelPlace(Wheel, timer);
+                timer = next;
+            }
+        }
+
+        timer = Wheel->Slots[0][Wheel->Now & (CYBERION_WHEEL_SLOTS - 1)];
+        Wheel->Slots[0][Wheel->Now & (CYBERION_WHEEL_SLOTS - 1)] = NULL;
+
+        while (timer) {
+            PCYBERION_TIMER next = timer->Next;
+
+            timer->Next = NULL;
+            timer->Link = NULL;
+            *tail = timer;
+            tail = &timer->Next;
+            Wheel->Count--;
+            timer = next;
+        }
+    }
+
+    return expired;
+}
@@ -0,0 +1,74 @@
+/*
+ * TIMERWHEEL.H
+ *
+ * Hierarchical timing wheel: any number of deadlines, each armed,
+ * cancelled and expired in constant time, all driven by one periodic
+ * tick. Time is counted in ticks of whatever length the caller chooses.
+ * Level 0 has a slot per tick for the next CYBERION_WHEEL_SLOTS ticks;
+ * each level above has slots CYBERION_WHEEL_SLOTS times as wide, and their
+ * timers are moved down a level as their slot comes up. Callers serialize
+ * access.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+
+#define CYBERION_WHEEL_BITS     6
+#define CYBERION_WHEEL_SLOTS    (1u << CYBERION_WHEEL_BITS)
+#define CYBERION_WHEEL_LEVELS   4   // Deadlines up to 2^24 ticks ahead
+
+//
+// A deadline, embedded in the caller's record.
+//
+typedef struct _CYBERION_TIMER {
+    struct _CYBERION_TIMER *Next;
+    struct _CYBERION_TIMER **Link;  // What points to this timer, NULL if not armed
+    ULONG64 Expires;                // Tick
+} CYBERION_TIMER, *PCYBERION_TIMER;
+
+typedef struct _CYBERION_TIMER_WHEEL {
+    ULONG64 Now;                    // Last tick processed
+    ULONG Count;                    // Armed timers
+    PCYBERION_TIMER Slots[CYBERION_WHEEL_LEVELS][CYBERION_WHEEL_SLOTS];
+} CYBERION_TIMER_WHEEL, *PCYBERION_TIMER_WHEEL;
+
+VOID CyberionTimerWheelInitialize(
+    _Out_ PCYBERION_TIMER_WHEEL Wheel,
+    _In_ ULONG64 Now
+);
+
+FORCEINLINE BOOLEAN CyberionTimerArmed(_In_ const CYBERION_TIMER *Timer)
+{
+    return Timer->Link != NULL;
+}
+
+//
+// CyberionTimerWheelArm: Arms an unarmed timer to expire at tick Expires.
+// A deadline already passed expires on the next tick, and one beyond the
+// wheel's reach is brought in to its furthest tick.
+//
+VOID CyberionTimerWheelArm(
+    _Inout_ PCYBERION_TIMER_WHEEL Wheel,
+    _Inout_ PCYBERION_TIMER Timer,
+    _In_ ULONG64 Expires
+);
+
+//
+// CyberionTimerWheelCancel: Disarms a timer if it is armed.
+//
+VOID CyberionTimerWheelCancel(
+    _Inout_ PCYBERION_TIMER_WHEEL Wheel,
+    _Inout_ PCYBERION_TIMER Timer
+);
+
+//
+// CyberionTimerWheelAdvance: Processes every tick up to Now and returns
+// the timers that expired, disarmed and chained through Next, earliest
+// first.
+//
+PCYBERION_TIMER CyberionTimerWheelAdvance(
+    _Inout_ PCYBERION_TIMER_WHEEL Wheel,
+    _In_ ULONG64 Now
+);
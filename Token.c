@@ -0,0 +1,152 @@
+/*
+ * TOKEN.C
+ *
+ * Token information for the Cyberion driver.
+ *
+ * A logon session belongs to one user, so the user SID is looked up by
+ * the token's authentication Id in a small direct-mapped cache first and
+ * only queried (and interned, SidTable.c) for a session not seen lately.
+ * The integrity level differs between tokens of one session and is read
+ * every time. Both are kept with the process (Process.c), so a parent's
+ * come from there rather than from its token.
+ */
+
+#include "Token.h"
+#include "SidTable.h"
+
+#define TOKEN_MAX_SIDS      1024    // Distinct user SIDs given an Id
+#define TOKEN_LOGON_CACHE   64      // A power of two
+
+typedef struct _TOKEN_LOGON {
+    LUID AuthenticationId;
+    ULONG UserId;                   // 0 if the slot is empty
+} TOKEN_LOGON, *PTOKEN_LOGON;
+
+//
+// Globals
+//
+static KSPIN_LOCK g_TokenLock;
+static CYBERION_SID_TABLE g_Sids; // Protected by g_TokenLock
+static TOKEN_LOGON g_Logons[TOKEN_LOGON_CACHE]; // Recent logon sessions, protected by g_TokenLock
+
+FORCEINLINE PTOKEN_LOGON TokenLogonSlot(_In_ const LUID *AuthenticationId)
+{
+    return &g_Logons[(AuthenticationId->LowPart ^ (ULONG)AuthenticationId->HighPart) & (TOKEN_LOGON_CACHE - 1)];
+}
+
+NTSTATUS CyberionTokenInitialize(VOID)
+{
+    KeInitializeSpinLock(&g_TokenLock);
+    return CyberionSidTableInitialize(&g_Sids, TOKEN_MAX_SIDS);
+}
+
+VOID CyberionTokenShutdown(VOID)
+{
+    CyberionSidTableDestroy(&g_Sids);
+}
+
+//
+// TokenQueryUser: Interns the user SID of Token, and caches it for the
+// logon session if it has one.
+//
+static ULONG TokenQueryUser(
+    _In_ PACCESS_TOKEN Token,
+    _In_opt_ const LUID *AuthenticationId
+)
+{
+    UCHAR sid[CYBERION_MAX_SID_SIZE];
+    PTOKEN_USER user = NULL;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    ULONG length;
+    ULONG userId;
+
+    if (!NT_SUCCESS(SeQueryInformationToken(Token, TokenUser, (PVOID *)&user))) {
+        return 0;
+    }
+
+    // The query's buffer is paged, the table is behind a spin lock
+    length = min(RtlLengthSid(user->User.Sid), sizeof(sid));
+    RtlCopyMemory(sid, user->User.Sid, length);
+    ExFreePool(user);
+
+    KeAcquireInStackQueuedSpinLock(&g_TokenLock, &lockHandle);
+
+    userId = CyberionSidTableIntern(&g_Sids, sid, length);
+    if (userId != 0 && AuthenticationId != NULL) {
+        TokenLogonSlot(AuthenticationId)->AuthenticationId = *AuthenticationId;
+        TokenLogonSlot(AuthenticationId)->UserId = userId;
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    return userId;
+}
+
+VOID CyberionTokenCapture(
+    _In_ PEPROCESS Process,
+    _Out_ PCYBERION_TOKEN_INFO Token
+)
+{
+    PACCESS_TOKEN token = PsReferencePrimaryToken(Process);
+    PTOKEN_MANDATORY_LABEL label = NULL;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    LUID authenticationId;
+    BOOLEAN haveSession;
+
+    RtlZeroMemory(Token, sizeof(*Token));
+
+    haveSession = NT_SUCCESS(SeQueryAuthenticationIdToken(token, &authenticationId));
+    if (haveSession) {
+        PTOKEN_LOGON logon;
+
+        KeAcquireInStackQueuedSpinLock(&g_TokenLock, &lockHandle);
+        logon = TokenLogonSlot(&authenticationId);
+        if (logon->UserId != 0 && RtlEqualMemory(&logon->AuthenticationId, &authenticationId, sizeof(LUID))) {
+            Token->UserId = logon->UserId;
+        }
+        KeReleaseInStackQueuedSpinLock(&lockHandle);
+    }
+
+    if (Token->UserId == 0) {
+        Token->UserId = TokenQueryUser(token, haveSession ? &authenticationId : NULL);
+    }
+
+    if (NT_SUCCESS(SeQueryInformationToken(token, TokenIntegrityLevel, (PVOID *)&label))) {
+        Token->IntegrityLevel = *RtlSubAuthoritySid(label->Label.Sid, *RtlSubAuthorityCountSid(label->Label.Sid) - 1);
+        ExFreePool(label);
+    }
+
+    PsDereferencePrimaryToken(token);
+}
+
+NTSTATUS CyberionTokenGetSid(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    const CYBERION_SID_ENTRY *entry;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    NTSTATUS status = STATUS_NOT_FOUND;
+    ULONG id;
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength < sizeof(ULONG)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    id = *(PULONG)Irp->AssociatedIrp.SystemBuffer;
+
+    KeAcquireInStackQueuedSpinLock(&g_TokenLock, &lockHandle);
+
+    entry = CyberionSidTableLookup(&g_Sids, id);
+    if (entry && Stack->Parameters.DeviceIoControl.OutputBufferLength < entry->Length) {
+        status = STATUS_BUFFER_TOO_SMALL;
+    } else if (entry) {
+        RtlCopyMemory(Irp->AssociatedIrp.SystemBuffer, entry->Sid, entry->Length);
+        Irp->IoStatus.Information = entry->Length;
+        status = STATUS_SUCCESS;
+    }
+
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    return status;
+}
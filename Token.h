@@ -0,0 +1,34 @@
+/*
+ * TOKEN.H
+ *
+ * Who a process runs as: the user SID and integrity level of its primary
+ * token, captured as it is created, with user SIDs interned into the small
+ * Ids events carry, and the IOCTL_CYBERION_GET_SID path that resolves them.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+
+typedef struct _CYBERION_TOKEN_INFO {
+    ULONG UserId;               // Interned user SID, 0 if unknown
+    ULONG IntegrityLevel;       // Mandatory label RID
+} CYBERION_TOKEN_INFO, *PCYBERION_TOKEN_INFO;
+
+NTSTATUS CyberionTokenInitialize(VOID);
+VOID CyberionTokenShutdown(VOID);
+
+//
+// CyberionTokenCapture: Reads the token of Process. Called at
+// PASSIVE_LEVEL.
+//
+VOID CyberionTokenCapture(
+    _In_ PEPROCESS Process,
+    _Out_ PCYBERION_TOKEN_INFO Token
+);
+
+//
+// CyberionTokenGetSid: Handles IOCTL_CYBERION_GET_SID.
+//
+NTSTATUS CyberionTokenGetSid(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
@@ -0,0 +1,241 @@
+/*
+ * TUNABLES.C
+ *
+ * Driver-wide settings for the Cyberion driver.
+ *
+ * Every setting is a DWORD described by one row of g_TunableDescriptors,
+ * which gives its registry value name, valid range and default. The same
+ * table drives loading from the service key and validating IOCTL updates,
+ * so a new setting only needs a field in CYBERION_TUNABLES and a row here.
+ */
+
+#include "Tunables.h"
+#include "Session.h"
+
+typedef struct _TUNABLE_DESCRIPTOR {
+    PCWSTR Name;            // Registry value under the service key
+    ULONG Offset;           // Field in CYBERION_TUNABLES
+    ULONG Minimum;
+    ULONG Maximum;
+    ULONG Default;
+    BOOLEAN LoadTimeOnly;   // Cannot be changed while the driver is running
+} TUNABLE_DESCRIPTOR;
+
+#define TUNABLE(Field, Minimum, Maximum, Default, LoadTimeOnly) \
+    { L ## #Field, FIELD_OFFSET(CYBERION_TUNABLES, Field), (Minimum), (Maximum), (Default), (LoadTimeOnly) }
+
+static const TUNABLE_DESCRIPTOR g_TunableDescriptors[] = {
+    TUNABLE(QueueCapacity,  16,     65536,                      256,    FALSE),
+    TUNABLE(EventPoolSize,  256,    1048576,                    4096,   TRUE),
+    TUNABLE(BatchSize,      1,      CYBERION_MAX_BATCH,         1,      FALSE),
+    TUNABLE(BatchTimeout,   0,      CYBERION_MAX_BATCH_TIMEOUT, 0,      FALSE),
+    TUNABLE(IdentityCacheSize, 1024, 1048576,                   8192,   TRUE),
+    TUNABLE(HashWorkers,    1,      16,                         2,      TRUE),
+    TUNABLE(HashQueueDepth, 16,     4096,                       256,    TRUE),
+    TUNABLE(ProcessTableSize, 1024, 262144,                     16384,  TRUE),
+    TUNABLE(VerdictTableSize, 1024, 4194304,                    65536,  TRUE),
+    TUNABLE(VerdictAllowTtl, 0,     2592000,                    0,      FALSE),
+    TUNABLE(DetailStoreSize, 64,    65536,                      1024,   TRUE),
+    TUNABLE(DetailRetention, 100,   600000,                     10000,  FALSE),
+    TUNABLE(TerminateDescendants, 0, 1,                         0,      FALSE),
+    TUNABLE(DecisionTimeout, 100,   600000,                     30000,  FALSE),
+    TUNABLE(DefaultDecision, VerdictUnknown, VerdictBlock,      VerdictUnknown, FALSE),
+    TUNABLE(FailOpenPercentile, 50, 100,                        99,     FALSE),
+    TUNABLE(FailOpenBudget, 0,      600000,                     5000,   FALSE),
+    TUNABLE(FailOpenRecovery, 0,    600000,                     1000,   FALSE),
+    TUNABLE(LatencyWindow,  1000,   3600000,                    60000,  FALSE),
+};
+
+C_ASSERT(RTL_NUMBER_OF(g_TunableDescriptors) * sizeof(ULONG) == sizeof(CYBERION_TUNABLES));
+
+#define TUNABLE_VALUE(Tunables, Descriptor) (*(PULONG)((PUCHAR)(Tunables) + (Descriptor)->Offset))
+
+//
+// TunablesConsistent: Checks the rules between settings that each row's
+// range cannot express. With FailOpenBudget 0 the driver never fails open
+// and the other two are unused. Otherwise a recovery point at or above the
+// budget would flap or never recover, and a timeout shorter than the
+// budget would keep timeouts, counted at DecisionTimeout, from ever
+// reaching it.
+//
+static BOOLEAN TunablesConsistent(
+    _In_ const CYBERION_TUNABLES *Tunables
+)
+{
+    if (Tunables->FailOpenBudget == 0) {
+        return TRUE;
+    }
+
+    return Tunables->FailOpenRecovery < Tunables->FailOpenBudget &&
+           Tunables->DecisionTimeout >= Tunables->FailOpenBudget;
+}
+
+//
+// Globals
+//
+static CYBERION_TUNABLES g_Tunables; // Current settings, protected by g_TunablesLock
+static KSPIN_LOCK g_TunablesLock;
+static FAST_MUTEX g_TunablesUpdateLock; // Serializes IOCTL_CYBERION_SET_TUNABLES
+
+NTSTATUS CyberionTunablesInitialize(
+    _In_ PUNICODE_STRING RegistryPath
+)
+{
+    RTL_QUERY_REGISTRY_TABLE query[RTL_NUMBER_OF(g_TunableDescriptors) + 1];
+    CYBERION_TUNABLES values;
+    PWSTR path;
+    NTSTATUS status;
+    ULONG i;
+
+    KeInitializeSpinLock(&g_TunablesLock);
+    ExInitializeFastMutex(&g_TunablesUpdateLock);
+
+    for (i = 0; i < RTL_NUMBER_OF(g_TunableDescriptors); i++) {
+        TUNABLE_VALUE(&g_Tunables, &g_TunableDescriptors[i]) = g_TunableDescriptors[i].Default;
+    }
+
+    // RtlQueryRegistryValues needs a NUL-terminated path
+    path = (PWSTR)ExAllocatePool2(POOL_FLAG_PAGED, RegistryPath->Length + sizeof(WCHAR), CYBERION_POOL_TAG);
+    if (path == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlCopyMemory(path, RegistryPath->Buffer, RegistryPath->Length);
+    path[RegistryPath->Length / sizeof(WCHAR)] = L'\0';
+
+    // Missing values leave the defaults in place
+    values = g_Tunables;
+    RtlZeroMemory(query, sizeof(query));
+    for (i = 0; i < RTL_NUMBER_OF(g_TunableDescriptors); i++) {
+        query[i].Flags = RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK;
+        query[i].Name = (PWSTR)g_TunableDescriptors[i].Name;
+        query[i].EntryContext = &TUNABLE_VALUE(&values, &g_TunableDescriptors[i]);
+        query[i].DefaultType = (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE;
+    }
+
+    status = RtlQueryRegistryValues(RTL_REGISTRY_ABSOLUTE, path, query, NULL, NULL);
+    ExFreePoolWithTag(path, CYBERION_POOL_TAG);
+
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Using default tunables (0x%08X).\n", status);
+        return STATUS_SUCCESS;
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(g_TunableDescriptors); i++) {
+        const TUNABLE_DESCRIPTOR *desc = &g_TunableDescriptors[i];
+        ULONG value = TUNABLE_VALUE(&values, desc);
+
+        if (value < desc->Minimum || value > desc->Maximum) {
+            DbgPrint("CyberionDriver: Registry value %ws out of range (%u), clamping.\n", desc->Name, value);
+            value = (value < desc->Minimum) ? desc->Minimum : desc->Maximum;
+        }
+
+        TUNABLE_VALUE(&g_Tunables, desc) = value;
+    }
+
+    // The defaults are consistent, so they are the fallback
+    if (!TunablesConsistent(&g_Tunables)) {
+        DbgPrint("CyberionDriver: Registry values FailOpenBudget %u, FailOpenRecovery %u and DecisionTimeout %u "
+                 "are inconsistent, using defaults.\n",
+                 g_Tunables.FailOpenBudget, g_Tunables.FailOpenRecovery, g_Tunables.DecisionTimeout);
+
+        for (i = 0; i < RTL_NUMBER_OF(g_TunableDescriptors); i++) {
+            const TUNABLE_DESCRIPTOR *desc = &g_TunableDescriptors[i];
+
+            if (desc->Offset == FIELD_OFFSET(CYBERION_TUNABLES, FailOpenBudget) ||
+                desc->Offset == FIELD_OFFSET(CYBERION_TUNABLES, FailOpenRecovery) ||
+                desc->Offset == FIELD_OFFSET(CYBERION_TUNABLES, DecisionTimeout)) {
+                TUNABLE_VALUE(&g_Tunables, desc) = desc->Default;
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionTunablesQuery(
+    _Out_ PCYBERION_TUNABLES Tunables
+)
+{
+    KLOCK_QUEUE_HANDLE lockHandle;
+
+    KeAcquireInStackQueuedSpinLock(&g_TunablesLock, &lockHandle);
+    *Tunables = g_Tunables;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+}
+
+//
+// CyberionTunablesGet: Handles IOCTL_CYBERION_GET_TUNABLES.
+//
+NTSTATUS CyberionTunablesGet(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(CYBERION_TUNABLES)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    CyberionTunablesQuery((PCYBERION_TUNABLES)Irp->AssociatedIrp.SystemBuffer);
+    Irp->IoStatus.Information = sizeof(CYBERION_TUNABLES);
+    return STATUS_SUCCESS;
+}
+
+//
+// CyberionTunablesSet: Handles IOCTL_CYBERION_SET_TUNABLES. All values are
+// validated before any is applied; resizable structures are resized in
+// place.
+//
+NTSTATUS CyberionTunablesSet(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_TUNABLES requested = (PCYBERION_TUNABLES)Irp->AssociatedIrp.SystemBuffer;
+    CYBERION_TUNABLES current;
+    CYBERION_TUNABLES updated;
+    KLOCK_QUEUE_HANDLE lockHandle;
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG i;
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength < sizeof(CYBERION_TUNABLES)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    updated = *requested;
+
+    ExAcquireFastMutex(&g_TunablesUpdateLock);
+
+    CyberionTunablesQuery(&current);
+
+    for (i = 0; i < RTL_NUMBER_OF(g_TunableDescriptors); i++) {
+        const TUNABLE_DESCRIPTOR *desc = &g_TunableDescriptors[i];
+        ULONG value = TUNABLE_VALUE(&updated, desc);
+
+        if (value < desc->Minimum || value > desc->Maximum ||
+            (desc->LoadTimeOnly && value != TUNABLE_VALUE(&current, desc))) {
+            ExReleaseFastMutex(&g_TunablesUpdateLock);
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    if (!TunablesConsistent(&updated)) {
+        ExReleaseFastMutex(&g_TunablesUpdateLock);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Sessions that could not be resized keep their old queue and the
+    // failure is reported; new sessions always get the new capacity.
+    if (updated.QueueCapacity != current.QueueCapacity) {
+        status = CyberionSessionResizeQueues(updated.QueueCapacity);
+    }
+
+    KeAcquireInStackQueuedSpinLock(&g_TunablesLock, &lockHandle);
+    g_Tunables = updated;
+    KeReleaseInStackQueuedSpinLock(&lockHandle);
+
+    ExReleaseFastMutex(&g_TunablesUpdateLock);
+
+    DbgPrint("CyberionDriver: Tunables updated (0x%08X).\n", status);
+    return status;
+}
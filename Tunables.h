@@ -0,0 +1,29 @@
+/*
+ * TUNABLES.H
+ *
+ * Driver-wide settings. Defaults are read from the service key when the
+ * driver loads and can be changed at run time through
+ * IOCTL_CYBERION_SET_TUNABLES.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+
+//
+// CyberionTunablesInitialize: Loads the settings from the service key,
+// falling back to built-in defaults for missing or out-of-range values.
+//
+NTSTATUS CyberionTunablesInitialize(_In_ PUNICODE_STRING RegistryPath);
+
+//
+// CyberionTunablesQuery: Returns a consistent snapshot of the settings.
+//
+VOID CyberionTunablesQuery(_Out_ PCYBERION_TUNABLES Tunables);
+
+//
+// IOCTL handlers; the caller completes the IRP with the returned status.
+//
+NTSTATUS CyberionTunablesGet(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+NTSTATUS CyberionTunablesSet(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
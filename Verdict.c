@@ -0,0 +1,583 @@
+/*
+ * VERDICT.C
+ *
+ * Verdict store for the Cyberion driver.
+ *
+ * A USER_RESPONSE names a process; the decision is recorded against the
+ * hash of that process's image, so every later launch of the same image is
+ * allowed or refused without asking user mode again. Creations are never
+ * held for a decision: an unknown image runs at once, and a Block response
+ * terminates the process when it arrives, and with TerminateDescendants
+ * every recorded process it started, directly or not.
+ *
+ * The store's memory is fixed at load (VerdictTableSize); when it is full,
+ * the least recently useful decision is evicted. Allow decisions can be
+ * given a lifetime (VerdictAllowTtl) so they are asked again eventually.
+ * Administrator rules are pinned: never evicted, never expired, and not
+ * overridden by responses.
+ *
+ * Behind the store sits an optional preloaded list, typically a fleet-wide
+ * allowlist of millions of hashes or the verdicts saved before the last
+ * restart. It is copied to paged pool from one IOCTL, in any supported
+ * format, checked there and published by swapping a pointer under a push
+ * lock, so lookups see either the old list or the new one, never a mix.
+ */
+
+#include "Verdict.h"
+#include "Decision.h"
+#include "HashQueue.h"
+#include "Image.h"
+#include "Policy.h"
+#include "Process.h"
+#include "Tunables.h"
+#include "VerdictList.h"
+#include "VerdictPerfect.h"
+#include "VerdictStore.h"
+#include "VerdictTable.h"
+
+//
+// A preloaded list and the data it was built from, in one allocation.
+//
+typedef struct _CYBERION_PRELOAD {
+    CYBERION_PRELOAD_FORMAT Format;
+    ULONG Count;
+    union {
+        CYBERION_VERDICT_LIST List;     // PreloadFormatSortedList
+        CYBERION_VERDICT_STORE Store;   // PreloadFormatStore
+        CYBERION_VERDICT_PERFECT Perfect; // PreloadFormatPerfect
+    };
+    // The list data follows
+} CYBERION_PRELOAD, *PCYBERION_PRELOAD;
+
+#define VERDICT_MAX_DESCENDANTS 256 // Descendants terminated with a blocked process
+
+//
+// Globals
+//
+static CYBERION_VERDICT_TABLE g_VerdictTable; // Image hash -> verdict
+static EX_PUSH_LOCK g_PreloadLock;
+static PCYBERION_PRELOAD g_Preload; // Preloaded list, protected by g_PreloadLock
+static volatile LONG64 g_Terminated; // Processes terminated by Block responses
+
+NTSTATUS CyberionVerdictInitialize(VOID)
+{
+    CYBERION_TUNABLES tunables;
+    NTSTATUS status;
+
+    CyberionTunablesQuery(&tunables);
+    ExInitializePushLock(&g_PreloadLock);
+
+    status = CyberionVerdictTableInitialize(&g_VerdictTable, tunables.VerdictTableSize);
+    if (NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Verdict store holds %lu hashes in %lu KB.\n",
+                 tunables.VerdictTableSize, (ULONG)(CyberionVerdictTableMemory(&g_VerdictTable) / 1024));
+    }
+
+    return status;
+}
+
+VOID CyberionVerdictShutdown(VOID)
+{
+    CyberionVerdictTableDestroy(&g_VerdictTable);
+
+    if (g_Preload) {
+        ExFreePoolWithTag(g_Preload, CYBERION_POOL_TAG);
+        g_Preload = NULL;
+    }
+}
+
+CYBERION_VERDICT CyberionVerdictLookup(
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    CYBERION_VERDICT verdict = CyberionVerdictTableLookup(&g_VerdictTable, Hash);
+
+    if (verdict != VerdictUnknown) {
+        return verdict;
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_PreloadLock);
+
+    if (g_Preload) {
+        switch (g_Preload->Format) {
+        case PreloadFormatSortedList:
+            verdict = CyberionVerdictListLookup(&g_Preload->List, Hash);
+            break;
+        case PreloadFormatStore:
+            verdict = CyberionVerdictStoreLookup(&g_Preload->Store, Hash);
+            break;
+        default:
+            verdict = CyberionVerdictPerfectLookup(&g_Preload->Perfect, Hash);
+            break;
+        }
+    }
+
+    ExReleasePushLockShared(&g_PreloadLock);
+    KeLeaveCriticalRegion();
+
+    return verdict;
+}
+
+//
+// VerdictRecord: Stores a decision for an image hash.
+//
+static VOID VerdictRecord(
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict
+)
+{
+    CYBERION_TUNABLES tunables;
+    ULONG64 expires = 0;
+    NTSTATUS status;
+
+    CyberionTunablesQuery(&tunables);
+    if (Verdict == VerdictAllow && tunables.VerdictAllowTtl != 0) {
+        expires = CyberionQueryTime() + (ULONG64)tunables.VerdictAllowTtl * 10000000;
+    }
+
+    status = CyberionVerdictTableInsert(&g_VerdictTable, Hash, Verdict, 0, expires);
+    if (status == STATUS_OBJECT_NAME_COLLISION) {
+        DbgPrint("CyberionDriver: Decision ignored, an administrator rule covers the image.\n");
+    } else if (!NT_SUCCESS(status)) {
+        DbgPrint("CyberionDriver: Verdict not stored (0x%08X).\n", status);
+    }
+}
+
+//
+// VerdictProcessKey: Returns the start key of the live process with this
+// ID, or 0 if there is none.
+//
+static ULONG64 VerdictProcessKey(
+    _In_ HANDLE ProcessId
+)
+{
+    PEPROCESS process;
+    ULONG64 processKey;
+
+    if (!NT_SUCCESS(PsLookupProcessByProcessId(ProcessId, &process))) {
+        return 0;
+    }
+
+    processKey = PsGetProcessStartKey(process);
+    ObDereferenceObject(process);
+    return processKey;
+}
+
+//
+// VerdictTerminate: Terminates a blocked process. If ProcessKey is not 0,
+// only a process with that start key is terminated, never a newer one
+// that was given its ID.
+//
+static NTSTATUS VerdictTerminate(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey
+)
+{
+    PEPROCESS process;
+    HANDLE processHandle;
+    NTSTATUS status;
+
+    status = PsLookupProcessByProcessId(ProcessId, &process);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    if (ProcessKey != 0 && PsGetProcessStartKey(process) != ProcessKey) {
+        ObDereferenceObject(process);
+        return STATUS_NOT_FOUND;
+    }
+
+    status = ObOpenObjectByPointer(process, OBJ_KERNEL_HANDLE, NULL, PROCESS_TERMINATE, *PsProcessType, KernelMode, &processHandle);
+    ObDereferenceObject(process);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = ZwTerminateProcess(processHandle, STATUS_ACCESS_DENIED);
+    ZwClose(processHandle);
+
+    if (NT_SUCCESS(status)) {
+        InterlockedIncrement64(&g_Terminated);
+    }
+
+    DbgPrint("CyberionDriver: Terminated blocked PID %d (0x%08X).\n", ProcessId, status);
+    return status;
+}
+
+//
+// VerdictTerminateTree: Terminates a blocked process and, if configured,
+// its descendants. The process goes first, so it starts no more; they are
+// then found by its start key, which its record keeps after it exits.
+//
+static VOID VerdictTerminateTree(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey
+)
+{
+    CYBERION_TUNABLES tunables;
+    PCYBERION_PROCESS_KEY descendants;
+    ULONG count;
+    ULONG i;
+
+    CyberionTunablesQuery(&tunables);
+
+    // Without a key the process is only known while it lives
+    if (ProcessKey == 0 && tunables.TerminateDescendants) {
+        ProcessKey = VerdictProcessKey(ProcessId);
+    }
+
+    VerdictTerminate(ProcessId, ProcessKey);
+
+    if (!tunables.TerminateDescendants || ProcessKey == 0) {
+        return;
+    }
+
+    descendants = (PCYBERION_PROCESS_KEY)CyberionAllocate(VERDICT_MAX_DESCENDANTS * sizeof(CYBERION_PROCESS_KEY));
+    if (descendants == NULL) {
+        return;
+    }
+
+    count = CyberionProcessCollectDescendants(ProcessId, ProcessKey, descendants, VERDICT_MAX_DESCENDANTS);
+
+    for (i = 0; i < count; i++) {
+        VerdictTerminate(descendants[i].ProcessId, descendants[i].ProcessKey);
+    }
+
+    CyberionFree(descendants);
+}
+
+VOID CyberionVerdictImageHashed(
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    CYBERION_VERDICT verdict = CyberionProcessHashKnown(Identity, Hash);
+
+    if (verdict != VerdictUnknown) {
+        VerdictRecord(Hash, verdict);
+    }
+}
+
+NTSTATUS CyberionVerdictDecide(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ CYBERION_VERDICT Verdict
+)
+{
+    UCHAR hash[CYBERION_HASH_SIZE];
+    NTSTATUS status;
+
+    // A decision made before the image was hashed is applied when it is
+    status = CyberionProcessResolveHash(ProcessId, Verdict, hash);
+    if (status == STATUS_SUCCESS) {
+        VerdictRecord(hash, Verdict);
+    } else if (status != STATUS_PENDING) {
+        return status;
+    }
+
+    if (Verdict == VerdictBlock) {
+        VerdictTerminateTree(ProcessId, ProcessKey);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS CyberionVerdictRespond(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PUSER_RESPONSE response = (PUSER_RESPONSE)Irp->AssociatedIrp.SystemBuffer;
+    CYBERION_VERDICT verdict;
+    ULONG64 processKey = 0;
+    ULONG64 waited;
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength < RTL_SIZEOF_THROUGH_FIELD(USER_RESPONSE, Response)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength >= sizeof(USER_RESPONSE)) {
+        processKey = response->ProcessKey;
+    }
+
+    switch (response->Response) {
+        case UserResponseAllow:
+            verdict = VerdictAllow;
+            break;
+
+        case UserResponseBlock:
+            verdict = VerdictBlock;
+            break;
+
+        default:
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    if (processKey != 0 && VerdictProcessKey(response->ProcessId) != processKey) {
+        return STATUS_NOT_FOUND;
+    }
+
+    if (CyberionDecisionResolve(response->ProcessId, processKey, &waited)) {
+        CyberionPolicyRecord(waited);
+    }
+
+    return CyberionVerdictDecide(response->ProcessId, processKey, verdict);
+}
+
+NTSTATUS CyberionVerdictSetRule(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_VERDICT_RULE rule = (PCYBERION_VERDICT_RULE)Irp->AssociatedIrp.SystemBuffer;
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength < sizeof(CYBERION_VERDICT_RULE)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    switch (rule->Verdict) {
+        case VerdictUnknown:
+            CyberionVerdictTableRemove(&g_VerdictTable, rule->Hash);
+            return STATUS_SUCCESS;
+
+        case VerdictAllow:
+        case VerdictBlock:
+            return CyberionVerdictTableInsert(&g_VerdictTable, rule->Hash, rule->Verdict, CYBERION_VERDICT_PINNED, 0);
+
+        default:
+            return STATUS_INVALID_PARAMETER;
+    }
+}
+
+NTSTATUS CyberionVerdictQueryStatistics(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_VERDICT_STATISTICS stats = (PCYBERION_VERDICT_STATISTICS)Irp->AssociatedIrp.SystemBuffer;
+
+    if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(CYBERION_VERDICT_STATISTICS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    CyberionVerdictTableQueryStatistics(&g_VerdictTable, stats);
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&g_PreloadLock);
+    stats->Preloaded = g_Preload ? g_Preload->Count : 0;
+    ExReleasePushLockShared(&g_PreloadLock);
+    KeLeaveCriticalRegion();
+
+    stats->Terminated = (ULONG64)ReadNoFence64(&g_Terminated);
+    CyberionDecisionQueryStatistics(stats);
+    CyberionPolicyQueryStatistics(stats);
+    CyberionImageQueryStatistics(stats);
+    CyberionHashQueueQueryStatistics(stats);
+
+    Irp->IoStatus.Information = sizeof(CYBERION_VERDICT_STATISTICS);
+    return STATUS_SUCCESS;
+}
+
+//
+// VerdictBuildPreload: Copies a preload payload of Length bytes from Data
+// and checks it. A sorted list is rearranged for searching as it is copied.
+//
+static NTSTATUS VerdictBuildPreload(
+    _In_ const CYBERION_PRELOAD_HEADER *Header,
+    _In_reads_bytes_(Length) const VOID *Data,
+    _In_ SIZE_T Length,
+    _Out_ PCYBERION_PRELOAD *Preload
+)
+{
+    PCYBERION_PRELOAD preload;
+    PUCHAR copy;
+    SIZE_T size = Length;
+    NTSTATUS status;
+
+    *Preload = NULL;
+
+    if (Header->Format == PreloadFormatSortedList) {
+        size = CyberionVerdictListSize(Header->Count);
+    }
+
+    // Lookups run at PASSIVE_LEVEL, so the list can live in paged pool
+    preload = (PCYBERION_PRELOAD)ExAllocatePool2(POOL_FLAG_PAGED, sizeof(CYBERION_PRELOAD) + size, CYBERION_POOL_TAG);
+    if (preload == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // Check our own copy; the caller's pages can change underneath us
+    copy = (PUCHAR)(preload + 1);
+
+    preload->Format = (CYBERION_PRELOAD_FORMAT)Header->Format;
+    preload->Count = Header->Count;
+
+    if (preload->Format == PreloadFormatSortedList) {
+        status = CyberionVerdictListBuild((const UCHAR *)Data,
+                                          (const UCHAR *)Data + (SIZE_T)Header->Count * CYBERION_HASH_SIZE,
+                                          Header->Count,
+                                          copy,
+                                          &preload->List);
+    } else {
+        RtlCopyMemory(copy, Data, Length);
+
+        if (preload->Format == PreloadFormatStore) {
+            status = CyberionVerdictStoreOpen(copy, Length, &preload->Store);
+            if (NT_SUCCESS(status) && preload->Store.Count != Header->Count) {
+                status = STATUS_INVALID_PARAMETER;
+            }
+        } else {
+            status = CyberionVerdictPerfectOpen(copy, Length, &preload->Perfect);
+            if (NT_SUCCESS(status) && preload->Perfect.Count != Header->Count) {
+                status = STATUS_INVALID_PARAMETER;
+            }
+        }
+    }
+
+    if (!NT_SUCCESS(status)) {
+        ExFreePoolWithTag(preload, CYBERION_POOL_TAG);
+        return status;
+    }
+
+    *Preload = preload;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS CyberionVerdictPreload(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    PCYBERION_PRELOAD_HEADER header = (PCYBERION_PRELOAD_HEADER)Irp->AssociatedIrp.SystemBuffer;
+    ULONG outputLength = Stack->Parameters.DeviceIoControl.OutputBufferLength;
+    PCYBERION_PRELOAD preload = NULL;
+    PCYBERION_PRELOAD oldPreload;
+    SIZE_T length;
+    PVOID data;
+    NTSTATUS status;
+
+    if (Stack->Parameters.DeviceIoControl.InputBufferLength < sizeof(CYBERION_PRELOAD_HEADER)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (header->Count > CYBERION_MAX_PRELOAD || header->Format >= PreloadFormatMax) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // A store image is at least its header; its slot table is sized below
+    if (header->Format == PreloadFormatSortedList) {
+        length = (SIZE_T)header->Count * (CYBERION_HASH_SIZE + 1);
+    } else if (header->Format == PreloadFormatStore) {
+        length = sizeof(CYBERION_STORE_HEADER);
+    } else {
+        length = CyberionVerdictPerfectSize(header->Count);
+    }
+
+    if (header->Count != 0) {
+        if (Irp->MdlAddress == NULL || outputLength < length) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        data = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+        if (data == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        // Only the slot count the header states is copied, never the rest
+        // of the caller's buffer
+        if (header->Format == PreloadFormatStore) {
+            length = CyberionVerdictStoreImageSize((const CYBERION_STORE_HEADER *)data, header->Count);
+            if (length == 0) {
+                return STATUS_INVALID_IMAGE_FORMAT;
+            }
+
+            if (outputLength < length) {
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+        }
+
+        status = VerdictBuildPreload(header, data, length, &preload);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&g_PreloadLock);
+    oldPreload = g_Preload;
+    g_Preload = preload;
+    ExReleasePushLockExclusive(&g_PreloadLock);
+    KeLeaveCriticalRegion();
+
+    if (oldPreload) {
+        ExFreePoolWithTag(oldPreload, CYBERION_POOL_TAG);
+    }
+
+    DbgPrint("CyberionDriver: Preloaded %lu verdicts.\n", header->Count);
+    return STATUS_SUCCESS;
+}
+
+//
+// VerdictExportEntry: CYBERION_VERDICT_VISIT callback adding one entry to
+// the store image in Context.
+//
+static BOOLEAN VerdictExportEntry(
+    _In_opt_ PVOID Context,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict,
+    _In_ UCHAR Flags,
+    _In_ ULONG64 Expires
+)
+{
+    UNREFERENCED_PARAMETER(Flags);
+
+    // Expiry times do not survive a restart
+    if (Expires != 0) {
+        return TRUE;
+    }
+
+    return NT_SUCCESS(CyberionVerdictStoreAdd(Context, Hash, Verdict));
+}
+
+NTSTATUS CyberionVerdictExport(
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION Stack
+)
+{
+    SIZE_T size = CyberionVerdictStoreSize(g_VerdictTable.Capacity);
+    PVOID output;
+    PVOID image;
+    NTSTATUS status;
+
+    if (Irp->MdlAddress == NULL || Stack->Parameters.DeviceIoControl.OutputBufferLength < size) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    output = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+    if (output == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // The builder reads its header back, and the caller's pages stay
+    // writable from user mode, so the image is built where only we can
+    // reach it and copied out once sealed
+    image = CyberionAllocate(size);
+    if (image == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    status = CyberionVerdictStoreCreate(image, size, g_VerdictTable.Capacity);
+    if (NT_SUCCESS(status)) {
+        if (CyberionVerdictTableEnumerate(&g_VerdictTable, VerdictExportEntry, image)) {
+            CyberionVerdictStoreSeal(image);
+            RtlCopyMemory(output, image, size);
+            Irp->IoStatus.Information = size;
+        } else {
+            status = STATUS_INTERNAL_ERROR;
+        }
+    }
+
+    CyberionFree(image);
+    return status;
+}
@@ -0,0 +1,70 @@
+/*
+ * VERDICT.H
+ *
+ * Allow/block decisions for image hashes: the verdict store consulted on
+ * every process creation, and the IOCTL_CYBERION_SEND_RESPONSE path that
+ * fills it.
+ */
+
+#pragma once
+
+#include <ntifs.h>
+#include "Public.h"
+#include "IdentityCache.h"
+
+NTSTATUS CyberionVerdictInitialize(VOID);
+VOID CyberionVerdictShutdown(VOID);
+
+//
+// CyberionVerdictLookup: Returns the verdict recorded or preloaded for an
+// image hash. Callable at IRQL <= APC_LEVEL.
+//
+CYBERION_VERDICT CyberionVerdictLookup(_In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash);
+
+//
+// CyberionVerdictImageHashed: Called when the hash of a file has been
+// computed. Applies any decision that arrived for its processes before the
+// hash did.
+//
+VOID CyberionVerdictImageHashed(
+    _In_ const CYBERION_FILE_IDENTITY *Identity,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
+
+//
+// CyberionVerdictDecide: Applies a decision on a process: records it for
+// the process's image hash, now or once the hash is known, and terminates
+// the process for VerdictBlock. A ProcessKey other than 0 is the process's
+// start key, so termination spares a newer process given the same ID.
+// Called at PASSIVE_LEVEL.
+//
+NTSTATUS CyberionVerdictDecide(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 ProcessKey,
+    _In_ CYBERION_VERDICT Verdict
+);
+
+//
+// CyberionVerdictRespond: Handles IOCTL_CYBERION_SEND_RESPONSE.
+//
+NTSTATUS CyberionVerdictRespond(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+
+//
+// CyberionVerdictSetRule: Handles IOCTL_CYBERION_SET_RULE.
+//
+NTSTATUS CyberionVerdictSetRule(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+
+//
+// CyberionVerdictQueryStatistics: Handles IOCTL_CYBERION_GET_VERDICT_STATS.
+//
+NTSTATUS CyberionVerdictQueryStatistics(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+
+//
+// CyberionVerdictPreload: Handles IOCTL_CYBERION_PRELOAD_VERDICTS.
+//
+NTSTATUS CyberionVerdictPreload(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
+
+//
+// CyberionVerdictExport: Handles IOCTL_CYBERION_EXPORT_VERDICTS.
+//
+NTSTATUS CyberionVerdictExport(_In_ PIRP Irp, _In_ PIO_STACK_LOCATION Stack);
@@ -0,0 +1,267 @@
+/*
+ * VERDICTFILTER.C
+ *
+ * Cuckoo filter for the verdict table.
+ *
+ * A hash's fingerprint is its bytes 16-17 and its first bucket comes from
+ * bytes 20-27; the table already uses bytes 0-11, so the filter's answers
+ * are independent of where the table would probe. The second bucket is the
+ * first XOR a mix of the fingerprint, so either bucket and the fingerprint
+ * give the other, which is what lets a full bucket push a fingerprint to
+ * its alternate without knowing the hash it came from.
+ *
+ * With 16-bit fingerprints and two buckets of four, a hash that is absent
+ * matches with probability below 8 / 65535 at full load.
+ */
+
+#include "VerdictFilter.h"
+
+#define FILTER_LANES    0x0001000100010001ull
+#define FILTER_HIGHS    0x8000800080008000ull
+
+FORCEINLINE USHORT FilterFingerprint(_In_ const UCHAR *Hash)
+{
+    USHORT fingerprint;
+
+    RtlCopyMemory(&fingerprint, Hash + 16, sizeof(fingerprint));
+
+    // Zero marks an empty lane
+    return fingerprint ? fingerprint : 1;
+}
+
+FORCEINLINE ULONG FilterBucket(_In_ const CYBERION_VERDICT_FILTER *Filter, _In_ const UCHAR *Hash)
+{
+    ULONG64 bits;
+
+    RtlCopyMemory(&bits, Hash + 20, sizeof(bits));
+    return (ULONG)bits & Filter->BucketMask;
+}
+
+FORCEINLINE ULONG FilterAlternate(
+    _In_ const CYBERION_VERDICT_FILTER *Filter,
+    _In_ ULONG Bucket,
+    _In_ USHORT Fingerprint
+)
+{
+    return (Bucket ^ (Fingerprint * 0x5BD1E995u)) & Filter->BucketMask;
+}
+
+//
+// FilterHolds: Returns TRUE if any lane of Word equals Fingerprint.
+//
+FORCEINLINE BOOLEAN FilterHolds(_In_ ULONG64 Word, _In_ USHORT Fingerprint)
+{
+    ULONG64 x = Word ^ (Fingerprint * FILTER_LANES);
+
+    return ((x - FILTER_LANES) & ~x & FILTER_HIGHS) != 0;
+}
+
+//
+// FilterPlace: Puts Fingerprint in a free lane of Bucket. Returns FALSE if
+// the bucket is full. Caller is the writer.
+//
+static BOOLEAN FilterPlace(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter,
+    _In_ ULONG Bucket,
+    _In_ USHORT Fingerprint
+)
+{
+    ULONG64 word = (ULONG64)Filter->Buckets[Bucket];
+    ULONG lane;
+
+    for (lane = 0; lane < CYBERION_FILTER_SLOTS; lane++) {
+        if (((word >> (lane * 16)) & 0xFFFF) == 0) {
+            WriteNoFence64(&Filter->Buckets[Bucket], (LONG64)(word | ((ULONG64)Fingerprint << (lane * 16))));
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+NTSTATUS CyberionVerdictFilterInitialize(
+    _Out_ PCYBERION_VERDICT_FILTER Filter,
+    _In_ ULONG Capacity
+)
+{
+    ULONG buckets = 16;
+
+    RtlZeroMemory(Filter, sizeof(*Filter));
+
+    if (Capacity == 0 || Capacity > (1u << 28)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    while ((ULONG64)buckets * CYBERION_FILTER_SLOTS < (ULONG64)Capacity * 2) {
+        buckets <<= 1;
+    }
+
+    Filter->Buckets = (volatile LONG64 *)CyberionAllocate(buckets * sizeof(LONG64));
+    if (Filter->Buckets == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory((PVOID)Filter->Buckets, buckets * sizeof(LONG64));
+    Filter->BucketMask = buckets - 1;
+    Filter->Random = 0x2545F491;
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionVerdictFilterDestroy(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter
+)
+{
+    if (Filter->Buckets) {
+        CyberionFree((PVOID)Filter->Buckets);
+    }
+
+    RtlZeroMemory(Filter, sizeof(*Filter));
+}
+
+SIZE_T CyberionVerdictFilterMemory(
+    _In_ const CYBERION_VERDICT_FILTER *Filter
+)
+{
+    if (Filter->Buckets == NULL) {
+        return 0;
+    }
+
+    return ((SIZE_T)Filter->BucketMask + 1) * sizeof(LONG64);
+}
+
+BOOLEAN CyberionVerdictFilterContains(
+    _In_ const CYBERION_VERDICT_FILTER *Filter,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    USHORT fingerprint = FilterFingerprint(Hash);
+    ULONG bucket = FilterBucket(Filter, Hash);
+    ULONG64 first;
+    ULONG64 second;
+    LONG sequence;
+
+    // A fingerprint being relocated may be in neither bucket for a moment
+    sequence = ReadAcquire(&Filter->Sequence);
+    if ((sequence & 1) || ReadNoFence(&Filter->Saturated)) {
+        return TRUE;
+    }
+
+    first = (ULONG64)ReadNoFence64(&Filter->Buckets[bucket]);
+    second = (ULONG64)ReadNoFence64(&Filter->Buckets[FilterAlternate(Filter, bucket, fingerprint)]);
+
+    CyberionLoadFence();
+    if (ReadNoFence(&Filter->Sequence) != sequence) {
+        return TRUE;
+    }
+
+    return FilterHolds(first, fingerprint) || FilterHolds(second, fingerprint);
+}
+
+BOOLEAN CyberionVerdictFilterAdd(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    USHORT fingerprint = FilterFingerprint(Hash);
+    ULONG bucket = FilterBucket(Filter, Hash);
+    LONG sequence = Filter->Sequence;
+    ULONG kick;
+
+    Filter->Count++;
+
+    if (FilterPlace(Filter, bucket, fingerprint) ||
+        FilterPlace(Filter, FilterAlternate(Filter, bucket, fingerprint), fingerprint)) {
+        return !Filter->Saturated;
+    }
+
+    // During a rebuild the sequence number is already odd
+    if (!(sequence & 1)) {
+        WriteNoFence(&Filter->Sequence, sequence + 1);
+        CyberionStoreFence();
+    }
+
+    // Both buckets are full: swap the fingerprint with a random resident and
+    // carry that one to its alternate bucket, until one finds room
+    for (kick = 0; kick < CYBERION_FILTER_MAX_KICKS; kick++) {
+        ULONG64 word = (ULONG64)Filter->Buckets[bucket];
+        ULONG lane;
+        USHORT victim;
+
+        Filter->Random ^= Filter->Random << 13;
+        Filter->Random ^= Filter->Random >> 17;
+        Filter->Random ^= Filter->Random << 5;
+        lane = Filter->Random % CYBERION_FILTER_SLOTS;
+
+        victim = (USHORT)(word >> (lane * 16));
+        word &= ~(0xFFFFull << (lane * 16));
+        WriteNoFence64(&Filter->Buckets[bucket], (LONG64)(word | ((ULONG64)fingerprint << (lane * 16))));
+
+        fingerprint = victim;
+        bucket = FilterAlternate(Filter, bucket, fingerprint);
+
+        if (FilterPlace(Filter, bucket, fingerprint)) {
+            break;
+        }
+    }
+
+    // A fingerprint without a home would turn into a false negative
+    if (kick == CYBERION_FILTER_MAX_KICKS) {
+        WriteNoFence(&Filter->Saturated, 1);
+    }
+
+    if (!(sequence & 1)) {
+        WriteRelease(&Filter->Sequence, sequence + 2);
+    }
+
+    return !Filter->Saturated;
+}
+
+VOID CyberionVerdictFilterReset(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter
+)
+{
+    ULONG bucket;
+
+    WriteNoFence(&Filter->Sequence, Filter->Sequence + 1);
+    CyberionStoreFence();
+
+    for (bucket = 0; bucket <= Filter->BucketMask; bucket++) {
+        WriteNoFence64(&Filter->Buckets[bucket], 0);
+    }
+
+    WriteNoFence(&Filter->Saturated, 0);
+    Filter->Count = 0;
+}
+
+VOID CyberionVerdictFilterResume(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter
+)
+{
+    WriteRelease(&Filter->Sequence, Filter->Sequence + 1);
+}
+
+VOID CyberionVerdictFilterRemove(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    USHORT fingerprint = FilterFingerprint(Hash);
+    ULONG buckets[2];
+    ULONG i;
+    ULONG lane;
+
+    buckets[0] = FilterBucket(Filter, Hash);
+    buckets[1] = FilterAlternate(Filter, buckets[0], fingerprint);
+
+    for (i = 0; i < 2; i++) {
+        ULONG64 word = (ULONG64)Filter->Buckets[buckets[i]];
+
+        for (lane = 0; lane < CYBERION_FILTER_SLOTS; lane++) {
+            if ((USHORT)(word >> (lane * 16)) == fingerprint) {
+                WriteNoFence64(&Filter->Buckets[buckets[i]], (LONG64)(word & ~(0xFFFFull << (lane * 16))));
+                Filter->Count--;
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * VERDICTFILTER.H
+ *
+ * Cuckoo filter over the image hashes in the verdict table. Most launches
+ * are of images the table has never seen; the filter answers "definitely
+ * absent" for those from two 8-byte buckets, which stay cache resident,
+ * instead of probing the table's cold tags and entries. Unlike a Bloom
+ * filter it supports removal, so it can follow evictions.
+ *
+ * Each bucket holds four 16-bit fingerprints in one 64-bit word. Writers
+ * are serialized by the caller. Readers take no lock: adding or removing a
+ * fingerprint is a single 64-bit store, and a relocation chain runs under a
+ * sequence number, during which readers answer "maybe". If an add finds no
+ * room the filter saturates and answers "maybe" to everything until its
+ * owner rebuilds it from the hashes it holds.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+#define CYBERION_FILTER_SLOTS       4   // Fingerprints per bucket
+#define CYBERION_FILTER_MAX_KICKS   500 // Relocations before an add gives up
+
+typedef struct _CYBERION_VERDICT_FILTER {
+    volatile LONG64 *Buckets;
+    ULONG BucketMask;               // Bucket count - 1 (a power of two)
+    volatile LONG Sequence;         // Odd while fingerprints are being relocated or reset
+    volatile LONG Saturated;        // An add failed since the last reset; lookups answer "maybe"
+
+    // Writer-owned
+    ULONG Count;                    // Fingerprints stored
+    ULONG Random;                   // Victim choice during relocation
+} CYBERION_VERDICT_FILTER, *PCYBERION_VERDICT_FILTER;
+
+//
+// CyberionVerdictFilterInitialize: Allocates a filter for up to Capacity
+// hashes at a load factor of at most 1/2. Adds can fail well short of
+// full, particularly under churn, and a rebuild is a pass over every hash,
+// so the filter is kept far from it.
+//
+NTSTATUS CyberionVerdictFilterInitialize(
+    _Out_ PCYBERION_VERDICT_FILTER Filter,
+    _In_ ULONG Capacity
+);
+
+//
+// CyberionVerdictFilterDestroy: Frees the filter. No lookups may be running.
+//
+VOID CyberionVerdictFilterDestroy(_Inout_ PCYBERION_VERDICT_FILTER Filter);
+
+//
+// CyberionVerdictFilterMemory: Bytes allocated by the filter.
+//
+SIZE_T CyberionVerdictFilterMemory(_In_ const CYBERION_VERDICT_FILTER *Filter);
+
+//
+// CyberionVerdictFilterContains: Returns FALSE only if Hash was never added
+// or has been removed. Safe at any IRQL <= DISPATCH_LEVEL, concurrently
+// with a writer.
+//
+BOOLEAN CyberionVerdictFilterContains(
+    _In_ const CYBERION_VERDICT_FILTER *Filter,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
+
+//
+// CyberionVerdictFilterAdd: Adds Hash. If no room can be made the filter
+// saturates. Returns FALSE if the filter is saturated, in which case the
+// caller should rebuild it.
+//
+BOOLEAN CyberionVerdictFilterAdd(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
+
+//
+// CyberionVerdictFilterReset: Empties the filter and clears saturation, to
+// rebuild it: the caller adds every hash it holds again, then calls
+// CyberionVerdictFilterResume. Lookups answer "maybe" in between.
+//
+VOID CyberionVerdictFilterReset(_Inout_ PCYBERION_VERDICT_FILTER Filter);
+VOID CyberionVerdictFilterResume(_Inout_ PCYBERION_VERDICT_FILTER Filter);
+
+//
+// CyberionVerdictFilterRemove: Removes Hash, which must have been added.
+//
+VOID CyberionVerdictFilterRemove(
+    _Inout_ PCYBERION_VERDICT_FILTER Filter,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
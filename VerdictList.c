@@ -0,0 +1,174 @@
+/*
+ * VERDICTLIST.C
+ *
+ * Sorted verdict list in Eytzinger order.
+ *
+ * Node k (from 1) has children 2k and 2k + 1, and the nodes 8k to 8k + 7
+ * three levels below it are adjacent, one cache line of prefixes. The
+ * descent is branch free: it always runs to a leaf, and the path taken
+ * encodes the first node whose prefix is not below the searched one. Hash
+ * prefixes collide only among millions of hashes, so the final step
+ * compares whole hashes and moves to the in-order successor while the
+ * prefix still matches.
+ *
+ * The whole-hash comparison uses two 16-byte SSE2 compares on x86. YMM
+ * registers would need their state saved around every lookup in kernel
+ * mode, which costs far more than the compare saves.
+ */
+
+#include "VerdictList.h"
+
+#if defined(_M_AMD64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VERDICT_LIST_X86 1
+#include <emmintrin.h>
+#endif
+
+FORCEINLINE ULONG64 VerdictListPrefix(_In_ const UCHAR *Hash)
+{
+    ULONG64 prefix;
+
+    RtlCopyMemory(&prefix, Hash, sizeof(prefix));
+
+    // Big endian, so prefixes order the same way as the hashes
+    return RtlUlonglongByteSwap(prefix);
+}
+
+FORCEINLINE BOOLEAN VerdictListEqual(_In_ const UCHAR *Left, _In_ const UCHAR *Right)
+{
+#ifdef VERDICT_LIST_X86
+    __m128i low = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)Left), _mm_loadu_si128((const __m128i *)Right));
+    __m128i high = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(Left + 16)), _mm_loadu_si128((const __m128i *)(Right + 16)));
+
+    return _mm_movemask_epi8(_mm_and_si128(low, high)) == 0xFFFF;
+#else
+    return RtlEqualMemory(Left, Right, CYBERION_HASH_SIZE);
+#endif
+}
+
+FORCEINLINE VOID VerdictListPrefetch(_In_ const VOID *Address)
+{
+#ifdef VERDICT_LIST_X86
+    _mm_prefetch((const char *)Address, _MM_HINT_T0);
+#else
+    UNREFERENCED_PARAMETER(Address);
+#endif
+}
+
+//
+// VerdictListFirst: Leftmost node of the subtree under Node.
+//
+FORCEINLINE ULONG VerdictListFirst(_In_ ULONG Node, _In_ ULONG Count)
+{
+    while ((ULONG64)Node * 2 <= Count) {
+        Node *= 2;
+    }
+    return Node;
+}
+
+//
+// VerdictListNext: In-order successor of Node, or 0 after the last.
+//
+FORCEINLINE ULONG VerdictListNext(_In_ ULONG Node, _In_ ULONG Count)
+{
+    if ((ULONG64)Node * 2 + 1 <= Count) {
+        return VerdictListFirst(Node * 2 + 1, Count);
+    }
+
+    // Climb while this is a right child, then once more
+    while (Node & 1) {
+        Node >>= 1;
+    }
+    return Node >> 1;
+}
+
+SIZE_T CyberionVerdictListSize(
+    _In_ ULONG Count
+)
+{
+    if (Count > CYBERION_MAX_PRELOAD) {
+        return 0;
+    }
+
+    return ((SIZE_T)Count + 1) * (sizeof(ULONG64) + CYBERION_HASH_SIZE + 1);
+}
+
+NTSTATUS CyberionVerdictListBuild(
+    _In_reads_(Count * CYBERION_HASH_SIZE) const UCHAR *Hashes,
+    _In_reads_(Count) const UCHAR *Verdicts,
+    _In_ ULONG Count,
+    _Out_writes_bytes_(CyberionVerdictListSize(Count)) PVOID Buffer,
+    _Out_ PCYBERION_VERDICT_LIST List
+)
+{
+    const UCHAR *previous = NULL;
+    ULONG node;
+    ULONG i;
+
+    RtlZeroMemory(List, sizeof(*List));
+
+    if (Count > CYBERION_MAX_PRELOAD) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    List->Prefixes = (PULONG64)Buffer;
+    List->Hashes = (PUCHAR)(List->Prefixes + (SIZE_T)Count + 1);
+    List->Verdicts = List->Hashes + ((SIZE_T)Count + 1) * CYBERION_HASH_SIZE;
+
+    // Visiting the tree in order meets its nodes in ascending order
+    node = VerdictListFirst(1, Count);
+
+    for (i = 0; i < Count; i++) {
+        PUCHAR hash = List->Hashes + (SIZE_T)node * CYBERION_HASH_SIZE;
+
+        RtlCopyMemory(hash, Hashes + (SIZE_T)i * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE);
+        List->Verdicts[node] = Verdicts[i];
+        List->Prefixes[node] = VerdictListPrefix(hash);
+
+        // Strictly ascending also rules out duplicates
+        if ((List->Verdicts[node] != VerdictAllow && List->Verdicts[node] != VerdictBlock) ||
+            (previous && memcmp(previous, hash, CYBERION_HASH_SIZE) >= 0)) {
+            RtlZeroMemory(List, sizeof(*List));
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        previous = hash;
+        node = VerdictListNext(node, Count);
+    }
+
+    List->Prefixes[0] = 0;
+    List->Verdicts[0] = VerdictUnknown;
+    List->Count = Count;
+    return STATUS_SUCCESS;
+}
+
+CYBERION_VERDICT CyberionVerdictListLookup(
+    _In_ const CYBERION_VERDICT_LIST *List,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    ULONG64 prefix = VerdictListPrefix(Hash);
+    ULONG node = 1;
+
+    while (node <= List->Count) {
+        // Four levels down, sixteen prefixes, two cache lines
+        VerdictListPrefetch(&List->Prefixes[(SIZE_T)node * 16]);
+        VerdictListPrefetch(&List->Prefixes[(SIZE_T)node * 16 + 8]);
+        node = node * 2 + (List->Prefixes[node] < prefix);
+    }
+
+    // Undo the right turns after the last left one: that node is the first
+    // whose prefix is not below the searched one (0 if there is none)
+    while (node & 1) {
+        node >>= 1;
+    }
+    node >>= 1;
+
+    while (node != 0 && List->Prefixes[node] == prefix) {
+        if (VerdictListEqual(List->Hashes + (SIZE_T)node * CYBERION_HASH_SIZE, Hash)) {
+            return (CYBERION_VERDICT)List->Verdicts[node];
+        }
+        node = VerdictListNext(node, List->Count);
+    }
+
+    return VerdictUnknown;
+}
@@ -0,0 +1,56 @@
+/*
+ * VERDICTLIST.H
+ *
+ * Immutable list of image hash verdicts, built once from a fleet allowlist
+ * or blocklist and then only searched. The sorted input is rearranged into
+ * Eytzinger (breadth-first) order, so a search walks down an implicit
+ * binary tree whose top levels share a few cache lines, and the next
+ * levels can be fetched before they are needed. The search compares only
+ * the first eight bytes of each hash, kept in an array of their own; the
+ * full hash is compared once, at the end.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+typedef struct _CYBERION_VERDICT_LIST {
+    ULONG Count;
+    ULONG Reserved;
+    PULONG64 Prefixes;              // Count + 1 big-endian hash prefixes, from index 1, tree order
+    PUCHAR Hashes;                  // Count + 1 hashes of CYBERION_HASH_SIZE bytes, from index 1, tree order
+    PUCHAR Verdicts;                // Count + 1 CYBERION_VERDICT values, from index 1, tree order
+} CYBERION_VERDICT_LIST, *PCYBERION_VERDICT_LIST;
+
+//
+// CyberionVerdictListSize: Bytes of Buffer needed to arrange Count hashes,
+// or 0 if Count exceeds CYBERION_MAX_PRELOAD.
+//
+SIZE_T CyberionVerdictListSize(_In_ ULONG Count);
+
+//
+// CyberionVerdictListBuild: Arranges Count hashes and their verdicts into
+// Buffer, which must hold CyberionVerdictListSize(Count) bytes, and
+// prepares List for lookups. The input must be strictly ascending and
+// every verdict VerdictAllow or VerdictBlock; this is checked on the
+// arranged copy, so the input may change underneath the call. Returns
+// STATUS_INVALID_PARAMETER otherwise.
+//
+NTSTATUS CyberionVerdictListBuild(
+    _In_reads_(Count * CYBERION_HASH_SIZE) const UCHAR *Hashes,
+    _In_reads_(Count) const UCHAR *Verdicts,
+    _In_ ULONG Count,
+    _Out_writes_bytes_(CyberionVerdictListSize(Count)) PVOID Buffer,
+    _Out_ PCYBERION_VERDICT_LIST List
+);
+
+//
+// CyberionVerdictListLookup: Returns the verdict listed for Hash, or
+// VerdictUnknown.
+//
+CYBERION_VERDICT CyberionVerdictListLookup(
+    _In_ const CYBERION_VERDICT_LIST *List,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
@@ -0,0 +1,422 @@
+/*
+ * VERDICTPERFECT.C
+ *
+ * CHD minimal perfect hash for static verdict lists.
+ *
+ * Hashes are split into buckets of about PERFECT_BUCKET_LOAD each. Buckets
+ * are placed largest first: for each, the compiler searches displacement
+ * values d = (d1, d2) until every hash in the bucket lands on a free slot,
+ * and records d. Every multiplier d1 is tried before the shift d2 grows:
+ * shifting alone would pack placed buckets into runs, and the last
+ * single-hash buckets would then have to walk those runs to find the few
+ * free slots left. If a bucket cannot be placed, the whole build is retried
+ * with a new seed.
+ */
+
+#include "VerdictPerfect.h"
+#include "Sha256.h"
+
+#define PERFECT_BUCKET_LOAD     4       // Average hashes per bucket
+#define PERFECT_MAX_D1          64      // Displacement multipliers tried per bucket
+#define PERFECT_MAX_SEEDS       16      // Builds attempted before giving up
+#define PERFECT_MAX_BUCKET      32      // Hashes in one bucket before a new seed is tried
+
+FORCEINLINE ULONG64 PerfectMix(_In_ ULONG64 Value)
+{
+    Value ^= Value >> 30;
+    Value *= 0xBF58476D1CE4E5B9ull;
+    Value ^= Value >> 27;
+    Value *= 0x94D049BB133111EBull;
+    Value ^= Value >> 31;
+    return Value;
+}
+
+FORCEINLINE ULONG64 PerfectWord(_In_ const UCHAR *Hash, _In_ ULONG Index)
+{
+    ULONG64 word;
+
+    RtlCopyMemory(&word, Hash + Index * sizeof(ULONG64), sizeof(word));
+    return word;
+}
+
+FORCEINLINE ULONG PerfectSlot(
+    _In_ ULONG Base,
+    _In_ ULONG Step,
+    _In_ ULONG Displacement,
+    _In_ ULONG Count
+)
+{
+    ULONG d1 = Displacement / Count;
+    ULONG d2 = Displacement % Count;
+
+    return (ULONG)(((ULONG64)Base + (ULONG64)d1 * Step + d2) % Count);
+}
+
+static ULONG PerfectBucketCount(_In_ ULONG Count)
+{
+    return max(1, (Count + PERFECT_BUCKET_LOAD - 1) / PERFECT_BUCKET_LOAD);
+}
+
+SIZE_T CyberionVerdictPerfectSize(
+    _In_ ULONG Count
+)
+{
+    if (Count > CYBERION_MAX_PRELOAD) {
+        return 0;
+    }
+
+    return sizeof(CYBERION_PERFECT_HEADER) +
+           (SIZE_T)PerfectBucketCount(Count) * sizeof(ULONG) +
+           (SIZE_T)Count * (CYBERION_HASH_SIZE + 1);
+}
+
+//
+// PerfectChecksum: SHA-256 of the header up to Checksum, then the rest of
+// the image.
+//
+static VOID PerfectChecksum(
+    _In_ const CYBERION_PERFECT_HEADER *Header,
+    _In_ SIZE_T Length,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Checksum
+)
+{
+    CYBERION_SHA256 context;
+
+    CyberionSha256Init(&context);
+    CyberionSha256Update(&context, Header, FIELD_OFFSET(CYBERION_PERFECT_HEADER, Checksum));
+    CyberionSha256Update(&context, Header + 1, Length - sizeof(CYBERION_PERFECT_HEADER));
+    CyberionSha256Final(&context, Checksum);
+}
+
+//
+// Working state of one build.
+//
+typedef struct _PERFECT_BUILD {
+    ULONG Count;
+    ULONG BucketCount;
+    PULONG Base;                // Per hash: Mix(W1 ^ Seed) % Count
+    PULONG Step;                // Per hash: Mix(W2 ^ Seed) % Count
+    PULONG Bucket;              // Per hash: its bucket
+    PULONG BucketStart;         // Per bucket + 1: first index into Members
+    PULONG Members;             // Hash indices grouped by bucket
+    PULONG Order;               // Buckets, largest first
+    PULONG Slot;                // Per hash: the slot it was given
+    PULONG Taken;               // Bitmap of slots in use
+    PULONG Displacements;       // Output, per bucket
+} PERFECT_BUILD, *PPERFECT_BUILD;
+
+//
+// PerfectPlaceBucket: Finds a displacement putting every member of Bucket
+// on a free slot, and takes those slots. Returns STATUS_NOT_FOUND if there
+// is none, or STATUS_INVALID_PARAMETER if two members are the same hash.
+//
+static NTSTATUS PerfectPlaceBucket(
+    _Inout_ PPERFECT_BUILD Build,
+    _In_ const UCHAR *Hashes,
+    _In_ ULONG Bucket
+)
+{
+    ULONG first = Build->BucketStart[Bucket];
+    ULONG size = Build->BucketStart[Bucket + 1] - first;
+    const ULONG *members = &Build->Members[first];
+    ULONG slots[PERFECT_MAX_BUCKET];
+    ULONG d1;
+    ULONG d2;
+    ULONG i;
+    ULONG j;
+
+    // PERFECT_MAX_D1 * CYBERION_MAX_PRELOAD fits in a ULONG
+    for (d2 = 0; d2 < Build->Count; d2++) {
+        for (d1 = 0; d1 < PERFECT_MAX_D1; d1++) {
+            ULONG displacement = d1 * Build->Count + d2;
+
+            for (i = 0; i < size; i++) {
+                ULONG slot = PerfectSlot(Build->Base[members[i]], Build->Step[members[i]], displacement, Build->Count);
+
+                if (Build->Taken[slot / 32] & (1u << (slot % 32))) {
+                    break;
+                }
+
+                for (j = 0; j < i && slots[j] != slot; j++) {
+                }
+                if (j < i) {
+                    // Identical hashes collide under every displacement
+                    if (RtlEqualMemory(Hashes + (SIZE_T)members[i] * CYBERION_HASH_SIZE,
+                                       Hashes + (SIZE_T)members[j] * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE)) {
+                        return STATUS_INVALID_PARAMETER;
+                    }
+                    break;
+                }
+
+                slots[i] = slot;
+            }
+
+            if (i == size) {
+                for (i = 0; i < size; i++) {
+                    Build->Taken[slots[i] / 32] |= 1u << (slots[i] % 32);
+                    Build->Slot[members[i]] = slots[i];
+                }
+
+                Build->Displacements[Bucket] = displacement;
+                return STATUS_SUCCESS;
+            }
+        }
+    }
+
+    return STATUS_NOT_FOUND;
+}
+
+//
+// PerfectTry: One build attempt with Seed. Returns STATUS_NOT_FOUND if a
+// bucket could not be placed under this seed.
+//
+static NTSTATUS PerfectTry(
+    _Inout_ PPERFECT_BUILD Build,
+    _In_ const UCHAR *Hashes,
+    _In_ ULONG64 Seed
+)
+{
+    ULONG sizeCount[PERFECT_MAX_BUCKET + 1];
+    NTSTATUS status;
+    ULONG i;
+    ULONG size;
+
+    RtlZeroMemory(Build->BucketStart, ((SIZE_T)Build->BucketCount + 1) * sizeof(ULONG));
+    RtlZeroMemory(Build->Slot, (SIZE_T)Build->BucketCount * sizeof(ULONG));
+    RtlZeroMemory(Build->Taken, (((SIZE_T)Build->Count + 31) / 32) * sizeof(ULONG));
+    RtlZeroMemory(Build->Displacements, (SIZE_T)Build->BucketCount * sizeof(ULONG));
+    RtlZeroMemory(sizeCount, sizeof(sizeCount));
+
+    for (i = 0; i < Build->Count; i++) {
+        const UCHAR *hash = Hashes + (SIZE_T)i * CYBERION_HASH_SIZE;
+
+        Build->Bucket[i] = (ULONG)(PerfectMix(PerfectWord(hash, 0) ^ Seed) % Build->BucketCount);
+        Build->Base[i] = (ULONG)(PerfectMix(PerfectWord(hash, 1) ^ Seed) % Build->Count);
+        Build->Step[i] = (ULONG)(PerfectMix(PerfectWord(hash, 2) ^ Seed) % Build->Count);
+        Build->BucketStart[Build->Bucket[i] + 1]++;
+    }
+
+    // Group members by bucket (counting sort)
+    for (i = 0; i < Build->BucketCount; i++) {
+        size = Build->BucketStart[i + 1];
+        if (size > PERFECT_MAX_BUCKET) {
+            return STATUS_NOT_FOUND;
+        }
+        sizeCount[size]++;
+        Build->BucketStart[i + 1] += Build->BucketStart[i];
+    }
+
+    // Slot counts each bucket's members until placement reuses it
+    for (i = 0; i < Build->Count; i++) {
+        Build->Members[Build->BucketStart[Build->Bucket[i]] + Build->Slot[Build->Bucket[i]]++] = i;
+    }
+
+    // Order buckets by size, largest first (counting sort again)
+    for (size = PERFECT_MAX_BUCKET; size > 0; size--) {
+        sizeCount[size - 1] += sizeCount[size];
+    }
+
+    for (i = 0; i < Build->BucketCount; i++) {
+        size = Build->BucketStart[i + 1] - Build->BucketStart[i];
+        Build->Order[--sizeCount[size]] = i;
+    }
+
+    for (i = 0; i < Build->BucketCount; i++) {
+        ULONG bucket = Build->Order[i];
+
+        if (Build->BucketStart[bucket + 1] == Build->BucketStart[bucket]) {
+            break;
+        }
+
+        status = PerfectPlaceBucket(Build, Hashes, bucket);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS CyberionVerdictPerfectBuild(
+    _In_reads_(Count * CYBERION_HASH_SIZE) const UCHAR *Hashes,
+    _In_reads_(Count) const UCHAR *Verdicts,
+    _In_ ULONG Count,
+    _Outptr_result_bytebuffer_(*Length) PVOID *Image,
+    _Out_ SIZE_T *Length
+)
+{
+    PERFECT_BUILD build;
+    PCYBERION_PERFECT_HEADER header;
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PULONG scratch;
+    SIZE_T size = CyberionVerdictPerfectSize(Count);
+    SIZE_T words;
+    NTSTATUS status = STATUS_NOT_FOUND;
+    ULONG64 seed = 0;
+    ULONG attempt;
+    ULONG i;
+
+    *Image = NULL;
+    *Length = 0;
+
+    if (size == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for (i = 0; i < Count; i++) {
+        if (Verdicts[i] != VerdictAllow && Verdicts[i] != VerdictBlock) {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    header = (PCYBERION_PERFECT_HEADER)CyberionAllocate(size);
+    if (header == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(header, size);
+    header->Magic = CYBERION_PERFECT_MAGIC;
+    header->Version = CYBERION_PERFECT_VERSION;
+    header->HeaderSize = sizeof(CYBERION_PERFECT_HEADER);
+    header->Count = Count;
+    header->BucketCount = PerfectBucketCount(Count);
+
+    if (Count == 0) {
+        PerfectChecksum(header, size, header->Checksum);
+        *Image = header;
+        *Length = size;
+        return STATUS_SUCCESS;
+    }
+
+    // One scratch allocation: five arrays per hash, two per bucket, the bitmap
+    words = (SIZE_T)Count * 5 + (SIZE_T)header->BucketCount * 2 + 1 + ((SIZE_T)Count + 31) / 32;
+    scratch = (PULONG)CyberionAllocate(words * sizeof(ULONG));
+    if (scratch == NULL) {
+        CyberionFree(header);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    build.Count = Count;
+    build.BucketCount = header->BucketCount;
+    build.Base = scratch;
+    build.Step = build.Base + Count;
+    build.Bucket = build.Step + Count;
+    build.Members = build.Bucket + Count;
+    build.Slot = build.Members + Count;
+    build.BucketStart = build.Slot + Count;
+    build.Order = build.BucketStart + build.BucketCount + 1;
+    build.Taken = build.Order + build.BucketCount;
+    build.Displacements = (PULONG)(header + 1);
+
+    for (attempt = 0; attempt < PERFECT_MAX_SEEDS && status == STATUS_NOT_FOUND; attempt++) {
+        seed = PerfectMix(0x9E3779B97F4A7C15ull * (attempt + 1));
+        status = PerfectTry(&build, Hashes, seed);
+    }
+
+    if (NT_SUCCESS(status)) {
+        hashes = (PUCHAR)(build.Displacements + build.BucketCount);
+        verdicts = hashes + (SIZE_T)Count * CYBERION_HASH_SIZE;
+
+        for (i = 0; i < Count; i++) {
+            RtlCopyMemory(hashes + (SIZE_T)build.Slot[i] * CYBERION_HASH_SIZE,
+                          Hashes + (SIZE_T)i * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE);
+            verdicts[build.Slot[i]] = Verdicts[i];
+        }
+
+        header->Seed = seed;
+        PerfectChecksum(header, size, header->Checksum);
+        *Image = header;
+        *Length = size;
+    } else {
+        // Only pathological input defeats every seed
+        CyberionFree(header);
+        status = STATUS_INVALID_PARAMETER;
+    }
+
+    CyberionFree(scratch);
+    return status;
+}
+
+NTSTATUS CyberionVerdictPerfectOpen(
+    _In_reads_bytes_(Length) const VOID *Image,
+    _In_ SIZE_T Length,
+    _Out_ PCYBERION_VERDICT_PERFECT Perfect
+)
+{
+    const CYBERION_PERFECT_HEADER *header = (const CYBERION_PERFECT_HEADER *)Image;
+    UCHAR checksum[CYBERION_HASH_SIZE];
+    SIZE_T size;
+    ULONG i;
+
+    RtlZeroMemory(Perfect, sizeof(*Perfect));
+
+    if (Length < sizeof(CYBERION_PERFECT_HEADER) ||
+        header->Magic != CYBERION_PERFECT_MAGIC ||
+        header->Version != CYBERION_PERFECT_VERSION ||
+        header->HeaderSize != sizeof(CYBERION_PERFECT_HEADER) ||
+        header->BucketCount != PerfectBucketCount(header->Count)) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    size = CyberionVerdictPerfectSize(header->Count);
+    if (size == 0 || Length < size) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    Perfect->Displacements = (const ULONG *)(header + 1);
+    Perfect->Hashes = (const UCHAR *)(Perfect->Displacements + header->BucketCount);
+    Perfect->Verdicts = Perfect->Hashes + (SIZE_T)header->Count * CYBERION_HASH_SIZE;
+
+    // A displacement must keep d1 within what the compiler searches
+    for (i = 0; i < header->BucketCount; i++) {
+        if (header->Count != 0 && Perfect->Displacements[i] / header->Count >= PERFECT_MAX_D1) {
+            RtlZeroMemory(Perfect, sizeof(*Perfect));
+            return STATUS_INVALID_IMAGE_FORMAT;
+        }
+    }
+
+    for (i = 0; i < header->Count; i++) {
+        if (Perfect->Verdicts[i] != VerdictAllow && Perfect->Verdicts[i] != VerdictBlock) {
+            RtlZeroMemory(Perfect, sizeof(*Perfect));
+            return STATUS_INVALID_IMAGE_FORMAT;
+        }
+    }
+
+    PerfectChecksum(header, size, checksum);
+
+    if (!RtlEqualMemory(checksum, header->Checksum, CYBERION_HASH_SIZE)) {
+        RtlZeroMemory(Perfect, sizeof(*Perfect));
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    Perfect->Seed = header->Seed;
+    Perfect->Count = header->Count;
+    Perfect->BucketCount = header->BucketCount;
+    return STATUS_SUCCESS;
+}
+
+CYBERION_VERDICT CyberionVerdictPerfectLookup(
+    _In_ const CYBERION_VERDICT_PERFECT *Perfect,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    ULONG bucket;
+    ULONG slot;
+
+    if (Perfect->Count == 0) {
+        return VerdictUnknown;
+    }
+
+    bucket = (ULONG)(PerfectMix(PerfectWord(Hash, 0) ^ Perfect->Seed) % Perfect->BucketCount);
+    slot = PerfectSlot((ULONG)(PerfectMix(PerfectWord(Hash, 1) ^ Perfect->Seed) % Perfect->Count),
+                       (ULONG)(PerfectMix(PerfectWord(Hash, 2) ^ Perfect->Seed) % Perfect->Count),
+                       Perfect->Displacements[bucket],
+                       Perfect->Count);
+
+    if (!RtlEqualMemory(Perfect->Hashes + (SIZE_T)slot * CYBERION_HASH_SIZE, Hash, CYBERION_HASH_SIZE)) {
+        return VerdictUnknown;
+    }
+
+    return (CYBERION_VERDICT)Perfect->Verdicts[slot];
+}
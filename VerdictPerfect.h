@@ -0,0 +1,67 @@
+/*
+ * VERDICTPERFECT.H
+ *
+ * Minimal perfect hash over a static verdict list (CYBERION_PERFECT_HEADER),
+ * built with the CHD (compress, hash and displace) algorithm. The compiler
+ * runs offline, typically in the service when the weekly allowlist
+ * arrives; a lookup then costs one bucket read, one slot computation and
+ * one 32-byte compare, and the image is never written after it is built.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+//
+// A checked image, ready for lookups. Points into the caller's buffer.
+//
+typedef struct _CYBERION_VERDICT_PERFECT {
+    const ULONG *Displacements;
+    const UCHAR *Hashes;
+    const UCHAR *Verdicts;
+    ULONG64 Seed;
+    ULONG Count;
+    ULONG BucketCount;
+} CYBERION_VERDICT_PERFECT, *PCYBERION_VERDICT_PERFECT;
+
+//
+// CyberionVerdictPerfectSize: Bytes in an image of Count hashes, or 0 if
+// Count exceeds CYBERION_MAX_PRELOAD.
+//
+SIZE_T CyberionVerdictPerfectSize(_In_ ULONG Count);
+
+//
+// CyberionVerdictPerfectBuild: Compiles Count distinct hashes and their
+// verdicts into an image allocated with CyberionAllocate; the caller frees
+// it with CyberionFree. Returns STATUS_INVALID_PARAMETER for duplicate
+// hashes or invalid verdicts. Runs in time roughly linear in Count.
+//
+NTSTATUS CyberionVerdictPerfectBuild(
+    _In_reads_(Count * CYBERION_HASH_SIZE) const UCHAR *Hashes,
+    _In_reads_(Count) const UCHAR *Verdicts,
+    _In_ ULONG Count,
+    _Outptr_result_bytebuffer_(*Length) PVOID *Image,
+    _Out_ SIZE_T *Length
+);
+
+//
+// CyberionVerdictPerfectOpen: Checks an image of Length bytes and prepares
+// Perfect for lookups. Returns STATUS_INVALID_IMAGE_FORMAT for anything
+// malformed.
+//
+NTSTATUS CyberionVerdictPerfectOpen(
+    _In_reads_bytes_(Length) const VOID *Image,
+    _In_ SIZE_T Length,
+    _Out_ PCYBERION_VERDICT_PERFECT Perfect
+);
+
+//
+// CyberionVerdictPerfectLookup: Returns the verdict listed for Hash, or
+// VerdictUnknown.
+//
+CYBERION_VERDICT CyberionVerdictPerfectLookup(
+    _In_ const CYBERION_VERDICT_PERFECT *Perfect,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
@@ -0,0 +1,245 @@
+/*
+ * VERDICTSTORE.C
+ *
+ * Verdict store images.
+ *
+ * Slots are placed with linear probing from the home slot given by the
+ * hash's first eight bytes, like the in-memory verdict table, and the
+ * header records the longest probe distance so a lookup for an absent hash
+ * stops early even in a crowded region. Opening an image is one sequential
+ * pass that checks each slot and feeds it to SHA-256; nothing is rebuilt or
+ * copied.
+ */
+
+#include "VerdictStore.h"
+#include "Sha256.h"
+
+FORCEINLINE ULONG StoreHomeSlot(_In_ const UCHAR *Hash, _In_ ULONG SlotMask)
+{
+    ULONG64 bits;
+
+    RtlCopyMemory(&bits, Hash, sizeof(bits));
+    return (ULONG)bits & SlotMask;
+}
+
+static ULONG StoreSlotCount(_In_ ULONG Capacity)
+{
+    ULONG slots = 16;
+
+    while ((ULONG64)slots * 3 < (ULONG64)Capacity * 4) {
+        slots <<= 1;
+    }
+
+    return slots;
+}
+
+//
+// StoreChecksum: SHA-256 of the header up to Checksum, then every slot.
+//
+static VOID StoreChecksum(
+    _In_ const CYBERION_STORE_HEADER *Header,
+    _In_ const CYBERION_STORE_ENTRY *Slots,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Checksum
+)
+{
+    CYBERION_SHA256 context;
+
+    CyberionSha256Init(&context);
+    CyberionSha256Update(&context, Header, FIELD_OFFSET(CYBERION_STORE_HEADER, Checksum));
+    CyberionSha256Update(&context, Slots, (SIZE_T)Header->SlotCount * sizeof(CYBERION_STORE_ENTRY));
+    CyberionSha256Final(&context, Checksum);
+}
+
+SIZE_T CyberionVerdictStoreSize(
+    _In_ ULONG Capacity
+)
+{
+    if (Capacity > CYBERION_MAX_PRELOAD) {
+        return 0;
+    }
+
+    return sizeof(CYBERION_STORE_HEADER) + (SIZE_T)StoreSlotCount(Capacity) * sizeof(CYBERION_STORE_ENTRY);
+}
+
+SIZE_T CyberionVerdictStoreImageSize(
+    _In_ const CYBERION_STORE_HEADER *Header,
+    _In_ ULONG Count
+)
+{
+    ULONG slotCount = (ULONG)ReadNoFence((const volatile LONG *)&Header->SlotCount);
+
+    if (Count > CYBERION_MAX_PRELOAD ||
+        slotCount < StoreSlotCount(Count) ||
+        slotCount > StoreSlotCount(CYBERION_MAX_PRELOAD) ||
+        (slotCount & (slotCount - 1)) != 0) {
+        return 0;
+    }
+
+    return sizeof(CYBERION_STORE_HEADER) + (SIZE_T)slotCount * sizeof(CYBERION_STORE_ENTRY);
+}
+
+NTSTATUS CyberionVerdictStoreCreate(
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ SIZE_T Length,
+    _In_ ULONG Capacity
+)
+{
+    PCYBERION_STORE_HEADER header = (PCYBERION_STORE_HEADER)Buffer;
+    SIZE_T size = CyberionVerdictStoreSize(Capacity);
+
+    if (size == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Length < size) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RtlZeroMemory(Buffer, size);
+
+    header->Magic = CYBERION_STORE_MAGIC;
+    header->Version = CYBERION_STORE_VERSION;
+    header->HeaderSize = sizeof(CYBERION_STORE_HEADER);
+    header->EntrySize = sizeof(CYBERION_STORE_ENTRY);
+    header->SlotCount = StoreSlotCount(Capacity);
+
+    // Reserved holds the capacity while the image is being built
+    header->Reserved = Capacity;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS CyberionVerdictStoreAdd(
+    _Inout_ PVOID Buffer,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict
+)
+{
+    PCYBERION_STORE_HEADER header = (PCYBERION_STORE_HEADER)Buffer;
+    PCYBERION_STORE_ENTRY slots = (PCYBERION_STORE_ENTRY)(header + 1);
+    ULONG slotMask = header->SlotCount - 1;
+    ULONG slot = StoreHomeSlot(Hash, slotMask);
+    ULONG distance;
+
+    if (Verdict != VerdictAllow && Verdict != VerdictBlock) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for (distance = 0; distance <= slotMask; distance++) {
+        PCYBERION_STORE_ENTRY entry = &slots[slot];
+
+        if (entry->Verdict == VerdictUnknown) {
+            if (header->Count >= header->Reserved) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            RtlCopyMemory(entry->Hash, Hash, CYBERION_HASH_SIZE);
+            entry->Verdict = (UCHAR)Verdict;
+            header->Count++;
+            header->MaxProbe = max(header->MaxProbe, distance);
+            return STATUS_SUCCESS;
+        }
+
+        if (RtlEqualMemory(entry->Hash, Hash, CYBERION_HASH_SIZE)) {
+            entry->Verdict = (UCHAR)Verdict;
+            return STATUS_SUCCESS;
+        }
+
+        slot = (slot + 1) & slotMask;
+    }
+
+    return STATUS_INSUFFICIENT_RESOURCES;
+}
+
+VOID CyberionVerdictStoreSeal(
+    _Inout_ PVOID Buffer
+)
+{
+    PCYBERION_STORE_HEADER header = (PCYBERION_STORE_HEADER)Buffer;
+
+    header->Reserved = 0;
+    StoreChecksum(header, (PCYBERION_STORE_ENTRY)(header + 1), header->Checksum);
+}
+
+NTSTATUS CyberionVerdictStoreOpen(
+    _In_reads_bytes_(Length) const VOID *Image,
+    _In_ SIZE_T Length,
+    _Out_ PCYBERION_VERDICT_STORE Store
+)
+{
+    const CYBERION_STORE_HEADER *header = (const CYBERION_STORE_HEADER *)Image;
+    const CYBERION_STORE_ENTRY *slots = (const CYBERION_STORE_ENTRY *)(header + 1);
+    UCHAR checksum[CYBERION_HASH_SIZE];
+    ULONG count = 0;
+    ULONG i;
+
+    RtlZeroMemory(Store, sizeof(*Store));
+
+    if (Length < sizeof(CYBERION_STORE_HEADER) ||
+        header->Magic != CYBERION_STORE_MAGIC ||
+        header->Version != CYBERION_STORE_VERSION ||
+        header->HeaderSize != sizeof(CYBERION_STORE_HEADER) ||
+        header->EntrySize != sizeof(CYBERION_STORE_ENTRY)) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    // The slot count must be one a builder could have chosen
+    if (header->Count > CYBERION_MAX_PRELOAD ||
+        header->SlotCount < StoreSlotCount(header->Count) ||
+        header->SlotCount > StoreSlotCount(CYBERION_MAX_PRELOAD) ||
+        (header->SlotCount & (header->SlotCount - 1)) != 0 ||
+        header->MaxProbe >= header->SlotCount ||
+        (Length - sizeof(CYBERION_STORE_HEADER)) / sizeof(CYBERION_STORE_ENTRY) < header->SlotCount) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    for (i = 0; i < header->SlotCount; i++) {
+        if (slots[i].Verdict > VerdictBlock) {
+            return STATUS_INVALID_IMAGE_FORMAT;
+        }
+        count += (slots[i].Verdict != VerdictUnknown);
+    }
+
+    StoreChecksum(header, slots, checksum);
+
+    if (count != header->Count || !RtlEqualMemory(checksum, header->Checksum, CYBERION_HASH_SIZE)) {
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    Store->Slots = slots;
+    Store->SlotMask = header->SlotCount - 1;
+    Store->MaxProbe = header->MaxProbe;
+    Store->Count = header->Count;
+    return STATUS_SUCCESS;
+}
+
+CYBERION_VERDICT CyberionVerdictStoreLookup(
+    _In_ const CYBERION_VERDICT_STORE *Store,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    ULONG slot;
+    ULONG distance;
+
+    if (Store->Count == 0) {
+        return VerdictUnknown;
+    }
+
+    slot = StoreHomeSlot(Hash, Store->SlotMask);
+
+    for (distance = 0; distance <= Store->MaxProbe; distance++) {
+        const CYBERION_STORE_ENTRY *entry = &Store->Slots[slot];
+
+        if (entry->Verdict == VerdictUnknown) {
+            break;
+        }
+
+        if (RtlEqualMemory(entry->Hash, Hash, CYBERION_HASH_SIZE)) {
+            return (CYBERION_VERDICT)entry->Verdict;
+        }
+
+        slot = (slot + 1) & Store->SlotMask;
+    }
+
+    return VerdictUnknown;
+}
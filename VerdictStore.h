@@ -0,0 +1,92 @@
+/*
+ * VERDICTSTORE.H
+ *
+ * Builder and reader for verdict store images (CYBERION_STORE_HEADER), the
+ * persistent form of a verdict list. A builder fills a caller-provided
+ * buffer and seals it with a checksum; a reader checks an image, typically
+ * a mapped file, once and then searches it in place.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+
+//
+// A checked image, ready for lookups. Points into the caller's buffer.
+//
+typedef struct _CYBERION_VERDICT_STORE {
+    const CYBERION_STORE_ENTRY *Slots;
+    ULONG SlotMask;             // SlotCount - 1
+    ULONG MaxProbe;
+    ULONG Count;
+} CYBERION_VERDICT_STORE, *PCYBERION_VERDICT_STORE;
+
+//
+// CyberionVerdictStoreSize: Bytes needed for an image holding up to
+// Capacity hashes at a load factor of at most 3/4, or 0 if Capacity
+// exceeds CYBERION_MAX_PRELOAD. An image may hold fewer hashes than its
+// capacity.
+//
+SIZE_T CyberionVerdictStoreSize(_In_ ULONG Capacity);
+
+//
+// CyberionVerdictStoreImageSize: Bytes in the image starting with Header,
+// from its SlotCount, or 0 if that is not a slot count a builder could
+// have chosen for Count hashes. SlotCount is read once, so the header may
+// be changing underneath the caller; CyberionVerdictStoreOpen still checks
+// the image itself.
+//
+SIZE_T CyberionVerdictStoreImageSize(
+    _In_ const CYBERION_STORE_HEADER *Header,
+    _In_ ULONG Count
+);
+
+//
+// CyberionVerdictStoreCreate: Starts an empty image for Capacity hashes in
+// Buffer, which must hold CyberionVerdictStoreSize(Capacity) bytes. The
+// builder trusts the header it wrote, so nobody else may be able to write
+// Buffer until the image is sealed.
+//
+NTSTATUS CyberionVerdictStoreCreate(
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ SIZE_T Length,
+    _In_ ULONG Capacity
+);
+
+//
+// CyberionVerdictStoreAdd: Adds or replaces a hash in an unsealed image.
+// Returns STATUS_INSUFFICIENT_RESOURCES once the image holds its capacity.
+//
+NTSTATUS CyberionVerdictStoreAdd(
+    _Inout_ PVOID Buffer,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict
+);
+
+//
+// CyberionVerdictStoreSeal: Computes the image's checksum. The image must
+// not be changed afterwards.
+//
+VOID CyberionVerdictStoreSeal(_Inout_ PVOID Buffer);
+
+//
+// CyberionVerdictStoreOpen: Checks an image of Length bytes (header fields,
+// every slot and the checksum) and prepares Store for lookups. Returns
+// STATUS_INVALID_IMAGE_FORMAT for anything malformed.
+//
+NTSTATUS CyberionVerdictStoreOpen(
+    _In_reads_bytes_(Length) const VOID *Image,
+    _In_ SIZE_T Length,
+    _Out_ PCYBERION_VERDICT_STORE Store
+);
+
+//
+// CyberionVerdictStoreLookup: Returns the verdict stored for Hash, or
+// VerdictUnknown.
+//
+CYBERION_VERDICT CyberionVerdictStoreLookup(
+    _In_ const CYBERION_VERDICT_STORE *Store,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
@@ -0,0 +1,602 @@
+/*
+ * VERDICTTABLE.C
+ *
+ * Lock-free read side, serialized write side hash table of image verdicts.
+ *
+ * Keys are SHA-256 digests, so their bytes are already uniformly
+ * distributed: the first eight select the home slot and the next four form
+ * the tag. Probing is linear. A slot's tag is published after its entry and
+ * cleared (to the deleted marker) before the entry is reused, so a reader
+ * that sees a tag match always finds a complete entry or an odd sequence
+ * number; the full 32-byte comparison under the sequence check is what
+ * decides a hit. Deleted slots are reused by later inserts, and emptied
+ * again as soon as no probe chain passes through them, so misses do not
+ * degrade to full-window probes as entries churn. Memory is never freed
+ * while the table is live, so readers need no reclamation protocol.
+ *
+ * The reference bit a lookup sets is a plain byte store, made only when the
+ * bit is clear; a racing writer may lose or misplace one, which costs an
+ * entry at most one extra pass of the clock hand.
+ */
+
+#include "VerdictTable.h"
+
+#define TAG_EMPTY   0u
+#define TAG_DELETED 2u
+
+FORCEINLINE ULONG VerdictHomeSlot(_In_ const CYBERION_VERDICT_TABLE *Table, _In_ const UCHAR *Hash)
+{
+    ULONG64 bits;
+
+    RtlCopyMemory(&bits, Hash, sizeof(bits));
+    return (ULONG)bits & Table->SlotMask;
+}
+
+FORCEINLINE ULONG VerdictTag(_In_ const UCHAR *Hash)
+{
+    ULONG tag;
+
+    RtlCopyMemory(&tag, Hash + 8, sizeof(tag));
+    return tag | 1;
+}
+
+FORCEINLINE BOOLEAN VerdictExpired(_In_ ULONG64 Expires, _In_ ULONG64 Now)
+{
+    return Expires != 0 && Now >= Expires;
+}
+
+//
+// VerdictReadEntry: Reads a consistent copy of a slot's verdict and expiry
+// time. Returns FALSE if the slot does not hold Hash.
+//
+FORCEINLINE BOOLEAN VerdictReadEntry(
+    _In_ const CYBERION_VERDICT_ENTRY *Entry,
+    _In_ const UCHAR *Hash,
+    _Out_ CYBERION_VERDICT *Verdict,
+    _Out_ ULONG64 *Expires
+)
+{
+    LONG before;
+    BOOLEAN match;
+    UCHAR verdict;
+    ULONG64 expires;
+
+    for (;;) {
+        before = ReadAcquire(&Entry->Sequence);
+        if (before & 1) {
+            YieldProcessor();
+            continue;
+        }
+
+        match = RtlEqualMemory((const VOID *)Entry->Hash, Hash, CYBERION_HASH_SIZE);
+        verdict = *(volatile const UCHAR *)&Entry->Verdict;
+        expires = *(volatile const ULONG64 *)&Entry->Expires;
+
+        CyberionLoadFence();
+        if (ReadNoFence(&Entry->Sequence) == before) {
+            break;
+        }
+    }
+
+    *Verdict = (CYBERION_VERDICT)verdict;
+    *Expires = expires;
+    return match;
+}
+
+//
+// VerdictWriteEntry: Rewrites a slot. Caller holds the writer lock.
+//
+static VOID VerdictWriteEntry(
+    _Inout_ PCYBERION_VERDICT_ENTRY Entry,
+    _In_ const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict,
+    _In_ UCHAR Flags,
+    _In_ ULONG64 Expires
+)
+{
+    LONG sequence = Entry->Sequence;
+
+    WriteNoFence(&Entry->Sequence, sequence + 1);
+    CyberionStoreFence();
+
+    RtlCopyMemory(Entry->Hash, Hash, CYBERION_HASH_SIZE);
+    Entry->Verdict = (UCHAR)Verdict;
+    Entry->Flags = Flags;
+    Entry->Expires = (Flags & CYBERION_VERDICT_PINNED) ? 0 : Expires;
+
+    // A new decision gets one pass of the clock before it can be evicted
+    Entry->Referenced = 1;
+
+    WriteRelease(&Entry->Sequence, sequence + 2);
+}
+
+//
+// VerdictFind: Returns the slot holding Hash, or MAXULONG. On a miss,
+// *FreeSlot receives the first reusable slot in the probe window, or
+// MAXULONG. Caller holds the writer lock, so entries are stable.
+//
+static ULONG VerdictFind(
+    _In_ const CYBERION_VERDICT_TABLE *Table,
+    _In_ const UCHAR *Hash,
+    _Out_opt_ ULONG *FreeSlot
+)
+{
+    ULONG slot = VerdictHomeSlot(Table, Hash);
+    ULONG tag = VerdictTag(Hash);
+    ULONG freeSlot = MAXULONG;
+    ULONG probe;
+
+    for (probe = 0; probe < CYBERION_VERDICT_MAX_PROBE && probe <= Table->SlotMask; probe++) {
+        ULONG current = (ULONG)Table->Tags[slot];
+
+        if (current == tag && RtlEqualMemory(Table->Entries[slot].Hash, Hash, CYBERION_HASH_SIZE)) {
+            return slot;
+        }
+
+        if ((current == TAG_EMPTY || current == TAG_DELETED) && freeSlot == MAXULONG) {
+            freeSlot = slot;
+        }
+
+        if (current == TAG_EMPTY) {
+            break;
+        }
+
+        slot = (slot + 1) & Table->SlotMask;
+    }
+
+    if (FreeSlot) {
+        *FreeSlot = freeSlot;
+    }
+    return MAXULONG;
+}
+
+//
+// VerdictSlotNeeded: Returns TRUE if a live entry's probe chain passes
+// through Slot. Caller holds the writer lock.
+//
+static BOOLEAN VerdictSlotNeeded(
+    _In_ const CYBERION_VERDICT_TABLE *Table,
+    _In_ ULONG Slot
+)
+{
+    ULONG distance;
+
+    for (distance = 1; distance < CYBERION_VERDICT_MAX_PROBE && distance <= Table->SlotMask; distance++) {
+        ULONG slot = (Slot + distance) & Table->SlotMask;
+        ULONG tag = (ULONG)Table->Tags[slot];
+
+        // No probe chain continues past an empty slot
+        if (tag == TAG_EMPTY) {
+            return FALSE;
+        }
+
+        if (tag != TAG_DELETED &&
+            ((slot - VerdictHomeSlot(Table, Table->Entries[slot].Hash)) & Table->SlotMask) >= distance) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// VerdictReleaseSlot: Drops the entry in a live slot. Caller holds the
+// writer lock.
+//
+static VOID VerdictReleaseSlot(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_ ULONG Slot
+)
+{
+    // Readers that already matched the tag still see the old entry, which
+    // is the answer they would have got a moment earlier
+    WriteRelease(&Table->Tags[Slot], (LONG)TAG_DELETED);
+    CyberionVerdictFilterRemove(&Table->Filter, Table->Entries[Slot].Hash);
+
+    if (Table->Entries[Slot].Flags & CYBERION_VERDICT_PINNED) {
+        Table->Pinned--;
+    }
+    Table->Count--;
+
+    // Under steady eviction deleted slots would otherwise fill every gap
+    // and each miss would probe the whole window. A slot no chain passes
+    // through can be emptied, and then so can the deleted run before it,
+    // since any chain through that run would continue into this slot.
+    if (!VerdictSlotNeeded(Table, Slot)) {
+        do {
+            WriteRelease(&Table->Tags[Slot], (LONG)TAG_EMPTY);
+            Slot = (Slot - 1) & Table->SlotMask;
+        } while (Table->Tags[Slot] == TAG_DELETED);
+    }
+}
+
+//
+// VerdictRebuildFilter: Refills a saturated filter from the live slots.
+// Caller holds the writer lock.
+//
+static VOID VerdictRebuildFilter(
+    _Inout_ PCYBERION_VERDICT_TABLE Table
+)
+{
+    ULONG slot;
+
+    CyberionVerdictFilterReset(&Table->Filter);
+
+    for (slot = 0; slot <= Table->SlotMask; slot++) {
+        ULONG tag = (ULONG)Table->Tags[slot];
+
+        if (tag != TAG_EMPTY && tag != TAG_DELETED) {
+            CyberionVerdictFilterAdd(&Table->Filter, Table->Entries[slot].Hash);
+        }
+    }
+
+    CyberionVerdictFilterResume(&Table->Filter);
+}
+
+//
+// VerdictEvictable: Returns 0 for a pinned entry, 1 for one the clock would
+// spare once, and 2 for one that can go now. Clears the reference bit of a
+// spared entry when Sweep is set. Caller holds the writer lock.
+//
+static ULONG VerdictEvictable(
+    _Inout_ PCYBERION_VERDICT_ENTRY Entry,
+    _In_ ULONG64 Now,
+    _In_ BOOLEAN Sweep
+)
+{
+    if (Entry->Flags & CYBERION_VERDICT_PINNED) {
+        return 0;
+    }
+
+    if (!VerdictExpired(Entry->Expires, Now) && Entry->Referenced) {
+        if (Sweep) {
+            Entry->Referenced = 0;
+        }
+        return 1;
+    }
+
+    return 2;
+}
+
+//
+// VerdictClockEvict: Advances the clock hand to the next entry that is
+// unpinned and either expired or unreferenced, and drops it. Returns FALSE
+// if two full turns found nothing to drop.
+//
+static BOOLEAN VerdictClockEvict(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_ ULONG64 Now
+)
+{
+    ULONG64 steps;
+
+    for (steps = 0; steps < 2 * ((ULONG64)Table->SlotMask + 1); steps++) {
+        ULONG slot = Table->ClockHand;
+        ULONG tag = (ULONG)Table->Tags[slot];
+
+        Table->ClockHand = (slot + 1) & Table->SlotMask;
+
+        if (tag == TAG_EMPTY || tag == TAG_DELETED) {
+            continue;
+        }
+
+        if (VerdictEvictable(&Table->Entries[slot], Now, TRUE) == 2) {
+            VerdictReleaseSlot(Table, slot);
+            Table->Evictions++;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// VerdictEvictInWindow: Frees a slot in Hash's probe window when every slot
+// in it is live, preferring an entry the clock would drop. Returns the
+// freed slot, or MAXULONG if the window holds only pinned entries.
+//
+static ULONG VerdictEvictInWindow(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_ const UCHAR *Hash,
+    _In_ ULONG64 Now
+)
+{
+    ULONG slot = VerdictHomeSlot(Table, Hash);
+    ULONG victim = MAXULONG;
+    ULONG probe;
+
+    for (probe = 0; probe < CYBERION_VERDICT_MAX_PROBE && probe <= Table->SlotMask; probe++) {
+        ULONG evictable = VerdictEvictable(&Table->Entries[slot], Now, FALSE);
+
+        if (evictable == 2) {
+            victim = slot;
+            break;
+        }
+
+        if (evictable == 1 && victim == MAXULONG) {
+            victim = slot;
+        }
+
+        slot = (slot + 1) & Table->SlotMask;
+    }
+
+    if (victim != MAXULONG) {
+        VerdictReleaseSlot(Table, victim);
+        Table->Evictions++;
+    }
+
+    return victim;
+}
+
+NTSTATUS CyberionVerdictTableInitialize(
+    _Out_ PCYBERION_VERDICT_TABLE Table,
+    _In_ ULONG Capacity
+)
+{
+    ULONG slots = 16;
+
+    RtlZeroMemory(Table, sizeof(*Table));
+
+    if (Capacity == 0 || Capacity > (1u << 28)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    while ((ULONG64)slots * 3 < (ULONG64)Capacity * 4) {
+        slots <<= 1;
+    }
+
+    Table->Tags = (volatile LONG *)CyberionAllocate(slots * sizeof(LONG));
+    Table->Entries = (PCYBERION_VERDICT_ENTRY)CyberionAllocate(slots * sizeof(CYBERION_VERDICT_ENTRY));
+
+    if (Table->Tags == NULL || Table->Entries == NULL ||
+        !NT_SUCCESS(CyberionCountersInitialize(&Table->Counters)) ||
+        !NT_SUCCESS(CyberionVerdictFilterInitialize(&Table->Filter, Capacity))) {
+        CyberionVerdictTableDestroy(Table);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Table->SlotMask = slots - 1;
+    Table->Capacity = Capacity;
+    return STATUS_SUCCESS;
+}
+
+VOID CyberionVerdictTableDestroy(
+    _Inout_ PCYBERION_VERDICT_TABLE Table
+)
+{
+    if (Table->Tags) {
+        CyberionFree((PVOID)Table->Tags);
+    }
+
+    if (Table->Entries) {
+        CyberionFree(Table->Entries);
+    }
+
+    CyberionCountersDestroy(&Table->Counters);
+    CyberionVerdictFilterDestroy(&Table->Filter);
+    RtlZeroMemory(Table, sizeof(*Table));
+}
+
+SIZE_T CyberionVerdictTableMemory(
+    _In_ const CYBERION_VERDICT_TABLE *Table
+)
+{
+    if (Table->Entries == NULL) {
+        return 0;
+    }
+
+    return ((SIZE_T)Table->SlotMask + 1) * (sizeof(LONG) + sizeof(CYBERION_VERDICT_ENTRY)) +
+           CyberionCountersMemory(&Table->Counters) +
+           CyberionVerdictFilterMemory(&Table->Filter);
+}
+
+CYBERION_VERDICT CyberionVerdictTableLookup(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    ULONG slot = VerdictHomeSlot(Table, Hash);
+    ULONG tag = VerdictTag(Hash);
+    ULONG probe;
+
+    if (!CyberionVerdictFilterContains(&Table->Filter, Hash)) {
+        CyberionCountersIncrement(&Table->Counters, VerdictCounterRejected);
+        return VerdictUnknown;
+    }
+
+    for (probe = 0; probe < CYBERION_VERDICT_MAX_PROBE && probe <= Table->SlotMask; probe++) {
+        ULONG current = (ULONG)ReadNoFence(&Table->Tags[slot]);
+        PCYBERION_VERDICT_ENTRY entry = &Table->Entries[slot];
+        CYBERION_VERDICT verdict;
+        ULONG64 expires;
+
+        if (current == TAG_EMPTY) {
+            break;
+        }
+
+        if (current == tag && VerdictReadEntry(entry, Hash, &verdict, &expires)) {
+            if (VerdictExpired(expires, CyberionQueryTime())) {
+                CyberionCountersIncrement(&Table->Counters, VerdictCounterExpired);
+                return VerdictUnknown;
+            }
+
+            if (!entry->Referenced) {
+                entry->Referenced = 1;
+            }
+
+            CyberionCountersIncrement(&Table->Counters, VerdictCounterHits);
+            return verdict;
+        }
+
+        slot = (slot + 1) & Table->SlotMask;
+    }
+
+    CyberionCountersIncrement(&Table->Counters, VerdictCounterFalsePositives);
+    return VerdictUnknown;
+}
+
+//
+// VerdictInsert: Body of CyberionVerdictTableInsert. Caller holds the
+// writer lock.
+//
+static NTSTATUS VerdictInsert(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_ const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict,
+    _In_ UCHAR Flags,
+    _In_ ULONG64 Expires
+)
+{
+    BOOLEAN pinned = (Flags & CYBERION_VERDICT_PINNED) != 0;
+    BOOLEAN filtered;
+    ULONG64 now = CyberionQueryTime();
+    ULONG freeSlot;
+    ULONG slot;
+
+    slot = VerdictFind(Table, Hash, &freeSlot);
+    if (slot != MAXULONG) {
+        PCYBERION_VERDICT_ENTRY entry = &Table->Entries[slot];
+        BOOLEAN wasPinned = (entry->Flags & CYBERION_VERDICT_PINNED) != 0;
+
+        if (wasPinned && !pinned) {
+            return STATUS_OBJECT_NAME_COLLISION;
+        }
+
+        if (pinned && !wasPinned) {
+            if (Table->Pinned >= Table->Capacity / 2) {
+                return STATUS_QUOTA_EXCEEDED;
+            }
+            Table->Pinned++;
+        }
+
+        VerdictWriteEntry(entry, Hash, Verdict, Flags, Expires);
+        Table->Insertions++;
+        return STATUS_SUCCESS;
+    }
+
+    if (pinned && Table->Pinned >= Table->Capacity / 2) {
+        return STATUS_QUOTA_EXCEEDED;
+    }
+
+    // At the budget, make room wherever the clock hand points; the slot it
+    // frees is usually outside this probe window, so look again
+    if (Table->Count >= Table->Capacity) {
+        if (!VerdictClockEvict(Table, now)) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        VerdictFind(Table, Hash, &freeSlot);
+    }
+
+    if (freeSlot == MAXULONG) {
+        freeSlot = VerdictEvictInWindow(Table, Hash, now);
+        if (freeSlot == MAXULONG) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    filtered = CyberionVerdictFilterAdd(&Table->Filter, Hash);
+    VerdictWriteEntry(&Table->Entries[freeSlot], Hash, Verdict, Flags, Expires);
+    WriteRelease(&Table->Tags[freeSlot], (LONG)VerdictTag(Hash));
+    Table->Count++;
+    Table->Pinned += pinned ? 1 : 0;
+    Table->Insertions++;
+
+    // A saturated filter passes every lookup through; the hashes it should
+    // hold are all in the slots, so start it over
+    if (!filtered) {
+        VerdictRebuildFilter(Table);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS CyberionVerdictTableInsert(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict,
+    _In_ UCHAR Flags,
+    _In_ ULONG64 Expires
+)
+{
+    CYBERION_PIN_STATE pinState;
+    NTSTATUS status;
+
+    CyberionAcquireLock(&Table->WriterLock, &pinState);
+    status = VerdictInsert(Table, Hash, Verdict, Flags, Expires);
+    CyberionReleaseLock(&Table->WriterLock, pinState);
+
+    return status;
+}
+
+BOOLEAN CyberionVerdictTableRemove(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+)
+{
+    CYBERION_PIN_STATE pinState;
+    ULONG slot;
+
+    CyberionAcquireLock(&Table->WriterLock, &pinState);
+
+    slot = VerdictFind(Table, Hash, NULL);
+    if (slot != MAXULONG) {
+        VerdictReleaseSlot(Table, slot);
+    }
+
+    CyberionReleaseLock(&Table->WriterLock, pinState);
+    return slot != MAXULONG;
+}
+
+VOID CyberionVerdictTableQueryStatistics(
+    _In_ PCYBERION_VERDICT_TABLE Table,
+    _Out_ PCYBERION_VERDICT_STATISTICS Statistics
+)
+{
+    CYBERION_PIN_STATE pinState;
+
+    RtlZeroMemory(Statistics, sizeof(*Statistics));
+
+    Statistics->Hits = CyberionCountersQuery(&Table->Counters, VerdictCounterHits);
+    Statistics->Expired = CyberionCountersQuery(&Table->Counters, VerdictCounterExpired);
+    Statistics->FilterRejected = CyberionCountersQuery(&Table->Counters, VerdictCounterRejected);
+    Statistics->FilterFalsePositives = CyberionCountersQuery(&Table->Counters, VerdictCounterFalsePositives);
+    Statistics->Misses = Statistics->Expired + Statistics->FilterRejected + Statistics->FilterFalsePositives;
+
+    CyberionAcquireLock(&Table->WriterLock, &pinState);
+    Statistics->Capacity = Table->Capacity;
+    Statistics->Count = Table->Count;
+    Statistics->Pinned = Table->Pinned;
+    Statistics->Insertions = Table->Insertions;
+    Statistics->Evictions = Table->Evictions;
+    CyberionReleaseLock(&Table->WriterLock, pinState);
+
+    Statistics->MemoryBytes = CyberionVerdictTableMemory(Table);
+}
+
+BOOLEAN CyberionVerdictTableEnumerate(
+    _In_ PCYBERION_VERDICT_TABLE Table,
+    _In_ CYBERION_VERDICT_VISIT *Visit,
+    _In_opt_ PVOID Context
+)
+{
+    ULONG64 now = CyberionQueryTime();
+    CYBERION_PIN_STATE pinState;
+    BOOLEAN complete = TRUE;
+    ULONG slot;
+
+    CyberionAcquireLock(&Table->WriterLock, &pinState);
+
+    for (slot = 0; slot <= Table->SlotMask && complete; slot++) {
+        ULONG tag = (ULONG)Table->Tags[slot];
+        const CYBERION_VERDICT_ENTRY *entry = &Table->Entries[slot];
+
+        if (tag == TAG_EMPTY || tag == TAG_DELETED || VerdictExpired(entry->Expires, now)) {
+            continue;
+        }
+
+        complete = Visit(Context, entry->Hash, (CYBERION_VERDICT)entry->Verdict, entry->Flags, entry->Expires);
+    }
+
+    CyberionReleaseLock(&Table->WriterLock, pinState);
+    return complete;
+}
@@ -0,0 +1,157 @@
+/*
+ * VERDICTTABLE.H
+ *
+ * Image hash to verdict table, read on every process creation.
+ *
+ * Lookups take no lock and perform no interlocked operation on shared
+ * entries: readers validate each entry they read against its sequence
+ * number and retry if a writer got in the way. Writers are serialized by a
+ * lock of their own. The table is open addressed with a separate array of
+ * 32-bit tags, so a lookup normally touches one cache line of tags and one
+ * entry.
+ *
+ * Memory is fixed when the table is created. Once Capacity entries are
+ * live, each insert evicts one with the CLOCK (second chance) algorithm:
+ * lookups mark the entries they hit, and the clock hand spares a marked
+ * entry once. Pinned entries are never evicted and never expire; entries
+ * may carry an expiry time after which lookups ignore them.
+ *
+ * A cuckoo filter (VerdictFilter.h) holding every live hash sits in front
+ * of the slots, so a lookup for an image the table has never seen usually
+ * ends without touching them.
+ * This component is portable C (Platform.h).
+ */
+
+#pragma once
+
+#include "Platform.h"
+#include "Public.h"
+#include "Counters.h"
+#include "VerdictFilter.h"
+
+#define CYBERION_VERDICT_MAX_PROBE  32  // Slots examined before a lookup gives up
+
+#define CYBERION_VERDICT_PINNED     0x01 // Entry flag: administrator rule
+
+typedef struct _CYBERION_VERDICT_ENTRY {
+    volatile LONG Sequence;         // Odd while a writer is changing the entry
+    UCHAR Verdict;                  // CYBERION_VERDICT
+    UCHAR Flags;                    // CYBERION_VERDICT_* flags
+    volatile UCHAR Referenced;      // Set by lookups, cleared by the clock hand
+    UCHAR Reserved;
+    ULONG64 Expires;                // CyberionQueryTime() deadline, or 0
+    UCHAR Hash[CYBERION_HASH_SIZE];
+} CYBERION_VERDICT_ENTRY, *PCYBERION_VERDICT_ENTRY;
+
+//
+// Lookup counters, kept per processor (Counters.h). Misses are the sum of
+// the last three.
+//
+typedef enum _CYBERION_VERDICT_COUNTER {
+    VerdictCounterHits,
+    VerdictCounterExpired,          // Misses on an entry past its expiry time
+    VerdictCounterRejected,         // Misses decided by the filter alone
+    VerdictCounterFalsePositives    // Misses the filter let through
+} CYBERION_VERDICT_COUNTER;
+
+typedef struct _CYBERION_VERDICT_TABLE {
+    volatile LONG *Tags;            // Per slot: 0 empty, 2 deleted, otherwise odd hash bits
+    PCYBERION_VERDICT_ENTRY Entries;
+    CYBERION_COUNTERS Counters;     // Indexed by CYBERION_VERDICT_COUNTER
+    CYBERION_VERDICT_FILTER Filter; // Every hash with a live entry
+    ULONG SlotMask;                 // Slot count - 1 (a power of two)
+    ULONG Capacity;                 // Most live entries
+
+    // Writer-owned
+    CYBERION_LOCK WriterLock;
+    ULONG Count;                    // Live entries
+    ULONG Pinned;                   // Live pinned entries
+    ULONG ClockHand;                // Next slot the clock examines
+    ULONG64 Insertions;
+    ULONG64 Evictions;              // Entries dropped to make room or after expiring
+} CYBERION_VERDICT_TABLE, *PCYBERION_VERDICT_TABLE;
+
+//
+// CyberionVerdictTableInitialize: Allocates a table holding at most
+// Capacity entries at a load factor of at most 3/4.
+//
+NTSTATUS CyberionVerdictTableInitialize(
+    _Out_ PCYBERION_VERDICT_TABLE Table,
+    _In_ ULONG Capacity
+);
+
+//
+// CyberionVerdictTableDestroy: Frees the table. No lookups may be running.
+//
+VOID CyberionVerdictTableDestroy(_Inout_ PCYBERION_VERDICT_TABLE Table);
+
+//
+// CyberionVerdictTableMemory: Bytes allocated by the table.
+//
+SIZE_T CyberionVerdictTableMemory(_In_ const CYBERION_VERDICT_TABLE *Table);
+
+//
+// CyberionVerdictTableLookup: Returns the verdict recorded for Hash, or
+// VerdictUnknown if there is none or it has expired. Safe at any IRQL <=
+// DISPATCH_LEVEL, concurrently with writers.
+//
+CYBERION_VERDICT CyberionVerdictTableLookup(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
+
+//
+// CyberionVerdictTableInsert: Records or replaces the verdict for Hash.
+// Expires is a CyberionQueryTime() deadline, or 0 for none; it is ignored
+// for pinned entries. An unpinned insert never replaces a pinned entry
+// (STATUS_OBJECT_NAME_COLLISION). Returns STATUS_QUOTA_EXCEEDED if pinned
+// entries would take more than half the capacity, and
+// STATUS_INSUFFICIENT_RESOURCES if nothing could be evicted to make room.
+//
+NTSTATUS CyberionVerdictTableInsert(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict,
+    _In_ UCHAR Flags,
+    _In_ ULONG64 Expires
+);
+
+//
+// CyberionVerdictTableRemove: Forgets Hash, pinned or not. Returns FALSE if
+// it was absent.
+//
+BOOLEAN CyberionVerdictTableRemove(
+    _Inout_ PCYBERION_VERDICT_TABLE Table,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash
+);
+
+//
+// CyberionVerdictTableQueryStatistics: Snapshot of the table's counters.
+//
+VOID CyberionVerdictTableQueryStatistics(
+    _In_ PCYBERION_VERDICT_TABLE Table,
+    _Out_ PCYBERION_VERDICT_STATISTICS Statistics
+);
+
+//
+// CYBERION_VERDICT_VISIT: Called by CyberionVerdictTableEnumerate for each
+// live entry. Return FALSE to stop.
+//
+typedef BOOLEAN CYBERION_VERDICT_VISIT(
+    _In_opt_ PVOID Context,
+    _In_reads_(CYBERION_HASH_SIZE) const UCHAR *Hash,
+    _In_ CYBERION_VERDICT Verdict,
+    _In_ UCHAR Flags,
+    _In_ ULONG64 Expires
+);
+
+//
+// CyberionVerdictTableEnumerate: Visits every entry that has not expired,
+// holding the writer lock (so Visit runs pinned and must not block).
+// Returns FALSE if Visit stopped the enumeration.
+//
+BOOLEAN CyberionVerdictTableEnumerate(
+    _In_ PCYBERION_VERDICT_TABLE Table,
+    _In_ CYBERION_VERDICT_VISIT *Visit,
+    _In_opt_ PVOID Context
+);
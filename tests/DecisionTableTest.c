@@ -0,0 +1,187 @@
+/*
+ * DECISIONTABLETEST.C
+ *
+ * Model checks for the pending decision table: random inserts, replaces
+ * and removals, with and without start keys, agree with a plain array,
+ * including in a table small enough that stripes fill and probes wrap;
+ * and threads working on their own processes never see each other's
+ * entries. "bench" times mixed operations on one and on eight threads.
+ */
+
+#include "Harness.h"
+#include "DecisionTable.h"
+
+#include <pthread.h>
+
+#define TABLE_TEST_THREADS      8
+#define TABLE_TEST_PROCESSES    1024    // Process IDs per thread
+
+//
+// Reference model: the start key and value expected for each process, by
+// process index. A NULL value means no entry.
+//
+typedef struct _TABLE_MODEL {
+    ULONG64 Keys[TABLE_TEST_THREADS * TABLE_TEST_PROCESSES];
+    PVOID Values[TABLE_TEST_THREADS * TABLE_TEST_PROCESSES];
+} TABLE_MODEL, *PTABLE_MODEL;
+
+static CYBERION_DECISION_TABLE g_Table;
+
+FORCEINLINE ULONG64 TableTestProcessId(ULONG Index)
+{
+    return ((ULONG64)Index + 1) * 4;
+}
+
+//
+// TableTestStep: One random operation on process Index, checked against
+// Model. Returns the number of mismatches.
+//
+static ULONG TableTestStep(_Inout_ PTABLE_MODEL Model, ULONG Index, _Inout_ PULONG64 Seed, ULONG64 Stamp)
+{
+    ULONG64 processId = TableTestProcessId(Index);
+    ULONG64 key = HarnessRandom(Seed) % 3 + 1;
+    ULONG64 operation = HarnessRandom(Seed) % 3;
+    PVOID value = (PVOID)(ULONG_PTR)Stamp;
+    PVOID replaced;
+    PVOID expected;
+    ULONG errors = 0;
+
+    if (operation == 0) {
+        NTSTATUS status = CyberionDecisionTableInsert(&g_Table, processId, key, value, &replaced);
+
+        if (status == STATUS_SUCCESS) {
+            errors += replaced != Model->Values[Index];
+            Model->Keys[Index] = key;
+            Model->Values[Index] = value;
+        } else {
+            // Only a new entry can find its stripe full
+            errors += status != STATUS_INSUFFICIENT_RESOURCES || Model->Values[Index] != NULL || replaced != NULL;
+        }
+    } else {
+        // Half the removals name any start key, half a random one
+        if (operation == 1) {
+            key = 0;
+        }
+
+        expected = (key == 0 || Model->Keys[Index] == key) ? Model->Values[Index] : NULL;
+        errors += CyberionDecisionTableRemove(&g_Table, processId, key) != expected;
+        if (expected != NULL) {
+            Model->Values[Index] = NULL;
+        }
+    }
+
+    return errors;
+}
+
+//
+// TableTestModel: Steps operations on Processes process IDs, then drains
+// the table and checks it held what the model holds.
+//
+static VOID TableTestModel(ULONG Capacity, ULONG Processes, ULONG Steps)
+{
+    static TABLE_MODEL model;
+    ULONG64 seed = Capacity + Processes;
+    ULONG expected = 0;
+    ULONG drained = 0;
+    ULONG errors = 0;
+    ULONG i;
+
+    RtlZeroMemory(&model, sizeof(model));
+    CHECK(CyberionDecisionTableInitialize(&g_Table, Capacity) == STATUS_SUCCESS);
+
+    for (i = 1; i <= Steps; i++) {
+        errors += TableTestStep(&model, (ULONG)(HarnessRandom(&seed) % Processes), &seed, i);
+    }
+    CHECK(errors == 0);
+
+    for (i = 0; i < CYBERION_DECISION_STRIPES; i++) {
+        CHECK(g_Table.Stripes[i].Count <= g_Table.StripeLimit);
+    }
+
+    for (i = 0; i < Processes; i++) {
+        expected += model.Values[i] != NULL;
+    }
+    while (CyberionDecisionTableRemoveAny(&g_Table) != NULL) {
+        drained++;
+    }
+    CHECK(drained == expected);
+
+    CHECK(CyberionDecisionTableRemove(&g_Table, 0, 0) == NULL);
+    CyberionDecisionTableDestroy(&g_Table);
+}
+
+typedef struct _TABLE_WORKER {
+    pthread_t Thread;
+    ULONG Index;
+    ULONG Steps;
+    ULONG Errors;
+    TABLE_MODEL Model;
+} TABLE_WORKER, *PTABLE_WORKER;
+
+//
+// TableTestWorker: Works on every TABLE_TEST_THREADS'th process from its
+// own index, so its model is exact whatever the other threads do.
+//
+static PVOID TableTestWorker(PVOID Argument)
+{
+    PTABLE_WORKER worker = Argument;
+    ULONG64 seed = worker->Index + 1;
+    ULONG i;
+
+    for (i = 1; i <= worker->Steps; i++) {
+        ULONG index = (ULONG)(HarnessRandom(&seed) % TABLE_TEST_PROCESSES) * TABLE_TEST_THREADS + worker->Index;
+
+        worker->Errors += TableTestStep(&worker->Model, index, &seed, i);
+    }
+
+    return NULL;
+}
+
+//
+// TableTestThreads: Runs Threads workers of Steps operations each and
+// returns the seconds taken.
+//
+static double TableTestThreads(ULONG Threads, ULONG Steps)
+{
+    static TABLE_WORKER workers[TABLE_TEST_THREADS];
+    double start;
+    ULONG i;
+
+    CHECK(CyberionDecisionTableInitialize(&g_Table, 16384) == STATUS_SUCCESS);
+
+    start = HarnessSeconds();
+    for (i = 0; i < Threads; i++) {
+        RtlZeroMemory(&workers[i], sizeof(workers[i]));
+        workers[i].Index = i;
+        workers[i].Steps = Steps;
+        pthread_create(&workers[i].Thread, NULL, TableTestWorker, &workers[i]);
+    }
+    for (i = 0; i < Threads; i++) {
+        pthread_join(workers[i].Thread, NULL);
+        CHECK(workers[i].Errors == 0);
+    }
+    start = HarnessSeconds() - start;
+
+    CyberionDecisionTableDestroy(&g_Table);
+    return start;
+}
+
+int main(int argc, char **argv)
+{
+    // Roomy, as the driver sizes it, and small enough that stripes fill
+    TableTestModel(16384, 4096, 3000000);
+    TableTestModel(0, 2048, 3000000);
+
+    TableTestThreads(TABLE_TEST_THREADS, 200000);
+
+    if (HarnessBenchmark(argc, argv)) {
+        ULONG steps = 2000000;
+
+        printf("decision table: 1 thread %.1f ns, %u threads %.1f ns per operation\n",
+               TableTestThreads(1, steps) * 1e9 / steps,
+               TABLE_TEST_THREADS,
+               TableTestThreads(TABLE_TEST_THREADS, steps) * 1e9 / ((double)steps * TABLE_TEST_THREADS));
+    }
+
+    return HarnessFinish();
+}
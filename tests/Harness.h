@@ -0,0 +1,86 @@
+/*
+ * HARNESS.H
+ *
+ * Helpers shared by the user-mode model checks and benchmarks.
+ */
+
+#pragma once
+
+#include "Platform.h"
+
+#include <stdio.h>
+#include <time.h>
+
+static ULONG g_HarnessFailures;
+
+//
+// CHECK: Records a failed model check without stopping the program, so one
+// run reports every broken case.
+//
+#define CHECK(e)                                                        \
+    do {                                                                \
+        if (!(e)) {                                                     \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #e); \
+            g_HarnessFailures++;                                        \
+        }                                                               \
+    } while (0)
+
+//
+// HarnessFinish: Exit status for main.
+//
+FORCEINLINE int HarnessFinish(VOID)
+{
+    if (g_HarnessFailures != 0) {
+        printf("%u check(s) failed\n", g_HarnessFailures);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}
+
+//
+// HarnessBenchmark: TRUE when the program was asked for timings.
+//
+FORCEINLINE BOOLEAN HarnessBenchmark(int argc, char **argv)
+{
+    return argc > 1 && strcmp(argv[1], "bench") == 0;
+}
+
+//
+// HarnessSeconds: Monotonic time in seconds.
+//
+FORCEINLINE double HarnessSeconds(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+//
+// HarnessRandom: xorshift64 generator; deterministic for a given seed.
+//
+FORCEINLINE ULONG64 HarnessRandom(_Inout_ ULONG64 *State)
+{
+    ULONG64 x = *State;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *State = x;
+    return x;
+}
+
+//
+// HarnessHash: Fills a SHA-256-sized digest with random bytes.
+//
+FORCEINLINE VOID HarnessHash(_Inout_ ULONG64 *State, _Out_writes_(32) PUCHAR Hash)
+{
+    ULONG i;
+
+    for (i = 0; i < 4; i++) {
+        ULONG64 word = HarnessRandom(State);
+        memcpy(Hash + i * 8, &word, 8);
+    }
+}
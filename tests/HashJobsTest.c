@@ -0,0 +1,291 @@
+/*
+ * HASHJOBSTEST.C
+ *
+ * Model checks for the hashing job queue, driven by pthreads the way the
+ * driver drives it with system threads: a burst of launches of the same
+ * files hashes each file once, a full queue still coalesces, no identity
+ * is ever hashed by two workers at a time, and stopping hands back the
+ * pending jobs. "bench" times submissions.
+ */
+
+#include "Harness.h"
+#include "HashJobs.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#define JOBS_TEST_FILES         16
+#define JOBS_TEST_LAUNCHES      64  // Submissions of each file per submitter
+#define JOBS_TEST_SUBMITTERS    8
+#define JOBS_TEST_WORKERS       4
+
+static CYBERION_HASH_JOBS g_Jobs;
+static sem_t g_Work;                            // One count per queued job
+static volatile LONG g_Hashed[JOBS_TEST_FILES]; // Jobs run per file
+static volatile LONG g_Running[JOBS_TEST_FILES]; // Workers on a file right now
+static volatile LONG g_Overlaps;
+static volatile LONG g_Queued;
+static volatile LONG g_Coalesced;
+static volatile LONG g_Rejected;
+
+static VOID JobsTestIdentity(ULONG File, _Out_ PCYBERION_FILE_IDENTITY Identity)
+{
+    Identity->VolumeId = 0x1234;
+    Identity->FileId = 1000 + File;
+    Identity->LastWriteTime = 42;
+    Identity->FileSize = 4096;
+}
+
+static VOID JobsTestSubmit(ULONG File)
+{
+    CYBERION_FILE_IDENTITY identity;
+
+    JobsTestIdentity(File, &identity);
+    switch (CyberionHashJobsSubmit(&g_Jobs, &identity, (PVOID)(ULONG_PTR)(File + 1))) {
+        case HashSubmitQueued:
+            InterlockedIncrement(&g_Queued);
+            sem_post(&g_Work);
+            break;
+
+        case HashSubmitCoalesced:
+            InterlockedIncrement(&g_Coalesced);
+            break;
+
+        default:
+            InterlockedIncrement(&g_Rejected);
+            break;
+    }
+}
+
+static PVOID JobsTestSubmitter(PVOID Argument)
+{
+    ULONG launch;
+    ULONG file;
+
+    UNREFERENCED_PARAMETER(Argument);
+
+    for (launch = 0; launch < JOBS_TEST_LAUNCHES; launch++) {
+        for (file = 0; file < JOBS_TEST_FILES; file++) {
+            JobsTestSubmit(file);
+        }
+    }
+
+    return NULL;
+}
+
+static PVOID JobsTestWorker(PVOID Argument)
+{
+    UNREFERENCED_PARAMETER(Argument);
+
+    for (;;) {
+        PCYBERION_HASH_JOB job;
+        ULONG file;
+
+        sem_wait(&g_Work);
+
+        job = CyberionHashJobsTake(&g_Jobs);
+        if (job == NULL) {
+            if (g_Jobs.Stopping) {
+                break;
+            }
+            continue;
+        }
+
+        file = (ULONG)(ULONG_PTR)job->Context - 1;
+        if (job->Identity.FileId != 1000 + file) {
+            InterlockedIncrement(&g_Overlaps);
+        }
+
+        if (InterlockedIncrement(&g_Running[file]) != 1) {
+            InterlockedIncrement(&g_Overlaps);
+        }
+        InterlockedIncrement(&g_Hashed[file]);
+        sched_yield();
+        InterlockedDecrement(&g_Running[file]);
+
+        CyberionHashJobsComplete(&g_Jobs, job);
+    }
+
+    return NULL;
+}
+
+static VOID JobsTestReset(ULONG Depth)
+{
+    CHECK(CyberionHashJobsInitialize(&g_Jobs, Depth) == STATUS_SUCCESS);
+    sem_init(&g_Work, 0, 0);
+    memset((PVOID)g_Hashed, 0, sizeof(g_Hashed));
+    g_Overlaps = 0;
+    g_Queued = 0;
+    g_Coalesced = 0;
+    g_Rejected = 0;
+}
+
+static VOID JobsTestRunSubmitters(VOID)
+{
+    pthread_t threads[JOBS_TEST_SUBMITTERS];
+    ULONG i;
+
+    for (i = 0; i < JOBS_TEST_SUBMITTERS; i++) {
+        pthread_create(&threads[i], NULL, JobsTestSubmitter, NULL);
+    }
+
+    for (i = 0; i < JOBS_TEST_SUBMITTERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+//
+// JobsTestStopWorkers: Stops the queue, completes what was still pending
+// and waits for the workers.
+//
+static ULONG JobsTestStopWorkers(_In_reads_(Count) pthread_t *Workers, ULONG Count)
+{
+    PCYBERION_HASH_JOB pending = CyberionHashJobsStop(&g_Jobs);
+    ULONG discarded = 0;
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        sem_post(&g_Work);
+    }
+
+    for (i = 0; i < Count; i++) {
+        pthread_join(Workers[i], NULL);
+    }
+
+    while (pending != NULL) {
+        PCYBERION_HASH_JOB next = pending->QueueNext;
+
+        CyberionHashJobsComplete(&g_Jobs, pending);
+        discarded++;
+        pending = next;
+    }
+
+    return discarded;
+}
+
+//
+// JobsTestBurst: Every submission arrives before any worker runs, as when
+// a build tool starts 64 copies of a new compiler. The queue only has room
+// for half the files, and further launches of those must still coalesce.
+//
+static VOID JobsTestBurst(VOID)
+{
+    pthread_t workers[JOBS_TEST_WORKERS];
+    ULONG total = JOBS_TEST_SUBMITTERS * JOBS_TEST_LAUNCHES * JOBS_TEST_FILES;
+    ULONG depth = JOBS_TEST_FILES / 2;
+    ULONG hashed = 0;
+    ULONG i;
+
+    JobsTestReset(depth);
+    JobsTestRunSubmitters();
+
+    CHECK(g_Queued == (LONG)depth);
+    CHECK(g_Queued + g_Coalesced + g_Rejected == (LONG)total);
+
+    for (i = 0; i < JOBS_TEST_WORKERS; i++) {
+        pthread_create(&workers[i], NULL, JobsTestWorker, NULL);
+    }
+
+    // Wait for the queued jobs to drain, then check each ran once
+    while (hashed != depth) {
+        sched_yield();
+        hashed = 0;
+        for (i = 0; i < JOBS_TEST_FILES; i++) {
+            hashed += (ULONG)g_Hashed[i];
+        }
+    }
+
+    CHECK(JobsTestStopWorkers(workers, JOBS_TEST_WORKERS) == 0);
+    CHECK(g_Overlaps == 0);
+    for (i = 0; i < JOBS_TEST_FILES; i++) {
+        CHECK(g_Hashed[i] <= 1);
+    }
+
+    CyberionHashJobsDestroy(&g_Jobs);
+    sem_destroy(&g_Work);
+}
+
+//
+// JobsTestConcurrent: Submitters and workers run together. A file may be
+// hashed again once its previous job is complete, but never by two workers
+// at once, and every queued job runs or is handed back by the stop.
+//
+static VOID JobsTestConcurrent(VOID)
+{
+    pthread_t workers[JOBS_TEST_WORKERS];
+    CYBERION_FILE_IDENTITY identity;
+    ULONG discarded;
+    LONG hashed = 0;
+    ULONG i;
+
+    JobsTestReset(4);
+
+    for (i = 0; i < JOBS_TEST_WORKERS; i++) {
+        pthread_create(&workers[i], NULL, JobsTestWorker, NULL);
+    }
+
+    JobsTestRunSubmitters();
+    discarded = JobsTestStopWorkers(workers, JOBS_TEST_WORKERS);
+
+    for (i = 0; i < JOBS_TEST_FILES; i++) {
+        hashed += g_Hashed[i];
+    }
+
+    CHECK(g_Overlaps == 0);
+    CHECK(hashed + (LONG)discarded == g_Queued);
+
+    // Stopped: nothing is accepted or handed out any more
+    JobsTestIdentity(0, &identity);
+    CHECK(CyberionHashJobsSubmit(&g_Jobs, &identity, NULL) == HashSubmitRejected);
+    CHECK(CyberionHashJobsTake(&g_Jobs) == NULL);
+
+    CyberionHashJobsDestroy(&g_Jobs);
+    sem_destroy(&g_Work);
+}
+
+static VOID JobsBenchmark(VOID)
+{
+    ULONG rounds = 10000000;
+    CYBERION_FILE_IDENTITY identity;
+    PCYBERION_HASH_JOB job;
+    double start;
+    double coalesce;
+    ULONG i;
+
+    CyberionHashJobsInitialize(&g_Jobs, 256);
+    JobsTestIdentity(0, &identity);
+    CyberionHashJobsSubmit(&g_Jobs, &identity, NULL);
+
+    start = HarnessSeconds();
+    for (i = 0; i < rounds; i++) {
+        CyberionHashJobsSubmit(&g_Jobs, &identity, NULL);
+    }
+    coalesce = (HarnessSeconds() - start) * 1e9 / rounds;
+
+    CyberionHashJobsComplete(&g_Jobs, CyberionHashJobsTake(&g_Jobs));
+
+    start = HarnessSeconds();
+    for (i = 0; i < rounds; i++) {
+        identity.FileId = i;
+        CyberionHashJobsSubmit(&g_Jobs, &identity, NULL);
+        job = CyberionHashJobsTake(&g_Jobs);
+        CyberionHashJobsComplete(&g_Jobs, job);
+    }
+
+    printf("hash jobs: %.1f ns per coalesced submission, %.1f ns per submit/take/complete\n",
+           coalesce, (HarnessSeconds() - start) * 1e9 / rounds);
+
+    CyberionHashJobsDestroy(&g_Jobs);
+}
+
+int main(int argc, char **argv)
+{
+    JobsTestBurst();
+    JobsTestConcurrent();
+
+    if (HarnessBenchmark(argc, argv)) {
+        JobsBenchmark();
+    }
+
+    return HarnessFinish();
+}
@@ -0,0 +1,156 @@
+/*
+ * SHA256TEST.C
+ *
+ * Model checks for SHA-256: the FIPS 180-2 vectors on every engine the
+ * processor supports, and random messages fed in random pieces, which must
+ * hash the same on all of them. "bench" reports throughput per engine.
+ */
+
+#include "Harness.h"
+#include "Sha256.h"
+
+typedef struct _SHA256_TEST_VECTOR {
+    const char *Message;
+    ULONG Repeat;
+    const char *Digest;
+} SHA256_TEST_VECTOR;
+
+static const SHA256_TEST_VECTOR g_Vectors[] = {
+    { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+static VOID Sha256TestHex(_In_ PCUCHAR Digest, _Out_writes_(65) char *Text)
+{
+    ULONG i;
+
+    for (i = 0; i < CYBERION_HASH_SIZE; i++) {
+        snprintf(Text + i * 2, 3, "%02x", Digest[i]);
+    }
+}
+
+static VOID Sha256TestVectors(ULONG Engines)
+{
+    ULONG i;
+
+    for (i = 0; i < RTL_NUMBER_OF(g_Vectors); i++) {
+        CYBERION_SHA256 context;
+        UCHAR digest[CYBERION_HASH_SIZE];
+        char text[65];
+        ULONG r;
+
+        CyberionSha256Init(&context);
+        for (r = 0; r < g_Vectors[i].Repeat; r++) {
+            CyberionSha256Update(&context, g_Vectors[i].Message, strlen(g_Vectors[i].Message));
+        }
+        CyberionSha256Final(&context, digest);
+
+        Sha256TestHex(digest, text);
+        if (strcmp(text, g_Vectors[i].Digest) != 0) {
+            printf("engines %#x, vector %u: %s\n", Engines, i, text);
+        }
+        CHECK(strcmp(text, g_Vectors[i].Digest) == 0);
+    }
+}
+
+//
+// Sha256TestPieces: Hashes Data in random pieces, so partial blocks are
+// carried across updates at every offset.
+//
+static VOID Sha256TestPieces(
+    _In_reads_bytes_(Length) PCUCHAR Data,
+    _In_ SIZE_T Length,
+    _Inout_ ULONG64 *Seed,
+    _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Digest
+)
+{
+    CYBERION_SHA256 context;
+    SIZE_T offset = 0;
+
+    CyberionSha256Init(&context);
+    while (offset < Length) {
+        SIZE_T piece = (SIZE_T)(HarnessRandom(Seed) % 200);
+
+        piece = min(piece, Length - offset);
+        CyberionSha256Update(&context, Data + offset, piece);
+        offset += piece;
+    }
+    CyberionSha256Final(&context, Digest);
+}
+
+static VOID Sha256TestEngines(ULONG Supported)
+{
+    static UCHAR data[4096];
+    ULONG64 seed = 77;
+    ULONG round;
+    ULONG i;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (UCHAR)HarnessRandom(&seed);
+    }
+
+    for (round = 0; round < 2000; round++) {
+        SIZE_T length = (SIZE_T)(HarnessRandom(&seed) % sizeof(data));
+        ULONG64 pieces = HarnessRandom(&seed);
+        UCHAR expected[CYBERION_HASH_SIZE];
+        UCHAR digest[CYBERION_HASH_SIZE];
+        CYBERION_SHA256 context;
+        ULONG64 s;
+
+        CyberionSha256Initialize(0);
+        CyberionSha256Init(&context);
+        CyberionSha256Update(&context, data, length);
+        CyberionSha256Final(&context, expected);
+
+        s = pieces;
+        Sha256TestPieces(data, length, &s, digest);
+        CHECK(RtlEqualMemory(digest, expected, sizeof(digest)));
+
+        if (Supported & CYBERION_SHA256_SHANI) {
+            CyberionSha256Initialize(CYBERION_SHA256_SHANI);
+            s = pieces;
+            Sha256TestPieces(data, length, &s, digest);
+            CHECK(RtlEqualMemory(digest, expected, sizeof(digest)));
+        }
+    }
+}
+
+static VOID Sha256Benchmark(ULONG Engines, const char *Name)
+{
+    SIZE_T length = 64 << 20;
+    PUCHAR data = calloc(1, length);
+    UCHAR digest[CYBERION_HASH_SIZE];
+    CYBERION_SHA256 context;
+    double start;
+
+    CyberionSha256Initialize(Engines);
+    start = HarnessSeconds();
+    CyberionSha256Init(&context);
+    CyberionSha256Update(&context, data, length);
+    CyberionSha256Final(&context, digest);
+
+    printf("sha256 %-8s %.0f MB/s\n", Name, (double)length / (HarnessSeconds() - start) / 1e6);
+    free(data);
+}
+
+int main(int argc, char **argv)
+{
+    ULONG supported = CyberionSha256Initialize(CYBERION_SHA256_ALL);
+
+    Sha256TestVectors(supported);
+    CyberionSha256Initialize(0);
+    Sha256TestVectors(0);
+    Sha256TestEngines(supported);
+
+    if (HarnessBenchmark(argc, argv)) {
+        Sha256Benchmark(0, "portable");
+        if (supported & CYBERION_SHA256_SHANI) {
+            Sha256Benchmark(CYBERION_SHA256_SHANI, "SHA-NI");
+        }
+    }
+
+    return HarnessFinish();
+}
@@ -0,0 +1,241 @@
+/*
+ * SLABTEST.C
+ *
+ * Model checks for the slab allocator: the object cap, objects stranded in
+ * other processors' magazines, and a multi-threaded stress run in which
+ * every object carries its owner's stamp, so handing one object to two
+ * threads is caught. "bench" times allocate/free pairs against malloc.
+ *
+ * The slab is compiled into this file with the processor count and index
+ * taken from the test, so the magazine paths are exercised the same way on
+ * a machine with one processor as on one with many.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <unistd.h>
+
+#define SLAB_TEST_PROCESSORS    8
+
+static __thread unsigned int g_SlabTestProcessor;
+
+#define sysconf(name)   ((long)SLAB_TEST_PROCESSORS)
+#define sched_getcpu()  ((int)g_SlabTestProcessor)
+
+#include "Harness.h"
+#include "Slab.c"
+
+#include <pthread.h>
+
+#define SLAB_TEST_OBJECT_SIZE   64
+#define SLAB_TEST_THREADS       8
+#define SLAB_TEST_HELD          64
+
+static CYBERION_SLAB g_Slab;
+static volatile LONG g_StampFailures;
+
+//
+// SlabTestPin: Makes the calling thread appear to run on Processor.
+//
+static VOID SlabTestPin(ULONG Processor)
+{
+    g_SlabTestProcessor = Processor % SLAB_TEST_PROCESSORS;
+}
+
+//
+// SlabTestDrain: Allocates until the slab refuses and frees everything
+// again. Returns the number of objects obtained.
+//
+static ULONG SlabTestDrain(VOID)
+{
+    PVOID *objects = calloc(g_Slab.ObjectCount + 1, sizeof(PVOID));
+    ULONG count = 0;
+    ULONG i;
+
+    while (count <= g_Slab.ObjectCount && (objects[count] = CyberionSlabAllocate(&g_Slab)) != NULL) {
+        count++;
+    }
+
+    for (i = 0; i < count; i++) {
+        CyberionSlabFree(&g_Slab, objects[i]);
+    }
+
+    free(objects);
+    return count;
+}
+
+static VOID SlabTestCap(VOID)
+{
+    ULONG count = 1000;
+    PUCHAR *objects = calloc(count, sizeof(PUCHAR));
+    ULONG i;
+
+    CHECK(CyberionSlabInitialize(&g_Slab, 40, count) == STATUS_SUCCESS);
+
+    for (i = 0; i < count; i++) {
+        objects[i] = CyberionSlabAllocate(&g_Slab);
+        CHECK(objects[i] != NULL);
+        CHECK(((ULONG_PTR)objects[i] % CYBERION_SLAB_ALIGNMENT) == 0);
+        CHECK(objects[i] >= g_Slab.Memory && objects[i] < g_Slab.Memory + count * g_Slab.ObjectSize);
+        memset(objects[i], (int)i, 40);
+    }
+
+    CHECK(CyberionSlabAllocate(&g_Slab) == NULL);
+    CHECK(g_Slab.Failures == 1);
+
+    for (i = 0; i < count; i++) {
+        CHECK(objects[i][0] == (UCHAR)i && objects[i][39] == (UCHAR)i);
+        CyberionSlabFree(&g_Slab, objects[i]);
+    }
+
+    CHECK(SlabTestDrain() == count);
+    CyberionSlabDestroy(&g_Slab);
+    free(objects);
+}
+
+//
+// SlabTestStranded: Allocates everything on processor 0 and frees it on
+// the others. Processor 0 must still get every object back.
+//
+static VOID SlabTestStranded(VOID)
+{
+    ULONG count;
+
+    for (count = 16; count <= 4096; count *= 4) {
+        PVOID *objects = calloc(count, sizeof(PVOID));
+        ULONG i;
+
+        CHECK(CyberionSlabInitialize(&g_Slab, SLAB_TEST_OBJECT_SIZE, count) == STATUS_SUCCESS);
+
+        SlabTestPin(0);
+        for (i = 0; i < count; i++) {
+            objects[i] = CyberionSlabAllocate(&g_Slab);
+            CHECK(objects[i] != NULL);
+        }
+
+        for (i = 0; i < count; i++) {
+            SlabTestPin(1 + i % 7);
+            CyberionSlabFree(&g_Slab, objects[i]);
+        }
+
+        SlabTestPin(0);
+        CHECK(SlabTestDrain() == count);
+
+        CyberionSlabDestroy(&g_Slab);
+        free(objects);
+    }
+}
+
+static PVOID SlabTestWorker(PVOID Argument)
+{
+    ULONG64 stamp = (ULONG64)(ULONG_PTR)Argument;
+    ULONG64 seed = stamp * 0x9E3779B97F4A7C15ULL + 1;
+    ULONG64 *held[SLAB_TEST_HELD];
+    ULONG count = 0;
+    ULONG i;
+
+    SlabTestPin((ULONG)stamp);
+
+    for (i = 0; i < 200000; i++) {
+        if (count < SLAB_TEST_HELD && (HarnessRandom(&seed) & 1)) {
+            ULONG64 *object = CyberionSlabAllocate(&g_Slab);
+
+            if (object != NULL) {
+                object[0] = stamp;
+                object[7] = stamp;
+                held[count++] = object;
+            }
+        } else if (count != 0) {
+            ULONG64 *object = held[--count];
+
+            if (object[0] != stamp || object[7] != stamp) {
+                InterlockedIncrement(&g_StampFailures);
+            }
+            CyberionSlabFree(&g_Slab, object);
+        }
+    }
+
+    while (count != 0) {
+        CyberionSlabFree(&g_Slab, held[--count]);
+    }
+
+    return NULL;
+}
+
+//
+// SlabTestThreads: More objects are wanted than exist, so threads see the
+// cap, refill and spill magazines, and race on the global list.
+//
+static VOID SlabTestThreads(VOID)
+{
+    pthread_t threads[SLAB_TEST_THREADS];
+    ULONG count = SLAB_TEST_THREADS * SLAB_TEST_HELD / 2;
+    ULONG i;
+
+    CHECK(CyberionSlabInitialize(&g_Slab, SLAB_TEST_OBJECT_SIZE, count) == STATUS_SUCCESS);
+
+    for (i = 0; i < SLAB_TEST_THREADS; i++) {
+        pthread_create(&threads[i], NULL, SlabTestWorker, (PVOID)(ULONG_PTR)(i + 1));
+    }
+
+    for (i = 0; i < SLAB_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    CHECK(g_StampFailures == 0);
+    CHECK(SlabTestDrain() == count);
+    CyberionSlabDestroy(&g_Slab);
+}
+
+static VOID SlabBenchmark(VOID)
+{
+    ULONG rounds = 20000000;
+    PVOID objects[8];
+    double start;
+    double slab;
+    ULONG i;
+    ULONG j;
+
+    CyberionSlabInitialize(&g_Slab, SLAB_TEST_OBJECT_SIZE, 4096);
+    SlabTestPin(0);
+
+    start = HarnessSeconds();
+    for (i = 0; i < rounds; i += 8) {
+        for (j = 0; j < 8; j++) {
+            objects[j] = CyberionSlabAllocate(&g_Slab);
+        }
+        for (j = 0; j < 8; j++) {
+            CyberionSlabFree(&g_Slab, objects[j]);
+        }
+    }
+    slab = (HarnessSeconds() - start) * 1e9 / rounds;
+
+    start = HarnessSeconds();
+    for (i = 0; i < rounds; i += 8) {
+        for (j = 0; j < 8; j++) {
+            objects[j] = malloc(SLAB_TEST_OBJECT_SIZE);
+            ((volatile UCHAR *)objects[j])[0] = 0;
+        }
+        for (j = 0; j < 8; j++) {
+            free(objects[j]);
+        }
+    }
+
+    printf("slab: %.1f ns per allocate/free pair (malloc %.1f ns)\n",
+           slab, (HarnessSeconds() - start) * 1e9 / rounds);
+
+    CyberionSlabDestroy(&g_Slab);
+}
+
+int main(int argc, char **argv)
+{
+    SlabTestCap();
+    SlabTestStranded();
+    SlabTestThreads();
+
+    if (HarnessBenchmark(argc, argv)) {
+        SlabBenchmark();
+    }
+
+    return HarnessFinish();
+}
@@ -0,0 +1,179 @@
+/*
+ * VERDICTFILTERTEST.C
+ *
+ * Model checks for the cuckoo filter: no false negatives through heavy
+ * churn or while a writer relocates fingerprints under lock-free readers,
+ * a bounded false-positive rate, and saturation followed by a rebuild.
+ */
+
+#include "Harness.h"
+#include "VerdictFilter.h"
+
+#include <pthread.h>
+
+#define FILTER_TEST_CAPACITY    65536
+
+static CYBERION_VERDICT_FILTER g_Filter;
+static UCHAR g_Hashes[FILTER_TEST_CAPACITY][CYBERION_HASH_SIZE];
+
+static double FilterTestFalsePositiveRate(_Inout_ ULONG64 *Seed)
+{
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG positives = 0;
+    ULONG rounds = 1000000;
+    ULONG i;
+
+    for (i = 0; i < rounds; i++) {
+        HarnessHash(Seed, hash);
+        positives += CyberionVerdictFilterContains(&g_Filter, hash);
+    }
+
+    return (double)positives / rounds;
+}
+
+//
+// FilterTestChurn: Fills the filter to capacity and replaces random hashes
+// many times over, as evictions do.
+//
+static VOID FilterTestChurn(VOID)
+{
+    ULONG64 seed = 1;
+    ULONG i;
+
+    CHECK(CyberionVerdictFilterInitialize(&g_Filter, FILTER_TEST_CAPACITY) == STATUS_SUCCESS);
+
+    for (i = 0; i < FILTER_TEST_CAPACITY; i++) {
+        HarnessHash(&seed, g_Hashes[i]);
+        CHECK(CyberionVerdictFilterAdd(&g_Filter, g_Hashes[i]));
+    }
+
+    for (i = 0; i < 4 * FILTER_TEST_CAPACITY; i++) {
+        ULONG victim = (ULONG)(HarnessRandom(&seed) % FILTER_TEST_CAPACITY);
+
+        CyberionVerdictFilterRemove(&g_Filter, g_Hashes[victim]);
+        HarnessHash(&seed, g_Hashes[victim]);
+        CHECK(CyberionVerdictFilterAdd(&g_Filter, g_Hashes[victim]));
+    }
+
+    for (i = 0; i < FILTER_TEST_CAPACITY; i++) {
+        CHECK(CyberionVerdictFilterContains(&g_Filter, g_Hashes[i]));
+    }
+
+    CHECK(g_Filter.Count == FILTER_TEST_CAPACITY);
+    CHECK(!g_Filter.Saturated);
+    CHECK(FilterTestFalsePositiveRate(&seed) < 0.0005);
+
+    CyberionVerdictFilterDestroy(&g_Filter);
+}
+
+//
+// FilterTestSaturation: Adds past any sensible load until an add fails,
+// then rebuilds from half the hashes.
+//
+static VOID FilterTestSaturation(VOID)
+{
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG64 seed = 2;
+    ULONG added = 0;
+    ULONG i;
+
+    CHECK(CyberionVerdictFilterInitialize(&g_Filter, 1000) == STATUS_SUCCESS);
+
+    for (;;) {
+        CHECK(added < FILTER_TEST_CAPACITY);
+        HarnessHash(&seed, g_Hashes[added]);
+        if (!CyberionVerdictFilterAdd(&g_Filter, g_Hashes[added])) {
+            break;
+        }
+        added++;
+    }
+
+    // Saturated: everything is a "maybe"
+    CHECK(g_Filter.Saturated);
+    HarnessHash(&seed, hash);
+    CHECK(CyberionVerdictFilterContains(&g_Filter, hash));
+
+    CyberionVerdictFilterReset(&g_Filter);
+    for (i = 0; i < added / 2; i++) {
+        CHECK(CyberionVerdictFilterAdd(&g_Filter, g_Hashes[i]));
+    }
+    CyberionVerdictFilterResume(&g_Filter);
+
+    CHECK(!g_Filter.Saturated);
+    CHECK(g_Filter.Count == added / 2);
+    for (i = 0; i < added / 2; i++) {
+        CHECK(CyberionVerdictFilterContains(&g_Filter, g_Hashes[i]));
+    }
+    CHECK(FilterTestFalsePositiveRate(&seed) < 0.001);
+
+    CyberionVerdictFilterDestroy(&g_Filter);
+}
+
+static volatile BOOLEAN g_FilterTestStop;
+static volatile LONG g_FilterTestMissing;
+
+//
+// FilterTestReader: The first half of g_Hashes stays in the filter the
+// whole time, so a reader must always find it.
+//
+static PVOID FilterTestReader(PVOID Argument)
+{
+    ULONG64 seed = (ULONG64)(ULONG_PTR)Argument;
+
+    while (!g_FilterTestStop) {
+        ULONG i = (ULONG)(HarnessRandom(&seed) % (FILTER_TEST_CAPACITY / 2));
+
+        if (!CyberionVerdictFilterContains(&g_Filter, g_Hashes[i])) {
+            InterlockedIncrement(&g_FilterTestMissing);
+        }
+    }
+
+    return NULL;
+}
+
+static VOID FilterTestReaders(VOID)
+{
+    pthread_t readers[3];
+    ULONG64 seed = 3;
+    ULONG i;
+
+    // Sized so the writer runs near the load at which relocations are long
+    CHECK(CyberionVerdictFilterInitialize(&g_Filter, FILTER_TEST_CAPACITY * 3 / 2) == STATUS_SUCCESS);
+
+    for (i = 0; i < FILTER_TEST_CAPACITY; i++) {
+        HarnessHash(&seed, g_Hashes[i]);
+        CHECK(CyberionVerdictFilterAdd(&g_Filter, g_Hashes[i]));
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(readers); i++) {
+        pthread_create(&readers[i], NULL, FilterTestReader, (PVOID)(ULONG_PTR)(i + 1));
+    }
+
+    for (i = 0; i < 2000000; i++) {
+        ULONG victim = FILTER_TEST_CAPACITY / 2 + (ULONG)(HarnessRandom(&seed) % (FILTER_TEST_CAPACITY / 2));
+
+        CyberionVerdictFilterRemove(&g_Filter, g_Hashes[victim]);
+        HarnessHash(&seed, g_Hashes[victim]);
+        CHECK(CyberionVerdictFilterAdd(&g_Filter, g_Hashes[victim]));
+    }
+
+    g_FilterTestStop = TRUE;
+    for (i = 0; i < RTL_NUMBER_OF(readers); i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    CHECK(g_FilterTestMissing == 0);
+    CyberionVerdictFilterDestroy(&g_Filter);
+}
+
+int main(int argc, char **argv)
+{
+    UNREFERENCED_PARAMETER(argc);
+    UNREFERENCED_PARAMETER(argv);
+
+    FilterTestChurn();
+    FilterTestSaturation();
+    FilterTestReaders();
+
+    return HarnessFinish();
+}
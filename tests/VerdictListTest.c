@@ -0,0 +1,268 @@
+/*
+ * VERDICTLISTTEST.C
+ *
+ * Model checks for the Eytzinger verdict list: lists of every size up to
+ * a few hundred, with hashes sharing their first eight bytes, find every
+ * listed hash and nothing else, and unsorted input is refused. "bench"
+ * times lookups, half of them hits, against a plain binary search, the
+ * store image and the perfect hash image built from the same hashes.
+ */
+
+#include "Harness.h"
+#include "VerdictList.h"
+#include "VerdictStore.h"
+#include "VerdictPerfect.h"
+#include "Sha256.h"
+
+static int ListTestCompare(const void *Left, const void *Right)
+{
+    return memcmp(Left, Right, CYBERION_HASH_SIZE);
+}
+
+//
+// ListTestSorted: Count distinct random hashes in ascending order, and
+// their verdicts. With Colliding set the hashes differ only in the bytes
+// past the eight-byte prefix, and only a few prefixes are used.
+//
+static VOID ListTestSorted(ULONG64 Seed, ULONG Count, BOOLEAN Colliding, _Out_ PUCHAR *Hashes, _Out_ PUCHAR *Verdicts)
+{
+    PUCHAR hashes = malloc((SIZE_T)Count * CYBERION_HASH_SIZE + 1);
+    PUCHAR verdicts = malloc((SIZE_T)Count + 1);
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        PUCHAR hash = hashes + (SIZE_T)i * CYBERION_HASH_SIZE;
+
+        HarnessHash(&Seed, hash);
+        if (Colliding) {
+            memset(hash, 0, 8);
+            hash[0] = (UCHAR)(i % 5);
+        }
+
+        // Keeps the hashes distinct
+        *(PULONG)(hash + 28) = i;
+        verdicts[i] = (UCHAR)((HarnessRandom(&Seed) & 1) ? VerdictBlock : VerdictAllow);
+    }
+
+    // Sorting moves the hashes away from their verdicts; verdicts stay random
+    qsort(hashes, Count, CYBERION_HASH_SIZE, ListTestCompare);
+
+    *Hashes = hashes;
+    *Verdicts = verdicts;
+}
+
+//
+// ListTestLookups: Every listed hash is found with its verdict, and hashes
+// next to listed ones, sharing their prefix, are not.
+//
+static VOID ListTestLookups(ULONG Count, BOOLEAN Colliding)
+{
+    CYBERION_VERDICT_LIST list;
+    UCHAR hash[CYBERION_HASH_SIZE];
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PVOID buffer;
+    ULONG i;
+
+    ListTestSorted(Count + 1, Count, Colliding, &hashes, &verdicts);
+    buffer = malloc(CyberionVerdictListSize(Count));
+
+    CHECK(CyberionVerdictListBuild(hashes, verdicts, Count, buffer, &list) == STATUS_SUCCESS);
+
+    for (i = 0; i < Count; i++) {
+        PUCHAR listed = hashes + (SIZE_T)i * CYBERION_HASH_SIZE;
+
+        CHECK(CyberionVerdictListLookup(&list, listed) == verdicts[i]);
+
+        memcpy(hash, listed, CYBERION_HASH_SIZE);
+        hash[31] ^= 0x80;
+        if (bsearch(hash, hashes, Count, CYBERION_HASH_SIZE, ListTestCompare) == NULL) {
+            CHECK(CyberionVerdictListLookup(&list, hash) == VerdictUnknown);
+        }
+    }
+
+    memset(hash, 0, sizeof(hash));
+    CHECK(bsearch(hash, hashes, Count, CYBERION_HASH_SIZE, ListTestCompare) != NULL ||
+          CyberionVerdictListLookup(&list, hash) == VerdictUnknown);
+    memset(hash, 0xFF, sizeof(hash));
+    CHECK(CyberionVerdictListLookup(&list, hash) == VerdictUnknown);
+
+    free(buffer);
+    free(hashes);
+    free(verdicts);
+}
+
+static VOID ListTestRefused(VOID)
+{
+    CYBERION_VERDICT_LIST list;
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PVOID buffer;
+
+    ListTestSorted(7, 100, FALSE, &hashes, &verdicts);
+    buffer = malloc(CyberionVerdictListSize(100));
+
+    CHECK(CyberionVerdictListSize(CYBERION_MAX_PRELOAD + 1) == 0);
+
+    // Out of order
+    memcpy(buffer, hashes + 10 * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE);
+    memcpy(hashes + 10 * CYBERION_HASH_SIZE, hashes + 11 * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE);
+    memcpy(hashes + 11 * CYBERION_HASH_SIZE, buffer, CYBERION_HASH_SIZE);
+    CHECK(CyberionVerdictListBuild(hashes, verdicts, 100, buffer, &list) == STATUS_INVALID_PARAMETER);
+
+    // Repeated
+    memcpy(hashes + 11 * CYBERION_HASH_SIZE, hashes + 10 * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE);
+    CHECK(CyberionVerdictListBuild(hashes, verdicts, 100, buffer, &list) == STATUS_INVALID_PARAMETER);
+
+    // Distinct and ascending again, but with a verdict that cannot be listed
+    hashes[11 * CYBERION_HASH_SIZE + 31] ^= 1;
+    qsort(hashes, 100, CYBERION_HASH_SIZE, ListTestCompare);
+    verdicts[40] = VerdictUnknown;
+    CHECK(CyberionVerdictListBuild(hashes, verdicts, 100, buffer, &list) == STATUS_INVALID_PARAMETER);
+
+    verdicts[40] = VerdictAllow;
+    CHECK(CyberionVerdictListBuild(hashes, verdicts, 100, buffer, &list) == STATUS_SUCCESS);
+
+    free(buffer);
+    free(hashes);
+    free(verdicts);
+}
+
+//
+// ListBisect: The plain binary search over the sorted input that the list
+// replaces.
+//
+static CYBERION_VERDICT ListBisect(const UCHAR *Hashes, const UCHAR *Verdicts, ULONG Count, const UCHAR *Hash)
+{
+    ULONG low = 0;
+    ULONG high = Count;
+
+    while (low < high) {
+        ULONG middle = low + (high - low) / 2;
+        int order = memcmp(Hashes + (SIZE_T)middle * CYBERION_HASH_SIZE, Hash, CYBERION_HASH_SIZE);
+
+        if (order == 0) {
+            return (CYBERION_VERDICT)Verdicts[middle];
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return VerdictUnknown;
+}
+
+#define LIST_BENCH_QUERIES 2000000
+
+static VOID ListBenchmark(ULONG Count)
+{
+    CYBERION_VERDICT_LIST list;
+    CYBERION_VERDICT_STORE store;
+    CYBERION_VERDICT_PERFECT perfect;
+    ULONG64 seed = 99;
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PUCHAR queries;
+    PVOID buffer;
+    PVOID image;
+    PVOID built;
+    SIZE_T length;
+    ULONG hits[4] = { 0 };
+    double seconds[4];
+    double start;
+    ULONG i;
+
+    ListTestSorted(Count, Count, FALSE, &hashes, &verdicts);
+
+    buffer = malloc(CyberionVerdictListSize(Count));
+    CHECK(CyberionVerdictListBuild(hashes, verdicts, Count, buffer, &list) == STATUS_SUCCESS);
+
+    length = CyberionVerdictStoreSize(Count);
+    image = malloc(length);
+    CHECK(CyberionVerdictStoreCreate(image, length, Count) == STATUS_SUCCESS);
+    for (i = 0; i < Count; i++) {
+        CyberionVerdictStoreAdd(image, hashes + (SIZE_T)i * CYBERION_HASH_SIZE, (CYBERION_VERDICT)verdicts[i]);
+    }
+    CyberionVerdictStoreSeal(image);
+    CHECK(CyberionVerdictStoreOpen(image, length, &store) == STATUS_SUCCESS);
+
+    CHECK(CyberionVerdictPerfectBuild(hashes, verdicts, Count, &built, &length) == STATUS_SUCCESS);
+    CHECK(CyberionVerdictPerfectOpen(built, length, &perfect) == STATUS_SUCCESS);
+
+    // Half listed hashes, half random ones, in random order
+    queries = malloc((SIZE_T)LIST_BENCH_QUERIES * CYBERION_HASH_SIZE);
+    for (i = 0; i < LIST_BENCH_QUERIES; i++) {
+        PUCHAR query = queries + (SIZE_T)i * CYBERION_HASH_SIZE;
+
+        if (i & 1) {
+            HarnessHash(&seed, query);
+        } else {
+            memcpy(query, hashes + (SIZE_T)(HarnessRandom(&seed) % Count) * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE);
+        }
+    }
+
+    start = HarnessSeconds();
+    for (i = 0; i < LIST_BENCH_QUERIES; i++) {
+        hits[0] += ListBisect(hashes, verdicts, Count, queries + (SIZE_T)i * CYBERION_HASH_SIZE) != VerdictUnknown;
+    }
+    seconds[0] = HarnessSeconds() - start;
+
+    start = HarnessSeconds();
+    for (i = 0; i < LIST_BENCH_QUERIES; i++) {
+        hits[1] += CyberionVerdictListLookup(&list, queries + (SIZE_T)i * CYBERION_HASH_SIZE) != VerdictUnknown;
+    }
+    seconds[1] = HarnessSeconds() - start;
+
+    start = HarnessSeconds();
+    for (i = 0; i < LIST_BENCH_QUERIES; i++) {
+        hits[2] += CyberionVerdictStoreLookup(&store, queries + (SIZE_T)i * CYBERION_HASH_SIZE) != VerdictUnknown;
+    }
+    seconds[2] = HarnessSeconds() - start;
+
+    start = HarnessSeconds();
+    for (i = 0; i < LIST_BENCH_QUERIES; i++) {
+        hits[3] += CyberionVerdictPerfectLookup(&perfect, queries + (SIZE_T)i * CYBERION_HASH_SIZE) != VerdictUnknown;
+    }
+    seconds[3] = HarnessSeconds() - start;
+
+    CHECK(hits[0] == LIST_BENCH_QUERIES / 2);
+    CHECK(hits[1] == hits[0] && hits[2] == hits[0] && hits[3] == hits[0]);
+
+    printf("%8u hashes: bisect %6.1f  eytzinger %6.1f  store %6.1f  perfect %6.1f ns per lookup\n",
+           Count,
+           seconds[0] * 1e9 / LIST_BENCH_QUERIES,
+           seconds[1] * 1e9 / LIST_BENCH_QUERIES,
+           seconds[2] * 1e9 / LIST_BENCH_QUERIES,
+           seconds[3] * 1e9 / LIST_BENCH_QUERIES);
+
+    free(queries);
+    CyberionFree(built);
+    free(image);
+    free(buffer);
+    free(hashes);
+    free(verdicts);
+}
+
+int main(int argc, char **argv)
+{
+    ULONG count;
+
+    CyberionSha256Initialize(CYBERION_SHA256_ALL);
+
+    for (count = 0; count < 300; count++) {
+        ListTestLookups(count, TRUE);
+        ListTestLookups(count, FALSE);
+    }
+    ListTestLookups(100000, FALSE);
+    ListTestRefused();
+
+    if (HarnessBenchmark(argc, argv)) {
+        ListBenchmark(64 * 1024);
+        ListBenchmark(1024 * 1024);
+        ListBenchmark(4 * 1024 * 1024);
+    }
+
+    return HarnessFinish();
+}
@@ -0,0 +1,165 @@
+/*
+ * VERDICTPERFECTTEST.C
+ *
+ * Model checks for perfect hash images: every listed hash is found with
+ * its verdict and nothing else is, duplicates and bad verdicts are
+ * refused, and damaged images are rejected. "bench" compiles a 2M-hash
+ * list, as for a large weekly allowlist.
+ */
+
+#include "Harness.h"
+#include "VerdictPerfect.h"
+#include "Sha256.h"
+
+//
+// PerfectTestList: Count random hashes and their verdicts.
+//
+static VOID PerfectTestList(ULONG64 Seed, ULONG Count, _Out_ PUCHAR *Hashes, _Out_ PUCHAR *Verdicts)
+{
+    ULONG i;
+
+    *Hashes = malloc((SIZE_T)Count * CYBERION_HASH_SIZE + 1);
+    *Verdicts = malloc((SIZE_T)Count + 1);
+
+    for (i = 0; i < Count; i++) {
+        HarnessHash(&Seed, *Hashes + (SIZE_T)i * CYBERION_HASH_SIZE);
+        (*Verdicts)[i] = (UCHAR)((i & 1) ? VerdictBlock : VerdictAllow);
+    }
+}
+
+static VOID PerfectTestLookups(ULONG Count)
+{
+    CYBERION_VERDICT_PERFECT perfect;
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG64 seed = 0xABCDEF + Count;
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PVOID image;
+    SIZE_T length;
+    ULONG i;
+
+    PerfectTestList(Count, Count, &hashes, &verdicts);
+
+    CHECK(CyberionVerdictPerfectBuild(hashes, verdicts, Count, &image, &length) == STATUS_SUCCESS);
+    CHECK(length == CyberionVerdictPerfectSize(Count));
+    CHECK(CyberionVerdictPerfectOpen(image, length, &perfect) == STATUS_SUCCESS);
+
+    for (i = 0; i < Count; i++) {
+        CHECK(CyberionVerdictPerfectLookup(&perfect, hashes + (SIZE_T)i * CYBERION_HASH_SIZE) == verdicts[i]);
+    }
+
+    for (i = 0; i < 10000; i++) {
+        HarnessHash(&seed, hash);
+        CHECK(CyberionVerdictPerfectLookup(&perfect, hash) == VerdictUnknown);
+    }
+
+    CyberionFree(image);
+    free(hashes);
+    free(verdicts);
+}
+
+static VOID PerfectTestRefused(VOID)
+{
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PVOID image;
+    SIZE_T length;
+
+    PerfectTestList(1, 100, &hashes, &verdicts);
+
+    CHECK(CyberionVerdictPerfectSize(CYBERION_MAX_PRELOAD + 1) == 0);
+
+    verdicts[7] = VerdictUnknown;
+    CHECK(CyberionVerdictPerfectBuild(hashes, verdicts, 100, &image, &length) == STATUS_INVALID_PARAMETER);
+    verdicts[7] = VerdictBlock;
+
+    memcpy(hashes + 50 * CYBERION_HASH_SIZE, hashes + 20 * CYBERION_HASH_SIZE, CYBERION_HASH_SIZE);
+    CHECK(CyberionVerdictPerfectBuild(hashes, verdicts, 100, &image, &length) == STATUS_INVALID_PARAMETER);
+
+    free(hashes);
+    free(verdicts);
+}
+
+//
+// PerfectTestDamage: Every single-byte change, and a truncated image, is
+// caught when the image is opened. Trailing bytes past the image are ignored.
+//
+static VOID PerfectTestDamage(VOID)
+{
+    CYBERION_VERDICT_PERFECT perfect;
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PVOID built;
+    PUCHAR image;
+    SIZE_T length;
+    SIZE_T offset;
+
+    PerfectTestList(2, 50, &hashes, &verdicts);
+    CHECK(CyberionVerdictPerfectBuild(hashes, verdicts, 50, &built, &length) == STATUS_SUCCESS);
+
+    // One spare byte so the over-long open stays inside the buffer
+    image = calloc(1, length + 1);
+    memcpy(image, built, length);
+    CyberionFree(built);
+
+    CHECK(CyberionVerdictPerfectOpen(image, length - 1, &perfect) == STATUS_INVALID_IMAGE_FORMAT);
+    CHECK(CyberionVerdictPerfectOpen(image, length + 1, &perfect) == STATUS_SUCCESS);
+
+    for (offset = 0; offset < length; offset++) {
+        image[offset] ^= 0x40;
+        CHECK(CyberionVerdictPerfectOpen(image, length, &perfect) == STATUS_INVALID_IMAGE_FORMAT);
+        image[offset] ^= 0x40;
+    }
+
+    CHECK(CyberionVerdictPerfectOpen(image, length, &perfect) == STATUS_SUCCESS);
+
+    free(image);
+    free(hashes);
+    free(verdicts);
+}
+
+static VOID PerfectBenchmark(VOID)
+{
+    CYBERION_VERDICT_PERFECT perfect;
+    ULONG count = 2000000;
+    PUCHAR hashes;
+    PUCHAR verdicts;
+    PVOID image;
+    SIZE_T length;
+    double start;
+
+    PerfectTestList(3, count, &hashes, &verdicts);
+
+    start = HarnessSeconds();
+    CHECK(CyberionVerdictPerfectBuild(hashes, verdicts, count, &image, &length) == STATUS_SUCCESS);
+    printf("perfect: built %u hashes in %.2f s, %.1f bytes per hash\n",
+           count, HarnessSeconds() - start, (double)length / count);
+
+    start = HarnessSeconds();
+    CHECK(CyberionVerdictPerfectOpen(image, length, &perfect) == STATUS_SUCCESS);
+    printf("perfect: opened in %.3f s\n", HarnessSeconds() - start);
+
+    CyberionFree(image);
+    free(hashes);
+    free(verdicts);
+}
+
+int main(int argc, char **argv)
+{
+    ULONG count;
+
+    CyberionSha256Initialize(CYBERION_SHA256_ALL);
+
+    for (count = 0; count < 300; count++) {
+        PerfectTestLookups(count);
+    }
+    PerfectTestLookups(100000);
+    PerfectTestRefused();
+    PerfectTestDamage();
+
+    if (HarnessBenchmark(argc, argv)) {
+        PerfectBenchmark();
+    }
+
+    return HarnessFinish();
+}
@@ -0,0 +1,234 @@
+/*
+ * VERDICTSTORETEST.C
+ *
+ * Model checks for verdict store images: build, seal, open and look up,
+ * replacement and the capacity bound, the sizes taken from a header, and
+ * rejection of damaged images. "bench" writes 1M- and 10M-entry images to
+ * a file and times mapping, opening (every slot and the checksum) and
+ * lookups, as a warm start does.
+ */
+
+#include "Harness.h"
+#include "VerdictStore.h"
+#include "Sha256.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static CYBERION_VERDICT StoreTestKey(ULONG64 Index, _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash)
+{
+    ULONG64 seed = Index * 0x9E3779B97F4A7C15ULL + 0x2545F4914F6CDD1DULL;
+
+    HarnessHash(&seed, Hash);
+    return (Index % 3) ? VerdictAllow : VerdictBlock;
+}
+
+//
+// StoreTestBuild: Allocates and seals an image of Count keys starting at
+// key First.
+//
+static PUCHAR StoreTestBuild(ULONG First, ULONG Count, _Out_ SIZE_T *Size)
+{
+    UCHAR hash[CYBERION_HASH_SIZE];
+    PUCHAR image;
+    ULONG i;
+
+    *Size = CyberionVerdictStoreSize(Count);
+    image = malloc(*Size);
+    CHECK(CyberionVerdictStoreCreate(image, *Size, Count) == STATUS_SUCCESS);
+
+    for (i = 0; i < Count; i++) {
+        CYBERION_VERDICT verdict = StoreTestKey(First + i, hash);
+        CHECK(CyberionVerdictStoreAdd(image, hash, verdict) == STATUS_SUCCESS);
+    }
+
+    CyberionVerdictStoreSeal(image);
+    return image;
+}
+
+static VOID StoreTestLookups(VOID)
+{
+    CYBERION_VERDICT_STORE store;
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG count = 100000;
+    SIZE_T size;
+    PUCHAR image = StoreTestBuild(0, count, &size);
+    ULONG i;
+
+    CHECK(CyberionVerdictStoreOpen(image, size, &store) == STATUS_SUCCESS);
+    CHECK(store.Count == count);
+    CHECK(store.MaxProbe < 64);
+
+    for (i = 0; i < count; i++) {
+        CYBERION_VERDICT verdict = StoreTestKey(i, hash);
+        CHECK(CyberionVerdictStoreLookup(&store, hash) == verdict);
+    }
+
+    for (i = 0; i < count; i++) {
+        StoreTestKey(count + i, hash);
+        CHECK(CyberionVerdictStoreLookup(&store, hash) == VerdictUnknown);
+    }
+
+    free(image);
+}
+
+static VOID StoreTestBuilder(VOID)
+{
+    UCHAR hash[CYBERION_HASH_SIZE];
+    CYBERION_VERDICT_STORE store;
+    SIZE_T size = CyberionVerdictStoreSize(4);
+    PUCHAR image = malloc(size);
+    ULONG i;
+
+    CHECK(CyberionVerdictStoreSize(CYBERION_MAX_PRELOAD + 1) == 0);
+    CHECK(CyberionVerdictStoreCreate(image, size - 1, 4) == STATUS_BUFFER_TOO_SMALL);
+    CHECK(CyberionVerdictStoreCreate(image, size, 4) == STATUS_SUCCESS);
+
+    for (i = 0; i < 4; i++) {
+        StoreTestKey(i, hash);
+        CHECK(CyberionVerdictStoreAdd(image, hash, VerdictAllow) == STATUS_SUCCESS);
+    }
+
+    // Replacing does not take a slot; a fifth hash does not fit
+    CHECK(CyberionVerdictStoreAdd(image, hash, VerdictBlock) == STATUS_SUCCESS);
+    StoreTestKey(4, hash);
+    CHECK(CyberionVerdictStoreAdd(image, hash, VerdictAllow) == STATUS_INSUFFICIENT_RESOURCES);
+    CHECK(CyberionVerdictStoreAdd(image, hash, VerdictUnknown) == STATUS_INVALID_PARAMETER);
+
+    CyberionVerdictStoreSeal(image);
+    CHECK(CyberionVerdictStoreOpen(image, size, &store) == STATUS_SUCCESS);
+    CHECK(store.Count == 4);
+    StoreTestKey(3, hash);
+    CHECK(CyberionVerdictStoreLookup(&store, hash) == VerdictBlock);
+
+    free(image);
+}
+
+//
+// StoreTestImageSize: The size a preload maps is taken from the header's
+// slot count, which must be one a builder could have chosen.
+//
+static VOID StoreTestImageSize(VOID)
+{
+    CYBERION_STORE_HEADER header;
+    ULONG count;
+
+    for (count = 1; count < 100000; count = count * 3 + 1) {
+        SIZE_T size = CyberionVerdictStoreSize(count);
+        PCYBERION_STORE_HEADER built = malloc(size);
+        ULONG slots;
+
+        CyberionVerdictStoreCreate(built, size, count);
+        slots = built->SlotCount;
+        CHECK(CyberionVerdictStoreImageSize(built, count) == size);
+
+        // A larger table is acceptable, a smaller or uneven one is not
+        header = *built;
+        header.SlotCount = slots * 2;
+        CHECK(CyberionVerdictStoreImageSize(&header, count) == sizeof(header) + (SIZE_T)slots * 2 * sizeof(CYBERION_STORE_ENTRY));
+        header.SlotCount = slots / 2;
+        CHECK(CyberionVerdictStoreImageSize(&header, count) == 0);
+        header.SlotCount = slots + 1;
+        CHECK(CyberionVerdictStoreImageSize(&header, count) == 0);
+
+        free(built);
+    }
+
+    RtlZeroMemory(&header, sizeof(header));
+    header.SlotCount = 0x80000000;
+    CHECK(CyberionVerdictStoreImageSize(&header, 1) == 0);
+    header.SlotCount = 16;
+    CHECK(CyberionVerdictStoreImageSize(&header, CYBERION_MAX_PRELOAD + 1) == 0);
+}
+
+//
+// StoreTestDamage: Every single-byte change to an image, and every wrong
+// length, is caught when it is opened.
+//
+static VOID StoreTestDamage(VOID)
+{
+    CYBERION_VERDICT_STORE store;
+    SIZE_T size;
+    PUCHAR image = StoreTestBuild(0, 100, &size);
+    SIZE_T offset;
+
+    CHECK(CyberionVerdictStoreOpen(image, size, &store) == STATUS_SUCCESS);
+    CHECK(CyberionVerdictStoreOpen(image, size - 1, &store) == STATUS_INVALID_IMAGE_FORMAT);
+    CHECK(CyberionVerdictStoreOpen(image, sizeof(CYBERION_STORE_HEADER) - 1, &store) == STATUS_INVALID_IMAGE_FORMAT);
+
+    for (offset = 0; offset < size; offset++) {
+        image[offset] ^= 0x40;
+        CHECK(CyberionVerdictStoreOpen(image, size, &store) == STATUS_INVALID_IMAGE_FORMAT);
+        image[offset] ^= 0x40;
+    }
+
+    CHECK(CyberionVerdictStoreOpen(image, size, &store) == STATUS_SUCCESS);
+    free(image);
+}
+
+static VOID StoreBenchmark(ULONG Count)
+{
+    char path[] = "/tmp/cyberion-storeXXXXXX";
+    UCHAR hash[CYBERION_HASH_SIZE];
+    CYBERION_VERDICT_STORE store;
+    ULONG lookups = 1000000;
+    ULONG found = 0;
+    double start;
+    double mapTime;
+    double openTime;
+    SIZE_T size;
+    PUCHAR image;
+    PVOID view;
+    int fd;
+    ULONG i;
+
+    image = StoreTestBuild(0, Count, &size);
+    fd = mkstemp(path);
+    CHECK(fd >= 0 && write(fd, image, size) == (ssize_t)size);
+    free(image);
+
+    // Page cache warm, as after the service saved the file
+    start = HarnessSeconds();
+    view = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    mapTime = HarnessSeconds() - start;
+    CHECK(view != MAP_FAILED);
+
+    start = HarnessSeconds();
+    CHECK(CyberionVerdictStoreOpen(view, size, &store) == STATUS_SUCCESS);
+    openTime = HarnessSeconds() - start;
+
+    start = HarnessSeconds();
+    for (i = 0; i < lookups; i++) {
+        ULONG64 key = ((ULONG64)i * 7919) % (2ULL * Count);
+        CYBERION_VERDICT expected = StoreTestKey(key, hash);
+        CYBERION_VERDICT verdict = CyberionVerdictStoreLookup(&store, hash);
+
+        CHECK(verdict == (key < Count ? expected : VerdictUnknown));
+        found += (verdict != VerdictUnknown);
+    }
+
+    printf("store %8u entries, %4.0f MB: mmap %.3f s, open %.3f s, %.0f ns per lookup (%u%% hits)\n",
+           Count, size / 1e6, mapTime, openTime, (HarnessSeconds() - start) * 1e9 / lookups,
+           found * 100 / lookups);
+
+    munmap(view, size);
+    close(fd);
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    CyberionSha256Initialize(CYBERION_SHA256_ALL);
+
+    StoreTestLookups();
+    StoreTestBuilder();
+    StoreTestImageSize();
+    StoreTestDamage();
+
+    if (HarnessBenchmark(argc, argv)) {
+        StoreBenchmark(1000000);
+        StoreBenchmark(10000000);
+    }
+
+    return HarnessFinish();
+}
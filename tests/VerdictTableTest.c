@@ -0,0 +1,384 @@
+/*
+ * VERDICTTABLETEST.C
+ *
+ * Model checks for the verdict table: the capacity bound under CLOCK
+ * eviction, second chances for entries that were looked up, expiry,
+ * pinned rules, insert/remove churn, and readers racing a writer, which
+ * must never see a verdict the table did not hold. "bench" measures the
+ * cuckoo filter's false-positive rate and the cost of a miss with and
+ * without it.
+ */
+
+#include "Harness.h"
+#include "VerdictTable.h"
+
+#include <pthread.h>
+
+#define TABLE_TEST_CAPACITY 4096
+
+static CYBERION_VERDICT_TABLE g_Table;
+
+//
+// TableTestKey: The hash for key Index, and the verdict the tests record
+// for it.
+//
+static CYBERION_VERDICT TableTestKey(ULONG64 Index, _Out_writes_(CYBERION_HASH_SIZE) PUCHAR Hash)
+{
+    ULONG64 seed = Index * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL;
+
+    HarnessHash(&seed, Hash);
+    return (Index & 1) ? VerdictBlock : VerdictAllow;
+}
+
+static ULONG TableTestCountPresent(ULONG64 First, ULONG Count)
+{
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG present = 0;
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        CYBERION_VERDICT expected = TableTestKey(First + i, hash);
+        CYBERION_VERDICT verdict = CyberionVerdictTableLookup(&g_Table, hash);
+
+        CHECK(verdict == VerdictUnknown || verdict == expected);
+        present += (verdict != VerdictUnknown);
+    }
+
+    return present;
+}
+
+static VOID TableTestBasic(VOID)
+{
+    CYBERION_VERDICT_STATISTICS stats;
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG i;
+
+    CHECK(CyberionVerdictTableInitialize(&g_Table, TABLE_TEST_CAPACITY) == STATUS_SUCCESS);
+
+    for (i = 0; i < 100; i++) {
+        CHECK(CyberionVerdictTableInsert(&g_Table, hash, TableTestKey(i, hash), 0, 0) == STATUS_SUCCESS);
+    }
+    CHECK(TableTestCountPresent(0, 100) == 100);
+    CHECK(TableTestCountPresent(1000, 100) == 0);
+
+    // Replacing keeps one entry
+    TableTestKey(7, hash);
+    CHECK(CyberionVerdictTableInsert(&g_Table, hash, VerdictAllow, 0, 0) == STATUS_SUCCESS);
+    CHECK(CyberionVerdictTableLookup(&g_Table, hash) == VerdictAllow);
+
+    CHECK(CyberionVerdictTableRemove(&g_Table, hash));
+    CHECK(!CyberionVerdictTableRemove(&g_Table, hash));
+    CHECK(CyberionVerdictTableLookup(&g_Table, hash) == VerdictUnknown);
+
+    CyberionVerdictTableQueryStatistics(&g_Table, &stats);
+    CHECK(stats.Capacity == TABLE_TEST_CAPACITY);
+    CHECK(stats.Count == 99);
+    CHECK(stats.Insertions == 101);
+    CHECK(stats.Evictions == 0);
+    CHECK(stats.MemoryBytes == CyberionVerdictTableMemory(&g_Table));
+
+    CyberionVerdictTableDestroy(&g_Table);
+}
+
+//
+// TableTestClock: A full table stays full. After one turn of the clock has
+// cleared every reference bit, the entries looked up again survive the
+// next round of evictions.
+//
+static VOID TableTestClock(VOID)
+{
+    CYBERION_VERDICT_STATISTICS stats;
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG missing = 0;
+    ULONG i;
+
+    CHECK(CyberionVerdictTableInitialize(&g_Table, TABLE_TEST_CAPACITY) == STATUS_SUCCESS);
+
+    for (i = 0; i <= TABLE_TEST_CAPACITY; i++) {
+        CHECK(CyberionVerdictTableInsert(&g_Table, hash, TableTestKey(i, hash), 0, 0) == STATUS_SUCCESS);
+    }
+
+    CyberionVerdictTableQueryStatistics(&g_Table, &stats);
+    CHECK(stats.Count == TABLE_TEST_CAPACITY);
+    CHECK(stats.Evictions == 1);
+
+    // Reference the even keys, then make room for a quarter more
+    for (i = 0; i <= TABLE_TEST_CAPACITY; i += 2) {
+        TableTestKey(i, hash);
+        CyberionVerdictTableLookup(&g_Table, hash);
+    }
+
+    for (i = 0; i < TABLE_TEST_CAPACITY / 4; i++) {
+        CHECK(CyberionVerdictTableInsert(&g_Table, hash, TableTestKey(100000 + i, hash), 0, 0) == STATUS_SUCCESS);
+    }
+
+    CyberionVerdictTableQueryStatistics(&g_Table, &stats);
+    CHECK(stats.Count == TABLE_TEST_CAPACITY);
+    CHECK(stats.Evictions == 1 + TABLE_TEST_CAPACITY / 4);
+
+    for (i = 0; i <= TABLE_TEST_CAPACITY; i += 2) {
+        CYBERION_VERDICT expected = TableTestKey(i, hash);
+        CYBERION_VERDICT verdict = CyberionVerdictTableLookup(&g_Table, hash);
+
+        CHECK(verdict == expected || verdict == VerdictUnknown);
+        missing += (verdict == VerdictUnknown);
+    }
+
+    // At most the one entry evicted before the lookups is gone
+    CHECK(missing <= 1);
+
+    CHECK(TableTestCountPresent(100000, TABLE_TEST_CAPACITY / 4) == TABLE_TEST_CAPACITY / 4);
+    CyberionVerdictTableDestroy(&g_Table);
+}
+
+static VOID TableTestExpiry(VOID)
+{
+    CYBERION_VERDICT_STATISTICS stats;
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG64 now = CyberionQueryTime();
+    ULONG i;
+
+    CHECK(CyberionVerdictTableInitialize(&g_Table, 64) == STATUS_SUCCESS);
+
+    TableTestKey(1, hash);
+    CHECK(CyberionVerdictTableInsert(&g_Table, hash, VerdictAllow, 0, now - 1) == STATUS_SUCCESS);
+    CHECK(CyberionVerdictTableLookup(&g_Table, hash) == VerdictUnknown);
+
+    TableTestKey(2, hash);
+    CHECK(CyberionVerdictTableInsert(&g_Table, hash, VerdictAllow, 0, now + 36000000000ULL) == STATUS_SUCCESS);
+    CHECK(CyberionVerdictTableLookup(&g_Table, hash) == VerdictAllow);
+
+    // Pinned entries ignore the expiry time
+    TableTestKey(3, hash);
+    CHECK(CyberionVerdictTableInsert(&g_Table, hash, VerdictBlock, CYBERION_VERDICT_PINNED, now - 1) == STATUS_SUCCESS);
+    CHECK(CyberionVerdictTableLookup(&g_Table, hash) == VerdictBlock);
+
+    CyberionVerdictTableQueryStatistics(&g_Table, &stats);
+    CHECK(stats.Expired == 1);
+    CHECK(stats.Hits == 2);
+
+    // An expired entry is the first one evicted
+    for (i = 10; i < 10 + 62; i++) {
+        CHECK(CyberionVerdictTableInsert(&g_Table, hash, TableTestKey(i, hash), 0, 0) == STATUS_SUCCESS);
+    }
+    CyberionVerdictTableQueryStatistics(&g_Table, &stats);
+    CHECK(stats.Evictions == 1);
+    CHECK(TableTestCountPresent(1, 3) == 2);
+    CHECK(TableTestCountPresent(2, 2) == 2);
+
+    CyberionVerdictTableDestroy(&g_Table);
+}
+
+static VOID TableTestPinned(VOID)
+{
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG i;
+
+    CHECK(CyberionVerdictTableInitialize(&g_Table, 256) == STATUS_SUCCESS);
+
+    for (i = 0; i < 128; i++) {
+        CHECK(CyberionVerdictTableInsert(&g_Table, hash, TableTestKey(i, hash), CYBERION_VERDICT_PINNED, 0) == STATUS_SUCCESS);
+    }
+
+    // At most half the capacity can be pinned
+    TableTestKey(128, hash);
+    CHECK(CyberionVerdictTableInsert(&g_Table, hash, VerdictBlock, CYBERION_VERDICT_PINNED, 0) == STATUS_QUOTA_EXCEEDED);
+
+    // User decisions never override a rule
+    TableTestKey(5, hash);
+    CHECK(CyberionVerdictTableInsert(&g_Table, hash, VerdictAllow, 0, 0) == STATUS_OBJECT_NAME_COLLISION);
+    CHECK(CyberionVerdictTableLookup(&g_Table, hash) == VerdictBlock);
+
+    // and churn never evicts one
+    for (i = 0; i < 100000; i++) {
+        CHECK(CyberionVerdictTableInsert(&g_Table, hash, TableTestKey(1000 + i, hash), 0, 0) == STATUS_SUCCESS);
+    }
+    CHECK(TableTestCountPresent(0, 128) == 128);
+
+    // The filter follows evictions exactly
+    CHECK(g_Table.Filter.Count == g_Table.Count);
+
+    CyberionVerdictTableDestroy(&g_Table);
+}
+
+//
+// TableTestChurn: Random inserts and removals against a reference model.
+// With the live set kept under capacity nothing may be evicted, so the
+// table must agree with the model exactly.
+//
+static VOID TableTestChurn(VOID)
+{
+    static BOOLEAN live[2 * TABLE_TEST_CAPACITY];
+    UCHAR hash[CYBERION_HASH_SIZE];
+    CYBERION_VERDICT_STATISTICS stats;
+    ULONG64 seed = 99;
+    ULONG count = 0;
+    ULONG i;
+
+    CHECK(CyberionVerdictTableInitialize(&g_Table, TABLE_TEST_CAPACITY) == STATUS_SUCCESS);
+
+    for (i = 0; i < 2000000; i++) {
+        ULONG key = (ULONG)(HarnessRandom(&seed) % RTL_NUMBER_OF(live));
+        CYBERION_VERDICT expected = TableTestKey(key, hash);
+
+        if (!live[key] && count < TABLE_TEST_CAPACITY / 2) {
+            CHECK(CyberionVerdictTableInsert(&g_Table, hash, expected, 0, 0) == STATUS_SUCCESS);
+            live[key] = TRUE;
+            count++;
+        } else if (live[key]) {
+            CHECK(CyberionVerdictTableRemove(&g_Table, hash));
+            live[key] = FALSE;
+            count--;
+        } else {
+            CHECK(CyberionVerdictTableLookup(&g_Table, hash) == VerdictUnknown);
+        }
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(live); i++) {
+        CYBERION_VERDICT expected = TableTestKey(i, hash);
+        CHECK(CyberionVerdictTableLookup(&g_Table, hash) == (live[i] ? expected : VerdictUnknown));
+    }
+
+    CyberionVerdictTableQueryStatistics(&g_Table, &stats);
+    CHECK(stats.Count == count);
+    CHECK(stats.Evictions == 0);
+    CHECK(g_Table.Filter.Count == count);
+
+    CyberionVerdictTableDestroy(&g_Table);
+}
+
+static volatile BOOLEAN g_TableTestStop;
+static volatile LONG g_TableTestTorn;
+
+static PVOID TableTestReader(PVOID Argument)
+{
+    ULONG64 seed = (ULONG64)(ULONG_PTR)Argument;
+    UCHAR hash[CYBERION_HASH_SIZE];
+
+    while (!g_TableTestStop) {
+        ULONG key = (ULONG)(HarnessRandom(&seed) % (2 * TABLE_TEST_CAPACITY));
+        CYBERION_VERDICT expected = TableTestKey(key, hash);
+        CYBERION_VERDICT verdict = CyberionVerdictTableLookup(&g_Table, hash);
+
+        if (verdict != VerdictUnknown && verdict != expected) {
+            InterlockedIncrement(&g_TableTestTorn);
+        }
+    }
+
+    return NULL;
+}
+
+//
+// TableTestReaders: Every key only ever carries its own verdict, so any
+// other answer is a torn read of a slot being rewritten.
+//
+static VOID TableTestReaders(VOID)
+{
+    pthread_t readers[3];
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG64 seed = 5;
+    ULONG i;
+
+    CHECK(CyberionVerdictTableInitialize(&g_Table, TABLE_TEST_CAPACITY) == STATUS_SUCCESS);
+
+    for (i = 0; i < RTL_NUMBER_OF(readers); i++) {
+        pthread_create(&readers[i], NULL, TableTestReader, (PVOID)(ULONG_PTR)(i + 1));
+    }
+
+    for (i = 0; i < 1000000; i++) {
+        ULONG key = (ULONG)(HarnessRandom(&seed) % (2 * TABLE_TEST_CAPACITY));
+        CYBERION_VERDICT verdict = TableTestKey(key, hash);
+
+        if (i & 1) {
+            CyberionVerdictTableInsert(&g_Table, hash, verdict, 0, 0);
+        } else {
+            CyberionVerdictTableRemove(&g_Table, hash);
+        }
+    }
+
+    g_TableTestStop = TRUE;
+    for (i = 0; i < RTL_NUMBER_OF(readers); i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    CHECK(g_TableTestTorn == 0);
+    CyberionVerdictTableDestroy(&g_Table);
+}
+
+static double TableBenchmarkMisses(_In_ PCUCHAR Queries, ULONG Count)
+{
+    double start = HarnessSeconds();
+    ULONG hits = 0;
+    ULONG i;
+
+    for (i = 0; i < Count; i++) {
+        hits += CyberionVerdictTableLookup(&g_Table, Queries + (SIZE_T)i * CYBERION_HASH_SIZE) != VerdictUnknown;
+    }
+
+    CHECK(hits == 0);
+    return (HarnessSeconds() - start) * 1e9 / Count;
+}
+
+//
+// TableBenchmark: Lookups of absent hashes against a full table, first
+// through the filter, then with the filter answering "maybe" as it does
+// while saturated.
+//
+static VOID TableBenchmark(VOID)
+{
+    static const ULONG capacities[] = { 65536, 262144, 1048576, 4194304 };
+    ULONG rounds = 4000000;
+    PUCHAR queries = malloc((SIZE_T)rounds * CYBERION_HASH_SIZE);
+    UCHAR hash[CYBERION_HASH_SIZE];
+    ULONG64 seed = 0xC0FFEE;
+    ULONG c;
+    ULONG i;
+
+    for (i = 0; i < rounds; i++) {
+        HarnessHash(&seed, queries + (SIZE_T)i * CYBERION_HASH_SIZE);
+    }
+
+    printf("verdict table, %u absent lookups against a full table\n", rounds);
+    printf("  capacity  filter KB  FPR       miss ns (filter / none)\n");
+
+    for (c = 0; c < RTL_NUMBER_OF(capacities); c++) {
+        CYBERION_VERDICT_STATISTICS stats;
+        double filtered;
+        double unfiltered;
+
+        CyberionVerdictTableInitialize(&g_Table, capacities[c]);
+        for (i = 0; i < capacities[c]; i++) {
+            CyberionVerdictTableInsert(&g_Table, hash, TableTestKey(i, hash), 0, 0);
+        }
+
+        filtered = TableBenchmarkMisses(queries, rounds);
+        CyberionVerdictTableQueryStatistics(&g_Table, &stats);
+
+        g_Table.Filter.Saturated = 1;
+        unfiltered = TableBenchmarkMisses(queries, rounds);
+
+        printf("  %8u  %9zu  %.4f%%   %.1f / %.1f\n",
+               capacities[c], CyberionVerdictFilterMemory(&g_Table.Filter) / 1024,
+               100.0 * stats.FilterFalsePositives / rounds, filtered, unfiltered);
+
+        CyberionVerdictTableDestroy(&g_Table);
+    }
+
+    free(queries);
+}
+
+int main(int argc, char **argv)
+{
+    TableTestBasic();
+    TableTestClock();
+    TableTestExpiry();
+    TableTestPinned();
+    TableTestChurn();
+    TableTestReaders();
+
+    if (HarnessBenchmark(argc, argv)) {
+        TableBenchmark();
+    }
+
+    return HarnessFinish();
+}